@@ -0,0 +1,148 @@
+/*
+ * admin.c - Administración de un Nodo del Servidor de Chat
+ *
+ * Envía una orden a la cola de administración de un nodo y muestra su
+ * respuesta. La cola es distinta de la cola global: la orden no espera
+ * detrás del tráfico de chat y sólo el usuario que ejecuta el servidor
+ * puede enviarla (permisos 0600).
+ *
+ * Órdenes:
+ * - expulsar <usuario> [sala]  Saca al usuario de la sala (o de todas)
+ * - donde <usuario>            Su sesión y las salas del nodo en que es miembro
+ * - cerrar <sala>              Avisa a miembros y observadores y elimina la sala
+ * - drenar                     Rechaza uniones nuevas y termina al vaciarse
+ * - apagar                     Termina el nodo (como Ctrl+C)
+ * - estado                     Salas, sesiones, cola y coste por tipo de mensaje
+ * - log <0-2>                  Nivel de log: errores, eventos o tráfico
+ *
+ * Uso: ./admin [-n <nodo>] [-t <segundos>] <orden> [argumentos]
+ */
+
+#include <stdio.h>        // entrada/salida estándar
+#include <stdlib.h>       // funciones de utilidad general
+#include <string.h>       // manipulación de strings
+#include <sys/types.h>    // tipos de datos del sistema
+#include <sys/ipc.h>      // comunicación entre procesos
+#include <sys/msg.h>      // colas de mensajes System V
+#include <unistd.h>       // funciones estándar de Unix (getopt, alarm)
+#include <signal.h>       // manejo de señales del sistema
+#include <errno.h>        // códigos de error del sistema
+
+#include "protocolo.h"    // estructura de mensaje y tipos compartidos
+#include "cluster.h"      // MAX_NODOS
+
+/* ==================== CONSTANTES Y CONFIGURACIÓN ==================== */
+#define ESPERA_POR_DEFECTO 5            // Segundos de espera de la respuesta
+
+/* ==================== VARIABLES GLOBALES ==================== */
+int cola_respuestas = -1;               // Cola privada donde llega la respuesta
+
+/* ==================== FUNCIONES ==================== */
+
+/**
+ * Sin respuesta a tiempo: el nodo no existe o está bloqueado
+ *
+ * @param signo Número de la señal recibida
+ */
+void sin_respuesta(int signo) {
+    (void)signo;  // msgrcv vuelve con EINTR
+}
+
+/**
+ * Mostrar el uso del programa y terminar
+ *
+ * @param programa Nombre del ejecutable
+ */
+void uso(const char *programa) {
+    fprintf(stderr, "Uso: %s [-n <nodo>] [-t <segundos>] <orden> [argumentos]\n", programa);
+    fprintf(stderr, "Órdenes: expulsar <usuario> [sala] | donde <usuario> | cerrar <sala> | drenar | apagar | "
+            "estado | log <0-2>\n");
+    exit(2);
+}
+
+/* ==================== FUNCIÓN PRINCIPAL ==================== */
+
+int main(int argc, char *argv[]) {
+    int nodo = 0;
+    int espera = ESPERA_POR_DEFECTO;
+    int opcion;
+    while ((opcion = getopt(argc, argv, "n:t:")) != -1) {
+        switch (opcion) {
+            case 'n':
+                nodo = atoi(optarg);
+                break;
+            case 't':
+                espera = atoi(optarg);
+                break;
+            default:
+                uso(argv[0]);
+        }
+    }
+    if (optind >= argc || nodo < 0 || nodo >= MAX_NODOS || espera <= 0) {
+        uso(argv[0]);
+    }
+
+    /* Orden: los argumentos restantes separados por espacios */
+    struct mensaje orden;
+    memset(&orden, 0, sizeof(orden));
+    orden.mtype = TIPO_ADMIN;
+    for (int i = optind; i < argc; i++) {
+        size_t usado = strlen(orden.texto);
+        snprintf(orden.texto + usado, MAX_TEXTO - usado, "%s%s", i > optind ? " " : "", argv[i]);
+    }
+
+    key_t clave = ftok("/tmp", PROYECTO_ADMIN(nodo));
+    int cola_admin = (clave == (key_t)-1) ? -1 : msgget(clave, 0);
+    if (cola_admin == -1) {
+        fprintf(stderr, "Error: el nodo %d no tiene cola de administración (¿servidor detenido "
+                "o de otro usuario?): %s\n", nodo, strerror(errno));
+        return 1;
+    }
+
+    cola_respuestas = msgget(IPC_PRIVATE, IPC_CREAT | 0600);
+    if (cola_respuestas == -1) {
+        perror("Error: no se pudo crear la cola de respuestas");
+        return 1;
+    }
+    orden.reply_qid = cola_respuestas;
+    orden.corr = (unsigned int)getpid();
+
+    if (msgsnd(cola_admin, &orden, sizeof(orden) - sizeof(long), 0) == -1) {
+        perror("Error: no se pudo enviar la orden");
+        msgctl(cola_respuestas, IPC_RMID, NULL);
+        return 1;
+    }
+
+    /* Respuesta: una línea por RESP hasta la última (seq = 0) */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sin_respuesta;
+    sigaction(SIGALRM, &sa, NULL);
+    alarm(espera);
+
+    int estado = ESTADO_ERROR;
+    struct mensaje resp;
+    while (1) {
+        if (msgrcv(cola_respuestas, &resp, sizeof(resp) - sizeof(long), TIPO_RESP, 0) == -1) {
+            if (errno == EINTR) {
+                fprintf(stderr, "Error: el nodo %d no respondió en %d s\n", nodo, espera);
+            } else {
+                perror("Error: no se pudo recibir la respuesta");
+            }
+            break;
+        }
+        if (resp.corr != orden.corr) {
+            continue;
+        }
+        resp.texto[MAX_TEXTO - 1] = '\0';
+        printf("%s\n", resp.texto);
+        if (resp.seq == 0) {
+            estado = resp.estado;
+            break;
+        }
+        alarm(espera);  // Un informe largo sigue llegando
+    }
+
+    msgctl(cola_respuestas, IPC_RMID, NULL);
+    return estado == ESTADO_OK ? 0 : 1;
+}
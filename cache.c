@@ -0,0 +1,132 @@
+/*
+ * cache.c - Caché local de mensajes de sala proyectada en memoria
+ *
+ * Cada sala ocupa una ranura fija del archivo con un anillo de
+ * CACHE_MENSAJES entradas indexado por seq, como el anillo de replay del
+ * servidor: guardar y leer son un acceso directo, sin búsquedas. Las
+ * páginas que nunca se tocan no llegan a ocupar disco.
+ */
+
+#include <string.h>       // memcpy, memset, strncmp
+#include <fcntl.h>        // open
+#include <unistd.h>       // ftruncate, close
+#include <sys/mman.h>     // mmap, munmap
+#include <sys/stat.h>     // fstat
+
+#include "cache.h"
+
+struct cache *cache_abrir(const char *ruta) {
+    int fd = open(ruta, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    // Un archivo de otro tamaño (otra versión del formato) se reinicia
+    struct stat st;
+    if (fstat(fd, &st) == -1 ||
+        (st.st_size != (off_t)sizeof(struct cache) &&
+         (ftruncate(fd, 0) == -1 || ftruncate(fd, sizeof(struct cache)) == -1))) {
+        close(fd);
+        return NULL;
+    }
+
+    void *p = mmap(NULL, sizeof(struct cache), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);  // La proyección sigue siendo válida sin el descriptor
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct cache *c = p;
+    if (c->magia != CACHE_MAGIA || c->tam != sizeof(struct cache)) {
+        memset(c, 0, sizeof(*c));
+        c->magia = CACHE_MAGIA;
+        c->tam = sizeof(struct cache);
+    }
+    return c;
+}
+
+void cache_cerrar(struct cache *c) {
+    if (c) {
+        munmap(c, sizeof(*c));
+    }
+}
+
+/**
+ * Buscar la ranura de una sala
+ *
+ * @param crear 1 para ocupar una ranura libre (o la menos usada) si no está
+ * @return Ranura, o NULL si la sala no está y crear == 0
+ */
+static struct sala_cache *buscar_sala(struct cache *c, const char *sala, int crear) {
+    struct sala_cache *elegida = NULL;
+    for (int i = 0; i < CACHE_SALAS; i++) {
+        struct sala_cache *sc = &c->salas[i];
+        if (strncmp(sc->nombre, sala, MAX_NOMBRE) == 0 && sc->nombre[0] != '\0') {
+            sc->uso = ++c->reloj;
+            return sc;
+        }
+        if (!elegida || (elegida->nombre[0] != '\0' &&
+                         (sc->nombre[0] == '\0' || sc->uso < elegida->uso))) {
+            elegida = sc;
+        }
+    }
+    if (!crear) {
+        return NULL;
+    }
+
+    // Las entradas de la sala anterior no deben pasar por mensajes de ésta
+    memset(elegida->nombre, 0, MAX_NOMBRE);
+    for (int i = 0; i < CACHE_MENSAJES; i++) {
+        elegida->mensajes[i].seq = 0;
+    }
+    elegida->ultimo = 0;
+    strncpy(elegida->nombre, sala, MAX_NOMBRE - 1);
+    elegida->uso = ++c->reloj;
+    return elegida;
+}
+
+void cache_guardar(struct cache *c, const char *sala, unsigned int seq,
+                   const char *remitente, const char *texto) {
+    if (seq == 0) {
+        return;
+    }
+    struct sala_cache *sc = buscar_sala(c, sala, 1);
+    struct entrada_cache *e = &sc->mensajes[seq & (CACHE_MENSAJES - 1)];
+
+    // La secuencia se escribe al final: una entrada a medias no se da por válida
+    e->seq = 0;
+    memcpy(e->remitente, remitente, MAX_NOMBRE);
+    memcpy(e->texto, texto, MAX_TEXTO);
+    e->seq = seq;
+    if (seq > sc->ultimo) {
+        sc->ultimo = seq;
+    }
+}
+
+void cache_avanzar(struct cache *c, const char *sala, unsigned int seq) {
+    struct sala_cache *sc = buscar_sala(c, sala, 0);
+    if (sc && seq > sc->ultimo) {
+        sc->ultimo = seq;
+    }
+}
+
+unsigned int cache_ultimo(struct cache *c, const char *sala) {
+    struct sala_cache *sc = buscar_sala(c, sala, 0);
+    return sc ? sc->ultimo : 0;
+}
+
+int cache_leer(struct cache *c, const char *sala, unsigned int seq, char *remitente, char *texto) {
+    struct sala_cache *sc = buscar_sala(c, sala, 0);
+    if (!sc || seq == 0) {
+        return 0;
+    }
+    const struct entrada_cache *e = &sc->mensajes[seq & (CACHE_MENSAJES - 1)];
+    if (e->seq != seq) {
+        return 0;  // Ya reemplazada o nunca recibida (filtro, propia)
+    }
+    memcpy(remitente, e->remitente, MAX_NOMBRE);
+    memcpy(texto, e->texto, MAX_TEXTO);
+    remitente[MAX_NOMBRE - 1] = '\0';
+    texto[MAX_TEXTO - 1] = '\0';
+    return 1;
+}
@@ -0,0 +1,73 @@
+/*
+ * cache.h - Caché local de mensajes de sala (un archivo por usuario)
+ *
+ * Guarda los últimos CACHE_MENSAJES mensajes recibidos de cada sala,
+ * indexados por número de secuencia, en un archivo proyectado en memoria
+ * (mmap). Al volver a unirse a una sala el cliente muestra lo guardado al
+ * instante y sólo pide al servidor, por BACKFILL, lo publicado después de
+ * la última secuencia guardada.
+ *
+ * El archivo sobrevive al proceso: la caché sirve también entre
+ * ejecuciones del cliente. Si lo usan a la vez dos procesos del mismo
+ * usuario, como mucho se pierde o se repite alguna entrada (cada entrada
+ * se valida con su secuencia al leerla).
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "protocolo.h"    // MAX_NOMBRE, MAX_TEXTO
+
+#define CACHE_SALAS 8                // Salas guardadas (se reemplaza la menos usada)
+#define CACHE_MENSAJES 256           // Mensajes por sala (potencia de 2: posición = seq % CACHE_MENSAJES)
+#define CACHE_MAGIA 0x43484331       // "CHC1": identifica el formato del archivo
+
+/**
+ * Mensaje guardado (seq = 0: entrada vacía)
+ */
+struct entrada_cache {
+    unsigned int seq;               // Secuencia del mensaje en la sala
+    char remitente[MAX_NOMBRE];
+    char texto[MAX_TEXTO];
+};
+
+/**
+ * Mensajes guardados de una sala ("" = ranura libre)
+ */
+struct sala_cache {
+    char nombre[MAX_NOMBRE];
+    unsigned int ultimo;            // Última secuencia vista en orden (0 = nada guardado)
+    unsigned int uso;               // Reloj del último acceso (para reemplazar la menos usada)
+    struct entrada_cache mensajes[CACHE_MENSAJES];
+};
+
+/**
+ * Contenido del archivo de caché (proyectado tal cual)
+ */
+struct cache {
+    unsigned int magia;             // CACHE_MAGIA si el archivo tiene este formato
+    unsigned int tam;               // sizeof(struct cache) al crearlo
+    unsigned int reloj;             // Contador de accesos
+    struct sala_cache salas[CACHE_SALAS];
+};
+
+/* Abre (o crea) el archivo de caché y lo proyecta. NULL si error (errno) */
+struct cache *cache_abrir(const char *ruta);
+
+/* Deshace la proyección (los cambios ya están en el archivo) */
+void cache_cerrar(struct cache *c);
+
+/* Guarda un mensaje de sala recibido en orden */
+void cache_guardar(struct cache *c, const char *sala, unsigned int seq,
+                   const char *remitente, const char *texto);
+
+/* Avanza la última secuencia vista sin guardar mensaje (fin de un BACKFILL filtrado) */
+void cache_avanzar(struct cache *c, const char *sala, unsigned int seq);
+
+/* Última secuencia vista de una sala (0 si no está en la caché) */
+unsigned int cache_ultimo(struct cache *c, const char *sala);
+
+/* Copia el mensaje con esa secuencia si sigue guardado: 1 si estaba, 0 si no */
+int cache_leer(struct cache *c, const char *sala, unsigned int seq, char *remitente, char *texto);
+
+#endif /* CACHE_H */
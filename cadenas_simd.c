@@ -0,0 +1,247 @@
+/*
+ * cadenas_simd.c - Kernels SIMD para nombres de ancho fijo y escaneo de texto
+ *
+ * Cada operación tiene tres variantes (escalar, SSE2 y AVX2). Los punteros
+ * a función arrancan apuntando a la versión escalar y simd_inicializar()
+ * los reemplaza según lo que reporte la CPU (__builtin_cpu_supports), de
+ * modo que el mismo binario funciona en cualquier máquina x86-64 o de
+ * otra arquitectura.
+ */
+
+#include <stdint.h>       // uint64_t
+#include <string.h>       // memcpy, memset, strlen, memchr
+#include <ctype.h>        // isalnum
+
+#include "cadenas_simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>    // intrínsecos SSE2 / AVX2
+#endif
+
+/* ==================== VERSIONES ESCALARES ==================== */
+
+static int nombre_igual_escalar(const char *a, const char *b) {
+    // Comparar en palabras de 64 bits (memcpy evita problemas de alineación)
+    for (int i = 0; i < NOMBRE_SLOT; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int buscar_nombre_escalar(const char (*tabla)[NOMBRE_SLOT], int n, const char *clave) {
+    for (int i = 0; i < n; i++) {
+        if (nombre_igual_escalar(tabla[i], clave)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static const char *buscar_byte_escalar(const char *texto, size_t len, char c) {
+    return memchr(texto, c, len);
+}
+
+/* ==================== VERSIONES SSE2 / AVX2 ==================== */
+
+#ifdef SIMD_X86
+
+__attribute__((target("sse2")))
+static int nombre_igual_sse2(const char *a, const char *b) {
+    __m128i r = _mm_set1_epi8(-1);
+    for (int i = 0; i < NOMBRE_SLOT; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        r = _mm_and_si128(r, _mm_cmpeq_epi8(x, y));
+    }
+    return _mm_movemask_epi8(r) == 0xFFFF;
+}
+
+__attribute__((target("sse2")))
+static int buscar_nombre_sse2(const char (*tabla)[NOMBRE_SLOT], int n, const char *clave) {
+    // La clave se carga una sola vez en registros y se reutiliza por fila
+    __m128i k0 = _mm_loadu_si128((const __m128i *)(clave + 0));
+    __m128i k1 = _mm_loadu_si128((const __m128i *)(clave + 16));
+    __m128i k2 = _mm_loadu_si128((const __m128i *)(clave + 32));
+    __m128i k3 = _mm_loadu_si128((const __m128i *)(clave + 48));
+    for (int i = 0; i < n; i++) {
+        const char *f = tabla[i];
+        __m128i r = _mm_cmpeq_epi8(k0, _mm_loadu_si128((const __m128i *)(f + 0)));
+        r = _mm_and_si128(r, _mm_cmpeq_epi8(k1, _mm_loadu_si128((const __m128i *)(f + 16))));
+        r = _mm_and_si128(r, _mm_cmpeq_epi8(k2, _mm_loadu_si128((const __m128i *)(f + 32))));
+        r = _mm_and_si128(r, _mm_cmpeq_epi8(k3, _mm_loadu_si128((const __m128i *)(f + 48))));
+        if (_mm_movemask_epi8(r) == 0xFFFF) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+__attribute__((target("sse2")))
+static const char *buscar_byte_sse2(const char *texto, size_t len, char c) {
+    __m128i objetivo = _mm_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i bloque = _mm_loadu_si128((const __m128i *)(texto + i));
+        int mascara = _mm_movemask_epi8(_mm_cmpeq_epi8(bloque, objetivo));
+        if (mascara) {
+            return texto + i + __builtin_ctz(mascara);
+        }
+    }
+    // Cola del buffer (menos de 16 bytes): nunca leer fuera de texto[0..len)
+    return buscar_byte_escalar(texto + i, len - i, c);
+}
+
+__attribute__((target("avx2")))
+static int nombre_igual_avx2(const char *a, const char *b) {
+    __m256i x0 = _mm256_loadu_si256((const __m256i *)(a + 0));
+    __m256i x1 = _mm256_loadu_si256((const __m256i *)(a + 32));
+    __m256i y0 = _mm256_loadu_si256((const __m256i *)(b + 0));
+    __m256i y1 = _mm256_loadu_si256((const __m256i *)(b + 32));
+    __m256i r = _mm256_and_si256(_mm256_cmpeq_epi8(x0, y0), _mm256_cmpeq_epi8(x1, y1));
+    return _mm256_movemask_epi8(r) == -1;
+}
+
+__attribute__((target("avx2")))
+static int buscar_nombre_avx2(const char (*tabla)[NOMBRE_SLOT], int n, const char *clave) {
+    __m256i k0 = _mm256_loadu_si256((const __m256i *)(clave + 0));
+    __m256i k1 = _mm256_loadu_si256((const __m256i *)(clave + 32));
+    for (int i = 0; i < n; i++) {
+        const char *f = tabla[i];
+        __m256i r = _mm256_and_si256(
+            _mm256_cmpeq_epi8(k0, _mm256_loadu_si256((const __m256i *)(f + 0))),
+            _mm256_cmpeq_epi8(k1, _mm256_loadu_si256((const __m256i *)(f + 32))));
+        if (_mm256_movemask_epi8(r) == -1) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static const char *buscar_byte_avx2(const char *texto, size_t len, char c) {
+    __m256i objetivo = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i bloque = _mm256_loadu_si256((const __m256i *)(texto + i));
+        unsigned mascara = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bloque, objetivo));
+        if (mascara) {
+            return texto + i + __builtin_ctz(mascara);
+        }
+    }
+    return buscar_byte_sse2(texto + i, len - i, c);
+}
+
+#endif /* SIMD_X86 */
+
+/* ==================== DESPACHO EN TIEMPO DE EJECUCIÓN ==================== */
+
+static int (*impl_nombre_igual)(const char *, const char *) = nombre_igual_escalar;
+static int (*impl_buscar_nombre)(const char (*)[NOMBRE_SLOT], int, const char *) = buscar_nombre_escalar;
+static const char *(*impl_buscar_byte)(const char *, size_t, char) = buscar_byte_escalar;
+static const char *nombre_impl = "escalar";
+
+/**
+ * Seleccionar las implementaciones según la CPU
+ *
+ * Debe llamarse una vez al inicio del programa, antes de crear hilos.
+ * Llamarla varias veces es inofensivo.
+ */
+void simd_inicializar(void) {
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        impl_nombre_igual = nombre_igual_avx2;
+        impl_buscar_nombre = buscar_nombre_avx2;
+        impl_buscar_byte = buscar_byte_avx2;
+        nombre_impl = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        impl_nombre_igual = nombre_igual_sse2;
+        impl_buscar_nombre = buscar_nombre_sse2;
+        impl_buscar_byte = buscar_byte_sse2;
+        nombre_impl = "sse2";
+    }
+#endif
+}
+
+const char *simd_implementacion(void) {
+    return nombre_impl;
+}
+
+/* ==================== API PÚBLICA ==================== */
+
+void nombre_a_slot(char *slot, const char *nombre) {
+    // Relleno con ceros: dos nombres iguales producen slots idénticos byte a byte
+    memset(slot, 0, NOMBRE_SLOT);
+    size_t n = strnlen(nombre, NOMBRE_SLOT - 1);
+    memcpy(slot, nombre, n);
+}
+
+int nombre_igual(const char *a, const char *b) {
+    return impl_nombre_igual(a, b);
+}
+
+int buscar_nombre(const char (*tabla)[NOMBRE_SLOT], int n, const char *clave) {
+    return impl_buscar_nombre(tabla, n, clave);
+}
+
+const char *buscar_byte(const char *texto, size_t len, char c) {
+    return impl_buscar_byte(texto, len, c);
+}
+
+/**
+ * Detectar una mención "@nombre" dentro de un texto
+ *
+ * Localiza cada '@' con el kernel vectorial y sólo entonces compara el
+ * nombre. La mención debe ser palabra completa: "@Juan" coincide en
+ * "hola @Juan!" pero no en "@Juanita" ni en "correo@Juan".
+ *
+ * @param texto Texto terminado en '\0' a examinar
+ * @param nombre Nombre de usuario a buscar (sin '@')
+ * @return 1 si hay mención, 0 si no
+ */
+int texto_menciona(const char *texto, const char *nombre) {
+    size_t len = strlen(texto);
+    size_t nlen = strlen(nombre);
+    if (nlen == 0) {
+        return 0;
+    }
+
+    const char *p = texto;
+    const char *fin = texto + len;
+    while (p < fin && (p = buscar_byte(p, (size_t)(fin - p), '@')) != NULL) {
+        int inicio_ok = (p == texto) || !(isalnum((unsigned char)p[-1]) || p[-1] == '_');
+        const char *q = p + 1;
+        if (inicio_ok && (size_t)(fin - q) >= nlen && memcmp(q, nombre, nlen) == 0) {
+            unsigned char sig = (unsigned char)q[nlen];
+            if (!(isalnum(sig) || sig == '_')) {
+                return 1;
+            }
+        }
+        p++;
+    }
+    return 0;
+}
+
+/**
+ * Hash FNV-1a de 32 bits de un nombre
+ *
+ * Barato y con buena dispersión para claves cortas; se usa para indexar
+ * tablas hash de nombres (sesiones, usuarios) con direccionamiento abierto.
+ *
+ * @param nombre Nombre terminado en '\0'
+ * @return Valor hash de 32 bits
+ */
+unsigned int hash_nombre(const char *nombre) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)nombre; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
@@ -0,0 +1,45 @@
+/*
+ * cadenas_simd.h - Comparación de nombres y búsqueda en texto con SIMD
+ *
+ * Los nombres de usuarios y salas se guardan en "slots" de ancho fijo
+ * (NOMBRE_SLOT bytes) rellenados con ceros. Con ese formato, comparar dos
+ * nombres equivale a comparar 64 bytes completos, lo que se resuelve con
+ * 2 instrucciones AVX2 o 4 SSE2 en lugar de un strcmp byte a byte.
+ *
+ * La implementación concreta se elige en tiempo de ejecución según la CPU
+ * (AVX2 -> SSE2 -> escalar). Si no se llama a simd_inicializar() se usa
+ * siempre la versión escalar, que es correcta en cualquier plataforma.
+ */
+
+#ifndef CADENAS_SIMD_H
+#define CADENAS_SIMD_H
+
+#include <stddef.h>       // size_t
+
+#define NOMBRE_SLOT 64    // Ancho fijo (bytes) de un nombre almacenado en tablas
+
+/* Selecciona las implementaciones más rápidas disponibles en esta CPU */
+void simd_inicializar(void);
+
+/* Nombre de la implementación activa ("avx2", "sse2" o "escalar") */
+const char *simd_implementacion(void);
+
+/* Copia un nombre terminado en '\0' a un slot de NOMBRE_SLOT bytes rellenado con ceros */
+void nombre_a_slot(char *slot, const char *nombre);
+
+/* Compara dos slots completos: 1 si son iguales, 0 si no */
+int nombre_igual(const char *a, const char *b);
+
+/* Busca un slot en una tabla contigua de n slots: índice o -1 si no está */
+int buscar_nombre(const char (*tabla)[NOMBRE_SLOT], int n, const char *clave);
+
+/* Primera aparición del byte c en texto[0..len), o NULL (equivalente a memchr) */
+const char *buscar_byte(const char *texto, size_t len, char c);
+
+/* 1 si texto contiene la mención "@nombre" como palabra completa, 0 si no */
+int texto_menciona(const char *texto, const char *nombre);
+
+/* Hash FNV-1a de 32 bits de un nombre terminado en '\0' (índices de tablas hash) */
+unsigned int hash_nombre(const char *nombre);
+
+#endif /* CADENAS_SIMD_H */
@@ -0,0 +1,2491 @@
+/*
+ * chatlib.c - Biblioteca cliente del chat multi-sala (ver chatlib.h)
+ *
+ * Cada sesión guarda su estado confirmado (sala actual, filtro), la tabla
+ * de solicitudes en vuelo, el seguimiento de secuencia por sala y la
+ * máquina de reconexión. Un mutex por sesión lo protege, de modo que el
+ * hilo receptor, el de mantenimiento y la aplicación pueden usarla a la
+ * vez; los envíos son siempre sin bloqueo (IPC_NOWAIT).
+ *
+ * Las sesiones de un canal comparten una cola de recepción: el servidor
+ * les envía con mtype = tipo + canal * CANAL_BASE y chat_canal_recibir
+ * reparte cada mensaje a su sesión.
+ */
+
+#include <stdio.h>        // snprintf, vsnprintf
+#include <stdlib.h>       // calloc, free, rand_r
+#include <stdarg.h>       // argumentos variables (avisar)
+#include <string.h>       // manipulación de strings
+#include <sys/types.h>    // tipos de datos del sistema
+#include <sys/ipc.h>      // comunicación entre procesos
+#include <sys/msg.h>      // colas de mensajes System V
+#include <sys/shm.h>      // shmdt (directorio del cluster), segmentos de los adjuntos
+#include <unistd.h>       // usleep, getpid
+#include <pthread.h>      // mutex e hilos de la sesión
+#include <errno.h>        // códigos de error del sistema
+#include <time.h>         // clock_gettime, time
+#include <stdint.h>       // uint64_t (contador del eventfd)
+#include <poll.h>         // poll (espera sobre el descriptor del puente)
+#include <sys/eventfd.h>  // eventfd (puente hacia el bucle de eventos)
+#include <limits.h>       // PATH_MAX
+
+#include "chatlib.h"
+#include "cadenas_simd.h" // detección vectorizada de menciones (@usuario)
+#include "cluster.h"      // directorio de nodos (modo cluster)
+#include "cache.h"        // caché local de mensajes de sala
+#include "compresion.h"   // compresión de textos largos con diccionario de sala
+
+/* ==================== CONSTANTES ==================== */
+#define MAX_SALAS_SEGUIDAS 8            // Salas con seguimiento de secuencia simultáneo
+#define MAX_EN_ESPERA 64                // Mensajes retenidos tras un hueco, por sala
+#define ESPERA_MIN_MS 100               // Primer intervalo de reintento de reconexión
+#define ESPERA_MAX_MS 5000              // Intervalo máximo de reintento de reconexión
+#define MAX_PENDIENTES 16               // Solicitudes en vuelo esperando confirmación
+#define TIEMPO_PENDIENTE 5              // Segundos sin respuesta antes de darla por perdida
+#define MAX_AVISOS 8                    // Avisos locales por entregar
+#define PERIODO_MANTENIMIENTO_MS 100    // Intervalo del hilo de mantenimiento
+#define CAPACIDAD_PUENTE 256            // Mensajes en tránsito del puente al bucle de eventos
+#define CAPACIDAD_PUENTE_CANAL 4096     // Ídem para la cola compartida de un canal
+#define SESIONES_CANAL_INICIAL 64       // Tabla de sesiones de un canal (crece al doble)
+#define BYTES_COLA_CANAL (1 << 20)      // Tamaño pedido para la cola de un canal (si se permite)
+#define MAX_ENSAMBLADOS 8               // Textos largos recibidos a medias a la vez
+#define CABECERA_FRAGMENTO 32           // Bytes reservados a la cabecera de un fragmento
+#define CARGA_FRAGMENTO (MAX_TEXTO - 1 - CABECERA_FRAGMENTO)  // Texto por fragmento
+#define MAX_FRAGMENTOS ((CHAT_MAX_LARGO + CARGA_FRAGMENTO - 1) / CARGA_FRAGMENTO)
+#define UMBRAL_COMPRESION 512           // Textos más cortos no se comprimen
+#define MAX_DICCIONARIOS 8              // Diccionarios de sala proyectados a la vez
+#define REPETIR_DICCIONARIO 30          // Segundos antes de volver a preguntar por uno sin entrenar
+#define REPETIR_MIEMBROS 2              // Segundos antes de volver a pedir los miembros que faltan
+
+/*
+ * Textos largos y adjuntos viajan como mensajes de sala normales; el
+ * servidor no los distingue (secuencia, historial, BACKFILL y buzones
+ * funcionan igual). El texto empieza con una cabecera entre '\x01'
+ * (formatos en protocolo.h):
+ * - "\x01F<id> <parte>/<partes>\x01<trozo>": fragmento de un texto largo
+ * - "\x01C<id> <parte>/<partes> <dicc>\x01<trozo>": fragmento de un texto
+ *   comprimido con el diccionario de la sala de huella dicc (0 = ninguno)
+ * - "\x01A<segmento> <bytes>\x01<nombre>": adjunto en memoria compartida
+ */
+
+/**
+ * Seguimiento de la secuencia de una sala
+ *
+ * 'ultimo' es la última secuencia entregada en orden. Un CHAT cuyo
+ * seq_prev no coincide con ella indica un hueco: el mensaje queda en
+ * espera (ordenado por seq) y se pide BACKFILL al servidor; los retenidos
+ * se entregan en cuanto encadenan. Tras volver a una sala con buzón,
+ * 'objetivo' marca hasta dónde hay que pedir aunque no llegue nada nuevo. El buffer de espera se reserva al
+ * primer hueco (la mayoría de las salas nunca lo necesitan).
+ */
+struct seguimiento {
+    char sala[MAX_NOMBRE];              // Sala seguida ("" = entrada libre)
+    int conocido;                       // 0 hasta el primer mensaje (fija la base)
+    unsigned int ultimo;                // Última secuencia entregada en orden
+    unsigned int objetivo;              // Secuencia que se sabe pendiente (buzón), 0 = ninguna
+    time_t pedido_en;                   // Momento del último BACKFILL pedido (0 = ninguno)
+    int num_espera;                     // Mensajes retenidos
+    struct mensaje *espera;             // Retenidos tras un hueco, ordenados por seq
+};
+
+/**
+ * Solicitud enviada que espera su RESP correlacionado
+ *
+ * Se guarda una copia completa: al confirmarse, de ella salen la sala
+ * (JOIN, OBSERVE, LEAVE) o la especificación del filtro (FILTER).
+ */
+struct pendiente {
+    struct mensaje sol;                 // Solicitud enviada (sol.corr == 0: entrada libre)
+    time_t enviada;                     // Momento del envío
+};
+
+/**
+ * Puente de una cola System V (no pollable) hacia un eventfd
+ *
+ * Un hilo copia los mensajes sin procesar de la cola a un anillo y marca
+ * el eventfd; el estado de las sesiones se actualiza en el hilo que los
+ * saca. Lo usan la sesión con cola propia (chat_descriptor) y el canal.
+ */
+struct puente {
+    int fd;                             // eventfd (-1 = sin puente)
+    int cola;                           // Cola que vacía el hilo
+    int capacidad;                      // Mensajes que caben en el anillo
+    pthread_t hilo;                     // Pasa los mensajes de la cola al anillo
+    pthread_mutex_t mutex;              // Protege el anillo
+    pthread_cond_t hueco;               // Señalada al sacar un mensaje del anillo lleno
+    struct mensaje *anillo;             // Mensajes sin procesar
+    int ini, num;
+    int cerrado;                        // 1 cuando el hilo terminó (cola eliminada)
+    int cerrando;                       // 1 cuando el dueño lo detiene
+};
+
+/**
+ * Texto largo cuyos fragmentos se están enviando (datos NULL = ninguno)
+ */
+struct envio_largo {
+    char *datos;                        // Texto completo
+    size_t largo;
+    char sala[MAX_NOMBRE];              // Sala a la que se envía
+    unsigned int id;                    // Identificador del texto (por remitente)
+    int parte, partes;                  // Próximo fragmento por enviar (1..partes) y total
+    size_t enviado;                     // Bytes de datos ya enviados
+    int comprimido;                     // 1 si datos es el texto comprimido y escapado
+    unsigned int dicc;                  // Huella del diccionario usado (0 = ninguno)
+};
+
+/**
+ * Texto largo recibido a medias (id 0 = entrada libre)
+ *
+ * Los fragmentos de un remitente llegan en orden de secuencia; los que
+ * falten (filtro, historial recortado) se cuentan y se indican al final.
+ */
+struct ensamblado {
+    char sala[MAX_NOMBRE];
+    char remitente[MAX_NOMBRE];
+    unsigned int id;
+    int partes;                         // Fragmentos del texto
+    int siguiente;                      // Próxima parte esperada
+    int perdidas;                       // Partes que no llegaron
+    unsigned int uso;                   // Reloj del último fragmento (para reemplazar)
+    char *datos;                        // Texto acumulado (escapado si es comprimido)
+    size_t largo;
+    int comprimido;                     // 1 si llegó en fragmentos 'C'
+    unsigned int dicc;                  // Huella del diccionario con que se comprimió
+};
+
+/**
+ * Diccionario de compresión de una sala proyectado en memoria (datos NULL = libre)
+ */
+struct diccionario {
+    char sala[MAX_NOMBRE];
+    unsigned int huella;
+    const void *datos;                  // Segmento del servidor (sólo lectura)
+    size_t tam;
+    unsigned int uso;                   // Reloj del último uso (para reemplazar)
+};
+
+/**
+ * Miembros de la sala actual según el servidor (se reserva al pedirlos por
+ * primera vez: las sesiones que no los consultan no pagan su memoria)
+ *
+ * 'version' es la versión de miembros de la sala ya aplicada; PRESENCIA y
+ * MIEMBROS se aplican sólo si su seq_prev coincide (ver protocolo.h).
+ */
+struct lista_miembros {
+    char sala[MAX_NOMBRE];
+    unsigned int version;               // 0 = aún sin lista
+    time_t pedida;                      // Cuándo se pidió lo que falta (0 = nada en vuelo)
+    char (*nombres)[MAX_NOMBRE];
+    int num, capacidad;
+};
+
+/**
+ * Estado de una sesión
+ */
+struct chat_sesion {
+    char nombre[MAX_NOMBRE];            // Nombre del usuario
+    int cola_global;                    // Cola global del servidor (nodo 0 en un cluster)
+    int cola_privada;                   // Cola privada de la sesión
+    int cola_sala;                      // Cola del nodo que atiende sala_actual (-1 = ninguna)
+
+    char sala_actual[MAX_NOMBRE];       // Sala confirmada por el servidor ("" = ninguna)
+    int es_observador;                  // 1 si sala_actual se observa en modo sólo lectura
+    char filtro_actual[MAX_TEXTO];      // Último filtro confirmado (se repite al reconectar)
+
+    struct pendiente pendientes[MAX_PENDIENTES];        // Solicitudes en vuelo
+    unsigned int siguiente_corr;        // Próxima correlación (nunca 0)
+    unsigned int corr_conexion;         // Correlación de los CONNECT (respuesta = nombre en uso)
+    struct seguimiento seguimientos[MAX_SALAS_SEGUIDAS];  // Secuencia por sala
+
+    struct chat_evento avisos[MAX_AVISOS];  // Avisos locales por entregar (anillo)
+    int aviso_ini, num_avisos;
+
+    struct cache *cache;                // Caché local de mensajes (NULL = sin caché)
+    char historial_sala[MAX_NOMBRE];    // Sala cuyo historial guardado se está entregando
+    unsigned int historial_seq;         // Próxima secuencia guardada por entregar (0 = ninguna)
+    unsigned int historial_hasta;       // Última secuencia guardada de esa sala
+
+    struct envio_largo envio;           // Texto largo con fragmentos por enviar
+    unsigned int siguiente_largo;       // Identificador del próximo texto largo
+    struct ensamblado ensamblados[MAX_ENSAMBLADOS];  // Textos largos recibidos a medias
+    unsigned int reloj_ensamblado;
+    char *largo_entregado;              // texto_largo del último evento (se libera en el siguiente)
+    int adjuntos[CHAT_MAX_ADJUNTOS];    // Segmentos de los adjuntos enviados (anillo)
+    int adjunto_ini, num_adjuntos;
+
+    int comprimir;                      // 1 si los textos largos se envían comprimidos
+    char dicc_sala[MAX_NOMBRE];         // Sala por cuyo diccionario se preguntó
+    unsigned int dicc_huella;           // Su huella según el servidor (0 = sin entrenar)
+    time_t dicc_pedido;                 // Cuándo se preguntó (0 = sin respuesta aún)
+    struct diccionario diccionarios[MAX_DICCIONARIOS];  // Proyectados (enviar y recibir)
+    unsigned int reloj_diccionario;
+    struct lista_miembros *miembros;    // NULL hasta el primer chat_miembros
+
+    int caido;                          // 1 mientras el servidor no está disponible
+    int espera_ms;                      // Intervalo actual de reintento
+    long long proximo_intento;          // Instante (ms) del siguiente reintento
+    unsigned int semilla;               // Semilla del jitter (rand_r)
+
+    pthread_mutex_t mutex;              // Protege todo el estado de la sesión
+    pthread_mutex_t mutex_entrega;      // Serializa las llamadas al manejador
+    chat_manejador manejador;           // Manejador de chat_escuchar (NULL = sondeo)
+    void *datos;                        // Argumento del manejador
+    int hilos;                          // 1 si chat_escuchar lanzó sus hilos
+    volatile int cerrando;              // Detiene el hilo de mantenimiento
+    pthread_t hilo_receptor;
+    pthread_t hilo_mantenimiento;
+
+    struct puente puente;               // Puente de chat_descriptor (fd -1 = sin puente)
+
+    struct chat_canal *canal;           // Canal cuya cola comparte (NULL = cola propia)
+    int id_canal;                       // Número en el canal (0 = cola propia)
+    int en_lista;                       // 1 si está en la lista de preparadas del canal
+    struct chat_sesion *siguiente_lista;
+};
+
+/**
+ * Canal: cola de recepción compartida por varias sesiones del proceso
+ *
+ * Cada sesión se presenta al servidor con su número de canal (su posición
+ * en la tabla) y recibe con MTYPE_CANAL. La caída del servidor se vigila
+ * una vez por canal, no por sesión. Las sesiones con eventos ya
+ * preparados (avisos, retenidos que encadenan tras un BACKFILL) esperan
+ * en una lista para no recorrer todas en cada recepción. Un canal y sus
+ * sesiones se usan desde un solo hilo (el del bucle de eventos).
+ */
+struct chat_canal {
+    int cola;                           // Cola compartida
+    int cola_global;                    // Cola global del servidor (vigilada por el canal)
+    int caido;                          // 1 mientras el servidor no está disponible
+    struct chat_sesion **sesiones;      // Número de canal -> sesión (NULL = libre, 0 sin usar)
+    int capacidad;                      // Entradas de la tabla
+    int siguiente_id;                   // Próximo número a probar (se reutilizan lo más tarde posible)
+    int num_sesiones;
+    struct chat_sesion *lista_ini, *lista_fin;  // Sesiones con eventos preparados
+    struct puente puente;               // Puente de chat_canal_descriptor (fd -1 = sin puente)
+};
+
+/* ==================== ESTADO COMPARTIDO DEL PROCESO ==================== */
+static key_t key_global = (key_t)-1;            // Clave de la cola global
+static struct directorio *directorio = NULL;    // Directorio del cluster (NULL = servidor único)
+static struct directorio *directorio_anterior = NULL;  // Se desadjunta en la siguiente reconexión
+static pthread_mutex_t mutex_proceso = PTHREAD_MUTEX_INITIALIZER;  // Inicialización y directorio
+static int inicializado = 0;
+
+/* ==================== UTILIDADES ==================== */
+
+static long long ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+/**
+ * Volver a leer el directorio del cluster
+ *
+ * El directorio actual puede estar leyéndose en otro hilo (o sesión): se
+ * desadjunta en la siguiente llamada, cuando ya nadie puede usarlo.
+ */
+static void adjuntar_directorio(void) {
+    pthread_mutex_lock(&mutex_proceso);
+    if (directorio_anterior) {
+        shmdt(directorio_anterior);
+    }
+    directorio_anterior = directorio;
+    struct directorio *nuevo = directorio_adjuntar(0);
+    if (nuevo && nuevo->num_nodos <= 1) {
+        shmdt(nuevo);
+        nuevo = NULL;
+    }
+    directorio = nuevo;
+    pthread_mutex_unlock(&mutex_proceso);
+}
+
+/**
+ * Elegir la cola de servidor a la que enviar un mensaje
+ *
+ * Con un cluster activo, los mensajes de sala van directamente al nodo
+ * que la atiende (según el anillo o su reubicación, consultados en cada
+ * envío) y los de sesión al dueño del usuario. El resto (LIST)
+ * va a la cola global, que lo propaga a los demás nodos.
+ *
+ * @param s Sesión
+ * @param msg Mensaje a enviar
+ * @return ID de la cola de destino
+ */
+static int cola_destino(const struct chat_sesion *s, const struct mensaje *msg) {
+    struct directorio *dir = directorio;
+    if (dir) {
+        int nodo = nodo_de_mensaje(dir, msg);
+        if (nodo != -1 && dir->colas[nodo] != -1) {
+            return dir->colas[nodo];
+        }
+    }
+    return s->cola_global;
+}
+
+/**
+ * Comprobar si la cola de un servidor ya no existe
+ *
+ * @param qid Cola a comprobar
+ * @return 1 si fue eliminada (servidor terminado), 0 si sigue existiendo
+ */
+static int servidor_caido(int qid) {
+    struct msqid_ds info;
+    return msgctl(qid, IPC_STAT, &info) == -1 && (errno == EINVAL || errno == EIDRM);
+}
+
+/**
+ * Preparar un mensaje de la sesión (remitente y cola de respuesta)
+ */
+static void preparar(struct chat_sesion *s, struct mensaje *msg, long tipo, const char *sala) {
+    memset(msg, 0, sizeof(*msg));
+    msg->mtype = tipo;
+    msg->reply_qid = s->cola_privada;
+    msg->canal = s->id_canal;
+    memcpy(msg->remitente, s->nombre, MAX_NOMBRE);
+    if (sala) {
+        snprintf(msg->sala, MAX_NOMBRE, "%s", sala);
+    }
+}
+
+/**
+ * Apuntar una sesión de canal en la lista de las que tienen eventos preparados
+ */
+static void marcar_preparada(struct chat_sesion *s) {
+    struct chat_canal *c = s->canal;
+    if (!c || s->en_lista) {
+        return;
+    }
+    s->en_lista = 1;
+    s->siguiente_lista = NULL;
+    if (c->lista_fin) {
+        c->lista_fin->siguiente_lista = s;
+    } else {
+        c->lista_ini = s;
+    }
+    c->lista_fin = s;
+}
+
+/**
+ * Encolar un aviso local para la aplicación (se descarta el más antiguo si no cabe)
+ */
+static void avisar(struct chat_sesion *s, int tipo, const char *sala, const char *formato, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static void avisar(struct chat_sesion *s, int tipo, const char *sala, const char *formato, ...) {
+    if (s->num_avisos == MAX_AVISOS) {
+        s->aviso_ini = (s->aviso_ini + 1) % MAX_AVISOS;
+        s->num_avisos--;
+    }
+    struct chat_evento *ev = &s->avisos[(s->aviso_ini + s->num_avisos) % MAX_AVISOS];
+    memset(ev, 0, sizeof(*ev));
+    ev->tipo = tipo;
+    if (sala) {
+        strncpy(ev->sala, sala, MAX_NOMBRE - 1);
+    }
+    va_list args;
+    va_start(args, formato);
+    vsnprintf(ev->texto, MAX_TEXTO, formato, args);
+    va_end(args);
+    s->num_avisos++;
+    marcar_preparada(s);
+}
+
+/**
+ * Marcar el servidor como caído: chat_mantener reintentará la conexión
+ */
+static void perder_conexion(struct chat_sesion *s) {
+    s->caido = 1;
+    s->espera_ms = ESPERA_MIN_MS;
+    s->proximo_intento = ahora_ms();
+    avisar(s, CHAT_EV_CONEXION, NULL, "Se perdió la conexión con el servidor, reintentando...");
+}
+
+/**
+ * Enviar un mensaje sin bloqueo a la cola que le corresponde
+ *
+ * Si la cola ya no existe se marca el servidor como caído (la reconexión
+ * la hace chat_mantener) y se devuelve ENOTCONN.
+ *
+ * @return 0 si éxito, -1 si error (errno)
+ */
+static int enviar(struct chat_sesion *s, struct mensaje *msg) {
+    if (s->caido) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    if (msgsnd(cola_destino(s, msg), msg, sizeof(*msg) - sizeof(long), IPC_NOWAIT) == 0) {
+        return 0;
+    }
+    if (errno == EINVAL || errno == EIDRM) {
+        perder_conexion(s);
+        errno = ENOTCONN;
+    }
+    return -1;
+}
+
+/* ==================== SECUENCIAS Y RECUPERACIÓN ==================== */
+
+/**
+ * Obtener (o crear) el seguimiento de una sala
+ *
+ * Si no hay entradas libres se reutiliza la primera: esa sala volverá a
+ * fijar su base con el siguiente mensaje.
+ */
+static struct seguimiento *seguimiento_de(struct chat_sesion *s, const char *sala) {
+    struct seguimiento *libre = &s->seguimientos[0];
+    for (int i = 0; i < MAX_SALAS_SEGUIDAS; i++) {
+        if (strcmp(s->seguimientos[i].sala, sala) == 0) {
+            return &s->seguimientos[i];
+        }
+        if (s->seguimientos[i].sala[0] == '\0') {
+            libre = &s->seguimientos[i];
+        }
+    }
+    struct mensaje *espera = libre->espera;  // Se conserva el buffer ya reservado
+    memset(libre, 0, sizeof(*libre));
+    libre->espera = espera;
+    strncpy(libre->sala, sala, MAX_NOMBRE - 1);
+    return libre;
+}
+
+/**
+ * Reiniciar el seguimiento de una sala (al unirse u observar de nuevo)
+ */
+static void reiniciar_seguimiento(struct chat_sesion *s, const char *sala) {
+    struct seguimiento *sg = seguimiento_de(s, sala);
+    sg->conocido = 0;
+    sg->ultimo = 0;
+    sg->objetivo = 0;
+    sg->pedido_en = 0;
+    sg->num_espera = 0;
+}
+
+/**
+ * Pedir al servidor los mensajes del hueco anterior al primer retenido
+ * (o, sin retenidos, hasta el objetivo pendiente del buzón)
+ *
+ * Se pide como mucho una vez por segundo por sala: si la respuesta se
+ * pierde (cola llena), el siguiente mensaje recibido vuelve a pedirla.
+ */
+static void pedir_backfill(struct chat_sesion *s, struct seguimiento *sg) {
+    time_t ahora = time(NULL);
+    unsigned int hasta = (sg->num_espera > 0) ? sg->espera[0].seq_prev : sg->objetivo;
+    if (hasta <= sg->ultimo || (sg->pedido_en != 0 && ahora - sg->pedido_en < 1)) {
+        return;
+    }
+
+    struct mensaje req;
+    preparar(s, &req, TIPO_BACKFILL, sg->sala);
+    req.seq_prev = sg->ultimo;              // Último entregado en orden
+    req.seq = hasta;                        // Hasta el anterior al primer retenido
+    if (enviar(s, &req) == 0) {
+        sg->pedido_en = ahora;
+    }
+}
+
+/**
+ * Convertir un mensaje de sala en evento
+ */
+static void evento_de_chat(struct chat_sesion *s, const struct mensaje *msg, struct chat_evento *ev) {
+    memset(ev, 0, sizeof(*ev));
+    ev->tipo = CHAT_EV_MENSAJE;
+    ev->seq = msg->seq;
+    memcpy(ev->remitente, msg->remitente, MAX_NOMBRE);
+    memcpy(ev->sala, msg->sala, MAX_NOMBRE);
+    memcpy(ev->texto, msg->texto, MAX_TEXTO);
+    ev->mencion = texto_menciona(ev->texto, s->nombre);
+    if (s->cache) {
+        cache_guardar(s->cache, msg->sala, msg->seq, msg->remitente, msg->texto);
+    }
+}
+
+/**
+ * Entregar el primer retenido de alguna sala si ya encadena
+ *
+ * @return 1 si se entregó un mensaje en ev, 0 si no hay ninguno listo
+ */
+static int liberar_retenido(struct chat_sesion *s, struct chat_evento *ev) {
+    for (int i = 0; i < MAX_SALAS_SEGUIDAS; i++) {
+        struct seguimiento *sg = &s->seguimientos[i];
+        while (sg->num_espera > 0 && sg->espera[0].seq_prev <= sg->ultimo) {
+            struct mensaje primero = sg->espera[0];
+            sg->num_espera--;
+            memmove(sg->espera, sg->espera + 1, sg->num_espera * sizeof(struct mensaje));
+            if (sg->num_espera == 0) {
+                sg->pedido_en = 0;
+            }
+            if (primero.seq > sg->ultimo) {
+                sg->ultimo = primero.seq;
+                evento_de_chat(s, &primero, ev);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Procesar un CHAT recibido respetando el orden de secuencia
+ *
+ * @return 1 si se entrega ya (en ev), 0 si se descartó o quedó retenido
+ */
+static int recibir_chat(struct chat_sesion *s, const struct mensaje *msg, struct chat_evento *ev) {
+    struct seguimiento *sg = seguimiento_de(s, msg->sala);
+
+    if (!sg->conocido) {
+        // Primer mensaje desde que nos unimos: fija la base
+        sg->conocido = 1;
+        sg->ultimo = msg->seq_prev;
+    }
+
+    if (msg->seq <= sg->ultimo) {
+        return 0;  // Duplicado (ya llegó por BACKFILL)
+    }
+    if (msg->seq_prev == sg->ultimo && sg->num_espera == 0) {
+        // Caso común: encadena, se entrega ya
+        sg->ultimo = msg->seq;
+        evento_de_chat(s, msg, ev);
+        return 1;
+    }
+
+    if (!sg->espera) {
+        sg->espera = malloc(MAX_EN_ESPERA * sizeof(struct mensaje));
+        if (!sg->espera) {
+            sg->ultimo = msg->seq;  // Sin memoria: se acepta el hueco
+            evento_de_chat(s, msg, ev);
+            return 1;
+        }
+    }
+
+    int entregado = 0;
+    if (sg->num_espera == MAX_EN_ESPERA) {
+        // Demasiados retenidos: se acepta el primer hueco y se entrega el más antiguo
+        avisar(s, CHAT_EV_AVISO, sg->sala, "Sala '%s': mensajes perdidos antes de la secuencia %u",
+               sg->sala, sg->espera[0].seq);
+        sg->ultimo = sg->espera[0].seq;
+        evento_de_chat(s, &sg->espera[0], ev);
+        sg->num_espera--;
+        memmove(sg->espera, sg->espera + 1, sg->num_espera * sizeof(struct mensaje));
+        entregado = 1;
+    }
+
+    // Hueco: retener en orden de seq y pedir lo que falta
+    int i = sg->num_espera;
+    while (i > 0 && sg->espera[i - 1].seq > msg->seq) {
+        sg->espera[i] = sg->espera[i - 1];
+        i--;
+    }
+    sg->espera[i] = *msg;
+    sg->num_espera++;
+    pedir_backfill(s, sg);
+    return entregado;
+}
+
+/**
+ * Procesar una respuesta BACKFILL (mensaje recuperado o marca de fin)
+ *
+ * @return 1 si se entrega un mensaje recuperado (en ev), 0 si no
+ */
+static int recibir_backfill(struct chat_sesion *s, const struct mensaje *msg, struct chat_evento *ev) {
+    struct seguimiento *sg = seguimiento_de(s, msg->sala);
+
+    if (msg->remitente[0] != '\0') {
+        // Mensaje recuperado: los del servidor llegan en orden creciente
+        if (msg->seq > sg->ultimo) {
+            sg->ultimo = msg->seq;
+            evento_de_chat(s, msg, ev);
+            return 1;
+        }
+        return 0;
+    }
+
+    // Fin: lo que no llegó hasta 'seq' no era para nosotros (filtro).
+    // Los retenidos que ya encadenan los entrega liberar_retenido
+    if (msg->seq > sg->ultimo) {
+        sg->ultimo = msg->seq;
+        if (s->cache) {
+            cache_avanzar(s->cache, sg->sala, sg->ultimo);
+        }
+    }
+    sg->pedido_en = 0;
+    if (sg->num_espera == 0 && sg->objetivo > sg->ultimo) {
+        pedir_backfill(s, sg);  // Queda buzón por recibir
+    }
+    if (sg->num_espera > 0 && sg->espera[sg->num_espera - 1].seq_prev > sg->ultimo) {
+        // Si el servidor se cortó antes, pedir el resto tras el primer retenido que no encadena
+        int k = 0;
+        while (k < sg->num_espera && sg->espera[k].seq_prev <= sg->ultimo) {
+            k++;
+        }
+        if (k == 0) {
+            pedir_backfill(s, sg);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Retomar una sala al unirse (u observar) de nuevo
+ *
+ * Si el servidor guardó un buzón mientras estábamos desconectados, la
+ * confirmación trae en base la secuencia anterior a su primer mensaje y
+ * en hasta la del último: el seguimiento parte de base, el buzón llega a
+ * continuación y lo que no quepa de una vez se pide hasta completarlo.
+ *
+ * Lo guardado en la caché local se entrega ya como historial
+ * (evento_listo). Sin buzón, el seguimiento parte de la última
+ * secuencia guardada: sólo se pide por BACKFILL lo publicado después,
+ * no la sala entera. Los CHAT que lleguen antes de la respuesta quedan
+ * retenidos hasta que encadenan.
+ */
+static void retomar_sala(struct chat_sesion *s, const char *sala, unsigned int base, unsigned int hasta) {
+    unsigned int ultimo = s->cache ? cache_ultimo(s->cache, sala) : 0;
+    if (hasta != 0 && ultimo > base) {
+        ultimo = base;  // Lo posterior llega en el buzón
+    }
+    if (ultimo != 0) {
+        memcpy(s->historial_sala, sala, MAX_NOMBRE);
+        s->historial_seq = (ultimo > CACHE_MENSAJES) ? ultimo - CACHE_MENSAJES + 1 : 1;
+        s->historial_hasta = ultimo;
+        marcar_preparada(s);
+    }
+
+    struct seguimiento *sg = seguimiento_de(s, sala);
+    if (hasta != 0) {
+        sg->conocido = 1;
+        sg->ultimo = base;
+        sg->objetivo = hasta;
+        return;
+    }
+    if (ultimo == 0) {
+        return;
+    }
+    sg->conocido = 1;
+    sg->ultimo = ultimo;
+
+    struct mensaje req;
+    preparar(s, &req, TIPO_BACKFILL, sala);
+    req.seq_prev = ultimo;
+    req.seq = 0;                            // Hasta la última de la sala
+    if (enviar(s, &req) == 0) {
+        sg->pedido_en = time(NULL);
+    }
+}
+
+/**
+ * Entregar el siguiente mensaje del historial guardado
+ *
+ * @return 1 si se entregó un mensaje en ev, 0 si ya no queda ninguno
+ */
+static int siguiente_historial(struct chat_sesion *s, struct chat_evento *ev) {
+    while (s->historial_seq != 0 && s->historial_seq <= s->historial_hasta) {
+        unsigned int seq = s->historial_seq++;
+        memset(ev, 0, sizeof(*ev));
+        if (cache_leer(s->cache, s->historial_sala, seq, ev->remitente, ev->texto)) {
+            ev->tipo = CHAT_EV_MENSAJE;
+            ev->seq = seq;
+            ev->historial = 1;
+            memcpy(ev->sala, s->historial_sala, MAX_NOMBRE);
+            ev->mencion = texto_menciona(ev->texto, s->nombre);
+            return 1;
+        }
+    }
+    s->historial_seq = 0;
+    return 0;
+}
+
+/* ==================== SOLICITUDES PENDIENTES ==================== */
+
+/**
+ * Anotar una solicitud y asignarle su correlación
+ *
+ * Si la tabla está llena se reutiliza la entrada más antigua (su
+ * respuesta, si llega, sólo se entregará como evento).
+ */
+static void registrar_pendiente(struct chat_sesion *s, struct mensaje *msg) {
+    struct pendiente *p = &s->pendientes[0];
+    for (int i = 0; i < MAX_PENDIENTES; i++) {
+        if (s->pendientes[i].sol.corr == 0) {
+            p = &s->pendientes[i];
+            break;
+        }
+        if (s->pendientes[i].enviada < p->enviada) {
+            p = &s->pendientes[i];
+        }
+    }
+
+    msg->corr = s->siguiente_corr++;
+    if (s->siguiente_corr == 0) {
+        s->siguiente_corr = 1;
+    }
+    p->sol = *msg;
+    p->enviada = time(NULL);
+}
+
+/**
+ * Enviar una solicitud correlacionada
+ *
+ * @param anotar 1 si cambia el estado al confirmarse (JOIN, OBSERVE, LEAVE, FILTER)
+ * @return Correlación, o 0 si no se pudo enviar
+ */
+static unsigned int solicitar(struct chat_sesion *s, struct mensaje *msg, int anotar) {
+    if (anotar) {
+        registrar_pendiente(s, msg);
+    } else {
+        msg->corr = s->siguiente_corr++;
+        if (s->siguiente_corr == 0) {
+            s->siguiente_corr = 1;
+        }
+    }
+
+    if (enviar(s, msg) == -1) {
+        for (int i = 0; anotar && i < MAX_PENDIENTES; i++) {
+            if (s->pendientes[i].sol.corr == msg->corr) {
+                s->pendientes[i].sol.corr = 0;
+            }
+        }
+        return 0;
+    }
+    return msg->corr;
+}
+
+/**
+ * Sala a la que se dirigen los comandos que se emiten ahora
+ *
+ * Es la sala actual, salvo que haya un JOIN/OBSERVE/LEAVE en vuelo: en
+ * ese caso la del más reciente. Así "unirse" seguido de "enviar" no
+ * espera la confirmación; el servidor los procesa en orden y, si el JOIN
+ * falla, el mensaje también se rechaza.
+ */
+static void sala_objetivo(struct chat_sesion *s, char *sala, int *observador) {
+    memcpy(sala, s->sala_actual, MAX_NOMBRE);
+    *observador = s->es_observador;
+
+    unsigned int ultima = 0;
+    for (int i = 0; i < MAX_PENDIENTES; i++) {
+        const struct mensaje *sol = &s->pendientes[i].sol;
+        if (sol->corr <= ultima) {
+            continue;
+        }
+        if (sol->mtype == TIPO_JOIN || sol->mtype == TIPO_OBSERVE) {
+            memcpy(sala, sol->sala, MAX_NOMBRE);
+            *observador = (sol->mtype == TIPO_OBSERVE);
+            ultima = sol->corr;
+        } else if (sol->mtype == TIPO_LEAVE) {
+            sala[0] = '\0';
+            *observador = 0;
+            ultima = sol->corr;
+        }
+    }
+}
+
+/**
+ * Aplicar el cambio de estado de una solicitud confirmada
+ *
+ * Un RESP con estado de error sólo libera la solicitud: la sala actual
+ * sigue siendo la anterior (en la que el servidor nos sigue teniendo).
+ */
+static void aplicar_respuesta(struct chat_sesion *s, const struct mensaje *resp) {
+    for (int i = 0; i < MAX_PENDIENTES; i++) {
+        struct mensaje *sol = &s->pendientes[i].sol;
+        if (sol->corr != resp->corr) {
+            continue;
+        }
+
+        if (resp->estado == ESTADO_OK) {
+            if (sol->mtype == TIPO_JOIN || sol->mtype == TIPO_OBSERVE) {
+                reiniciar_seguimiento(s, sol->sala);
+                retomar_sala(s, sol->sala, resp->seq, resp->seq_prev);
+                memcpy(s->sala_actual, sol->sala, MAX_NOMBRE);
+                s->es_observador = (sol->mtype == TIPO_OBSERVE);
+                s->filtro_actual[0] = '\0';
+                s->cola_sala = cola_destino(s, sol);
+            } else if (sol->mtype == TIPO_LEAVE && strcmp(s->sala_actual, sol->sala) == 0) {
+                s->sala_actual[0] = '\0';
+                s->es_observador = 0;
+                s->cola_sala = -1;
+            } else if (sol->mtype == TIPO_FILTER && strcmp(s->sala_actual, sol->sala) == 0) {
+                memcpy(s->filtro_actual, sol->texto, MAX_TEXTO);
+            }
+        }
+        sol->corr = 0;
+        break;
+    }
+}
+
+/* ==================== LISTA DE MIEMBROS ==================== */
+
+/**
+ * Vaciar la lista de miembros y pasar a seguir otra sala
+ */
+static void reiniciar_miembros(struct lista_miembros *l, const char *sala) {
+    memcpy(l->sala, sala, MAX_NOMBRE);
+    l->version = 0;
+    l->pedida = 0;
+    l->num = 0;
+}
+
+/**
+ * Volver a pedir al servidor los cambios de miembros desde la versión aplicada
+ *
+ * Se usa al detectar un hueco. Con corr = 0 (hueco en un PRESENCIA) la
+ * respuesta no produce evento y no se repite mientras la anterior pueda
+ * seguir en camino; con el corr de un chat_miembros se pide siempre, para
+ * que su evento llegue.
+ */
+static void pedir_miembros(struct chat_sesion *s, unsigned int corr) {
+    struct lista_miembros *l = s->miembros;
+    time_t ahora = time(NULL);
+    if (corr == 0 && l->pedida != 0 && ahora - l->pedida < REPETIR_MIEMBROS) {
+        return;
+    }
+
+    struct mensaje req;
+    preparar(s, &req, TIPO_MIEMBROS, l->sala);
+    req.corr = corr;
+    req.seq = l->version;
+    if (enviar(s, &req) == 0) {
+        l->pedida = ahora;
+    }
+}
+
+/**
+ * Añadir o quitar un nombre de la lista de miembros
+ *
+ * @return 0 si éxito, -1 si no hay memoria para uno más
+ */
+static int cambiar_miembro(struct lista_miembros *l, const char *nombre, int alta) {
+    for (int i = 0; i < l->num; i++) {
+        if (strcmp(l->nombres[i], nombre) == 0) {
+            if (!alta) {
+                memcpy(l->nombres[i], l->nombres[--l->num], MAX_NOMBRE);
+            }
+            return 0;
+        }
+    }
+    if (!alta) {
+        return 0;
+    }
+    if (l->num == l->capacidad) {
+        int capacidad = l->capacidad ? 2 * l->capacidad : 16;
+        char (*nombres)[MAX_NOMBRE] = realloc(l->nombres, (size_t)capacidad * MAX_NOMBRE);
+        if (!nombres) {
+            return -1;
+        }
+        l->nombres = nombres;
+        l->capacidad = capacidad;
+    }
+    memset(l->nombres[l->num], 0, MAX_NOMBRE);
+    strncpy(l->nombres[l->num++], nombre, MAX_NOMBRE - 1);
+    return 0;
+}
+
+/**
+ * Aplicar un PRESENCIA o una parte de MIEMBROS a la lista de la sala actual
+ *
+ * Se aplica si seq_prev es 0 (lista completa) o la versión ya aplicada.
+ * Un mensaje que no llega a la versión aplicada es antiguo y se ignora;
+ * uno que parte de una versión posterior indica un hueco: se pide lo que
+ * falta desde la versión aplicada.
+ *
+ * @return 0 si la lista está al día (o no se sigue esa sala), -1 si hay un hueco
+ */
+static int aplicar_miembros(struct chat_sesion *s, const struct mensaje *msg) {
+    struct lista_miembros *l = s->miembros;
+    if (!l || strcmp(msg->sala, s->sala_actual) != 0) {
+        return 0;
+    }
+    if (strcmp(l->sala, s->sala_actual) != 0) {
+        reiniciar_miembros(l, s->sala_actual);
+    }
+
+    if (msg->seq_prev != 0 && msg->seq_prev != l->version) {
+        if (l->version != 0 && msg->seq <= l->version) {
+            return 0;  // Ya aplicado por otro camino
+        }
+        if (msg->mtype != TIPO_MIEMBROS) {
+            pedir_miembros(s, 0);
+        } else if (msg->estado == 0) {
+            pedir_miembros(s, msg->corr);  // Una sola vez por respuesta: en su última parte
+        }
+        return -1;
+    }
+
+    char texto[MAX_TEXTO];
+    memcpy(texto, msg->texto, MAX_TEXTO);
+    texto[MAX_TEXTO - 1] = '\0';
+    char *resto = NULL;
+    for (char *t = strtok_r(texto, " ", &resto); t; t = strtok_r(NULL, " ", &resto)) {
+        if (t[0] == '=') {
+            l->num = 0;
+        } else if ((t[0] == '+' || t[0] == '-') && t[1] != '\0') {
+            cambiar_miembro(l, t + 1, t[0] == '+');
+        }
+    }
+    l->version = msg->seq;
+    if (msg->mtype == TIPO_MIEMBROS && msg->estado == 0) {
+        l->pedida = 0;
+    }
+    return 0;
+}
+
+/**
+ * Poner en texto_largo la lista de miembros de un CHAT_EV_MIEMBROS
+ *
+ * "Ana, Bob, Carlos" en texto; si no cabe, completa en texto_largo.
+ */
+static void describir_miembros(struct chat_sesion *s, struct chat_evento *ev) {
+    const struct lista_miembros *l = s->miembros;
+    size_t tam = (size_t)l->num * (MAX_NOMBRE + 2) + 1;
+    char *lista = malloc(tam);
+    if (!lista) {
+        return;  // Queda el resumen de texto
+    }
+    size_t largo = 0;
+    lista[0] = '\0';
+    for (int i = 0; i < l->num; i++) {
+        largo += (size_t)snprintf(lista + largo, tam - largo, "%s%s", i > 0 ? ", " : "", l->nombres[i]);
+    }
+    snprintf(ev->texto, MAX_TEXTO, "%s", lista);
+    if (largo < MAX_TEXTO) {
+        free(lista);
+        return;
+    }
+    s->largo_entregado = lista;
+    ev->texto_largo = lista;
+    ev->largo = largo;
+}
+
+/* ==================== TEXTOS LARGOS Y ADJUNTOS ==================== */
+
+/**
+ * Proyectar el diccionario de una sala publicado por el servidor
+ *
+ * El segmento se encuentra por su clave (sala y huella) y se comprueba
+ * que su contenido tenga esa huella. Sin sitio se suelta el menos usado.
+ *
+ * @return Diccionario, o NULL si el servidor no lo publica
+ */
+static const struct diccionario *diccionario_de(struct chat_sesion *s, const char *sala, unsigned int huella) {
+    struct diccionario *elegido = NULL;
+    for (int i = 0; i < MAX_DICCIONARIOS; i++) {
+        struct diccionario *d = &s->diccionarios[i];
+        if (d->datos && d->huella == huella && strcmp(d->sala, sala) == 0) {
+            d->uso = ++s->reloj_diccionario;
+            return d;
+        }
+        if (!elegido || (elegido->datos && (!d->datos || d->uso < elegido->uso))) {
+            elegido = d;
+        }
+    }
+
+    int shmid = shmget(clave_diccionario(sala, huella), 0, 0);
+    struct shmid_ds info;
+    if (shmid == -1 || shmctl(shmid, IPC_STAT, &info) == -1) {
+        return NULL;
+    }
+    void *datos = shmat(shmid, NULL, SHM_RDONLY);
+    if (datos == (void *)-1) {
+        return NULL;
+    }
+    if (huella_diccionario(datos, info.shm_segsz) != huella) {
+        shmdt(datos);  // Otra sala con la misma clave (o uno a medio publicar)
+        return NULL;
+    }
+
+    if (elegido->datos) {
+        shmdt(elegido->datos);
+    }
+    memset(elegido->sala, 0, MAX_NOMBRE);
+    strncpy(elegido->sala, sala, MAX_NOMBRE - 1);
+    elegido->huella = huella;
+    elegido->datos = datos;
+    elegido->tam = info.shm_segsz;
+    elegido->uso = ++s->reloj_diccionario;
+    return elegido;
+}
+
+/**
+ * Preguntar al servidor por el diccionario de la sala en la que se habla
+ *
+ * Sólo con la compresión activa. Mientras la sala no tenga diccionario
+ * se vuelve a preguntar cada REPETIR_DICCIONARIO segundos.
+ */
+static void pedir_diccionario(struct chat_sesion *s, const char *sala) {
+    time_t ahora = time(NULL);
+    if (!s->comprimir || sala[0] == '\0' ||
+        (strcmp(s->dicc_sala, sala) == 0 &&
+         (s->dicc_huella != 0 || ahora - s->dicc_pedido < REPETIR_DICCIONARIO))) {
+        return;
+    }
+
+    struct mensaje req;
+    preparar(s, &req, TIPO_DICCIONARIO, sala);
+    if (enviar(s, &req) == 0) {
+        memcpy(s->dicc_sala, req.sala, MAX_NOMBRE);
+        s->dicc_huella = 0;
+        s->dicc_pedido = ahora;
+    }
+}
+
+/**
+ * Bytes del próximo fragmento del texto largo en curso
+ *
+ * Un texto comprimido no se corta tras un '\x1b': el byte escapado
+ * viaja entero en el mismo fragmento.
+ */
+static size_t corte_fragmento(const struct envio_largo *e, size_t inicio) {
+    size_t n = (e->largo - inicio < CARGA_FRAGMENTO) ? e->largo - inicio : CARGA_FRAGMENTO;
+    if (e->comprimido && n > 1 && (unsigned char)e->datos[inicio + n - 1] == ESCAPE_COMPRESION) {
+        n--;
+    }
+    return n;
+}
+
+/**
+ * Número de fragmentos en que se envía un texto largo
+ */
+static int contar_fragmentos(const struct envio_largo *e) {
+    int partes = 0;
+    size_t inicio = 0;
+    do {
+        inicio += corte_fragmento(e, inicio);
+        partes++;
+    } while (inicio < e->largo);
+    return partes;
+}
+
+/**
+ * Comprimir el texto largo en curso con el diccionario de su sala
+ *
+ * Se queda comprimido sólo si necesita menos fragmentos que sin comprimir.
+ */
+static void comprimir_envio(struct chat_sesion *s, struct envio_largo *e) {
+    const struct diccionario *d = NULL;
+    if (s->dicc_huella != 0 && strcmp(s->dicc_sala, e->sala) == 0) {
+        d = diccionario_de(s, e->sala, s->dicc_huella);
+    }
+
+    char *binario = malloc(e->largo);
+    char *escapado = malloc(2 * e->largo);
+    size_t tam = binario ? comprimir(d ? d->datos : NULL, d ? d->tam : 0, e->datos, e->largo,
+                                     binario, e->largo) : 0;
+    if (tam == 0 || !escapado) {
+        free(binario);
+        free(escapado);
+        return;  // No se comprime (o sin memoria): se envía tal cual
+    }
+
+    struct envio_largo comprimido = *e;
+    comprimido.datos = escapado;
+    comprimido.largo = escapar_binario(binario, tam, escapado);
+    comprimido.comprimido = 1;
+    comprimido.dicc = d ? d->huella : 0;
+    free(binario);
+    comprimido.partes = contar_fragmentos(&comprimido);
+    if (comprimido.partes < e->partes) {
+        free(e->datos);
+        *e = comprimido;
+    } else {
+        free(escapado);
+    }
+}
+
+/**
+ * Enviar los fragmentos pendientes del texto largo en curso
+ *
+ * Se envía todo lo que cabe en la cola del servidor; con EAGAIN (o
+ * mientras se reconecta) el resto espera a la próxima llamada. Si la
+ * sesión dejó la sala, lo que falta se descarta.
+ */
+static void continuar_envio_largo(struct chat_sesion *s) {
+    struct envio_largo *e = &s->envio;
+    if (!e->datos || s->caido) {
+        return;
+    }
+
+    char sala[MAX_NOMBRE];
+    int observador;
+    sala_objetivo(s, sala, &observador);
+    if (strcmp(sala, e->sala) != 0 || observador) {
+        avisar(s, CHAT_EV_AVISO, e->sala, "Texto largo interrumpido al dejar la sala '%s' (%d de %d fragmentos)",
+               e->sala, e->parte - 1, e->partes);
+        free(e->datos);
+        e->datos = NULL;
+        return;
+    }
+
+    struct mensaje msg;
+    preparar(s, &msg, TIPO_MSG, e->sala);
+    while (e->parte <= e->partes) {
+        size_t n = corte_fragmento(e, e->enviado);
+        int cabecera;
+        if (e->comprimido) {
+            cabecera = snprintf(msg.texto, MAX_TEXTO, FORMATO_COMPRIMIDO, e->id, e->parte, e->partes, e->dicc);
+            memcpy(msg.texto + cabecera, e->datos + e->enviado, n);
+        } else {
+            cabecera = snprintf(msg.texto, MAX_TEXTO, FORMATO_FRAGMENTO, e->id, e->parte, e->partes);
+            for (size_t i = 0; i < n; i++) {
+                char c = e->datos[e->enviado + i];
+                msg.texto[cabecera + i] = (c == '\n') ? SALTO_FRAGMENTO : c;
+            }
+        }
+        msg.texto[cabecera + n] = '\0';
+        if (enviar(s, &msg) == -1) {
+            return;
+        }
+        e->enviado += n;
+        e->parte++;
+    }
+    free(e->datos);
+    e->datos = NULL;
+}
+
+/**
+ * Buscar (o reservar) el ensamblado de un texto largo recibido
+ *
+ * Sin entradas libres se reemplaza la menos usada y se avisa de que ese
+ * texto queda incompleto (su último fragmento no llegó).
+ */
+static struct ensamblado *ensamblado_de(struct chat_sesion *s, const struct chat_evento *ev,
+                                        unsigned int id, int partes) {
+    struct ensamblado *elegido = NULL;
+    for (int i = 0; i < MAX_ENSAMBLADOS; i++) {
+        struct ensamblado *en = &s->ensamblados[i];
+        if (en->id == id && strcmp(en->remitente, ev->remitente) == 0 &&
+            strcmp(en->sala, ev->sala) == 0) {
+            return en;
+        }
+        if (!elegido || (elegido->id != 0 && (en->id == 0 || en->uso < elegido->uso))) {
+            elegido = en;
+        }
+    }
+
+    if (elegido->id != 0) {
+        avisar(s, CHAT_EV_AVISO, elegido->sala, "Texto largo de %s incompleto: se descarta",
+               elegido->remitente);
+    }
+    char *datos = realloc(elegido->datos, (size_t)partes * CARGA_FRAGMENTO + 64);
+    if (!datos) {
+        return NULL;
+    }
+    memset(elegido, 0, sizeof(*elegido));
+    elegido->datos = datos;
+    memcpy(elegido->sala, ev->sala, MAX_NOMBRE);
+    memcpy(elegido->remitente, ev->remitente, MAX_NOMBRE);
+    elegido->id = id;
+    elegido->partes = partes;
+    elegido->siguiente = 1;
+    return elegido;
+}
+
+/**
+ * Descomprimir un texto largo recibido entero en fragmentos 'C'
+ *
+ * @return 0 si éxito (datos pasa a ser el texto), -1 si falta el
+ *         diccionario de la sala o los datos están dañados
+ */
+static int descomprimir_ensamblado(struct chat_sesion *s, struct ensamblado *en) {
+    const struct diccionario *d = NULL;
+    if (en->dicc != 0 && !(d = diccionario_de(s, en->sala, en->dicc))) {
+        return -1;
+    }
+
+    char *binario = malloc(en->largo);
+    char *texto = malloc(CHAT_MAX_LARGO + 64);
+    size_t tam = (size_t)-1;
+    if (binario && texto) {
+        size_t n = desescapar_binario(en->datos, en->largo, binario);
+        tam = descomprimir(d ? d->datos : NULL, d ? d->tam : 0, binario, n, texto, CHAT_MAX_LARGO);
+    }
+    free(binario);
+    if (tam == (size_t)-1) {
+        free(texto);
+        return -1;
+    }
+    free(en->datos);
+    en->datos = texto;
+    en->largo = tam;
+    return 0;
+}
+
+/**
+ * Completar un evento de sala que trae un fragmento o un adjunto
+ *
+ * Los fragmentos se acumulan por (sala, remitente, id) y sólo el último
+ * produce el evento, con el texto completo (descomprimido si venía
+ * comprimido) en texto_largo. Un adjunto se entrega con su segmento en
+ * adjunto_id y el nombre en texto. Vale igual para mensajes en vivo,
+ * recuperados por BACKFILL o del historial.
+ *
+ * @return 1 si el evento se entrega, 0 si era un fragmento intermedio
+ */
+static int completar_evento(struct chat_sesion *s, struct chat_evento *ev) {
+    free(s->largo_entregado);  // El texto_largo anterior deja de ser válido
+    s->largo_entregado = NULL;
+    if (ev->tipo == CHAT_EV_MIEMBROS) {
+        describir_miembros(s, ev);
+        return 1;
+    }
+    if (ev->tipo != CHAT_EV_MENSAJE || ev->texto[0] != '\001') {
+        return 1;
+    }
+
+    int id_adjunto, usados = 0;
+    size_t tam;
+    if (sscanf(ev->texto, FORMATO_ADJUNTO "%n", &id_adjunto, &tam, &usados) == 2 && usados > 0) {
+        ev->adjunto = 1;
+        ev->adjunto_id = id_adjunto;
+        ev->adjunto_tam = tam;
+        ev->mencion = 0;
+        memmove(ev->texto, ev->texto + usados, MAX_TEXTO - usados);
+        return 1;
+    }
+
+    unsigned int id, dicc = 0;
+    int parte, partes, comprimido = 0;
+    usados = 0;
+    if (sscanf(ev->texto, FORMATO_FRAGMENTO "%n", &id, &parte, &partes, &usados) != 3 || usados == 0) {
+        usados = 0;
+        comprimido = 1;
+        if (sscanf(ev->texto, FORMATO_COMPRIMIDO "%n", &id, &parte, &partes, &dicc, &usados) != 4) {
+            usados = 0;
+        }
+    }
+    if (usados == 0 || partes < 1 || partes > MAX_FRAGMENTOS || parte < 1 || parte > partes || id == 0) {
+        return 1;  // No es una cabecera válida: se entrega tal cual
+    }
+
+    struct ensamblado *en = ensamblado_de(s, ev, id, partes);
+    if (!en) {
+        return 1;  // Sin memoria: el fragmento se entrega suelto
+    }
+    en->uso = ++s->reloj_ensamblado;
+    en->comprimido = comprimido;
+    en->dicc = dicc;
+    if (parte < en->siguiente) {
+        return 0;  // Repetido
+    }
+    en->perdidas += parte - en->siguiente;
+    en->siguiente = parte + 1;
+    for (const char *c = ev->texto + usados; *c && en->largo < (size_t)partes * CARGA_FRAGMENTO; c++) {
+        en->datos[en->largo++] = (!comprimido && *c == SALTO_FRAGMENTO) ? '\n' : *c;
+    }
+    if (parte < partes) {
+        return 0;
+    }
+
+    // Último fragmento: el evento lleva el texto completo (seq del último)
+    if (en->comprimido && en->perdidas > 0) {
+        en->largo = snprintf(en->datos, 64, "[texto comprimido incompleto: faltan %d de %d fragmentos]",
+                             en->perdidas, partes);
+    } else if (en->comprimido && descomprimir_ensamblado(s, en) == -1) {
+        en->largo = snprintf(en->datos, 64, "[texto comprimido ilegible: falta el diccionario %08x]",
+                             en->dicc);
+    } else if (en->perdidas > 0) {
+        en->largo += snprintf(en->datos + en->largo, 64, "\n[faltan %d de %d fragmentos]",
+                              en->perdidas, partes);
+    } else {
+        en->datos[en->largo] = '\0';
+    }
+    s->largo_entregado = en->datos;
+    ev->texto_largo = en->datos;
+    ev->largo = en->largo;
+    snprintf(ev->texto, MAX_TEXTO, "%s", en->datos);
+    ev->mencion = texto_menciona(en->datos, s->nombre);
+    en->datos = NULL;
+    en->id = 0;
+    return 1;
+}
+
+/* ==================== RECONEXIÓN ==================== */
+
+/**
+ * Restaurar la sesión en un servidor recién (re)conectado
+ *
+ * Registra de nuevo la sesión, vuelve a unirse (u observar) a la sala
+ * actual con su filtro y pide por BACKFILL lo publicado desde la última
+ * secuencia entregada. Van sin correlación (salvo CONNECT, por si otro
+ * cliente tomó el nombre mientras tanto): el estado ya está aplicado.
+ */
+static void restaurar_sesion(struct chat_sesion *s) {
+    struct mensaje msg;
+    preparar(s, &msg, TIPO_CONNECT, NULL);
+    msg.corr = s->corr_conexion;
+    enviar(s, &msg);
+
+    if (s->sala_actual[0] == '\0') {
+        return;
+    }
+
+    preparar(s, &msg, s->es_observador ? TIPO_OBSERVE : TIPO_JOIN, s->sala_actual);
+    s->cola_sala = cola_destino(s, &msg);
+    enviar(s, &msg);
+
+    if (s->filtro_actual[0] != '\0' && !s->es_observador) {
+        msg.mtype = TIPO_FILTER;
+        memcpy(msg.texto, s->filtro_actual, MAX_TEXTO);
+        enviar(s, &msg);
+    }
+
+    // Reanudar desde la última secuencia entregada (hasta la última de la sala)
+    struct seguimiento *sg = seguimiento_de(s, s->sala_actual);
+    if (sg->conocido) {
+        preparar(s, &msg, TIPO_BACKFILL, s->sala_actual);
+        msg.seq_prev = sg->ultimo;
+        msg.seq = 0;
+        enviar(s, &msg);
+    }
+}
+
+/**
+ * Comprobar si la sesión perdió el servidor
+ *
+ * En un canal lo decide el estado que chat_canal_mantener comprobó una
+ * vez para todas: no hace llamadas al sistema por sesión.
+ */
+static int conexion_perdida(const struct chat_sesion *s) {
+    if (s->canal) {
+        return s->canal->caido || s->cola_global != s->canal->cola_global;
+    }
+    return servidor_caido(s->cola_global) ||
+           (s->cola_sala != -1 && servidor_caido(s->cola_sala));
+}
+
+void chat_mantener(struct chat_sesion *s) {
+    pthread_mutex_lock(&s->mutex);
+    long long ahora = ahora_ms();
+
+    if (!s->caido && conexion_perdida(s)) {
+        perder_conexion(s);
+    }
+
+    if (s->caido && ahora >= s->proximo_intento) {
+        int qid;
+        if (s->canal) {
+            qid = s->canal->caido ? -1 : s->canal->cola_global;  // El canal ya releyó el directorio
+        } else {
+            qid = msgget(key_global, 0666);
+            if (qid != -1 && servidor_caido(qid)) {
+                qid = -1;
+            } else if (qid != -1) {
+                adjuntar_directorio();
+            }
+        }
+        if (qid != -1) {
+            s->cola_global = qid;
+            s->caido = 0;
+            restaurar_sesion(s);
+            avisar(s, CHAT_EV_CONEXION, s->sala_actual, "Reconectado al servidor (Global: %d)%s%s",
+                   qid, s->sala_actual[0] ? ", retomando la sala " : "", s->sala_actual);
+        } else {
+            // Espera exponencial con jitter (entre la mitad y el total del
+            // intervalo): tras un reinicio, los clientes no reintentan a la vez
+            s->proximo_intento = ahora + s->espera_ms / 2 +
+                                 rand_r(&s->semilla) % (s->espera_ms / 2 + 1);
+            s->espera_ms = (s->espera_ms * 2 > ESPERA_MAX_MS) ? ESPERA_MAX_MS : s->espera_ms * 2;
+        }
+    }
+
+    // Solicitudes sin respuesta (servidor caído o saturado)
+    time_t segundos = time(NULL);
+    for (int i = 0; i < MAX_PENDIENTES; i++) {
+        struct mensaje *sol = &s->pendientes[i].sol;
+        if (sol->corr != 0 && segundos - s->pendientes[i].enviada >= TIEMPO_PENDIENTE) {
+            avisar(s, CHAT_EV_AVISO, sol->sala,
+                   "Sin respuesta del servidor (solicitud tipo %ld, sala '%s')", sol->mtype, sol->sala);
+            sol->corr = 0;
+        }
+    }
+
+    // Fragmentos de un texto largo que no cupieron en la cola del servidor
+    continuar_envio_largo(s);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+/* ==================== PUENTE HACIA UN BUCLE DE EVENTOS ==================== */
+
+static void puente_iniciar(struct puente *p) {
+    memset(p, 0, sizeof(*p));
+    p->fd = -1;
+    pthread_mutex_init(&p->mutex, NULL);
+    pthread_cond_init(&p->hueco, NULL);
+}
+
+/**
+ * Hilo puente: cola (no pollable) -> anillo + eventfd
+ *
+ * Sólo mueve mensajes sin procesar; el estado de las sesiones lo
+ * actualiza el hilo del bucle de eventos al sacarlos. Con el anillo lleno
+ * deja de leer: la cola se llena y el servidor descarta para nosotros lo
+ * que no cabe (se recupera con BACKFILL).
+ */
+static void *hilo_puente(void *arg) {
+    struct puente *p = arg;
+    struct mensaje msg;
+    uint64_t uno = 1;
+
+    while (1) {
+        if (msgrcv(p->cola, &msg, sizeof(msg) - sizeof(long), 0, 0) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;  // Cola eliminada (sesión o canal cerrado)
+        }
+
+        pthread_mutex_lock(&p->mutex);
+        while (p->num == p->capacidad && !p->cerrando) {
+            pthread_cond_wait(&p->hueco, &p->mutex);
+        }
+        if (p->cerrando) {
+            pthread_mutex_unlock(&p->mutex);
+            break;
+        }
+        p->anillo[(p->ini + p->num) % p->capacidad] = msg;
+        p->num++;
+        pthread_mutex_unlock(&p->mutex);
+        write(p->fd, &uno, sizeof(uno));
+    }
+
+    pthread_mutex_lock(&p->mutex);
+    p->cerrado = 1;
+    pthread_mutex_unlock(&p->mutex);
+    write(p->fd, &uno, sizeof(uno));  // Despertar al bucle para que lo vea
+    return NULL;
+}
+
+/**
+ * Lanzar el puente de una cola
+ *
+ * @return eventfd, o -1 si error (errno)
+ */
+static int puente_abrir(struct puente *p, int cola, int capacidad) {
+    p->anillo = malloc(capacidad * sizeof(struct mensaje));
+    if (!p->anillo) {
+        return -1;
+    }
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) {
+        free(p->anillo);
+        p->anillo = NULL;
+        return -1;
+    }
+    p->fd = fd;
+    p->cola = cola;
+    p->capacidad = capacidad;
+    if (pthread_create(&p->hilo, NULL, hilo_puente, p) != 0) {
+        close(fd);
+        p->fd = -1;
+        free(p->anillo);
+        p->anillo = NULL;
+        errno = EAGAIN;
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Sacar un mensaje del anillo del puente (equivalente a msgrcv)
+ *
+ * El contador del eventfd se consume antes de dar el anillo por vacío:
+ * un mensaje que llegue después vuelve a marcar el descriptor, así el
+ * bucle de eventos nunca se queda dormido con mensajes pendientes.
+ *
+ * @return 0 si hay mensaje, -1 si no (errno ENOMSG, EINTR o EIDRM)
+ */
+static int puente_sacar(struct puente *p, struct mensaje *msg, int esperar) {
+    while (1) {
+        pthread_mutex_lock(&p->mutex);
+        if (p->num > 0) {
+            *msg = p->anillo[p->ini];
+            p->ini = (p->ini + 1) % p->capacidad;
+            p->num--;
+            pthread_cond_signal(&p->hueco);
+            pthread_mutex_unlock(&p->mutex);
+            return 0;
+        }
+        int cerrado = p->cerrado;
+        pthread_mutex_unlock(&p->mutex);
+        if (cerrado) {
+            errno = EIDRM;
+            return -1;
+        }
+
+        uint64_t contador;
+        if (read(p->fd, &contador, sizeof(contador)) == sizeof(contador)) {
+            continue;  // Había notificaciones: volver a mirar el anillo
+        }
+        if (!esperar) {
+            errno = ENOMSG;
+            return -1;
+        }
+        struct pollfd espera = {.fd = p->fd, .events = POLLIN};
+        if (poll(&espera, 1, -1) == -1) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * Detener el puente (la cola ya se eliminó) y liberar sus recursos
+ */
+static void puente_cerrar(struct puente *p) {
+    if (p->fd != -1) {
+        // El hilo puede estar esperando hueco en el anillo lleno
+        pthread_mutex_lock(&p->mutex);
+        p->cerrando = 1;
+        pthread_cond_broadcast(&p->hueco);
+        pthread_mutex_unlock(&p->mutex);
+        pthread_join(p->hilo, NULL);
+        close(p->fd);
+        free(p->anillo);
+    }
+    pthread_mutex_destroy(&p->mutex);
+    pthread_cond_destroy(&p->hueco);
+}
+
+int chat_descriptor(struct chat_sesion *s) {
+    if (s->puente.fd != -1) {
+        return s->puente.fd;
+    }
+    if (s->hilos || s->canal) {
+        errno = s->canal ? EINVAL : EBUSY;  // La cola la consume chat_escuchar o el canal
+        return -1;
+    }
+    return puente_abrir(&s->puente, s->cola_privada, CAPACIDAD_PUENTE);
+}
+
+/* ==================== CONEXIÓN ==================== */
+
+/**
+ * Localizar el servidor (inicializa el estado del proceso la primera vez)
+ *
+ * @return Cola global, o -1 si el servidor no está ejecutándose
+ */
+static int buscar_servidor(void) {
+    pthread_mutex_lock(&mutex_proceso);
+    if (!inicializado) {
+        simd_inicializar();
+        key_global = ftok("/tmp", 'A');
+        inicializado = 1;
+    }
+    pthread_mutex_unlock(&mutex_proceso);
+
+    if (key_global == (key_t)-1) {
+        return -1;
+    }
+    int cola_global = msgget(key_global, 0666);
+    if (cola_global != -1 && !directorio) {
+        adjuntar_directorio();
+    }
+    return cola_global;
+}
+
+/**
+ * Crear una sesión sin cola todavía (la asigna chat_conectar o chat_conectar_en)
+ */
+static struct chat_sesion *nueva_sesion(const char *nombre, int cola_global) {
+    struct chat_sesion *s = calloc(1, sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    strncpy(s->nombre, nombre, MAX_NOMBRE - 1);
+    s->cola_global = cola_global;
+    s->cola_sala = -1;
+    s->siguiente_corr = 1;
+    s->semilla = (unsigned int)getpid() ^ (unsigned int)time(NULL) ^ (unsigned int)(size_t)s;
+    s->siguiente_largo = (unsigned int)rand_r(&s->semilla) | 1;
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_mutex_init(&s->mutex_entrega, NULL);
+    puente_iniciar(&s->puente);
+    return s;
+}
+
+/**
+ * Liberar una sesión cuya cola ya no se usa (eliminada o del canal)
+ */
+static void liberar_sesion(struct chat_sesion *s) {
+    puente_cerrar(&s->puente);
+    cache_cerrar(s->cache);
+    for (int i = 0; i < MAX_SALAS_SEGUIDAS; i++) {
+        free(s->seguimientos[i].espera);
+    }
+    for (int i = 0; i < MAX_ENSAMBLADOS; i++) {
+        free(s->ensamblados[i].datos);
+    }
+    free(s->envio.datos);
+    free(s->largo_entregado);
+    if (s->miembros) {
+        free(s->miembros->nombres);
+        free(s->miembros);
+    }
+    for (int i = 0; i < MAX_DICCIONARIOS; i++) {
+        if (s->diccionarios[i].datos) {
+            shmdt(s->diccionarios[i].datos);
+        }
+    }
+    pthread_mutex_destroy(&s->mutex);
+    pthread_mutex_destroy(&s->mutex_entrega);
+    free(s);
+}
+
+/**
+ * Registrar la sesión en el servidor (necesario para recibir privados)
+ *
+ * El servidor sólo responde si el nombre ya lo usa otro cliente: esa
+ * respuesta se entrega como CHAT_EV_CONEXION con estado ESTADO_ERROR.
+ *
+ * @return 0 si se envió, -1 si no (errno; ENOTCONN: se hará al reconectar)
+ */
+static int presentar_sesion(struct chat_sesion *s) {
+    struct mensaje msg;
+    pthread_mutex_lock(&s->mutex);
+    preparar(s, &msg, TIPO_CONNECT, NULL);
+    int r = solicitar(s, &msg, 0) ? 0 : -1;
+    s->corr_conexion = msg.corr;
+    pthread_mutex_unlock(&s->mutex);
+    return r;
+}
+
+struct chat_sesion *chat_conectar(const char *nombre) {
+    int cola_global = buscar_servidor();
+    if (cola_global == -1) {
+        return NULL;  // Servidor no está ejecutándose
+    }
+
+    struct chat_sesion *s = nueva_sesion(nombre, cola_global);
+    if (!s) {
+        return NULL;
+    }
+    s->cola_privada = msgget(IPC_PRIVATE, IPC_CREAT | 0666);
+    if (s->cola_privada == -1) {
+        int error = errno;
+        liberar_sesion(s);
+        errno = error;
+        return NULL;
+    }
+
+    presentar_sesion(s);
+    return s;
+}
+
+/**
+ * Sacar una sesión de su canal (tabla y lista de preparadas)
+ */
+static void salir_del_canal(struct chat_sesion *s) {
+    struct chat_canal *c = s->canal;
+    c->sesiones[s->id_canal] = NULL;
+    c->num_sesiones--;
+    if (!s->en_lista) {
+        return;
+    }
+    struct chat_sesion **p = &c->lista_ini;
+    struct chat_sesion *anterior = NULL;
+    while (*p != s) {
+        anterior = *p;
+        p = &(*p)->siguiente_lista;
+    }
+    *p = s->siguiente_lista;
+    if (c->lista_fin == s) {
+        c->lista_fin = anterior;
+    }
+}
+
+void chat_cerrar(struct chat_sesion *s) {
+    if (!s) {
+        return;
+    }
+
+    // Avisar al servidor para que retire la sesión de su índice
+    pthread_mutex_lock(&s->mutex);
+    struct mensaje msg;
+    preparar(s, &msg, TIPO_DISCONNECT, NULL);
+    enviar(s, &msg);
+    // Los lectores que aún tengan un adjunto proyectado lo conservan hasta soltarlo
+    while (s->num_adjuntos > 0) {
+        shmctl(s->adjuntos[s->adjunto_ini], IPC_RMID, NULL);
+        s->adjunto_ini = (s->adjunto_ini + 1) % CHAT_MAX_ADJUNTOS;
+        s->num_adjuntos--;
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    if (s->canal) {
+        // La cola es del canal: sólo se deja de repartirle mensajes
+        salir_del_canal(s);
+        liberar_sesion(s);
+        return;
+    }
+
+    // Eliminar la cola privada: el hilo receptor termina al recibir EIDRM
+    s->cerrando = 1;
+    msgctl(s->cola_privada, IPC_RMID, NULL);
+    if (s->hilos && !pthread_equal(pthread_self(), s->hilo_receptor) &&
+        !pthread_equal(pthread_self(), s->hilo_mantenimiento)) {
+        pthread_join(s->hilo_receptor, NULL);
+        pthread_join(s->hilo_mantenimiento, NULL);
+    } else if (s->hilos) {
+        return;  // Llamada desde un hilo propio: la memoria se libera al salir el proceso
+    }
+    liberar_sesion(s);
+}
+
+int chat_usar_cache(struct chat_sesion *s, const char *ruta) {
+    char ruta_defecto[PATH_MAX];
+    if (!ruta) {
+        // Una por usuario del sistema y del chat; '/' no puede ir en el nombre del archivo
+        char nombre[MAX_NOMBRE];
+        memcpy(nombre, s->nombre, MAX_NOMBRE);
+        for (char *c = nombre; *c; c++) {
+            if (*c == '/') {
+                *c = '_';
+            }
+        }
+        snprintf(ruta_defecto, sizeof(ruta_defecto), "/tmp/chat_%u_%s.cache",
+                 (unsigned int)getuid(), nombre);
+        ruta = ruta_defecto;
+    }
+
+    struct cache *c = cache_abrir(ruta);
+    if (!c) {
+        return -1;
+    }
+    pthread_mutex_lock(&s->mutex);
+    cache_cerrar(s->cache);
+    s->cache = c;
+    pthread_mutex_unlock(&s->mutex);
+    return 0;
+}
+
+int chat_cola(const struct chat_sesion *s) {
+    return s->cola_privada;
+}
+
+const char *chat_nombre(const struct chat_sesion *s) {
+    return s->nombre;
+}
+
+int chat_conectado(struct chat_sesion *s) {
+    pthread_mutex_lock(&s->mutex);
+    int conectado = !s->caido;
+    pthread_mutex_unlock(&s->mutex);
+    return conectado;
+}
+
+int chat_cola_servidor(const struct chat_sesion *s) {
+    return s->cola_global;
+}
+
+int chat_sala(struct chat_sesion *s, char *sala, int *observador) {
+    int obs;
+    pthread_mutex_lock(&s->mutex);
+    sala_objetivo(s, sala, &obs);
+    pthread_mutex_unlock(&s->mutex);
+    if (observador) {
+        *observador = obs;
+    }
+    return sala[0] != '\0';
+}
+
+/* ==================== SOLICITUDES ==================== */
+
+/**
+ * Solicitud que sólo lleva una sala (JOIN, OBSERVE, LEAVE, USERS, LIST)
+ */
+static unsigned int solicitud_de_sala(struct chat_sesion *s, long tipo, const char *sala, int anotar) {
+    struct mensaje msg;
+    pthread_mutex_lock(&s->mutex);
+
+    char objetivo[MAX_NOMBRE];
+    int observador;
+    if (!sala && tipo != TIPO_LIST) {
+        sala_objetivo(s, objetivo, &observador);
+        if (objetivo[0] == '\0') {
+            pthread_mutex_unlock(&s->mutex);
+            errno = ENOENT;
+            return 0;
+        }
+        sala = objetivo;
+    }
+
+    preparar(s, &msg, tipo, sala);
+    unsigned int corr = solicitar(s, &msg, anotar);
+    pthread_mutex_unlock(&s->mutex);
+    return corr;
+}
+
+unsigned int chat_unirse(struct chat_sesion *s, const char *sala) {
+    return solicitud_de_sala(s, TIPO_JOIN, sala, 1);
+}
+
+unsigned int chat_observar(struct chat_sesion *s, const char *sala) {
+    return solicitud_de_sala(s, TIPO_OBSERVE, sala, 1);
+}
+
+unsigned int chat_abandonar(struct chat_sesion *s) {
+    return solicitud_de_sala(s, TIPO_LEAVE, NULL, 1);
+}
+
+unsigned int chat_usuarios(struct chat_sesion *s) {
+    return solicitud_de_sala(s, TIPO_USERS, NULL, 0);
+}
+
+unsigned int chat_miembros(struct chat_sesion *s) {
+    pthread_mutex_lock(&s->mutex);
+    char sala[MAX_NOMBRE];
+    int observador;
+    sala_objetivo(s, sala, &observador);
+    if (sala[0] == '\0') {
+        pthread_mutex_unlock(&s->mutex);
+        errno = ENOENT;
+        return 0;
+    }
+    if (!s->miembros && !(s->miembros = calloc(1, sizeof(*s->miembros)))) {
+        pthread_mutex_unlock(&s->mutex);
+        errno = ENOMEM;
+        return 0;
+    }
+    struct lista_miembros *l = s->miembros;
+    if (strcmp(l->sala, sala) != 0) {
+        reiniciar_miembros(l, sala);
+    }
+
+    struct mensaje msg;
+    preparar(s, &msg, TIPO_MIEMBROS, sala);
+    msg.seq = l->version;  // El servidor sólo envía lo que cambió desde ella
+    unsigned int corr = solicitar(s, &msg, 0);
+    if (corr) {
+        l->pedida = time(NULL);
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return corr;
+}
+
+int chat_lista_miembros(struct chat_sesion *s, char (*nombres)[MAX_NOMBRE], int max, unsigned int *version) {
+    pthread_mutex_lock(&s->mutex);
+    const struct lista_miembros *l = s->miembros;
+    int num = 0;
+    unsigned int v = 0;
+    if (l && strcmp(l->sala, s->sala_actual) == 0) {
+        num = l->num;
+        v = l->version;
+        for (int i = 0; i < num && i < max; i++) {
+            memcpy(nombres[i], l->nombres[i], MAX_NOMBRE);
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+    if (version) {
+        *version = v;
+    }
+    return num;
+}
+
+unsigned int chat_listar(struct chat_sesion *s) {
+    return solicitud_de_sala(s, TIPO_LIST, NULL, 0);
+}
+
+unsigned int chat_filtrar(struct chat_sesion *s, const char *spec) {
+    struct mensaje msg;
+    char sala[MAX_NOMBRE];
+    int observador;
+
+    pthread_mutex_lock(&s->mutex);
+    sala_objetivo(s, sala, &observador);
+    if (sala[0] == '\0') {
+        pthread_mutex_unlock(&s->mutex);
+        errno = ENOENT;
+        return 0;
+    }
+    preparar(s, &msg, TIPO_FILTER, sala);
+    strncpy(msg.texto, spec, MAX_TEXTO - 1);
+    unsigned int corr = solicitar(s, &msg, 1);
+    pthread_mutex_unlock(&s->mutex);
+    return corr;
+}
+
+/* ==================== MENSAJES ==================== */
+
+int chat_enviar_lote(struct chat_sesion *s, const char *const textos[], int n) {
+    struct mensaje msg;
+    char sala[MAX_NOMBRE];
+    int observador;
+
+    pthread_mutex_lock(&s->mutex);
+    sala_objetivo(s, sala, &observador);
+    if (sala[0] == '\0' || observador) {
+        pthread_mutex_unlock(&s->mutex);
+        errno = observador ? EPERM : ENOENT;
+        return -1;
+    }
+
+    // La cola de destino se resuelve una vez por lote (misma sala)
+    preparar(s, &msg, TIPO_MSG, sala);
+    int qid = s->caido ? -1 : cola_destino(s, &msg);
+    int enviados = 0;
+    while (qid != -1 && enviados < n) {
+        strncpy(msg.texto, textos[enviados], MAX_TEXTO - 1);
+        if (msgsnd(qid, &msg, sizeof(msg) - sizeof(long), IPC_NOWAIT) == -1) {
+            if (errno == EINVAL || errno == EIDRM) {
+                enviar(s, &msg);  // Marca la caída y encola el aviso
+            }
+            break;
+        }
+        enviados++;
+    }
+    if (qid == -1) {
+        errno = ENOTCONN;
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return (enviados == 0 && n > 0) ? -1 : enviados;
+}
+
+int chat_enviar(struct chat_sesion *s, const char *texto) {
+    const char *textos[1] = {texto};
+    return chat_enviar_lote(s, textos, 1) == 1 ? 0 : -1;
+}
+
+int chat_enviar_largo(struct chat_sesion *s, const char *texto) {
+    size_t largo = strlen(texto);
+    if (largo < MAX_TEXTO && !strchr(texto, '\n') && texto[0] != '\001') {
+        return chat_enviar(s, texto);  // Cabe en un mensaje normal
+    }
+    if (largo > CHAT_MAX_LARGO) {
+        errno = E2BIG;
+        return -1;
+    }
+
+    char sala[MAX_NOMBRE];
+    int observador;
+    pthread_mutex_lock(&s->mutex);
+    sala_objetivo(s, sala, &observador);
+    if (sala[0] == '\0' || observador) {
+        pthread_mutex_unlock(&s->mutex);
+        errno = observador ? EPERM : ENOENT;
+        return -1;
+    }
+
+    // Un texto largo a la vez: primero lo que quede del anterior
+    continuar_envio_largo(s);
+    if (s->envio.datos) {
+        errno = s->caido ? ENOTCONN : EAGAIN;
+        pthread_mutex_unlock(&s->mutex);
+        return -1;
+    }
+    char *datos = malloc(largo + 1);
+    if (!datos) {
+        pthread_mutex_unlock(&s->mutex);
+        return -1;
+    }
+    memcpy(datos, texto, largo + 1);
+
+    struct envio_largo *e = &s->envio;
+    e->datos = datos;
+    e->largo = largo;
+    memcpy(e->sala, sala, MAX_NOMBRE);
+    e->id = s->siguiente_largo++;
+    if (e->id == 0) {
+        e->id = s->siguiente_largo++;  // 0 marca las entradas libres del receptor
+    }
+    e->parte = 1;
+    e->enviado = 0;
+    e->comprimido = 0;
+    e->dicc = 0;
+    e->partes = contar_fragmentos(e);
+    if (s->comprimir && largo >= UMBRAL_COMPRESION) {
+        pedir_diccionario(s, sala);  // Sirve a partir del siguiente si aún no se conoce
+        comprimir_envio(s, e);
+    }
+    continuar_envio_largo(s);
+    pthread_mutex_unlock(&s->mutex);
+    return 0;
+}
+
+void chat_comprimir(struct chat_sesion *s, int activar) {
+    pthread_mutex_lock(&s->mutex);
+    s->comprimir = activar ? 1 : 0;
+    if (s->comprimir && !s->es_observador) {
+        pedir_diccionario(s, s->sala_actual);
+    }
+    pthread_mutex_unlock(&s->mutex);
+}
+
+int chat_adjuntar(struct chat_sesion *s, const char *nombre, const void *datos, size_t tam) {
+    struct mensaje msg;
+    char sala[MAX_NOMBRE];
+    int observador;
+
+    pthread_mutex_lock(&s->mutex);
+    sala_objetivo(s, sala, &observador);
+    pthread_mutex_unlock(&s->mutex);
+    if (sala[0] == '\0' || observador) {
+        errno = observador ? EPERM : ENOENT;
+        return -1;
+    }
+
+    // La copia al segmento se hace sin el mutex: puede ser grande
+    int id = shmget(IPC_PRIVATE, tam ? tam : 1, IPC_CREAT | 0644);
+    if (id == -1) {
+        return -1;
+    }
+    void *p = shmat(id, NULL, 0);
+    if (p == (void *)-1) {
+        int error = errno;
+        shmctl(id, IPC_RMID, NULL);
+        errno = error;
+        return -1;
+    }
+    memcpy(p, datos, tam);
+    shmdt(p);
+
+    pthread_mutex_lock(&s->mutex);
+    preparar(s, &msg, TIPO_MSG, sala);
+    snprintf(msg.texto, MAX_TEXTO, FORMATO_ADJUNTO "%s", id, tam, nombre);
+    if (enviar(s, &msg) == -1) {
+        int error = errno;
+        pthread_mutex_unlock(&s->mutex);
+        shmctl(id, IPC_RMID, NULL);
+        errno = error;
+        return -1;
+    }
+    if (s->num_adjuntos == CHAT_MAX_ADJUNTOS) {
+        // Se retira el más antiguo (quien lo tenga proyectado lo conserva)
+        shmctl(s->adjuntos[s->adjunto_ini], IPC_RMID, NULL);
+        s->adjunto_ini = (s->adjunto_ini + 1) % CHAT_MAX_ADJUNTOS;
+        s->num_adjuntos--;
+    }
+    s->adjuntos[(s->adjunto_ini + s->num_adjuntos) % CHAT_MAX_ADJUNTOS] = id;
+    s->num_adjuntos++;
+    pthread_mutex_unlock(&s->mutex);
+    return 0;
+}
+
+const void *chat_adjunto_mapear(const struct chat_evento *ev) {
+    if (!ev->adjunto) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // El identificador pudo reutilizarse para otro segmento tras retirarse el adjunto
+    struct shmid_ds ds;
+    if (shmctl(ev->adjunto_id, IPC_STAT, &ds) == -1) {
+        return NULL;
+    }
+    if (ds.shm_segsz != (ev->adjunto_tam ? ev->adjunto_tam : 1)) {
+        errno = EIDRM;
+        return NULL;
+    }
+    void *p = shmat(ev->adjunto_id, NULL, SHM_RDONLY);
+    return (p == (void *)-1) ? NULL : p;
+}
+
+void chat_adjunto_soltar(const void *datos) {
+    if (datos) {
+        shmdt(datos);
+    }
+}
+
+int chat_privado(struct chat_sesion *s, const char *destino, const char *texto) {
+    struct mensaje msg;
+    pthread_mutex_lock(&s->mutex);
+    preparar(s, &msg, TIPO_DM, destino);  // En DM el campo sala contiene al destinatario
+    strncpy(msg.texto, texto, MAX_TEXTO - 1);
+    int r = enviar(s, &msg);
+    pthread_mutex_unlock(&s->mutex);
+    return r;
+}
+
+/* ==================== RECEPCIÓN ==================== */
+
+/**
+ * Tomar un evento ya preparado: avisos locales, historial guardado o
+ * retenidos que encadenan (el historial va antes que los nuevos)
+ *
+ * @return 1 si hay evento en ev, 0 si no
+ */
+static int evento_listo(struct chat_sesion *s, struct chat_evento *ev) {
+    if (s->num_avisos > 0) {
+        *ev = s->avisos[s->aviso_ini];
+        s->aviso_ini = (s->aviso_ini + 1) % MAX_AVISOS;
+        s->num_avisos--;
+        return 1;
+    }
+    if (s->historial_seq != 0 && siguiente_historial(s, ev)) {
+        return 1;
+    }
+    return liberar_retenido(s, ev);
+}
+
+/**
+ * Procesar un mensaje recibido en la cola privada
+ *
+ * @return 1 si produce un evento (en ev), 0 si no
+ */
+static int procesar_recibido(struct chat_sesion *s, const struct mensaje *msg, struct chat_evento *ev) {
+    if (msg->mtype == TIPO_CHAT) {
+        return recibir_chat(s, msg, ev);
+    }
+    if (msg->mtype == TIPO_BACKFILL) {
+        return recibir_backfill(s, msg, ev);
+    }
+    if (msg->mtype == TIPO_DICCIONARIO) {
+        if (strcmp(msg->sala, s->dicc_sala) == 0) {
+            s->dicc_huella = msg->seq;  // Se usa en los próximos textos largos
+        }
+        return 0;
+    }
+    if (msg->mtype == TIPO_MIEMBROS) {
+        // Sólo la última parte de una respuesta pedida con chat_miembros es un evento
+        if (aplicar_miembros(s, msg) == -1 || msg->corr == 0 || msg->estado != 0 ||
+            !s->miembros || strcmp(s->miembros->sala, msg->sala) != 0) {
+            return 0;
+        }
+        memset(ev, 0, sizeof(*ev));
+        ev->tipo = CHAT_EV_MIEMBROS;
+        ev->corr = msg->corr;
+        ev->estado = ESTADO_OK;
+        ev->seq = s->miembros->version;
+        memcpy(ev->sala, msg->sala, MAX_NOMBRE);
+        return 1;
+    }
+    if (msg->mtype == TIPO_PRESENCIA) {
+        aplicar_miembros(s, msg);  // Con hueco se piden los cambios; el evento se entrega igual
+    }
+
+    memset(ev, 0, sizeof(*ev));
+    memcpy(ev->remitente, msg->remitente, MAX_NOMBRE);
+    memcpy(ev->sala, msg->sala, MAX_NOMBRE);
+    memcpy(ev->texto, msg->texto, MAX_TEXTO);
+    if (msg->mtype == TIPO_RESP && msg->corr != 0 && msg->corr == s->corr_conexion) {
+        ev->tipo = CHAT_EV_CONEXION;  // El nombre ya está en uso: la sesión no debe seguir
+        ev->estado = msg->estado;
+    } else if (msg->mtype == TIPO_RESP) {
+        ev->tipo = CHAT_EV_RESPUESTA;
+        ev->corr = msg->corr;
+        ev->estado = msg->estado;
+        if (msg->corr != 0) {
+            aplicar_respuesta(s, msg);  // Confirmación (o rechazo) de una solicitud
+            if (!s->es_observador) {
+                pedir_diccionario(s, s->sala_actual);  // Recién unida a otra sala
+            }
+        }
+    } else if (msg->mtype == TIPO_PRIV) {
+        ev->tipo = CHAT_EV_PRIVADO;
+    } else if (msg->mtype == TIPO_PRESENCIA) {
+        ev->tipo = CHAT_EV_PRESENCIA;
+    } else {
+        // Tipos desconocidos o de extensiones futuras: se entregan como respuesta
+        ev->tipo = CHAT_EV_RESPUESTA;
+        snprintf(ev->texto, MAX_TEXTO, "[tipo %ld] %.*s", msg->mtype, MAX_TEXTO - 32, msg->texto);
+    }
+    return 1;
+}
+
+int chat_recibir(struct chat_sesion *s, struct chat_evento *ev, int esperar) {
+    struct mensaje msg;
+    if (s->canal) {
+        errno = EINVAL;  // La cola es compartida: se recibe con chat_canal_recibir
+        return -1;
+    }
+
+    while (1) {
+        // Un fragmento intermedio no es evento: se sigue con el siguiente preparado
+        pthread_mutex_lock(&s->mutex);
+        int listo;
+        do {
+            listo = evento_listo(s, ev);
+        } while (listo && !completar_evento(s, ev));
+        pthread_mutex_unlock(&s->mutex);
+        if (listo) {
+            return 1;
+        }
+
+        int r;
+        if (s->puente.fd != -1) {
+            r = puente_sacar(&s->puente, &msg, esperar);
+        } else {
+            r = (int)msgrcv(s->cola_privada, &msg, sizeof(msg) - sizeof(long), 0,
+                            esperar ? 0 : IPC_NOWAIT);
+        }
+        if (r == -1) {
+            if (errno == EINTR && esperar) {
+                continue;
+            }
+            return (errno == ENOMSG || errno == EINTR) ? 0 : -1;
+        }
+
+        pthread_mutex_lock(&s->mutex);
+        int producido = procesar_recibido(s, &msg, ev) && completar_evento(s, ev);
+        pthread_mutex_unlock(&s->mutex);
+        if (producido) {
+            return 1;
+        }
+    }
+}
+
+/**
+ * Entregar al manejador los avisos pendientes (hilo de mantenimiento)
+ */
+static void entregar_avisos(struct chat_sesion *s) {
+    struct chat_evento ev;
+    pthread_mutex_lock(&s->mutex_entrega);
+    while (1) {
+        pthread_mutex_lock(&s->mutex);
+        int hay = 0;
+        if (s->num_avisos > 0) {
+            ev = s->avisos[s->aviso_ini];
+            s->aviso_ini = (s->aviso_ini + 1) % MAX_AVISOS;
+            s->num_avisos--;
+            hay = 1;
+        }
+        pthread_mutex_unlock(&s->mutex);
+        if (!hay) {
+            break;
+        }
+        s->manejador(s, &ev, s->datos);
+    }
+    pthread_mutex_unlock(&s->mutex_entrega);
+}
+
+static void *hilo_receptor(void *arg) {
+    struct chat_sesion *s = arg;
+    struct chat_evento ev;
+
+    while (chat_recibir(s, &ev, 1) != -1) {
+        pthread_mutex_lock(&s->mutex_entrega);
+        s->manejador(s, &ev, s->datos);
+        pthread_mutex_unlock(&s->mutex_entrega);
+    }
+    return NULL;  // Cola privada eliminada (sesión cerrada)
+}
+
+static void *hilo_mantenimiento(void *arg) {
+    struct chat_sesion *s = arg;
+
+    while (!s->cerrando) {
+        usleep(PERIODO_MANTENIMIENTO_MS * 1000);
+        chat_mantener(s);
+        entregar_avisos(s);
+    }
+    return NULL;
+}
+
+int chat_escuchar(struct chat_sesion *s, chat_manejador manejador, void *datos) {
+    if (s->puente.fd != -1 || s->canal) {
+        errno = s->canal ? EINVAL : EBUSY;  // La cola la consume el puente o el canal
+        return -1;
+    }
+    s->manejador = manejador;
+    s->datos = datos;
+    if (pthread_create(&s->hilo_receptor, NULL, hilo_receptor, s) != 0) {
+        return -1;
+    }
+    if (pthread_create(&s->hilo_mantenimiento, NULL, hilo_mantenimiento, s) != 0) {
+        s->cerrando = 1;
+        msgctl(s->cola_privada, IPC_RMID, NULL);
+        pthread_join(s->hilo_receptor, NULL);
+        return -1;
+    }
+    s->hilos = 1;
+    return 0;
+}
+
+/* ==================== CANAL COMPARTIDO ==================== */
+
+struct chat_canal *chat_canal_crear(void) {
+    int cola_global = buscar_servidor();
+    if (cola_global == -1) {
+        return NULL;  // Servidor no está ejecutándose
+    }
+
+    struct chat_canal *c = calloc(1, sizeof(*c));
+    if (!c) {
+        return NULL;
+    }
+    c->sesiones = calloc(SESIONES_CANAL_INICIAL, sizeof(*c->sesiones));
+    c->cola = msgget(IPC_PRIVATE, IPC_CREAT | 0666);
+    if (!c->sesiones || c->cola == -1) {
+        int error = errno;
+        free(c->sesiones);
+        free(c);
+        errno = error;
+        return NULL;
+    }
+    c->capacidad = SESIONES_CANAL_INICIAL;
+    c->siguiente_id = 1;
+    c->cola_global = cola_global;
+    puente_iniciar(&c->puente);
+
+    // Una cola para muchas sesiones: se amplía si el sistema lo permite
+    // (sin privilegios el máximo es msgmnb; si no, se queda como está)
+    struct msqid_ds info;
+    if (msgctl(c->cola, IPC_STAT, &info) == 0 && info.msg_qbytes < BYTES_COLA_CANAL) {
+        info.msg_qbytes = BYTES_COLA_CANAL;
+        msgctl(c->cola, IPC_SET, &info);
+    }
+    return c;
+}
+
+/**
+ * Reservar un número de canal para una sesión (duplica la tabla si está llena)
+ *
+ * Se busca a partir del último asignado, para que un número liberado no
+ * se reutilice enseguida: las respuestas tardías a la sesión anterior no
+ * deben llegarle a la nueva.
+ *
+ * @return Número asignado (>= 1), o 0 si no hay memoria
+ */
+static int asignar_canal(struct chat_canal *c, struct chat_sesion *s) {
+    if (c->num_sesiones == c->capacidad - 1) {
+        struct chat_sesion **tabla = realloc(c->sesiones, 2 * c->capacidad * sizeof(*tabla));
+        if (!tabla) {
+            return 0;
+        }
+        memset(tabla + c->capacidad, 0, c->capacidad * sizeof(*tabla));
+        c->siguiente_id = c->capacidad;
+        c->sesiones = tabla;
+        c->capacidad *= 2;
+    }
+
+    int id = c->siguiente_id;
+    while (c->sesiones[id]) {
+        id = (id + 1 < c->capacidad) ? id + 1 : 1;
+    }
+    c->sesiones[id] = s;
+    c->num_sesiones++;
+    c->siguiente_id = (id + 1 < c->capacidad) ? id + 1 : 1;
+    return id;
+}
+
+struct chat_sesion *chat_conectar_en(struct chat_canal *c, const char *nombre) {
+    struct chat_sesion *s = nueva_sesion(nombre, c->cola_global);
+    if (!s) {
+        return NULL;
+    }
+    s->id_canal = asignar_canal(c, s);
+    if (s->id_canal == 0) {
+        liberar_sesion(s);
+        errno = ENOMEM;
+        return NULL;
+    }
+    s->canal = c;
+    s->cola_privada = c->cola;
+    s->caido = c->caido;  // Si el servidor está caído se presentará al reconectar
+    s->espera_ms = ESPERA_MIN_MS;
+
+    // Al conectar muchas seguidas la cola del servidor se llena: sin el
+    // CONNECT la sesión no recibiría privados, así que el llamador reintenta
+    if (presentar_sesion(s) == -1 && errno == EAGAIN) {
+        salir_del_canal(s);
+        liberar_sesion(s);
+        errno = EAGAIN;
+        return NULL;
+    }
+    return s;
+}
+
+int chat_canal_descriptor(struct chat_canal *c) {
+    if (c->puente.fd != -1) {
+        return c->puente.fd;
+    }
+    return puente_abrir(&c->puente, c->cola, CAPACIDAD_PUENTE_CANAL);
+}
+
+int chat_canal_recibir(struct chat_canal *c, struct chat_sesion **sesion,
+                       struct chat_evento *ev, int esperar) {
+    struct mensaje msg;
+
+    while (1) {
+        // Primero las sesiones que ya tienen algo preparado
+        while (c->lista_ini) {
+            struct chat_sesion *s = c->lista_ini;
+            c->lista_ini = s->siguiente_lista;
+            if (!c->lista_ini) {
+                c->lista_fin = NULL;
+            }
+            s->en_lista = 0;
+
+            pthread_mutex_lock(&s->mutex);
+            int listo = evento_listo(s, ev);
+            if (listo) {
+                marcar_preparada(s);  // Puede tener más: se vuelve a mirar después
+                listo = completar_evento(s, ev);
+            }
+            pthread_mutex_unlock(&s->mutex);
+            if (listo) {
+                *sesion = s;
+                return 1;
+            }
+        }
+
+        int r;
+        if (c->puente.fd != -1) {
+            r = puente_sacar(&c->puente, &msg, esperar);
+        } else {
+            r = (int)msgrcv(c->cola, &msg, sizeof(msg) - sizeof(long), 0, esperar ? 0 : IPC_NOWAIT);
+        }
+        if (r == -1) {
+            if (errno == EINTR && esperar) {
+                continue;
+            }
+            return (errno == ENOMSG || errno == EINTR) ? 0 : -1;
+        }
+
+        // Demultiplexar: mtype = tipo + canal * CANAL_BASE
+        long id = msg.mtype / CANAL_BASE;
+        msg.mtype %= CANAL_BASE;
+        struct chat_sesion *s = (id > 0 && id < c->capacidad) ? c->sesiones[id] : NULL;
+        if (!s) {
+            continue;  // Sesión ya cerrada
+        }
+
+        pthread_mutex_lock(&s->mutex);
+        int producido = procesar_recibido(s, &msg, ev) && completar_evento(s, ev);
+        if (msg.mtype == TIPO_BACKFILL) {
+            marcar_preparada(s);  // Puede haber retenidos que ya encadenan
+        }
+        pthread_mutex_unlock(&s->mutex);
+        if (producido) {
+            *sesion = s;
+            return 1;
+        }
+    }
+}
+
+void chat_canal_mantener(struct chat_canal *c) {
+    // Una sola comprobación del servidor para todas las sesiones
+    if (!c->caido && servidor_caido(c->cola_global)) {
+        c->caido = 1;
+    }
+    if (c->caido) {
+        int qid = msgget(key_global, 0666);
+        if (qid != -1 && !servidor_caido(qid)) {
+            c->cola_global = qid;
+            c->caido = 0;
+            adjuntar_directorio();
+        }
+    }
+
+    // Cada sesión reconecta con su propia espera (con jitter): tras un
+    // reinicio no se presentan todas a la vez
+    for (int i = 1; i < c->capacidad; i++) {
+        if (c->sesiones[i]) {
+            chat_mantener(c->sesiones[i]);
+        }
+    }
+}
+
+void chat_canal_cerrar(struct chat_canal *c) {
+    if (!c) {
+        return;
+    }
+    for (int i = 1; i < c->capacidad; i++) {
+        if (c->sesiones[i]) {
+            chat_cerrar(c->sesiones[i]);
+        }
+    }
+    msgctl(c->cola, IPC_RMID, NULL);  // El hilo puente termina al recibir EIDRM
+    puente_cerrar(&c->puente);
+    free(c->sesiones);
+    free(c);
+}
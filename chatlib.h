@@ -0,0 +1,202 @@
+/*
+ * chatlib.h - Biblioteca cliente del chat multi-sala
+ *
+ * Toda la lógica de cliente que antes vivía en cliente.c (conexión,
+ * envío directo al nodo dueño en un cluster, entrega ordenada con
+ * BACKFILL, solicitudes correlacionadas y reconexión) separada de la
+ * terminal, para que bots e integraciones la usen sin raspar la salida.
+ *
+ * Modelo de uso:
+ * - Ninguna llamada de envío bloquea: si la cola del servidor está llena
+ *   devuelve error con errno = EAGAIN y el llamador decide si reintenta.
+ * - Las solicitudes que cambian el estado (unirse, observar, abandonar,
+ *   filtrar) devuelven su correlación; la respuesta llega como evento
+ *   CHAT_EV_RESPUESTA con el mismo corr. Pueden tenerse muchas en vuelo.
+ * - Recepción por sondeo (chat_recibir), desde un bucle de eventos con
+ *   poll (chat_descriptor + chat_recibir) o por manejador (chat_escuchar,
+ *   que además lanza el hilo de mantenimiento).
+ * - En modo sondeo hay que llamar a chat_mantener periódicamente (por
+ *   ejemplo cada 100 ms): detecta la caída del servidor, reconecta con
+ *   espera exponencial y caduca las solicitudes sin respuesta.
+ *
+ * Una sesión es un usuario con su propia cola privada; un proceso puede
+ * abrir varias. Para simular miles de usuarios en un solo proceso, las
+ * sesiones de un canal (chat_canal_crear + chat_conectar_en) comparten
+ * una única cola de recepción y un único bucle de eventos.
+ */
+
+#ifndef CHATLIB_H
+#define CHATLIB_H
+
+#include <stddef.h>       // size_t
+#include "protocolo.h"    // MAX_NOMBRE, MAX_TEXTO, ESTADO_*
+
+#define CHAT_MAX_LARGO 16384         // Texto máximo de chat_enviar_largo (más: chat_adjuntar)
+#define CHAT_MAX_ADJUNTOS 16         // Adjuntos enviados que siguen disponibles por sesión
+
+/* ==================== EVENTOS ==================== */
+#define CHAT_EV_MENSAJE    1   // Mensaje de una sala (en orden de secuencia)
+#define CHAT_EV_PRIVADO    2   // Mensaje privado de otro usuario
+#define CHAT_EV_RESPUESTA  3   // Respuesta del servidor (corr != 0: confirma una solicitud)
+#define CHAT_EV_AVISO      4   // Aviso local (mensajes perdidos, solicitud sin respuesta)
+#define CHAT_EV_CONEXION   5   // Cambio de conexión (caída, reconexión; ESTADO_ERROR: nombre en uso)
+#define CHAT_EV_PRESENCIA  6   // Altas y bajas de la sala, agrupadas (texto "+Ana -Bob")
+#define CHAT_EV_MIEMBROS   7   // Lista de miembros pedida con chat_miembros (seq = versión)
+
+/**
+ * Evento entregado a la aplicación
+ */
+struct chat_evento {
+    int tipo;                       // CHAT_EV_*
+    unsigned int corr;              // RESPUESTA: correlación de la solicitud (0 = espontánea)
+    int estado;                     // RESPUESTA / CONEXION: ESTADO_OK o ESTADO_ERROR
+    unsigned int seq;               // MENSAJE: número de secuencia en la sala; MIEMBROS: versión
+    int mencion;                    // MENSAJE: 1 si menciona "@usuario" de esta sesión
+    int historial;                  // MENSAJE: 1 si viene de la caché local (ya recibido antes)
+    char remitente[MAX_NOMBRE];     // MENSAJE / PRIVADO: autor
+    char sala[MAX_NOMBRE];          // MENSAJE / RESPUESTA / PRESENCIA / MIEMBROS: sala
+    char texto[MAX_TEXTO];          // Contenido (adjunto: nombre del archivo)
+    const char *texto_largo;        // MENSAJE en fragmentos o MIEMBROS: texto completo (NULL
+                                    // si cabe en texto); válido hasta la siguiente recepción
+    size_t largo;                   // Bytes de texto_largo
+    int adjunto;                    // MENSAJE: 1 si es un adjunto en memoria compartida
+    int adjunto_id;                 // Segmento del adjunto (chat_adjunto_mapear)
+    size_t adjunto_tam;             // Bytes del adjunto
+};
+
+struct chat_sesion;                 // Opaca: ver chatlib.c
+struct chat_canal;                  // Opaca: cola de recepción compartida por varias sesiones
+
+/* Manejador de eventos de chat_escuchar (se llama desde los hilos de la biblioteca) */
+typedef void (*chat_manejador)(struct chat_sesion *s, const struct chat_evento *ev, void *datos);
+
+/* ==================== CONEXIÓN ==================== */
+
+/* Conecta un usuario al servidor (o cluster). NULL si no hay servidor o error (errno).
+ * Si otro cliente ya usa el nombre llega un CHAT_EV_CONEXION con estado ESTADO_ERROR */
+struct chat_sesion *chat_conectar(const char *nombre);
+
+/* Cierra la sesión: avisa al servidor, elimina la cola privada, detiene hilos y libera */
+void chat_cerrar(struct chat_sesion *s);
+
+/* Guarda los mensajes de sala en una caché local (ruta NULL: /tmp/chat_<uid>_<nombre>.cache).
+ * Al volver a unirse a una sala se entregan primero los guardados (con
+ * historial = 1) y sólo se pide al servidor lo posterior. 0 si éxito, -1 (errno) */
+int chat_usar_cache(struct chat_sesion *s, const char *ruta);
+
+/* Cola privada de la sesión (para esperarla con el bucle de eventos de la aplicación) */
+int chat_cola(const struct chat_sesion *s);
+
+/* Nombre de usuario de la sesión */
+const char *chat_nombre(const struct chat_sesion *s);
+
+/* 1 si el servidor está disponible, 0 mientras se reintenta la conexión */
+int chat_conectado(struct chat_sesion *s);
+
+/* Cola global del servidor a la que está conectada la sesión */
+int chat_cola_servidor(const struct chat_sesion *s);
+
+/* Sala a la que van los mensajes: 1 si hay sala (copiada en sala), 0 si no */
+int chat_sala(struct chat_sesion *s, char *sala, int *observador);
+
+/* Miembros de la sala actual según la última versión recibida (hasta max copiados en
+ * nombres): devuelve cuántos hay, 0 si aún no se pidieron con chat_miembros */
+int chat_lista_miembros(struct chat_sesion *s, char (*nombres)[MAX_NOMBRE], int max, unsigned int *version);
+
+/* ==================== SOLICITUDES (devuelven corr, 0 si error) ==================== */
+unsigned int chat_unirse(struct chat_sesion *s, const char *sala);
+unsigned int chat_observar(struct chat_sesion *s, const char *sala);
+unsigned int chat_abandonar(struct chat_sesion *s);
+unsigned int chat_filtrar(struct chat_sesion *s, const char *spec);
+unsigned int chat_usuarios(struct chat_sesion *s);
+/* Miembros de la sala actual como CHAT_EV_MIEMBROS (texto "Ana, Bob"). La primera vez
+ * llega la lista completa; después sólo lo que cambió desde la versión conocida, y los
+ * PRESENCIA la mantienen al día sin volver a pedirla */
+unsigned int chat_miembros(struct chat_sesion *s);
+unsigned int chat_listar(struct chat_sesion *s);
+
+/* ==================== MENSAJES (0 si éxito, -1 si error con errno) ==================== */
+
+/* Mensaje a la sala actual (ENOENT sin sala, EPERM si sólo se observa) */
+int chat_enviar(struct chat_sesion *s, const char *texto);
+
+/* Varios mensajes seguidos a la sala actual: devuelve cuántos se enviaron */
+int chat_enviar_lote(struct chat_sesion *s, const char *const textos[], int n);
+
+/* Texto de cualquier longitud (hasta CHAT_MAX_LARGO, con saltos de línea) a
+ * la sala actual. Si no cabe en un mensaje se parte en fragmentos que el
+ * receptor vuelve a unir en un solo evento (texto_largo). Lo que no quepa
+ * en la cola del servidor lo sigue enviando chat_mantener; con otro texto
+ * largo aún a medias devuelve EAGAIN (E2BIG si supera CHAT_MAX_LARGO) */
+int chat_enviar_largo(struct chat_sesion *s, const char *texto);
+
+/* Activa (1) o desactiva (0) la compresión de los textos largos de la
+ * sesión. Los de al menos 512 bytes se comprimen con el diccionario que el
+ * servidor entrena en cada sala, sólo si así ocupan menos fragmentos. Los
+ * receptores descomprimen siempre, esté activa o no */
+void chat_comprimir(struct chat_sesion *s, int activar);
+
+/* Adjunto a la sala actual: los datos se copian a un segmento de memoria
+ * compartida y por la cola sólo viaja su identificador. El segmento vive
+ * hasta chat_cerrar o hasta que la sesión envía CHAT_MAX_ADJUNTOS más */
+int chat_adjuntar(struct chat_sesion *s, const char *nombre, const void *datos, size_t tam);
+
+/* Proyecta el adjunto de un evento en sólo lectura, sin copiarlo. NULL si
+ * ya no existe (el remitente cerró su sesión) o error (errno) */
+const void *chat_adjunto_mapear(const struct chat_evento *ev);
+
+/* Deshace la proyección de chat_adjunto_mapear */
+void chat_adjunto_soltar(const void *datos);
+
+/* Mensaje privado a otro usuario */
+int chat_privado(struct chat_sesion *s, const char *destino, const char *texto);
+
+/* ==================== RECEPCIÓN ==================== */
+
+/* Siguiente evento: 1 si hay (en ev), 0 si no (esperar = 0), -1 si error */
+int chat_recibir(struct chat_sesion *s, struct chat_evento *ev, int esperar);
+
+/* Lanza el hilo receptor (llama a manejador) y el de mantenimiento. 0 si éxito */
+int chat_escuchar(struct chat_sesion *s, chat_manejador manejador, void *datos);
+
+/* Mantenimiento: caída del servidor, reconexión y solicitudes caducadas */
+void chat_mantener(struct chat_sesion *s);
+
+/* Descriptor pollable (eventfd) para un bucle de eventos propio: se vuelve
+ * legible cuando chat_recibir tiene algo que entregar. Un hilo puente sólo
+ * copia los mensajes de la cola privada; el estado de la sesión se
+ * actualiza en el hilo que llama a chat_recibir. Excluyente con
+ * chat_escuchar. -1 si error (errno) */
+int chat_descriptor(struct chat_sesion *s);
+
+/* ==================== CANAL (VARIAS SESIONES, UNA COLA) ==================== */
+/*
+ * Todas las sesiones de un canal reciben en la misma cola; el servidor
+ * marca cada mensaje con el número de la sesión (MTYPE_CANAL) y
+ * chat_canal_recibir lo reparte. Las solicitudes y envíos son los de
+ * siempre sobre cada sesión; chat_recibir, chat_escuchar y
+ * chat_descriptor no se usan con ellas (EINVAL). Un canal y sus sesiones
+ * se usan desde un solo hilo. Las sesiones de un canal no pueden observar
+ * salas (el servidor identifica a los observadores sólo por su cola).
+ */
+
+/* Crea un canal (una cola privada compartida). NULL si no hay servidor o error */
+struct chat_canal *chat_canal_crear(void);
+
+/* Conecta un usuario más dentro del canal. NULL si error (errno; EAGAIN:
+ * la cola del servidor está llena, reintentar) */
+struct chat_sesion *chat_conectar_en(struct chat_canal *c, const char *nombre);
+
+/* Descriptor pollable (eventfd) del canal, como chat_descriptor. -1 si error */
+int chat_canal_descriptor(struct chat_canal *c);
+
+/* Siguiente evento de cualquier sesión del canal (la sesión en *s): 1, 0 o -1 */
+int chat_canal_recibir(struct chat_canal *c, struct chat_sesion **s, struct chat_evento *ev, int esperar);
+
+/* Mantenimiento de todas las sesiones: comprueba el servidor una vez por canal */
+void chat_canal_mantener(struct chat_canal *c);
+
+/* Cierra todas las sesiones del canal (chat_cerrar) y elimina su cola */
+void chat_canal_cerrar(struct chat_canal *c);
+
+#endif /* CHATLIB_H */
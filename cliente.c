@@ -11,376 +11,1513 @@
  * - Envío y recepción de mensajes en tiempo real
  * - Listado de salas disponibles
  * - Visualización de usuarios en sala actual
+ * - Resaltado de menciones "@usuario" en mensajes recibidos
+ * - Mensajes privados directos entre usuarios (sin sala)
  * - Manejo multi-hilo para recepción asíncrona
  * - Limpieza automática de recursos
  * 
- * Uso: ./cliente <nombre_usuario>
+ * La conexión, el envío al nodo dueño de cada sala, la entrega ordenada
+ * con BACKFILL, las solicitudes correlacionadas y la reconexión viven en
+ * la biblioteca chatlib (chatlib.h); este programa sólo traduce comandos
+ * de la terminal a llamadas de la biblioteca y muestra sus eventos.
+ * 
+ * Uso: ./cliente [-b] [-e] [-z] [-f <archivo>] [-w <segundos>] <nombre_usuario>
+ *      ./cliente -t [-z] <nombre_usuario>
+ *      ./cliente -n <sesiones> [-m <mensajes>] [-w <segundos>] <prefijo>
+ * 
+ * Modo sin terminal (-b, o -f para leer de un archivo): lee comandos y
+ * mensajes línea a línea sin prompts ni banners, envía los mensajes
+ * consecutivos en lotes y escribe lo recibido en líneas separadas por
+ * tabuladores (ver emitir_evento). -w mantiene la recepción unos segundos
+ * tras el fin de la entrada.
+ * 
+ * Con -e la entrada y el servidor se atienden en un único bucle de
+ * eventos con poll (ver modo_bucle_eventos), en lugar de los hilos de
+ * recepción de la biblioteca.
+ * 
+ * Con -t la terminal se usa a pantalla completa (ver pantalla.h):
+ * historial desplazable, barra de estado y una línea de entrada que los
+ * mensajes entrantes no pisan, redibujada como mucho 30 veces por segundo.
+ * 
+ * Con -z los textos largos (/pegar, líneas de más de un mensaje) de al
+ * menos 512 bytes se envían comprimidos con el diccionario de la sala
+ * (ver chat_comprimir). Los comprimidos se leen siempre, con -z o sin él.
+ * 
+ * Con -n el proceso simula muchos usuarios (<prefijo>1 .. <prefijo>N)
+ * que comparten una sola cola de recepción y un bucle de eventos (ver
+ * modo_carga): cada uno envía -m privados al siguiente y al final se
+ * resume cuántos llegaron. Sirve para pruebas de capacidad sin lanzar
+ * un proceso (y una cola) por usuario.
  * 
  * Comandos disponibles:
  * - join <sala>    : Unirse a una sala de chat
+ * - /observar <sala> : Observar una sala en modo sólo lectura
  * - /leave         : Abandonar la sala actual
  * - /list          : Mostrar todas las salas disponibles
  * - /users         : Mostrar usuarios en la sala actual
- * - <mensaje>      : Enviar mensaje a la sala actual
+ * - /msg <usuario> <texto> : Enviar mensaje privado a un usuario
+ * - /filtro <spec> : Filtrar mensajes de la sala (todo | menciones |
+ *                    palabras a,b,c | de ana,bob)
+ * - /pegar         : Enviar como un solo mensaje las líneas siguientes
+ *                    (hasta una línea con sólo ".")
+ * - /adjuntar <archivo> : Compartir un archivo por memoria compartida
+ * - /guardar [ruta]: Guardar el último adjunto recibido
+ * - <mensaje>      : Enviar mensaje a la sala actual (si no cabe en un
+ *                    mensaje, la biblioteca lo envía en fragmentos)
  * - Ctrl+C         : Salir del cliente
  */
 
 #include <stdio.h>        // entrada/salida estándar
 #include <stdlib.h>       // funciones de utilidad general
 #include <string.h>       // manipulación de strings
-#include <sys/types.h>    // tipos de datos del sistema
-#include <sys/ipc.h>      // comunicación entre procesos
-#include <sys/msg.h>      // colas de mensajes System V
-#include <unistd.h>       // funciones estándar de Unix
-#include <pthread.h>      // hilos POSIX para recepción asíncrona
+#include <stdarg.h>       // argumentos variables (informar, error_comando)
+#include <pthread.h>      // máscara de señales de los hilos
 #include <signal.h>       // manejo de señales del sistema
+#include <unistd.h>       // usleep, getopt, read
+#include <poll.h>         // poll (cliente de un solo hilo, -e)
 #include <errno.h>        // códigos de error del sistema
+#include <time.h>         // clock_gettime (mantenimiento del bucle de eventos)
+#include <fcntl.h>        // open (adjuntos)
+#include <sys/mman.h>     // mmap del archivo a adjuntar
+#include <sys/stat.h>     // fstat
 
-/* ==================== CONSTANTES Y CONFIGURACIÓN ==================== */
-#define MAX_TEXTO 256                   // Longitud máxima de un mensaje de texto
-#define MAX_NOMBRE 50                   // Longitud máxima para nombres de usuario y salas
-
-/* ==================== ESTRUCTURAS DE DATOS ==================== */
+#include "chatlib.h"      // biblioteca cliente (sesión, eventos, solicitudes)
+#include "pantalla.h"     // interfaz a pantalla completa (-t)
 
-/**
- * Estructura de mensaje para comunicación cliente-servidor
- * 
- * Esta estructura debe coincidir exactamente con la del servidor para
- * garantizar compatibilidad en la comunicación mediante colas de mensajes.
- * 
- * Tipos de mensaje soportados:
- * - mtype 1 (JOIN): Solicitud para unirse a una sala
- * - mtype 2 (RESP): Respuesta del servidor (confirmaciones/errores)
- * - mtype 3 (MSG):  Mensaje de chat para distribuir en sala
- * - mtype 4 (CHAT): Mensaje distribuido por el servidor
- * - mtype 5 (LEAVE): Solicitud para abandonar sala actual
- * - mtype 6 (USERS): Solicitud de lista de usuarios en sala
- * - mtype 7 (LIST): Solicitud de lista de salas disponibles
- */
-struct mensaje {
-    long mtype;                     // Tipo de mensaje (ver descripción arriba)
-    int reply_qid;                  // ID de cola privada del cliente (para respuestas)
-    char remitente[MAX_NOMBRE];     // Nombre del usuario que envía el mensaje
-    char texto[MAX_TEXTO];          // Contenido del mensaje de chat
-    char sala[MAX_NOMBRE];          // Nombre de la sala objetivo/actual
-};
+/* ==================== CONSTANTES ==================== */
+#define LOTE_SIN_TERMINAL 64            // Mensajes consecutivos por lote en modo -b
+#define BUFFER_ENTRADA (1 << 16)        // Buffer de lectura de la entrada en modo -b
+#define PERIODO_BUCLE_MS 100            // Espera máxima del bucle de eventos (-e) entre mantenimientos
+#define ENVIOS_POR_VUELTA 256           // Envíos de la prueba de carga (-n) entre recepciones
+#define ESPERA_CARGA 5                  // Segundos por defecto esperando lo que falta tras enviar (-n)
+#define EVENTOS_POR_VUELTA 1024         // Eventos procesados entre lecturas del teclado (-t)
+#define MAX_LINEA (CHAT_MAX_LARGO + 2)  // Línea de entrada más larga (texto, '\n' y '\0')
 
 /* ==================== VARIABLES GLOBALES ==================== */
-int cola_global = -1;               // ID de la cola global del servidor
-int cola_privada = -1;              // ID de la cola privada de este cliente
+struct chat_sesion *sesion = NULL;  // Sesión con el servidor
 char nombre_usuario[MAX_NOMBRE];    // Nombre del usuario actual (del argumento de línea de comandos)
-char sala_actual[MAX_NOMBRE] = "";  // Nombre de la sala en la que está conectado el usuario
+volatile sig_atomic_t terminar = 0; // 1 tras Ctrl+C: el bucle principal sale y limpia
+volatile sig_atomic_t nombre_en_uso = 0;  // 1 si el servidor rechazó el nombre (otro cliente lo usa)
+int sin_terminal = 0;               // 1 en modo -b: sin prompts, salida legible por máquina
+int con_pantalla = 0;               // 1 en modo -t: todo se muestra a través de pantalla.c
+char lote[LOTE_SIN_TERMINAL][MAX_TEXTO];  // Mensajes consecutivos pendientes (modo -b)
+int num_lote = 0;                   // Mensajes en el lote
+char *pegado = NULL;                // Texto de /pegar en curso (NULL = no se está pegando)
+size_t largo_pegado = 0;            // Bytes acumulados en pegado
+int pegado_excedido = 0;            // 1 si lo pegado superó CHAT_MAX_LARGO
+struct chat_evento ultimo_adjunto;  // Último adjunto recibido (para /guardar)
+int hay_adjunto = 0;                // 1 si ultimo_adjunto es válido
+pthread_mutex_t mutex_adjunto = PTHREAD_MUTEX_INITIALIZER;  // Lo usan el receptor y los comandos
 
 /* ==================== FUNCIONES DE UTILIDAD ==================== */
 
 /**
- * Función de limpieza y terminación del cliente
+ * Manejador de SIGINT (Ctrl+C)
+ * 
+ * Sólo marca la salida: la lectura de la terminal se interrumpe (EINTR)
+ * y el bucle principal cierra la sesión fuera del manejador de señal.
+ * 
+ * @param signo Número de la señal recibida
+ */
+void pedir_salida(int signo) {
+    (void)signo;
+    terminar = 1;
+}
+
+/**
+ * Terminar el cliente si el servidor rechazó su nombre
+ * 
+ * Los eventos llegan en los hilos de la biblioteca, que tienen SIGINT
+ * bloqueada: la señal al proceso la atiende el hilo principal e
+ * interrumpe su lectura, como un Ctrl+C.
+ * 
+ * @param ev Evento recibido
+ */
+void salir_si_nombre_en_uso(const struct chat_evento *ev) {
+    if (ev->tipo == CHAT_EV_CONEXION && ev->estado == ESTADO_ERROR) {
+        nombre_en_uso = 1;
+        kill(getpid(), SIGINT);
+    }
+}
+
+/**
+ * Mostrar un mensaje informativo (sólo en modo interactivo)
+ * 
+ * @param formato Formato del texto (como printf)
+ */
+void informar(const char *formato, ...) {
+    if (sin_terminal) {
+        return;
+    }
+    va_list args;
+    va_start(args, formato);
+    if (con_pantalla) {
+        char texto[MAX_TEXTO * 2];
+        vsnprintf(texto, sizeof(texto), formato, args);
+        pantalla_escribir(PANTALLA_INFO, texto);
+    } else {
+        vprintf(formato, args);
+    }
+    va_end(args);
+}
+
+/**
+ * Mostrar un error de uso de un comando
+ * 
+ * En modo sin terminal va a stderr, para no mezclarse con los eventos.
+ * 
+ * @param formato Formato del texto (como printf)
+ */
+void error_comando(const char *formato, ...) {
+    va_list args;
+    va_start(args, formato);
+    if (con_pantalla) {
+        char texto[MAX_TEXTO * 2];
+        vsnprintf(texto, sizeof(texto), formato, args);
+        pantalla_escribir(PANTALLA_AVISO, texto);
+    } else {
+        vfprintf(sin_terminal ? stderr : stdout, formato, args);
+    }
+    va_end(args);
+}
+
+/**
+ * Decidir si reintentar un envío que falló
  * 
- * Esta función se ejecuta cuando el cliente recibe SIGINT (Ctrl+C) o
- * cuando termina normalmente. Se encarga de limpiar los recursos del
- * sistema (cola privada) para evitar dejar recursos huérfanos.
+ * La biblioteca nunca bloquea: con la cola del servidor llena devuelve
+ * EAGAIN y, mientras reconecta, ENOTCONN. La terminal espera un momento
+ * y reintenta, para no perder lo que escribe el usuario. La reconexión
+ * se impulsa desde aquí: con -e no hay otro hilo que la haga.
  * 
- * @param signo Número de la señal recibida (0 para terminación normal)
+ * @param error Mensaje a mostrar si el error es definitivo
+ * @return 1 si hay que reintentar, 0 si el error es definitivo (ya mostrado)
  */
-void limpiar_y_salir(int signo) {
-    // Eliminar cola privada si fue creada exitosamente
-    if (cola_privada != -1) {
-        msgctl(cola_privada, IPC_RMID, NULL);
+int reintentar(const char *error) {
+    if (errno == EAGAIN && !terminar) {
+        usleep(10000);
+        return 1;
     }
+    if (errno == ENOTCONN && !terminar) {
+        usleep(100000);
+        chat_mantener(sesion);
+        return 1;
+    }
+    perror(error);
+    return 0;
+}
+
+/**
+ * Función de limpieza y terminación del cliente
+ * 
+ * Cierra la sesión (avisa al servidor y elimina la cola privada) para
+ * evitar dejar recursos huérfanos.
+ * 
+ * @param codigo Código de salida del proceso
+ */
+void limpiar_y_salir(int codigo) {
+    chat_cerrar(sesion);
+    pantalla_terminar();
+    con_pantalla = 0;
     
-    printf("\nCliente %s: desconectado del servidor\n", nombre_usuario);
-    printf("¡Hasta luego!\n");
-    exit(0);
+    informar("\nCliente %s: desconectado del servidor\n", nombre_usuario);
+    informar("¡Hasta luego!\n");
+    fflush(stdout);
+    exit(codigo);
 }
 
+/* ==================== TEXTOS LARGOS Y ADJUNTOS ==================== */
+
 /**
- * Hilo de recepción de mensajes (ejecutado en hilo separado)
+ * Comprobar que se puede hablar en la sala actual (con el error ya mostrado)
  * 
- * Esta función se ejecuta continuamente en un hilo independiente y
- * se encarga de recibir todos los mensajes que el servidor envía a
- * la cola privada del cliente. Procesa diferentes tipos de mensajes:
+ * @return 1 si hay sala y no se observa en modo sólo lectura, 0 si no
+ */
+int puede_hablar(void) {
+    char sala_vista[MAX_NOMBRE];
+    int observador_visto;
+    chat_sala(sesion, sala_vista, &observador_visto);
+    
+    // Verificar que el usuario esté en una sala para enviar mensajes
+    if (strlen(sala_vista) == 0) {
+        error_comando("Error: Debes estar en una sala para enviar mensajes.\n");
+        error_comando("Usa 'join <sala>' para unirte a una sala primero.\n");
+        return 0;
+    }
+    
+    // Los observadores sólo leen: evitar el viaje al servidor
+    if (observador_visto) {
+        error_comando("Error: observas '%s' en modo sólo lectura. Usa 'join %s' para hablar.\n", 
+                      sala_vista, sala_vista);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Enviar un texto a la sala actual, sea cual sea su longitud
  * 
- * - RESP (2): Respuestas y notificaciones del servidor
- * - CHAT (4): Mensajes de otros usuarios en la sala
- * - Otros tipos: Mensajes especiales o de extensiones futuras
+ * Si no cabe en un mensaje la biblioteca lo parte en fragmentos y el
+ * receptor lo muestra entero; el texto ya no se trunca a MAX_TEXTO.
  * 
- * @param arg Argumento del hilo (no utilizado)
- * @return NULL (requerido por especificación pthread)
+ * @param texto Texto a enviar (puede contener saltos de línea)
  */
-void *recibir_mensajes(void *arg) {
-    struct mensaje msg;
+void enviar_texto(const char *texto) {
+    if (!puede_hablar()) {
+        return;
+    }
+    if (strlen(texto) > CHAT_MAX_LARGO) {
+        error_comando("Error: el texto supera %d bytes; usa /adjuntar <archivo>\n", CHAT_MAX_LARGO);
+        return;
+    }
     
-    while (1) {
-        // Esperar cualquier mensaje en la cola privada del cliente
-        // Parámetro msgtyp=0 significa "aceptar cualquier tipo de mensaje"
-        ssize_t r = msgrcv(cola_privada, &msg, sizeof(msg) - sizeof(long), 0, 0);
-        
-        // Manejo de errores en la recepción
-        if (r == -1) {
-            if (errno == EINTR) {
-                // Interrupción por señal (comportamiento normal), continuar
-                continue;
-            }
-            perror("Error al recibir mensaje en cola privada");
-            continue;
+    // Enviar mensaje al servidor para distribución
+    // (se distribuirá a otros usuarios, pero no al remitente)
+    int r;
+    while ((r = chat_enviar_largo(sesion, texto)) == -1 && reintentar("Error enviando mensaje de chat")) {
+    }
+    
+    // A pantalla completa la línea escrita se borra: queda en el historial
+    if (r == 0 && con_pantalla) {
+        size_t tam = MAX_NOMBRE + strlen(texto) + 4;
+        char *linea = malloc(tam);
+        if (linea) {
+            snprintf(linea, tam, "%s: %s", nombre_usuario, texto);
+            pantalla_escribir(PANTALLA_PROPIO, linea);
+            free(linea);
         }
+    }
+}
 
-        // Procesar mensaje según su tipo
-        if (msg.mtype == 2) {
-            // RESP: Respuesta del servidor (confirmaciones, errores, listas, etc.)
-            printf("[SERVIDOR] %s\n", msg.texto);
-        } else if (msg.mtype == 4) {
-            // CHAT: Mensaje de chat enviado por otro usuario de la sala
-            printf("%s: %s\n", msg.remitente, msg.texto);
-        } else {
-            // Tipos de mensaje desconocidos o especiales
-            printf("[MENSAJE TIPO %ld] %s\n", msg.mtype, msg.texto);
-        }
-        
-        // Mostrar prompt nuevamente para mantener interfaz interactiva
-        printf("> ");
-        fflush(stdout);
+/**
+ * Terminar /pegar: enviar lo acumulado (también al acabarse la entrada)
+ */
+void terminar_pegado(void) {
+    if (!pegado) {
+        return;
     }
+    char *texto = pegado;
+    pegado = NULL;
+    if (largo_pegado > 0) {
+        largo_pegado--;  // Sin el salto de la última línea
+    }
+    texto[largo_pegado] = '\0';
     
-    return NULL;  // Nunca se alcanza debido al bucle infinito
+    if (pegado_excedido) {
+        error_comando("Error: lo pegado supera %d bytes y no se envió; usa /adjuntar <archivo>\n", 
+                      CHAT_MAX_LARGO);
+    } else if (largo_pegado > 0) {
+        enviar_texto(texto);
+    }
+    free(texto);
+    largo_pegado = 0;
+    pegado_excedido = 0;
 }
 
-/* ==================== FUNCIÓN PRINCIPAL ==================== */
+/**
+ * Acumular una línea mientras se pega un texto (/pegar)
+ * 
+ * Una línea con sólo "." termina el texto y lo envía como un mensaje.
+ * 
+ * @param linea Línea leída (sin salto de línea)
+ * @return 1 si la línea era parte de lo pegado, 0 si no se está pegando
+ */
+int acumular_pegado(const char *linea) {
+    if (!pegado) {
+        return 0;
+    }
+    if (strcmp(linea, ".") == 0) {
+        terminar_pegado();
+        return 1;
+    }
+    size_t n = strlen(linea);
+    if (largo_pegado + n + 1 > CHAT_MAX_LARGO) {
+        pegado_excedido = 1;
+    } else {
+        memcpy(pegado + largo_pegado, linea, n);
+        largo_pegado += n;
+        pegado[largo_pegado++] = '\n';
+    }
+    return 1;
+}
 
 /**
- * Función principal del cliente de chat
+ * Compartir un archivo con la sala actual (/adjuntar)
  * 
- * Inicializa todas las conexiones necesarias, configura el hilo de recepción
- * y maneja el bucle principal de interfaz de usuario para procesar comandos
- * y mensajes del usuario.
+ * El archivo se proyecta en memoria y la biblioteca lo copia una sola
+ * vez a un segmento compartido; por la cola sólo viaja su identificador.
  * 
- * @param argc Número de argumentos de línea de comandos
- * @param argv Array de argumentos (debe incluir nombre de usuario)
- * @return 0 en terminación exitosa
+ * @param ruta Ruta del archivo
  */
-int main(int argc, char *argv[]) {
-    /* Validación de argumentos de entrada */
-    if (argc != 2) {
-        printf("Uso: %s <nombre_usuario>\n", argv[0]);
-        printf("Ejemplo: %s Juan\n", argv[0]);
-        exit(1);
+void adjuntar_archivo(const char *ruta) {
+    if (!puede_hablar()) {
+        return;
     }
     
-    /* Configuración inicial del sistema */
-    
-    // Instalar manejador de señal para limpieza automática con Ctrl+C
-    signal(SIGINT, limpiar_y_salir);
+    int fd = open(ruta, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        error_comando("Error: no se puede leer el archivo '%s'\n", ruta);
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+    size_t tam = (size_t)st.st_size;
+    void *datos = tam > 0 ? mmap(NULL, tam, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (datos == MAP_FAILED) {
+        perror("Error leyendo el archivo a adjuntar");
+        return;
+    }
     
-    // Copiar nombre de usuario desde argumentos de línea de comandos
-    strcpy(nombre_usuario, argv[1]);
+    // Al destinatario le basta el nombre, sin los directorios
+    const char *nombre = strrchr(ruta, '/') ? strrchr(ruta, '/') + 1 : ruta;
+    int r;
+    while ((r = chat_adjuntar(sesion, nombre, datos ? datos : "", tam)) == -1 && 
+           reintentar("Error enviando el adjunto")) {
+    }
+    if (datos) {
+        munmap(datos, tam);
+    }
+    if (r == 0) {
+        informar("Adjunto '%s' enviado (%zu bytes)\n", nombre, tam);
+    }
+}
 
-    /* Establecer conexión con el servidor */
+/**
+ * Recordar el último adjunto recibido (lo guarda /guardar)
+ * 
+ * @param ev Evento del adjunto
+ */
+void recordar_adjunto(const struct chat_evento *ev) {
+    pthread_mutex_lock(&mutex_adjunto);
+    ultimo_adjunto = *ev;
+    ultimo_adjunto.texto_largo = NULL;
+    hay_adjunto = 1;
+    pthread_mutex_unlock(&mutex_adjunto);
+}
+
+/**
+ * Guardar el último adjunto recibido en un archivo (/guardar)
+ * 
+ * El segmento se proyecta sólo para lectura y se escribe directamente
+ * al archivo, sin copias intermedias.
+ * 
+ * @param ruta Archivo de destino ("" = el nombre del adjunto, sin sobrescribir)
+ */
+void guardar_adjunto(const char *ruta) {
+    pthread_mutex_lock(&mutex_adjunto);
+    struct chat_evento ev = ultimo_adjunto;
+    int hay = hay_adjunto;
+    pthread_mutex_unlock(&mutex_adjunto);
+    if (!hay) {
+        error_comando("Error: no has recibido ningún adjunto.\n");
+        return;
+    }
     
-    // Generar clave para cola global (debe coincidir con la del servidor)
-    key_t key_global = ftok("/tmp", 'A');
-    if (key_global == (key_t)-1) { 
-        perror("Error generando clave para cola global"); 
-        exit(1); 
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (ruta[0] == '\0') {
+        // El nombre lo eligió el remitente: nada de directorios ni de sobrescribir
+        ruta = ev.texto;
+        if (strchr(ruta, '/') || ruta[0] == '\0' || strcmp(ruta, ".") == 0 || strcmp(ruta, "..") == 0) {
+            ruta = "adjunto";
+        }
+        flags = O_WRONLY | O_CREAT | O_EXCL;
     }
     
-    // Conectar a la cola global existente (creada por el servidor)
-    cola_global = msgget(key_global, 0666);
-    if (cola_global == -1) { 
-        fprintf(stderr, "Error: No se puede conectar al servidor.\n");
-        fprintf(stderr, "¿Está el servidor ejecutándose?\n");
-        exit(1); 
+    const char *datos = chat_adjunto_mapear(&ev);
+    if (!datos) {
+        error_comando("Error: el adjunto '%s' de %s ya no está disponible.\n", ev.texto, ev.remitente);
+        return;
+    }
+    int fd = open(ruta, flags, 0644);
+    if (fd == -1) {
+        perror("Error creando el archivo");
+        chat_adjunto_soltar(datos);
+        return;
+    }
+    size_t escritos = 0;
+    while (escritos < ev.adjunto_tam) {
+        ssize_t n = write(fd, datos + escritos, ev.adjunto_tam - escritos);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            perror("Error escribiendo el adjunto");
+            break;
+        }
+        escritos += (size_t)n;
+    }
+    close(fd);
+    chat_adjunto_soltar(datos);
+    if (escritos == ev.adjunto_tam) {
+        informar("Adjunto guardado en '%s' (%zu bytes)\n", ruta, escritos);
+    }
+}
+
+/* ==================== EVENTOS ==================== */
+
+/**
+ * Describir un aviso de presencia ("+Ana +Bob -Carlos") para la terminal
+ * 
+ * @param cambios Texto del evento
+ * @param destino Descripción ("se unieron Ana, Bob; se fue Carlos")
+ * @param tam Tamaño de destino
+ */
+void describir_presencia(const char *cambios, char *destino, size_t tam) {
+    size_t usado = 0;
+    destino[0] = '\0';
+    for (int alta = 1; alta >= 0; alta--) {
+        const char *signo = alta ? "+" : "-";
+        int nombres = 0;
+        for (const char *p = cambios; *p; ) {
+            size_t largo = strcspn(p, " ");
+            if (largo > 1 && p[0] == signo[0]) {
+                nombres++;
+            }
+            p += largo + (p[largo] == ' ');
+        }
+        if (nombres == 0) {
+            continue;
+        }
+        
+        usado += snprintf(destino + usado, tam - usado, "%s%s ", usado ? "; " : "", 
+                          alta ? (nombres > 1 ? "se unieron" : "se unió") 
+                               : (nombres > 1 ? "se fueron" : "se fue"));
+        int escritos = 0;
+        for (const char *p = cambios; *p && usado < tam; ) {
+            size_t largo = strcspn(p, " ");
+            if (largo > 1 && p[0] == signo[0]) {
+                usado += snprintf(destino + usado, tam - usado, "%s%.*s", escritos++ ? ", " : "", 
+                                  (int)largo - 1, p + 1);
+            }
+            p += largo + (p[largo] == ' ');
+        }
+        if (usado >= tam) {
+            return;  // Truncado
+        }
     }
+}
 
-    /* Crear cola privada para recibir mensajes del servidor */
+/**
+ * Mostrar un evento de la sesión (se llama desde los hilos de la biblioteca)
+ * 
+ * - MENSAJE: mensajes de la sala, ya en orden de secuencia
+ * - PRIVADO: mensajes privados de otro usuario
+ * - RESPUESTA: respuestas y notificaciones del servidor
+ * - AVISO / CONEXION: avisos locales (huecos, solicitudes sin respuesta, reconexión) o nombre en uso
+ * - PRESENCIA: quién se unió a la sala o se fue
+ * - MIEMBROS: lista de miembros pedida con /users
+ * 
+ * @param s Sesión que produjo el evento
+ * @param ev Evento a mostrar
+ * @param datos Argumento del manejador (no utilizado)
+ */
+void mostrar_evento(struct chat_sesion *s, const struct chat_evento *ev, void *datos) {
+    (void)datos;
+    // Un texto largo (en fragmentos) llega completo en texto_largo
+    const char *texto = ev->texto_largo ? ev->texto_largo : ev->texto;
+    size_t tam = MAX_NOMBRE + 2 * strlen(texto) + 96;  // PRESENCIA crece al describirse
+    char *linea = malloc(tam);
+    int estilo = PANTALLA_NORMAL;
+    int separar = 0;                    // Avisos: línea en blanco antes (fuera de -t)
+    if (!linea) {
+        return;
+    }
+    
+    switch (ev->tipo) {
+    case CHAT_EV_MENSAJE:
+        // Historial de la caché local: atenuado, ya se leyó antes.
+        // Resaltar los mensajes que mencionan a este usuario con "@nombre"
+        if (ev->adjunto) {
+            recordar_adjunto(ev);
+            snprintf(linea, tam, "[ADJUNTO] %s: %s (%zu bytes) - /guardar [ruta] para guardarlo", 
+                     ev->remitente, texto, ev->adjunto_tam);
+            estilo = ev->historial ? PANTALLA_PROPIO : PANTALLA_INFO;
+        } else if (ev->historial) {
+            snprintf(linea, tam, "[HISTORIAL] %s: %s", ev->remitente, texto);
+            estilo = PANTALLA_PROPIO;
+        } else if (ev->mencion) {
+            snprintf(linea, tam, "[MENCIÓN] %s: %s", ev->remitente, texto);
+            estilo = PANTALLA_MENCION;
+        } else {
+            snprintf(linea, tam, "%s: %s", ev->remitente, texto);
+        }
+        break;
+    case CHAT_EV_PRIVADO:
+        snprintf(linea, tam, "[PRIVADO] %s: %s", ev->remitente, texto);
+        estilo = PANTALLA_PRIVADO;
+        break;
+    case CHAT_EV_RESPUESTA:
+        snprintf(linea, tam, "[SERVIDOR] %s", texto);
+        estilo = PANTALLA_SERVIDOR;
+        break;
+    case CHAT_EV_AVISO:
+        snprintf(linea, tam, "[AVISO] %s", texto);
+        estilo = PANTALLA_AVISO;
+        separar = 1;
+        break;
+    case CHAT_EV_PRESENCIA: {
+        char cambios[2 * MAX_TEXTO];
+        describir_presencia(texto, cambios, sizeof(cambios));
+        snprintf(linea, tam, "[PRESENCIA] %s: %s", ev->sala, cambios);
+        estilo = PANTALLA_INFO;
+        break;
+    }
+    case CHAT_EV_MIEMBROS: {
+        int num = chat_lista_miembros(s, NULL, 0, NULL);
+        snprintf(linea, tam, "[USUARIOS] %s (versión %u): %s (%d miembro%s)", ev->sala, ev->seq,
+                 texto, num, num == 1 ? "" : "s");
+        estilo = PANTALLA_SERVIDOR;
+        break;
+    }
+    default:
+        snprintf(linea, tam, "%s %s", ev->estado == ESTADO_ERROR ? "[ERROR]" : "[RECONEXIÓN]", texto);
+        estilo = PANTALLA_AVISO;
+        separar = 1;
+        break;
+    }
     
-    // Crear cola privada única usando IPC_PRIVATE
-    cola_privada = msgget(IPC_PRIVATE, IPC_CREAT | 0666);
-    if (cola_privada == -1) { 
-        perror("Error creando cola privada del cliente"); 
-        exit(1); 
+    if (con_pantalla) {
+        pantalla_escribir(estilo, linea);  // Se dibuja en el próximo cuadro
+    } else {
+        // Mostrar prompt nuevamente para mantener interfaz interactiva
+        printf("%s%s\n> ", separar ? "\n" : "", linea);
+        fflush(stdout);
     }
+    free(linea);
+    salir_si_nombre_en_uso(ev);
+}
 
-    /* Mostrar información de bienvenida */
-    printf("\n=== Cliente de Chat Multi-Sala ===\n");
-    printf("Bienvenid@ %s!\n", nombre_usuario);
-    printf("Conectado al servidor (Global: %d, Privada: %d)\n", cola_global, cola_privada);
-    printf("\nComandos disponibles:\n");
-    printf("  join <sala>  - Unirse a una sala\n");
-    printf("  /leave       - Abandonar sala actual\n");
-    printf("  /list        - Ver salas disponibles\n");
-    printf("  /users       - Ver usuarios en sala\n");
-    printf("  <mensaje>    - Enviar mensaje\n");
-    printf("==============================\n\n");
-
-    /* Inicializar hilo de recepción de mensajes */
+/**
+ * Escribir un campo de texto escapado (\t, \n y \\)
+ * 
+ * Así cada evento ocupa exactamente una línea y los tabuladores sólo
+ * separan campos, aunque el texto del usuario los contenga.
+ * 
+ * @param texto Campo a escribir
+ */
+void escribir_campo(const char *texto) {
+    for (const char *c = texto; *c; c++) {
+        if (*c == '\t') {
+            fputs("\\t", stdout);
+        } else if (*c == '\n') {
+            fputs("\\n", stdout);
+        } else if (*c == '\\') {
+            fputs("\\\\", stdout);
+        } else {
+            putchar(*c);
+        }
+    }
+}
+
+/**
+ * Escribir un evento en formato legible por máquina (modo sin terminal)
+ * 
+ * Una línea por evento, campos separados por tabuladores:
+ * - MSG      <sala> <seq> <remitente> <mención 0|1> <texto>
+ * - ADJUNTO  <sala> <seq> <remitente> <segmento> <bytes> <nombre>
+ * - PRIV     <remitente> <texto>
+ * - RESP     <corr> <OK|ERROR> <sala> <texto>
+ * - AVISO    <sala> <texto>
+ * - CONEXION <texto> (también "Error: el nombre ... ya está en uso", y el cliente termina)
+ * - PRESENCIA <sala> <cambios ("+Ana +Bob -Carlos")>
+ * - MIEMBROS <sala> <versión> <nombres ("Ana, Bob")>
+ * 
+ * @param s Sesión que produjo el evento
+ * @param ev Evento a escribir
+ * @param datos Argumento del manejador (no utilizado)
+ */
+void emitir_evento(struct chat_sesion *s, const struct chat_evento *ev, void *datos) {
+    (void)s;
+    (void)datos;
     
-    // Crear hilo separado para recibir mensajes asíncronamente del servidor
-    // Esto permite al usuario escribir comandos mientras recibe mensajes
-    pthread_t hilo_receptor;
-    if (pthread_create(&hilo_receptor, NULL, recibir_mensajes, NULL) != 0) {
-        perror("Error creando hilo de recepción");
-        limpiar_y_salir(1);
+    switch (ev->tipo) {
+    case CHAT_EV_MENSAJE:
+        fputs(ev->adjunto ? "ADJUNTO\t" : "MSG\t", stdout);
+        escribir_campo(ev->sala);
+        printf("\t%u\t", ev->seq);
+        escribir_campo(ev->remitente);
+        if (ev->adjunto) {
+            recordar_adjunto(ev);
+            printf("\t%d\t%zu\t", ev->adjunto_id, ev->adjunto_tam);
+        } else {
+            printf("\t%d\t", ev->mencion);
+        }
+        break;
+    case CHAT_EV_PRIVADO:
+        fputs("PRIV\t", stdout);
+        escribir_campo(ev->remitente);
+        putchar('\t');
+        break;
+    case CHAT_EV_RESPUESTA:
+        printf("RESP\t%u\t%s\t", ev->corr, ev->estado == ESTADO_OK ? "OK" : "ERROR");
+        escribir_campo(ev->sala);
+        putchar('\t');
+        break;
+    case CHAT_EV_AVISO:
+        fputs("AVISO\t", stdout);
+        escribir_campo(ev->sala);
+        putchar('\t');
+        break;
+    case CHAT_EV_CONEXION:
+        fputs("CONEXION\t", stdout);
+        break;
+    case CHAT_EV_PRESENCIA:
+        fputs("PRESENCIA\t", stdout);
+        escribir_campo(ev->sala);
+        putchar('\t');
+        break;
+    case CHAT_EV_MIEMBROS:
+        fputs("MIEMBROS\t", stdout);
+        escribir_campo(ev->sala);
+        printf("\t%u\t", ev->seq);
+        break;
     }
+    escribir_campo(ev->texto_largo ? ev->texto_largo : ev->texto);
+    putchar('\n');  // stdout va con buffer de línea en este modo
+    salir_si_nombre_en_uso(ev);
+}
+
+/* ==================== COMANDOS ==================== */
+
+/**
+ * Ejecutar un comando (join, /observar, /leave, /list, /users, /msg, /filtro,
+ * /pegar, /adjuntar, /guardar)
+ * 
+ * Lo comparten el modo interactivo y el modo sin terminal.
+ * 
+ * @param comando Línea leída (sin salto de línea)
+ * @return 1 si era un comando (ejecutado o con error ya mostrado),
+ *         0 si es un mensaje de chat para la sala actual
+ */
+int ejecutar_comando(const char *comando) {
+    // Sala a la que se dirige el comando (la actual o la de un JOIN en vuelo)
+    char sala_vista[MAX_NOMBRE];
+    int observador_visto;
+    chat_sala(sesion, sala_vista, &observador_visto);
+
+    /* ===== PROCESAMIENTO DE COMANDO JOIN ===== */
+    if (strncmp(comando, "join ", 5) == 0) {
+        // Extraer nombre de sala del comando
+        char sala[MAX_NOMBRE];
+        int items_leidos = sscanf(comando + 5, "%49s", sala);
+        
+        // Validar que se especificó un nombre de sala
+        if (items_leidos != 1 || strlen(sala) == 0) {
+            error_comando("Error: Especifica el nombre de la sala.\n");
+            error_comando("Uso: join <nombre_sala>\n");
+            return 1;
+        }
 
-    /* Variables para el bucle principal de comandos */
-    struct mensaje msg;
-    char comando[MAX_TEXTO];
+        // La sala actual cambia cuando llegue la confirmación de esta solicitud
+        unsigned int corr;
+        while ((corr = chat_unirse(sesion, sala)) == 0 && reintentar("Error enviando solicitud JOIN")) {
+        }
+        if (corr == 0) {
+            return 1;
+        }
+        
+        informar("Solicitando unión a sala '%s'...\n", sala);
+
+    } else if (strncmp(comando, "/observar ", 10) == 0) {
+        /* ===== PROCESAMIENTO DE COMANDO /OBSERVAR ===== */
+        char sala[MAX_NOMBRE];
+        if (sscanf(comando + 10, "%49s", sala) != 1) {
+            error_comando("Uso: /observar <nombre_sala>\n");
+            return 1;
+        }
+        
+        // Igual que JOIN pero sin ocupar slot de usuario
+        unsigned int corr;
+        while ((corr = chat_observar(sesion, sala)) == 0 && reintentar("Error enviando solicitud OBSERVE")) {
+        }
+        if (corr == 0) {
+            return 1;
+        }
+        
+        informar("Solicitando observar la sala '%s'...\n", sala);
+
+    } else if (strncmp(comando, "/leave", 6) == 0) {
+        /* ===== PROCESAMIENTO DE COMANDO /LEAVE ===== */
+        
+        // Verificar que el usuario esté en una sala
+        if (strlen(sala_vista) == 0) {
+            error_comando("Error: No estás en ninguna sala para abandonar.\n");
+            return 1;
+        }
+        
+        // Enviar solicitud de abandono (la sala se limpia al confirmarse)
+        unsigned int corr;
+        while ((corr = chat_abandonar(sesion)) == 0 && reintentar("Error enviando solicitud LEAVE")) {
+        }
+        if (corr == 0) {
+            return 1;
+        }
+        
+        informar("Abandonando sala '%s'...\n", sala_vista);
+
+    } else if (strncmp(comando, "/list", 5) == 0) {
+        /* ===== PROCESAMIENTO DE COMANDO /LIST ===== */
+        unsigned int corr;
+        while ((corr = chat_listar(sesion)) == 0 && reintentar("Error enviando solicitud LIST")) {
+        }
+        if (corr == 0) {
+            return 1;
+        }
+        
+        informar("Solicitando lista de salas disponibles...\n");
+
+    } else if (strncmp(comando, "/users", 6) == 0) {
+        /* ===== PROCESAMIENTO DE COMANDO /USERS ===== */
+        
+        // Verificar que el usuario esté en una sala
+        if (strlen(sala_vista) == 0) {
+            error_comando("Error: Debes estar en una sala para ver sus usuarios.\n");
+            error_comando("Usa 'join <sala>' para unirte a una sala primero.\n");
+            return 1;
+        }
+        
+        unsigned int corr;
+        // Versionada: tras la primera vez sólo viaja lo que cambió
+        while ((corr = chat_miembros(sesion)) == 0 && reintentar("Error enviando solicitud MIEMBROS")) {
+        }
+        if (corr == 0) {
+            return 1;
+        }
+        
+        informar("Solicitando lista de usuarios en sala '%s'...\n", sala_vista);
+
+    } else if (strncmp(comando, "/msg ", 5) == 0) {
+        /* ===== PROCESAMIENTO DE COMANDO /MSG (PRIVADO) ===== */
+        
+        // Extraer destinatario y texto: "/msg <usuario> <texto>"
+        char destino[MAX_NOMBRE];
+        int consumidos = 0;
+        if (sscanf(comando + 5, "%49s %n", destino, &consumidos) != 1 || 
+            comando[5 + consumidos] == '\0') {
+            error_comando("Uso: /msg <usuario> <texto>\n");
+            return 1;
+        }
+        
+        // El servidor lo entrega directamente al destinatario
+        while (chat_privado(sesion, destino, comando + 5 + consumidos) == -1 && 
+               reintentar("Error enviando mensaje privado")) {
+        }
+
+    } else if (strncmp(comando, "/filtro ", 8) == 0) {
+        /* ===== PROCESAMIENTO DE COMANDO /FILTRO ===== */
+        
+        // El filtro se aplica a la sala actual
+        if (strlen(sala_vista) == 0) {
+            error_comando("Error: Debes estar en una sala para configurar un filtro.\n");
+            return 1;
+        }
+        
+        // El filtro se recuerda (para reconectar) cuando el servidor lo acepta
+        while (chat_filtrar(sesion, comando + 8) == 0 && reintentar("Error enviando filtro")) {
+        }
+
+    } else if (strcmp(comando, "/pegar") == 0) {
+        /* ===== PROCESAMIENTO DE COMANDO /PEGAR ===== */
+        
+        // Las líneas siguientes se acumulan hasta una con sólo "."
+        if (!puede_hablar()) {
+            return 1;
+        }
+        free(pegado);
+        pegado = malloc(CHAT_MAX_LARGO + 1);
+        if (!pegado) {
+            perror("Error reservando el texto a pegar");
+            return 1;
+        }
+        largo_pegado = 0;
+        pegado_excedido = 0;
+        informar("Pega el texto y termina con una línea que sólo tenga '.'\n");
+
+    } else if (strncmp(comando, "/adjuntar ", 10) == 0) {
+        /* ===== PROCESAMIENTO DE COMANDO /ADJUNTAR ===== */
+        adjuntar_archivo(comando + 10);
+
+    } else if (strcmp(comando, "/guardar") == 0 || strncmp(comando, "/guardar ", 9) == 0) {
+        /* ===== PROCESAMIENTO DE COMANDO /GUARDAR ===== */
+        guardar_adjunto(comando[8] ? comando + 9 : "");
+
+    } else {
+        // Mensaje de chat regular
+        return 0;
+    }
+    return 1;
+}
+
+/* ==================== MODO INTERACTIVO ==================== */
+
+/**
+ * Procesar una línea escrita en la terminal (comando o mensaje)
+ * 
+ * @param comando Línea leída (sin salto de línea)
+ */
+void procesar_linea(const char *comando) {
+    if (acumular_pegado(comando)) {
+        return;
+    }
+    // Ignorar líneas vacías
+    if (strlen(comando) == 0 || ejecutar_comando(comando)) {
+        return;
+    }
+
+    /* ===== PROCESAMIENTO DE MENSAJE DE CHAT REGULAR ===== */
+    enviar_texto(comando);
+}
+
+/**
+ * Mostrar la bienvenida y la lista de comandos
+ */
+void mostrar_bienvenida(void) {
+    informar("\n=== Cliente de Chat Multi-Sala ===\n");
+    informar("Bienvenid@ %s!\n", nombre_usuario);
+    informar("Conectado al servidor (Global: %d, Privada: %d)\n", 
+             chat_cola_servidor(sesion), chat_cola(sesion));
+    informar("\nComandos disponibles:\n");
+    informar("  join <sala>  - Unirse a una sala\n");
+    informar("  /observar <sala> - Observar una sala (sólo lectura)\n");
+    informar("  /leave       - Abandonar sala actual\n");
+    informar("  /list        - Ver salas disponibles\n");
+    informar("  /users       - Ver usuarios en sala\n");
+    informar("  /msg <usuario> <texto> - Mensaje privado\n");
+    informar("  /filtro <spec> - todo | menciones | palabras a,b | de ana,bob\n");
+    informar("  /pegar       - Enviar varias líneas como un mensaje (termina con '.')\n");
+    informar("  /adjuntar <archivo> - Compartir un archivo con la sala\n");
+    informar("  /guardar [ruta] - Guardar el último adjunto recibido\n");
+    informar("  <mensaje>    - Enviar mensaje\n");
+    informar("==============================\n\n");
+}
+
+/**
+ * Quitar el salto de una línea leída con fgets
+ * 
+ * Si la línea no cupo en el buffer, el resto se descarta avisando (ya
+ * no cabría ni en un texto largo).
+ * 
+ * @param linea Línea leída
+ * @param entrada Archivo del que se leyó
+ */
+void cerrar_linea(char *linea, FILE *entrada) {
+    size_t largo = strcspn(linea, "\n");
+    if (linea[largo] != '\n' && !feof(entrada)) {
+        int c;
+        while ((c = fgetc(entrada)) != EOF && c != '\n') {
+        }
+        error_comando("Aviso: línea de más de %d bytes truncada; usa /adjuntar <archivo>\n", 
+                      CHAT_MAX_LARGO);
+    }
+    linea[largo] = '\0';
+}
+
+/**
+ * Bucle de la terminal: prompt, un comando o mensaje por línea
+ */
+void modo_interactivo(void) {
+    static char comando[MAX_LINEA];
+
+    /* Mostrar información de bienvenida */
+    mostrar_bienvenida();
 
     /* Bucle principal de interfaz de usuario */
-    while (1) {
+    while (!terminar) {
         // Mostrar prompt y esperar entrada del usuario
         printf("> ");
         fflush(stdout);
         
         // Leer comando completo del usuario
         if (!fgets(comando, sizeof(comando), stdin)) {
-            // EOF detectado (Ctrl+D), terminar cliente
-            printf("\nTerminando cliente...\n");
+            if (!terminar) {
+                // EOF detectado (Ctrl+D), terminar cliente
+                printf("\nTerminando cliente...\n");
+            }
             break;
         }
         
         // Eliminar salto de línea del final del comando
-        comando[strcspn(comando, "\n")] = '\0';
-        
-        // Ignorar líneas vacías
-        if (strlen(comando) == 0) {
-            continue;
+        cerrar_linea(comando, stdin);
+        procesar_linea(comando);
+    }
+}
+
+/* ==================== MODO SIN TERMINAL ==================== */
+
+/**
+ * Enviar el lote pendiente a la sala actual, esperando si la cola se llena
+ * 
+ * El ritmo lo marca el servidor: cada llamada envía todo lo que cabe en
+ * su cola y, cuando se llena, se espera a que la vacíe.
+ */
+void vaciar_lote(void) {
+    const char *textos[LOTE_SIN_TERMINAL];
+    for (int i = 0; i < num_lote; i++) {
+        textos[i] = lote[i];
+    }
+
+    int enviados = 0;
+    while (enviados < num_lote) {
+        int r = chat_enviar_lote(sesion, textos + enviados, num_lote - enviados);
+        if (r > 0) {
+            enviados += r;
+        } else if (!reintentar("Error enviando lote de mensajes")) {
+            break;  // Sin sala, sólo observador o sesión cerrada: se descarta el lote
         }
+    }
+    num_lote = 0;
+}
 
-        /* ===== PROCESAMIENTO DE COMANDO JOIN ===== */
-        if (strncmp(comando, "join ", 5) == 0) {
-            // Extraer nombre de sala del comando
-            char sala[MAX_NOMBRE];
-            int items_leidos = sscanf(comando + 5, "%49s", sala);
-            
-            // Validar que se especificó un nombre de sala
-            if (items_leidos != 1 || strlen(sala) == 0) {
-                printf("Error: Especifica el nombre de la sala.\n");
-                printf("Uso: join <nombre_sala>\n");
-                continue;
+/**
+ * Añadir una línea de entrada sin terminal (comando o mensaje)
+ * 
+ * Los mensajes consecutivos se acumulan y se envían en lotes de hasta
+ * LOTE_SIN_TERMINAL; un comando vacía antes el lote pendiente, así el
+ * orden de la entrada se respeta (p. ej. mensajes antes de un /leave).
+ * 
+ * @param linea Línea leída (sin salto de línea)
+ */
+void agregar_linea(const char *linea) {
+    if (acumular_pegado(linea) || linea[0] == '\0') {
+        return;
+    }
+    if (linea[0] == '/' || strncmp(linea, "join ", 5) == 0) {
+        // Posible comando: primero lo que ya estaba en el lote
+        vaciar_lote();
+        if (ejecutar_comando(linea)) {
+            return;
+        }
+        // "/algo" desconocido: es un mensaje
+    }
+    if (strlen(linea) >= MAX_TEXTO) {
+        // No cabe en un mensaje: va solo, en fragmentos, tras lo ya acumulado
+        vaciar_lote();
+        enviar_texto(linea);
+        return;
+    }
+
+    strncpy(lote[num_lote], linea, MAX_TEXTO - 1);
+    lote[num_lote][MAX_TEXTO - 1] = '\0';
+    if (++num_lote == LOTE_SIN_TERMINAL) {
+        vaciar_lote();
+    }
+}
+
+/**
+ * Bucle sin terminal: comandos y mensajes de una entrada, sin prompts
+ * 
+ * @param entrada Archivo de entrada (stdin o el de -f)
+ * @param espera Segundos que se sigue recibiendo tras el fin de la entrada
+ */
+void modo_sin_terminal(FILE *entrada, int espera) {
+    static char linea[MAX_LINEA];
+    long lineas = 0;
+
+    setvbuf(entrada, NULL, _IOFBF, BUFFER_ENTRADA);
+    while (!terminar && fgets(linea, sizeof(linea), entrada)) {
+        cerrar_linea(linea, entrada);
+        lineas++;
+        agregar_linea(linea);
+    }
+    vaciar_lote();
+    terminar_pegado();  // Un /pegar sin su "." final se envía igual
+    fprintf(stderr, "[BOT] %ld líneas procesadas\n", lineas);
+
+    // Seguir recibiendo (respuestas, mensajes de otros) el tiempo pedido
+    for (int t = 0; t < espera * 10 && !terminar; t++) {
+        usleep(100000);
+    }
+}
+
+/* ==================== BUCLE DE EVENTOS DE UN SOLO HILO ==================== */
+
+static long long ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+/**
+ * Bucle de eventos (-e): entrada y servidor multiplexados con poll
+ * 
+ * Un solo hilo lee la entrada, procesa los eventos de la sesión y
+ * escribe en stdout; la biblioteca sólo mantiene un hilo puente que
+ * copia la cola privada (no pollable) a un eventfd. Así no hay carreras
+ * entre hilos por la terminal ni por la sala actual.
+ * 
+ * @param fd_sesion Descriptor de la sesión (chat_descriptor)
+ * @param fd_entrada Descriptor de la entrada (stdin o el archivo de -f)
+ * @param espera Segundos que se sigue recibiendo tras el fin de la entrada (-b)
+ */
+void modo_bucle_eventos(int fd_sesion, int fd_entrada, int espera) {
+    static char buffer[BUFFER_ENTRADA];
+    size_t usados = 0;                  // Bytes de una línea aún incompleta
+    long lineas = 0;
+    long long fin = -1;                 // Fin de la espera tras cerrar la entrada (-1 = abierta)
+    long long proximo_mantenimiento = 0;
+    struct pollfd fds[2] = {
+        {.fd = fd_sesion, .events = POLLIN},
+        {.fd = fd_entrada, .events = POLLIN},
+    };
+
+    if (!sin_terminal) {
+        mostrar_bienvenida();
+        printf("> ");
+        fflush(stdout);
+    }
+
+    while (!terminar) {
+        if (poll(fds, fin == -1 ? 2 : 1, PERIODO_BUCLE_MS) == -1 && errno != EINTR) {
+            perror("Error en poll");
+            break;
+        }
+
+        // Eventos de la sesión: se entregan todos los disponibles
+        struct chat_evento ev;
+        int r;
+        while ((r = chat_recibir(sesion, &ev, 0)) == 1) {
+            if (sin_terminal) {
+                emitir_evento(sesion, &ev, NULL);
+            } else {
+                mostrar_evento(sesion, &ev, NULL);
             }
+        }
+        if (r == -1) {
+            break;  // Cola privada eliminada
+        }
 
-            // Preparar mensaje JOIN para el servidor
-            memset(&msg, 0, sizeof(msg));
-            msg.mtype = 1;                                    // Tipo JOIN
-            msg.reply_qid = cola_privada;                     // Para recibir respuesta
-            strncpy(msg.remitente, nombre_usuario, MAX_NOMBRE - 1);
-            msg.remitente[MAX_NOMBRE - 1] = '\0';             // Asegurar terminación nula
-            strncpy(msg.sala, sala, MAX_NOMBRE - 1);
-            msg.sala[MAX_NOMBRE - 1] = '\0';                  // Asegurar terminación nula
-            
-            // Enviar solicitud al servidor
-            if (msgsnd(cola_global, &msg, sizeof(msg) - sizeof(long), 0) == -1) {
-                perror("Error enviando solicitud JOIN");
-                continue;
+        // Mantenimiento (caída del servidor, solicitudes caducadas) aunque haya tráfico
+        long long ahora = ahora_ms();
+        if (ahora >= proximo_mantenimiento) {
+            chat_mantener(sesion);
+            proximo_mantenimiento = ahora + PERIODO_BUCLE_MS;
+        }
+        if (fin != -1) {
+            if (ahora >= fin) {
+                break;
             }
-            
-            // Actualizar sala actual (optimista - confirmación llegará por hilo receptor)
-            strncpy(sala_actual, sala, MAX_NOMBRE - 1);
-            sala_actual[MAX_NOMBRE - 1] = '\0';
-            printf("Solicitando unión a sala '%s'...\n", sala);
-
-        } else if (strncmp(comando, "/leave", 6) == 0) {
-            /* ===== PROCESAMIENTO DE COMANDO /LEAVE ===== */
-            
-            // Verificar que el usuario esté en una sala
-            if (strlen(sala_actual) == 0) {
-                printf("Error: No estás en ninguna sala para abandonar.\n");
+            continue;
+        }
+        if (!(fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+
+        // Entrada: se procesan todas las líneas completas leídas
+        ssize_t leidos = read(fd_entrada, buffer + usados, sizeof(buffer) - usados);
+        if (leidos == -1 && errno == EINTR) {
+            continue;
+        }
+        size_t total = usados + (leidos > 0 ? (size_t)leidos : 0);
+        size_t inicio = 0;
+        for (size_t i = usados; i < total; i++) {
+            if (buffer[i] != '\n') {
                 continue;
             }
-            
-            // Preparar mensaje LEAVE para el servidor
-            memset(&msg, 0, sizeof(msg));
-            msg.mtype = 5;                                    // Tipo LEAVE
-            msg.reply_qid = cola_privada;                     // Para recibir confirmación
-            strncpy(msg.remitente, nombre_usuario, MAX_NOMBRE - 1);
-            msg.remitente[MAX_NOMBRE - 1] = '\0';
-            strncpy(msg.sala, sala_actual, MAX_NOMBRE - 1);
-            msg.sala[MAX_NOMBRE - 1] = '\0';
-            
-            // Enviar solicitud de abandono al servidor
-            if (msgsnd(cola_global, &msg, sizeof(msg) - sizeof(long), 0) == -1) {
-                perror("Error enviando solicitud LEAVE");
-                continue;
+            buffer[i] = '\0';
+            if (i - inicio > CHAT_MAX_LARGO) {
+                buffer[inicio + CHAT_MAX_LARGO] = '\0';  // Ni en fragmentos cabe: se trunca avisando
+                error_comando("Aviso: línea de más de %d bytes truncada; usa /adjuntar <archivo>\n", 
+                              CHAT_MAX_LARGO);
             }
-            
-            // Limpiar sala actual localmente
-            printf("Abandonando sala '%s'...\n", sala_actual);
-            sala_actual[0] = '\0';
-
-        } else if (strncmp(comando, "/list", 5) == 0) {
-            /* ===== PROCESAMIENTO DE COMANDO /LIST ===== */
-            
-            // Preparar solicitud de lista de salas disponibles
-            memset(&msg, 0, sizeof(msg));
-            msg.mtype = 7;                                    // Tipo LIST
-            msg.reply_qid = cola_privada;                     // Para recibir la lista
-            
-            // Enviar solicitud al servidor
-            if (msgsnd(cola_global, &msg, sizeof(msg) - sizeof(long), 0) == -1) {
-                perror("Error enviando solicitud LIST");
-                continue;
+            lineas++;
+            if (sin_terminal) {
+                agregar_linea(buffer + inicio);
+            } else {
+                procesar_linea(buffer + inicio);
             }
-            
-            printf("Solicitando lista de salas disponibles...\n");
-
-        } else if (strncmp(comando, "/users", 6) == 0) {
-            /* ===== PROCESAMIENTO DE COMANDO /USERS ===== */
-            
-            // Verificar que el usuario esté en una sala
-            if (strlen(sala_actual) == 0) {
-                printf("Error: Debes estar en una sala para ver sus usuarios.\n");
-                printf("Usa 'join <sala>' para unirte a una sala primero.\n");
-                continue;
+            inicio = i + 1;
+        }
+        usados = total - inicio;
+        memmove(buffer, buffer + inicio, usados);
+        if (usados == sizeof(buffer)) {
+            usados = 0;  // Línea sin fin más larga que el buffer: se descarta
+        }
+
+        if (leidos <= 0) {
+            // Fin de la entrada: la última línea puede no tener salto
+            if (usados > 0) {
+                buffer[usados <= CHAT_MAX_LARGO ? usados : CHAT_MAX_LARGO] = '\0';
+                lineas++;
+                if (sin_terminal) {
+                    agregar_linea(buffer);
+                } else {
+                    procesar_linea(buffer);
+                }
             }
-            
-            // Preparar solicitud de lista de usuarios en sala actual
-            memset(&msg, 0, sizeof(msg));
-            msg.mtype = 6;                                    // Tipo USERS
-            msg.reply_qid = cola_privada;                     // Para recibir la lista
-            strncpy(msg.sala, sala_actual, MAX_NOMBRE - 1);
-            msg.sala[MAX_NOMBRE - 1] = '\0';
-            
-            // Enviar solicitud al servidor
-            if (msgsnd(cola_global, &msg, sizeof(msg) - sizeof(long), 0) == -1) {
-                perror("Error enviando solicitud USERS");
-                continue;
+            if (sin_terminal) {
+                vaciar_lote();
             }
-            
-            printf("Solicitando lista de usuarios en sala '%s'...\n", sala_actual);
-
-        } else if (strlen(comando) > 0) {
-            /* ===== PROCESAMIENTO DE MENSAJE DE CHAT REGULAR ===== */
-            
-            // Verificar que el usuario esté en una sala para enviar mensajes
-            if (strlen(sala_actual) == 0) {
-                printf("Error: Debes estar en una sala para enviar mensajes.\n");
-                printf("Usa 'join <sala>' para unirte a una sala primero.\n");
-                continue;
+            terminar_pegado();
+            if (!sin_terminal) {
+                printf("\nTerminando cliente...\n");
+                break;
             }
-            
-            // Preparar mensaje de chat para distribuir en la sala
-            memset(&msg, 0, sizeof(msg));
-            msg.mtype = 3;                                    // Tipo MSG (mensaje de chat)
-            msg.reply_qid = cola_privada;                     // Para posibles respuestas de error
-            strncpy(msg.remitente, nombre_usuario, MAX_NOMBRE - 1);
-            msg.remitente[MAX_NOMBRE - 1] = '\0';
-            strncpy(msg.sala, sala_actual, MAX_NOMBRE - 1);
-            msg.sala[MAX_NOMBRE - 1] = '\0';
-            strncpy(msg.texto, comando, MAX_TEXTO - 1);
-            msg.texto[MAX_TEXTO - 1] = '\0';
-            
-            // Enviar mensaje al servidor para distribución
-            if (msgsnd(cola_global, &msg, sizeof(msg) - sizeof(long), 0) == -1) {
-                perror("Error enviando mensaje de chat");
-                continue;
+            fin = ahora + (long long)espera * 1000;
+        }
+        if (sin_terminal) {
+            vaciar_lote();
+        } else {
+            printf("> ");
+            fflush(stdout);
+        }
+    }
+    if (sin_terminal) {
+        fprintf(stderr, "[BOT] %ld líneas procesadas\n", lineas);
+    }
+}
+
+/* ==================== PANTALLA COMPLETA (-t) ==================== */
+
+/**
+ * Actualizar la barra de estado (usuario, sala y conexión)
+ */
+void actualizar_estado(void) {
+    char sala[MAX_NOMBRE];
+    int observador = 0;
+    char texto[MAX_NOMBRE * 2 + 64];
+    
+    if (!chat_sala(sesion, sala, &observador)) {
+        strcpy(sala, "(sin sala)");
+    }
+    snprintf(texto, sizeof(texto), "%s | %s%s | %s", nombre_usuario, sala, 
+             observador ? " (observando)" : "", 
+             chat_conectado(sesion) ? "conectado" : "reconectando...");
+    pantalla_estado(texto);
+}
+
+/**
+ * Bucle de la interfaz a pantalla completa (-t)
+ * 
+ * Como el de -e, un solo hilo atiende teclado y sesión con poll, pero
+ * nada se escribe directamente: eventos y respuestas van al historial de
+ * pantalla.c, que dibuja como mucho PANTALLA_FPS cuadros por segundo.
+ * Entre dos lecturas del teclado se procesan como mucho
+ * EVENTOS_POR_VUELTA eventos, así la entrada responde aunque la sala
+ * reciba cientos de mensajes por segundo.
+ * 
+ * @param fd_sesion Descriptor de la sesión (chat_descriptor)
+ */
+void modo_pantalla(int fd_sesion) {
+    char teclas[256];
+    long long proximo_mantenimiento = 0;
+    int pendientes = 0;                 // 1 si quedaron eventos por procesar
+    struct pollfd fds[2] = {
+        {.fd = fd_sesion, .events = POLLIN},
+        {.fd = STDIN_FILENO, .events = POLLIN},
+    };
+
+    mostrar_bienvenida();
+    informar("Flechas / RePág / AvPág: recorrer el historial, Fin: volver, Ctrl+D: salir\n");
+
+    while (!terminar) {
+        actualizar_estado();
+        int espera = pantalla_refrescar();
+        if (pendientes) {
+            espera = 0;
+        } else if (espera == -1 || espera > PERIODO_BUCLE_MS) {
+            espera = PERIODO_BUCLE_MS;
+        }
+        if (poll(fds, 2, espera) == -1 && errno != EINTR) {
+            break;
+        }
+
+        // Eventos de la sesión, con tope por vuelta
+        struct chat_evento ev;
+        int r = 0;
+        int procesados = 0;
+        while (procesados < EVENTOS_POR_VUELTA && (r = chat_recibir(sesion, &ev, 0)) == 1) {
+            mostrar_evento(sesion, &ev, NULL);
+            procesados++;
+        }
+        if (r == -1) {
+            break;  // Cola privada eliminada
+        }
+        pendientes = (procesados == EVENTOS_POR_VUELTA);
+
+        long long ahora = ahora_ms();
+        if (ahora >= proximo_mantenimiento) {
+            chat_mantener(sesion);
+            proximo_mantenimiento = ahora + PERIODO_BUCLE_MS;
+        }
+
+        // Teclado: la línea completa se procesa como en el modo interactivo
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = read(STDIN_FILENO, teclas, sizeof(teclas));
+            if (n == 0 || (n == -1 && errno != EINTR)) {
+                break;
+            }
+            if (n > 0 && pantalla_entrada(teclas, (size_t)n, procesar_linea) == -1) {
+                break;
             }
-            
-            // Nota: El mensaje se distribuirá a otros usuarios, pero no al remitente
         }
     }
+}
+
+/* ==================== PRUEBA DE CARGA: VARIAS SESIONES (-n) ==================== */
+
+/**
+ * Simular muchos usuarios en este proceso (-n)
+ * 
+ * Todas las sesiones comparten un canal de la biblioteca: una cola de
+ * recepción, un hilo puente y este único bucle de eventos. Cada usuario
+ * envía 'mensajes' privados al siguiente (el último al primero); los
+ * envíos se reparten por vueltas entre las sesiones y entre vuelta y
+ * vuelta se recibe, así la cola compartida no se desborda. Un EAGAIN
+ * (cola del servidor llena) termina la vuelta: se reintenta en la siguiente.
+ * 
+ * @param prefijo Prefijo de los nombres de usuario
+ * @param num Número de sesiones
+ * @param mensajes Privados que envía cada sesión
+ * @param espera Segundos máximos esperando lo que falta tras enviar todo
+ */
+void modo_carga(const char *prefijo, int num, int mensajes, int espera) {
+    // El hilo puente hereda SIGINT bloqueada (la atiende este hilo)
+    sigset_t sigint, previa;
+    sigemptyset(&sigint);
+    sigaddset(&sigint, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigint, &previa);
+    struct chat_canal *canal = chat_canal_crear();
+    int fd = canal ? chat_canal_descriptor(canal) : -1;
+    pthread_sigmask(SIG_SETMASK, &previa, NULL);
+    if (fd == -1) {
+        perror("Error: no se pudo abrir el canal (¿está el servidor ejecutándose?)");
+        chat_canal_cerrar(canal);
+        exit(1);
+    }
+
+    struct chat_sesion **sesiones = calloc(num, sizeof(*sesiones));
+    int *enviados = calloc(num, sizeof(int));
+    if (!sesiones || !enviados) {
+        perror("Error reservando las sesiones");
+        chat_canal_cerrar(canal);
+        exit(1);
+    }
+
+    long long inicio = ahora_ms();
+    char nombre[MAX_NOMBRE];
+    for (int i = 0; i < num && !terminar; i++) {
+        snprintf(nombre, sizeof(nombre), "%.*s%d", MAX_NOMBRE - 12, prefijo, i + 1);
+        while (!(sesiones[i] = chat_conectar_en(canal, nombre)) && errno == EAGAIN && !terminar) {
+            usleep(1000);  // Cola del servidor llena: dejar que procese los CONNECT
+        }
+        if (!sesiones[i] && !terminar) {
+            perror("Error conectando una sesión");
+            num = i;
+        }
+    }
+    fprintf(stderr, "[CARGA] %d sesiones conectadas en %lld ms (una cola de recepción)\n", 
+            num, ahora_ms() - inicio);
+
+    long total = (long)num * mensajes;
+    long total_enviados = 0, recibidos = 0, errores = 0, avisos = 0;
+    int siguiente = 0;                  // Sesión por la que sigue la próxima vuelta
+    long long fin = -1;                 // Fin de la espera tras enviar todo (-1 = enviando)
+    long long proximo_mantenimiento = 0, proximo_progreso = inicio + 1000;
+    struct pollfd p = {.fd = fd, .events = POLLIN};
+    inicio = ahora_ms();
+
+    while (!terminar && (fin == -1 || (recibidos + errores < total_enviados && ahora_ms() < fin))) {
+        // Recibir todo lo disponible, de cualquier sesión
+        struct chat_sesion *s;
+        struct chat_evento ev;
+        int r;
+        while ((r = chat_canal_recibir(canal, &s, &ev, 0)) == 1) {
+            if (ev.tipo == CHAT_EV_PRIVADO) {
+                recibidos++;
+            } else if (ev.tipo == CHAT_EV_RESPUESTA && ev.estado == ESTADO_ERROR) {
+                errores++;
+            } else if (ev.tipo == CHAT_EV_RESPUESTA && strncmp(ev.texto, "Error", 5) == 0) {
+                errores++;      // Los privados no llevan correlación: el rechazo es texto
+            } else if (ev.tipo == CHAT_EV_AVISO || ev.tipo == CHAT_EV_CONEXION) {
+                avisos++;
+            }
+        }
+        if (r == -1) {
+            perror("Error recibiendo del canal");
+            break;
+        }
+
+        long long ahora = ahora_ms();
+        if (ahora >= proximo_mantenimiento) {
+            chat_canal_mantener(canal);
+            proximo_mantenimiento = ahora + PERIODO_BUCLE_MS;
+        }
+        if (ahora >= proximo_progreso) {
+            fprintf(stderr, "[CARGA] %llds: %ld/%ld enviados, %ld recibidos, %ld errores\n", 
+                    (ahora - inicio) / 1000, total_enviados, total, recibidos, errores);
+            proximo_progreso = ahora + 1000;
+        }
+
+        // Una vuelta de envíos, repartida entre las sesiones
+        int vuelta = 0;
+        while (fin == -1 && vuelta < ENVIOS_POR_VUELTA && total_enviados < total) {
+            int i = siguiente;
+            if (enviados[i] < mensajes) {
+                char texto[MAX_TEXTO];
+                snprintf(texto, sizeof(texto), "carga %d/%d", enviados[i] + 1, mensajes);
+                snprintf(nombre, sizeof(nombre), "%.*s%d", MAX_NOMBRE - 12, prefijo, (i + 1) % num + 1);
+                if (chat_privado(sesiones[i], nombre, texto) == -1) {
+                    break;      // EAGAIN o ENOTCONN: se reintenta en la próxima vuelta
+                }
+                enviados[i]++;
+                total_enviados++;
+                vuelta++;
+            }
+            siguiente = (i + 1) % num;
+        }
+        if (fin == -1 && total_enviados == total) {
+            fin = ahora_ms() + (long long)espera * 1000;
+        }
+
+        if (poll(&p, 1, vuelta > 0 ? 0 : PERIODO_BUCLE_MS) == -1 && errno != EINTR) {
+            perror("Error en poll");
+            break;
+        }
+    }
+
+    long long ms = ahora_ms() - inicio;
+    printf("[CARGA] %d sesiones: %ld privados enviados, %ld recibidos, %ld errores, %ld avisos "
+           "en %lld ms (%.0f msg/s)\n", num, total_enviados, recibidos, errores, avisos, ms, 
+           ms > 0 ? recibidos * 1000.0 / ms : 0.0);
+
+    chat_canal_cerrar(canal);
+    free(sesiones);
+    free(enviados);
+}
+
+/* ==================== FUNCIÓN PRINCIPAL ==================== */
+
+/**
+ * Función principal del cliente de chat
+ * 
+ * Abre la sesión, delega la recepción en los hilos de la biblioteca y
+ * procesa comandos y mensajes desde la terminal o, en modo -b, desde
+ * una entrada sin interacción.
+ * 
+ * @param argc Número de argumentos de línea de comandos
+ * @param argv Array de argumentos (debe incluir nombre de usuario)
+ * @return 0 en terminación exitosa
+ */
+int main(int argc, char *argv[]) {
+    /* Procesar opciones de línea de comandos */
+    int opt;
+    const char *archivo = NULL;
+    int espera = 0;
+    int un_hilo = 0;
+    int num_sesiones = 0;
+    int mensajes = 10;
+    int comprimir = 0;
+    while ((opt = getopt(argc, argv, "betzf:w:n:m:")) != -1) {
+        if (opt == 'b') {
+            sin_terminal = 1;
+        } else if (opt == 'e') {
+            un_hilo = 1;
+        } else if (opt == 't') {
+            con_pantalla = 1;
+            un_hilo = 1;                // La pantalla se dibuja desde el bucle de eventos
+        } else if (opt == 'z') {
+            comprimir = 1;
+        } else if (opt == 'f') {
+            archivo = optarg;
+            sin_terminal = 1;
+        } else if (opt == 'w') {
+            espera = atoi(optarg);
+        } else if (opt == 'n') {
+            num_sesiones = atoi(optarg);
+        } else if (opt == 'm') {
+            mensajes = atoi(optarg);
+        } else {
+            optind = argc + 1;  // Forzar mensaje de uso
+            break;
+        }
+    }
+    
+    /* Validación de argumentos de entrada */
+    if (optind != argc - 1 || (con_pantalla && sin_terminal)) {
+        printf("Uso: %s [-b] [-e] [-z] [-f <archivo>] [-w <segundos>] <nombre_usuario>\n", argv[0]);
+        printf("     %s -t [-z] <nombre_usuario>\n", argv[0]);
+        printf("     %s -n <sesiones> [-m <mensajes>] [-w <segundos>] <prefijo>\n", argv[0]);
+        printf("Ejemplo: %s Juan\n", argv[0]);
+        exit(1);
+    }
+    
+    FILE *entrada = stdin;
+    if (archivo && !(entrada = fopen(archivo, "r"))) {
+        perror("Error abriendo archivo de entrada");
+        exit(1);
+    }
+    
+    /* Configuración inicial del sistema */
+    
+    // Ctrl+C interrumpe fgets (sin SA_RESTART) para salir limpiamente
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = pedir_salida;
+    sigaction(SIGINT, &sa, NULL);
+    
+    // Copiar nombre de usuario desde argumentos de línea de comandos
+    strncpy(nombre_usuario, argv[optind], MAX_NOMBRE - 1);
+
+    /* Prueba de carga: muchas sesiones en este proceso */
+    if (num_sesiones > 0) {
+        modo_carga(nombre_usuario, num_sesiones, mensajes, espera > 0 ? espera : ESPERA_CARGA);
+        return 0;
+    }
+
+    /* Establecer conexión con el servidor */
+    sesion = chat_conectar(nombre_usuario);
+    if (!sesion) {
+        fprintf(stderr, "Error: No se puede conectar al servidor.\n");
+        fprintf(stderr, "¿Está el servidor ejecutándose?\n");
+        exit(1);
+    }
+    
+    // Caché local de mensajes: al volver a una sala se ve lo anterior al
+    // instante. En modo -b no, para no alterar la salida de los bots
+    if (!sin_terminal && chat_usar_cache(sesion, NULL) == -1) {
+        perror("[AVISO] Caché local de mensajes no disponible");
+    }
+    chat_comprimir(sesion, comprimir);
+
+    /* Inicializar la recepción: hilos de la biblioteca o bucle de eventos (-e) */
+    
+    // Sin terminal, una línea por evento aunque la salida sea una tubería
+    if (sin_terminal) {
+        setvbuf(stdout, NULL, _IOLBF, 0);
+    }
+    
+    // Los hilos heredan SIGINT bloqueada: la señal siempre llega al hilo
+    // principal, que es el que está leyendo la entrada
+    sigset_t sigint, previa;
+    sigemptyset(&sigint);
+    sigaddset(&sigint, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigint, &previa);
+    int r = un_hilo ? chat_descriptor(sesion) :
+                      chat_escuchar(sesion, sin_terminal ? emitir_evento : mostrar_evento, NULL);
+    pthread_sigmask(SIG_SETMASK, &previa, NULL);
+    if (r == -1) {
+        perror("Error iniciando la recepción");
+        limpiar_y_salir(1);
+    }
+
+    if (con_pantalla && pantalla_iniciar() == -1) {
+        fprintf(stderr, "Error: la interfaz a pantalla completa (-t) necesita una terminal\n");
+        limpiar_y_salir(1);
+    }
+
+    if (con_pantalla) {
+        modo_pantalla(r);
+    } else if (un_hilo) {
+        modo_bucle_eventos(r, fileno(entrada), espera);
+    } else if (sin_terminal) {
+        modo_sin_terminal(entrada, espera);
+    } else {
+        modo_interactivo();
+    }
 
-    // Terminación normal del programa
-    limpiar_y_salir(0);
+    // Terminación normal del programa (o rechazada: el nombre ya estaba en uso)
+    limpiar_y_salir(nombre_en_uso ? 1 : 0);
     return 0;
 }
@@ -0,0 +1,264 @@
+/*
+ * cluster.c - Directorio compartido y anillo de hashing consistente
+ *
+ * El anillo no se guarda en memoria compartida: cada proceso lo calcula
+ * de forma determinista a partir de num_nodos (VNODOS_POR_NODO puntos
+ * por nodo), así que todos llegan al mismo dueño para una misma clave.
+ */
+
+#include <stdio.h>        // snprintf, perror
+#include <stdlib.h>       // qsort
+#include <string.h>       // strcmp, strncpy
+#include <sys/ipc.h>      // ftok
+#include <sys/shm.h>      // memoria compartida System V
+
+#include "cadenas_simd.h" // hash_nombre
+#include "cluster.h"
+
+/* ==================== ANILLO DE HASHING CONSISTENTE ==================== */
+
+struct punto_anillo {
+    unsigned int hash;              // Posición en el anillo
+    int nodo;                       // Nodo dueño del tramo que termina aquí
+};
+
+static struct punto_anillo anillo[MAX_NODOS * VNODOS_POR_NODO];
+static int anillo_nodos = 0;        // num_nodos con el que se construyó el anillo
+
+/**
+ * Posición en el anillo de una cadena
+ *
+ * FNV-1a seguido del mezclador final de MurmurHash3: sin él, etiquetas
+ * que sólo difieren en un carácter ("nodo-0#5", "nodo-1#5") quedan muy
+ * próximas en el anillo y el reparto entre nodos sale muy desigual.
+ */
+static unsigned int posicion_anillo(const char *cadena) {
+    unsigned int h = hash_nombre(cadena);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static int comparar_puntos(const void *a, const void *b) {
+    unsigned int x = ((const struct punto_anillo *)a)->hash;
+    unsigned int y = ((const struct punto_anillo *)b)->hash;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Construir el anillo para un número de nodos (sólo si cambió)
+ *
+ * @param num_nodos Número de nodos del cluster
+ */
+static void construir_anillo(int num_nodos) {
+    if (num_nodos == anillo_nodos) {
+        return;
+    }
+
+    int n = 0;
+    for (int k = 0; k < num_nodos; k++) {
+        for (int v = 0; v < VNODOS_POR_NODO; v++) {
+            char etiqueta[32];
+            snprintf(etiqueta, sizeof(etiqueta), "nodo-%d#%d", k, v);
+            anillo[n].hash = posicion_anillo(etiqueta);
+            anillo[n].nodo = k;
+            n++;
+        }
+    }
+    qsort(anillo, n, sizeof(anillo[0]), comparar_puntos);
+    anillo_nodos = num_nodos;
+}
+
+int nodo_de_clave(const struct directorio *dir, const char *clave) {
+    int num_nodos = dir->num_nodos;
+    if (num_nodos <= 0 || num_nodos > MAX_NODOS) {
+        return -1;
+    }
+    construir_anillo(num_nodos);
+
+    // Búsqueda binaria del primer punto con hash >= hash(clave)
+    int total = num_nodos * VNODOS_POR_NODO;
+    unsigned int h = posicion_anillo(clave);
+    int ini = 0, fin = total;
+    while (ini < fin) {
+        int medio = (ini + fin) / 2;
+        if (anillo[medio].hash < h) {
+            ini = medio + 1;
+        } else {
+            fin = medio;
+        }
+    }
+
+    // Avanzar en sentido horario hasta un nodo activo
+    for (int i = 0; i < total; i++) {
+        int nodo = anillo[(ini + i) % total].nodo;
+        if (dir->colas[nodo] != -1) {
+            return nodo;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Obtener la clave de reparto de un mensaje
+ *
+ * Los mensajes de sala se reparten por nombre de sala; las sesiones por
+ * nombre de usuario, de modo que el índice de sesiones también queda
+ * particionado y un DM se resuelve en el nodo dueño del destinatario.
+ *
+ * @param msg Mensaje a enrutar
+ * @return Clave (sala o usuario), o NULL si el mensaje lo atiende cualquier nodo
+ */
+const char *clave_de_reparto(const struct mensaje *msg) {
+    switch (msg->mtype) {
+    case TIPO_JOIN: case TIPO_MSG: case TIPO_LEAVE: case TIPO_USERS:
+    case TIPO_FILTER: case TIPO_OBSERVE: case TIPO_RELAY_REG: case TIPO_RELAY_DEL:
+    case TIPO_BACKFILL: case TIPO_DICCIONARIO: case TIPO_MIEMBROS:
+    case TIPO_DM:  // En DM el campo sala contiene al destinatario
+        return msg->sala;
+    case TIPO_CONNECT: case TIPO_DISCONNECT:
+        return msg->remitente;
+    default:
+        return NULL;
+    }
+}
+
+/* ==================== REUBICACIONES (REBALANCEO) ==================== */
+
+int nodo_de_sala(const struct directorio *dir, const char *sala) {
+    // Una reubicación sólo vale mientras su nodo siga activo
+    for (int i = 0; i < MAX_REUBICACIONES; i++) {
+        const struct reubicacion *r = &dir->reubicaciones[i];
+        int nodo = r->nodo;
+        if (nodo >= 0 && nodo < MAX_NODOS && dir->colas[nodo] != -1 &&
+            strcmp(r->sala, sala) == 0) {
+            return nodo;
+        }
+    }
+    return nodo_de_clave(dir, sala);
+}
+
+int nodo_de_mensaje(const struct directorio *dir, const struct mensaje *msg) {
+    const char *clave = clave_de_reparto(msg);
+    if (!clave) {
+        return -1;
+    }
+    if (msg->mtype == TIPO_DM || msg->mtype == TIPO_CONNECT || msg->mtype == TIPO_DISCONNECT) {
+        return nodo_de_clave(dir, clave);  // Sesiones: siempre por el anillo
+    }
+    return nodo_de_sala(dir, clave);
+}
+
+/**
+ * Publicar el nuevo nodo de una sala
+ *
+ * La entrada se completa antes de activarla (nodo se escribe al final,
+ * tras una barrera), así un lector nunca ve un nombre a medio copiar.
+ *
+ * @param dir Directorio del cluster
+ * @param sala Nombre de la sala
+ * @param nodo Nodo que la atiende desde ahora
+ * @return 0 si éxito, -1 si la tabla de reubicaciones está llena
+ */
+int fijar_reubicacion(struct directorio *dir, const char *sala, int nodo) {
+    int libre = -1;
+    int anillo_propio = (nodo_de_clave(dir, sala) == nodo);
+
+    for (int i = 0; i < MAX_REUBICACIONES; i++) {
+        struct reubicacion *r = &dir->reubicaciones[i];
+        if (r->nodo != -1 && strcmp(r->sala, sala) == 0) {
+            // Volver al nodo del anillo equivale a borrar la excepción
+            r->nodo = anillo_propio ? -1 : nodo;
+            dir->version++;
+            return 0;
+        }
+        if (libre == -1 && (r->nodo == -1 || dir->colas[r->nodo] == -1)) {
+            libre = i;
+        }
+    }
+
+    if (anillo_propio) {
+        return 0;
+    }
+    if (libre == -1) {
+        return -1;
+    }
+
+    struct reubicacion *r = &dir->reubicaciones[libre];
+    r->nodo = -1;
+    __sync_synchronize();
+    strncpy(r->sala, sala, MAX_NOMBRE - 1);
+    r->sala[MAX_NOMBRE - 1] = '\0';
+    __sync_synchronize();
+    r->nodo = nodo;
+    dir->version++;
+    return 0;
+}
+
+/* ==================== DIRECTORIO EN MEMORIA COMPARTIDA ==================== */
+
+/**
+ * Adjuntar el directorio del cluster
+ *
+ * Un segmento recién creado llega lleno de ceros; el primer nodo que lo
+ * adjunta lo inicializa (num_nodos == 0 indica "sin inicializar").
+ *
+ * @param crear Distinto de 0 para crearlo si no existe (servidores)
+ * @return Puntero al directorio, o NULL si no existe / error
+ */
+struct directorio *directorio_adjuntar(int crear) {
+    key_t key = ftok("/tmp", PROYECTO_DIRECTORIO);
+    if (key == (key_t)-1) {
+        return NULL;
+    }
+
+    int shmid = shmget(key, sizeof(struct directorio), crear ? (IPC_CREAT | 0666) : 0666);
+    if (shmid == -1) {
+        if (crear) {
+            perror("[ERROR] shmget del directorio del cluster");
+        }
+        return NULL;
+    }
+
+    void *p = shmat(shmid, NULL, 0);
+    if (p == (void *)-1) {
+        perror("[ERROR] shmat del directorio del cluster");
+        return NULL;
+    }
+
+    struct directorio *dir = p;
+    if (crear && dir->num_nodos == 0) {
+        for (int k = 0; k < MAX_NODOS; k++) {
+            dir->colas[k] = -1;
+            dir->pids[k] = 0;
+        }
+        for (int i = 0; i < MAX_REUBICACIONES; i++) {
+            dir->reubicaciones[i].nodo = -1;
+        }
+    }
+    return dir;
+}
+
+void directorio_liberar(struct directorio *dir) {
+    if (!dir) {
+        return;
+    }
+
+    int activos = 0;
+    for (int k = 0; k < MAX_NODOS; k++) {
+        activos += (dir->colas[k] != -1);
+    }
+
+    if (activos == 0) {
+        // Último nodo: marcar el segmento para eliminarlo al desadjuntar
+        key_t key = ftok("/tmp", PROYECTO_DIRECTORIO);
+        int shmid = shmget(key, 0, 0);
+        if (shmid != -1) {
+            shmctl(shmid, IPC_RMID, NULL);
+        }
+    }
+    shmdt(dir);
+}
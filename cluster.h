@@ -0,0 +1,84 @@
+/*
+ * cluster.h - Directorio de nodos y reparto de salas por hashing consistente
+ *
+ * Varios procesos servidor pueden repartirse las salas: cada nodo tiene su
+ * propia cola de entrada y es dueño de las salas (y de las sesiones de
+ * usuario) cuyo nombre cae en su tramo del anillo de hashing consistente.
+ *
+ * El directorio es un pequeño segmento de memoria compartida System V con
+ * la cola de entrada de cada nodo, sus métricas de carga y las salas
+ * reubicadas por el rebalanceo (que prevalecen sobre el anillo). Los
+ * clientes lo leen para enviar cada
+ * solicitud directamente al dueño; cualquier nodo que reciba algo que no
+ * le corresponde lo reenvía (hace de "shim"), así los clientes sin
+ * directorio siguen funcionando a través de la cola global conocida.
+ */
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <sys/types.h>    // pid_t
+
+#include "protocolo.h"    // struct mensaje y tipos
+
+#define MAX_NODOS 16                // Nodos máximos en un cluster local
+#define VNODOS_POR_NODO 64          // Puntos virtuales por nodo en el anillo
+#define PROYECTO_DIRECTORIO 'D'     // proj_id de ftok para el directorio
+#define PROYECTO_NODO(k) ('A' + (k))  // proj_id de ftok de la cola del nodo k ('A' = nodo 0)
+#define MAX_REUBICACIONES 64        // Salas movidas fuera de su nodo del anillo
+
+/**
+ * Métricas de carga publicadas por cada nodo (una vez por segundo)
+ */
+struct metricas_nodo {
+    int profundidad;                // Mensajes pendientes en su cola de entrada
+    int mensajes_por_seg;           // Mensajes procesados en el último segundo
+    int cpu_pct;                    // Uso de CPU del proceso en el último segundo
+    int num_salas;                  // Salas que atiende
+};
+
+/**
+ * Sala reubicada por el rebalanceo (nodo = -1: entrada libre)
+ */
+struct reubicacion {
+    char sala[MAX_NOMBRE];          // Nombre de la sala
+    int nodo;                       // Nodo que la atiende ahora
+};
+
+/**
+ * Directorio compartido del cluster
+ *
+ * colas[k] = -1 indica que el nodo k no está activo: sus claves pasan al
+ * siguiente nodo activo del anillo (sólo se mueven las suyas).
+ */
+struct directorio {
+    int num_nodos;                  // Tamaño configurado del cluster
+    int version;                    // Se incrementa en cada cambio de colas[]
+    int colas[MAX_NODOS];           // Cola de entrada de cada nodo (-1 = inactivo)
+    pid_t pids[MAX_NODOS];          // PID de cada nodo (para diagnóstico)
+    struct metricas_nodo metricas[MAX_NODOS];              // Carga de cada nodo
+    struct reubicacion reubicaciones[MAX_REUBICACIONES];   // Excepciones al anillo
+};
+
+/* Adjunta el directorio; crear != 0 lo crea si no existe. NULL si no hay cluster */
+struct directorio *directorio_adjuntar(int crear);
+
+/* Desadjunta; si ya no queda ningún nodo activo, elimina el segmento */
+void directorio_liberar(struct directorio *dir);
+
+/* Nodo dueño de una clave (nombre de sala o de usuario), o -1 si no hay nodos activos */
+int nodo_de_clave(const struct directorio *dir, const char *clave);
+
+/* Clave de reparto de un mensaje (sala o usuario), o NULL si lo atiende cualquier nodo */
+const char *clave_de_reparto(const struct mensaje *msg);
+
+/* Nodo que atiende una sala: reubicación vigente o, si no hay, el anillo */
+int nodo_de_sala(const struct directorio *dir, const char *sala);
+
+/* Nodo que debe procesar un mensaje, o -1 si lo atiende cualquier nodo */
+int nodo_de_mensaje(const struct directorio *dir, const struct mensaje *msg);
+
+/* Publica que una sala pasa a 'nodo' (si coincide con el anillo, se borra la excepción) */
+int fijar_reubicacion(struct directorio *dir, const char *sala, int nodo);
+
+#endif /* CLUSTER_H */
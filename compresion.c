@@ -0,0 +1,340 @@
+/*
+ * compresion.c - Compresión de textos largos con diccionario por sala
+ *
+ * Formato comprimido: una serie de secuencias
+ *   token | literales extra | literales | desplazamiento (2 bytes) | coincidencia extra
+ * El nibble alto del token es el número de literales y el bajo la
+ * longitud de la coincidencia menos MIN_COINCIDENCIA; 15 indica que
+ * siguen bytes extra (255 = continúa). La última secuencia sólo lleva
+ * literales. El diccionario se coloca delante del texto en un mismo
+ * buffer: un desplazamiento que retrocede más allá del texto apunta a él.
+ */
+
+#include <stdlib.h>       // malloc, calloc, free
+#include <string.h>       // memcpy, memmove
+#include <stdint.h>       // uint32_t
+
+#include "compresion.h"
+
+#define MIN_COINCIDENCIA 4              // Coincidencia más corta que compensa
+#define MAX_DESPLAZAMIENTO 65535        // Ventana (desplazamiento de 16 bits)
+#define BITS_HASH 13                    // Tabla de posiciones del compresor
+#define GRAMA 8                         // Bytes de cada trozo contado al entrenar
+#define SEGMENTO 64                     // Bytes que el entrenamiento elige de una vez
+#define BITS_CONTEO 16                  // Tabla de frecuencias del entrenamiento
+
+static uint32_t leer32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned int hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - BITS_HASH);
+}
+
+/**
+ * FNV-1a de 32 bits de un bloque de bytes
+ */
+static uint32_t fnv(const void *datos, size_t n, uint32_t h) {
+    const unsigned char *p = datos;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* ==================== COMPRESIÓN ==================== */
+
+/**
+ * Escribir una longitud extra (bytes de 255 y un resto menor)
+ */
+static void escribir_extra(unsigned char *d, size_t *o, size_t largo) {
+    while (largo >= 255) {
+        d[(*o)++] = 255;
+        largo -= 255;
+    }
+    d[(*o)++] = (unsigned char)largo;
+}
+
+/**
+ * Escribir una secuencia (literales y, si largo > 0, una coincidencia)
+ *
+ * @return 0 si cabe, -1 si no queda sitio en destino
+ */
+static int escribir_secuencia(unsigned char *d, size_t *o, size_t cap, const unsigned char *literales,
+                              size_t num_literales, size_t desplazamiento, size_t largo) {
+    size_t necesario = 1 + num_literales / 255 + 1 + num_literales + 2 + largo / 255 + 1;
+    if (*o + necesario > cap) {
+        return -1;
+    }
+
+    size_t extra = largo ? largo - MIN_COINCIDENCIA : 0;
+    d[*o] = (unsigned char)(((num_literales < 15 ? num_literales : 15) << 4) | (extra < 15 ? extra : 15));
+    (*o)++;
+    if (num_literales >= 15) {
+        escribir_extra(d, o, num_literales - 15);
+    }
+    memcpy(d + *o, literales, num_literales);
+    *o += num_literales;
+    if (largo == 0) {
+        return 0;
+    }
+    d[(*o)++] = (unsigned char)(desplazamiento & 0xff);
+    d[(*o)++] = (unsigned char)(desplazamiento >> 8);
+    if (extra >= 15) {
+        escribir_extra(d, o, extra - 15);
+    }
+    return 0;
+}
+
+size_t comprimir(const void *dicc, size_t tam_dicc, const void *origen, size_t n,
+                 void *destino, size_t cap) {
+    if (!dicc) {
+        tam_dicc = 0;
+    }
+    if (tam_dicc > MAX_DESPLAZAMIENTO) {
+        dicc = (const char *)dicc + tam_dicc - MAX_DESPLAZAMIENTO;  // Sólo se alcanza el final
+        tam_dicc = MAX_DESPLAZAMIENTO;
+    }
+    unsigned char *buf = malloc(tam_dicc + n);
+    int *tabla = malloc(sizeof(int) << BITS_HASH);
+    if (!buf || !tabla) {
+        free(buf);
+        free(tabla);
+        return 0;
+    }
+    if (tam_dicc > 0) {
+        memcpy(buf, dicc, tam_dicc);
+    }
+    memcpy(buf + tam_dicc, origen, n);
+    for (int i = 0; i < (1 << BITS_HASH); i++) {
+        tabla[i] = -1;
+    }
+    for (size_t i = 0; i + MIN_COINCIDENCIA <= tam_dicc; i++) {
+        tabla[hash4(leer32(buf + i))] = (int)i;
+    }
+
+    unsigned char *d = destino;
+    size_t o = 0;
+    size_t fin = tam_dicc + n;
+    size_t ancla = tam_dicc;            // Primer literal pendiente
+    size_t i = tam_dicc;
+    int error = 0;
+    while (i + MIN_COINCIDENCIA <= fin) {
+        uint32_t v = leer32(buf + i);
+        unsigned int h = hash4(v);
+        int candidato = tabla[h];
+        tabla[h] = (int)i;
+        if (candidato < 0 || i - (size_t)candidato > MAX_DESPLAZAMIENTO || leer32(buf + candidato) != v) {
+            i++;
+            continue;
+        }
+
+        size_t largo = MIN_COINCIDENCIA;
+        while (i + largo < fin && buf[candidato + largo] == buf[i + largo]) {
+            largo++;
+        }
+        if (escribir_secuencia(d, &o, cap, buf + ancla, i - ancla, i - (size_t)candidato, largo) == -1) {
+            error = 1;
+            break;
+        }
+        // Las posiciones dentro de la coincidencia también sirven para las siguientes
+        for (size_t k = i + 1; k < i + largo && k + MIN_COINCIDENCIA <= fin; k++) {
+            tabla[hash4(leer32(buf + k))] = (int)k;
+        }
+        i += largo;
+        ancla = i;
+    }
+    if (!error && escribir_secuencia(d, &o, cap, buf + ancla, fin - ancla, 0, 0) == -1) {
+        error = 1;
+    }
+
+    free(buf);
+    free(tabla);
+    return error ? 0 : o;
+}
+
+/* ==================== DESCOMPRESIÓN ==================== */
+
+/**
+ * Leer una longitud extra
+ *
+ * @return 0 si éxito, -1 si los datos se acaban antes
+ */
+static int leer_extra(const unsigned char **p, const unsigned char *fin, size_t *largo) {
+    unsigned char b;
+    do {
+        if (*p >= fin) {
+            return -1;
+        }
+        b = *(*p)++;
+        *largo += b;
+    } while (b == 255);
+    return 0;
+}
+
+size_t descomprimir(const void *dicc, size_t tam_dicc, const void *origen, size_t n,
+                    void *destino, size_t cap) {
+    if (!dicc) {
+        tam_dicc = 0;
+    }
+    if (tam_dicc > MAX_DESPLAZAMIENTO) {
+        dicc = (const char *)dicc + tam_dicc - MAX_DESPLAZAMIENTO;
+        tam_dicc = MAX_DESPLAZAMIENTO;
+    }
+    unsigned char *buf = malloc(tam_dicc + cap);
+    if (!buf) {
+        return (size_t)-1;
+    }
+    if (tam_dicc > 0) {
+        memcpy(buf, dicc, tam_dicc);
+    }
+
+    const unsigned char *p = origen;
+    const unsigned char *fin = p + n;
+    size_t o = tam_dicc;
+    size_t limite = tam_dicc + cap;
+    while (p < fin) {
+        unsigned int token = *p++;
+        size_t literales = token >> 4;
+        if (literales == 15 && leer_extra(&p, fin, &literales) == -1) {
+            goto danado;
+        }
+        if (literales > (size_t)(fin - p) || literales > limite - o) {
+            goto danado;
+        }
+        memcpy(buf + o, p, literales);
+        o += literales;
+        p += literales;
+        if (p == fin) {
+            break;  // Última secuencia: sólo literales
+        }
+
+        if (fin - p < 2) {
+            goto danado;
+        }
+        size_t desplazamiento = p[0] | ((size_t)p[1] << 8);
+        p += 2;
+        size_t largo = (token & 15) + MIN_COINCIDENCIA;
+        if ((token & 15) == 15 && leer_extra(&p, fin, &largo) == -1) {
+            goto danado;
+        }
+        if (desplazamiento == 0 || desplazamiento > o || largo > limite - o) {
+            goto danado;
+        }
+        // Byte a byte: la coincidencia puede solaparse con lo que escribe
+        for (size_t k = 0; k < largo; k++) {
+            buf[o + k] = buf[o - desplazamiento + k];
+        }
+        o += largo;
+    }
+
+    memcpy(destino, buf + tam_dicc, o - tam_dicc);
+    free(buf);
+    return o - tam_dicc;
+
+danado:
+    free(buf);
+    return (size_t)-1;
+}
+
+/* ==================== DICCIONARIO ==================== */
+
+size_t entrenar_diccionario(const char *muestras, size_t n, char *dicc, size_t cap) {
+    if (n < SEGMENTO * 2) {
+        // Muy poco texto: el propio texto es el diccionario
+        size_t tam = n < cap ? n : cap;
+        memcpy(dicc, muestras + n - tam, tam);
+        return tam;
+    }
+
+    // Frecuencia de cada trozo de GRAMA bytes (por su hash)
+    size_t num = n - GRAMA + 1;
+    unsigned short *conteo = calloc((size_t)1 << BITS_CONTEO, sizeof(unsigned short));
+    unsigned short *hashes = malloc(num * sizeof(unsigned short));
+    if (!conteo || !hashes) {
+        free(conteo);
+        free(hashes);
+        return 0;
+    }
+    for (size_t i = 0; i < num; i++) {
+        hashes[i] = (unsigned short)(fnv(muestras + i, GRAMA, 2166136261u) >> (32 - BITS_CONTEO));
+        if (conteo[hashes[i]] < 65535) {
+            conteo[hashes[i]]++;
+        }
+    }
+
+    // Elegir una y otra vez el segmento cuyos trozos más se repiten; los
+    // trozos elegidos dejan de puntuar, así no se repite contenido
+    size_t puestos = 0;
+    while (puestos + SEGMENTO <= cap) {
+        size_t mejor = 0;
+        unsigned long mejor_puntos = 0;
+        for (size_t pos = 0; pos + SEGMENTO <= n; pos += SEGMENTO / 4) {
+            unsigned long puntos = 0;
+            for (size_t k = 0; k + GRAMA <= SEGMENTO; k++) {
+                unsigned short c = conteo[hashes[pos + k]];
+                puntos += c > 1 ? c - 1 : 0;    // Un trozo visto una vez no se repite
+            }
+            if (puntos > mejor_puntos) {
+                mejor_puntos = puntos;
+                mejor = pos;
+            }
+        }
+        if (mejor_puntos == 0) {
+            break;
+        }
+        // Los más valiosos al final: quedan más cerca del texto (desplazamientos cortos)
+        puestos += SEGMENTO;
+        memcpy(dicc + cap - puestos, muestras + mejor, SEGMENTO);
+        for (size_t k = 0; k + GRAMA <= SEGMENTO; k++) {
+            conteo[hashes[mejor + k]] = 0;
+        }
+    }
+    memmove(dicc, dicc + cap - puestos, puestos);
+
+    free(conteo);
+    free(hashes);
+    return puestos;
+}
+
+unsigned int huella_diccionario(const void *dicc, size_t tam) {
+    uint32_t h = fnv(dicc, tam, 2166136261u);
+    return h ? h : 1;
+}
+
+key_t clave_diccionario(const char *sala, unsigned int huella) {
+    uint32_t h = fnv(sala, strlen(sala), 2166136261u);
+    h = fnv(&huella, sizeof(huella), h);
+    return (key_t)((h & 0x7fffffff) | 1);  // Nunca IPC_PRIVATE (0)
+}
+
+/* ==================== TRANSPORTE COMO TEXTO ==================== */
+
+size_t escapar_binario(const void *origen, size_t n, char *destino) {
+    const unsigned char *p = origen;
+    size_t o = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = p[i];
+        if (c == '\0' || c == '\n' || c == '\r' || c == ESCAPE_COMPRESION) {
+            destino[o++] = ESCAPE_COMPRESION;
+            c ^= 0x40;
+        }
+        destino[o++] = (char)c;
+    }
+    return o;
+}
+
+size_t desescapar_binario(const char *origen, size_t n, void *destino) {
+    unsigned char *d = destino;
+    size_t o = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)origen[i];
+        if (c == ESCAPE_COMPRESION && i + 1 < n) {
+            c = (unsigned char)origen[++i] ^ 0x40;
+        }
+        d[o++] = c;
+    }
+    return o;
+}
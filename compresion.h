@@ -0,0 +1,57 @@
+/*
+ * compresion.h - Compresión de textos largos con diccionario por sala
+ *
+ * Un compresor LZ77 sencillo y rápido (formato tipo LZ4: secuencias de
+ * literales y coincidencias con desplazamiento de 16 bits) que admite un
+ * diccionario previo: las coincidencias pueden apuntar a él como si
+ * precediera al texto. Con el diccionario entrenado de la sala, incluso
+ * los textos de pocos KB encuentran coincidencias desde el primer byte.
+ *
+ * El servidor entrena el diccionario de cada sala con el texto que pasa
+ * por ella, lo guarda en "<sala>.dic" y lo publica en un segmento de
+ * memoria compartida cuya clave sale del nombre de la sala y de la
+ * huella del diccionario: cualquier cliente lo encuentra sin preguntar.
+ *
+ * Lo comprimido es binario; antes de viajar en el campo texto se escapa
+ * para que no contenga '\0' ni saltos de línea (el historial del servidor
+ * es de una línea por mensaje).
+ */
+
+#ifndef COMPRESION_H
+#define COMPRESION_H
+
+#include <stddef.h>       // size_t
+#include <sys/types.h>    // key_t
+
+#define DICC_TAM 4096                // Bytes de un diccionario de sala
+#define DICC_MUESTRAS (32 * 1024)    // Texto reunido para entrenarlo
+#define ESCAPE_COMPRESION 0x1b       // Prefijo de un byte escapado
+
+/* Comprime n bytes con el diccionario (puede ser NULL). Devuelve los bytes
+ * escritos en destino, o 0 si no caben en cap (el texto no se comprime bien) */
+size_t comprimir(const void *dicc, size_t tam_dicc, const void *origen, size_t n,
+                 void *destino, size_t cap);
+
+/* Descomprime con el mismo diccionario. Devuelve los bytes escritos en
+ * destino, o (size_t)-1 si los datos están dañados o no caben en cap */
+size_t descomprimir(const void *dicc, size_t tam_dicc, const void *origen, size_t n,
+                    void *destino, size_t cap);
+
+/* Entrena un diccionario de hasta cap bytes con las muestras: los trozos
+ * más repetidos, los más valiosos al final. Devuelve su tamaño */
+size_t entrenar_diccionario(const char *muestras, size_t n, char *dicc, size_t cap);
+
+/* Huella del diccionario (nunca 0: 0 significa "sin diccionario") */
+unsigned int huella_diccionario(const void *dicc, size_t tam);
+
+/* Clave del segmento de memoria compartida del diccionario de una sala */
+key_t clave_diccionario(const char *sala, unsigned int huella);
+
+/* Escapa datos binarios como texto sin '\0', '\n' ni '\r' (destino: 2 * n).
+ * Devuelve los bytes escritos */
+size_t escapar_binario(const void *origen, size_t n, char *destino);
+
+/* Deshace escapar_binario (destino: n). Devuelve los bytes escritos */
+size_t desescapar_binario(const char *origen, size_t n, void *destino);
+
+#endif /* COMPRESION_H */
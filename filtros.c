@@ -0,0 +1,148 @@
+/*
+ * filtros.c - Construcción y evaluación del autómata Aho-Corasick
+ *
+ * Construcción clásica en dos fases: primero se insertan los patrones en
+ * un trie y luego un recorrido en anchura calcula los enlaces de fallo y
+ * completa la tabla de transiciones, de modo que la evaluación es un
+ * único acceso a tabla por byte de texto, sin retrocesos.
+ */
+
+#include <string.h>       // memset, strlen
+
+#include "filtros.h"
+
+/**
+ * Normalizar un byte para la búsqueda
+ *
+ * Letras ASCII a minúsculas; letras, dígitos, '_', '@' y bytes UTF-8
+ * (>= 128) se conservan; cualquier otro byte pasa a ser un separador.
+ */
+static unsigned char normalizar(unsigned char c) {
+    if (c >= 'A' && c <= 'Z') {
+        return (unsigned char)(c - 'A' + 'a');
+    }
+    if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '@' || c >= 128) {
+        return c;
+    }
+    return ' ';
+}
+
+void ac_reiniciar(struct automata *a) {
+    // Sólo se limpia la raíz: los demás nodos se inicializan al crearse
+    a->num_nodos = 1;
+    a->compilado = 0;
+    memset(a->siguiente[0], 0, sizeof(a->siguiente[0]));
+    a->fallo[0] = 0;
+    a->salida[0] = 0;
+}
+
+/**
+ * Agregar un patrón al trie
+ *
+ * El patrón se normaliza y se rodea de separadores (" patron ") para que
+ * sólo coincida como palabra completa. Un mismo patrón agregado por varios
+ * miembros acumula sus bits en el mismo nodo final.
+ *
+ * @param a Autómata (no compilado o que se recompilará después)
+ * @param patron Palabra clave o mención "@usuario"
+ * @param miembros Máscara de miembros interesados en el patrón
+ * @return 0 si éxito, -1 si el patrón es vacío/largo o el trie está lleno
+ */
+int ac_agregar(struct automata *a, const char *patron, mascara_t miembros) {
+    size_t len = strlen(patron);
+    if (len == 0 || len + 2 > AC_MAX_PATRON) {
+        return -1;
+    }
+
+    unsigned char norm[AC_MAX_PATRON];
+    norm[0] = ' ';
+    for (size_t i = 0; i < len; i++) {
+        norm[i + 1] = normalizar((unsigned char)patron[i]);
+    }
+    norm[len + 1] = ' ';
+
+    int estado = 0;
+    for (size_t i = 0; i < len + 2; i++) {
+        unsigned short sig = a->siguiente[estado][norm[i]];
+        if (sig == 0) {
+            if (a->num_nodos >= AC_MAX_NODOS) {
+                return -1;  // Trie lleno: el patrón se ignora
+            }
+            sig = (unsigned short)a->num_nodos++;
+            memset(a->siguiente[sig], 0, sizeof(a->siguiente[sig]));
+            a->salida[sig] = 0;
+            a->siguiente[estado][norm[i]] = sig;
+        }
+        estado = sig;
+    }
+    a->salida[estado] |= miembros;
+    a->compilado = 0;
+    return 0;
+}
+
+/**
+ * Compilar el autómata
+ *
+ * Recorrido en anchura desde la raíz: para cada transición ausente se
+ * copia la del enlace de fallo, y cada nodo hereda las salidas de su
+ * enlace de fallo. El resultado es un DFA completo.
+ */
+void ac_compilar(struct automata *a) {
+    unsigned short cola[AC_MAX_NODOS];
+    int ini = 0, fin = 0;
+
+    // Hijos directos de la raíz: su enlace de fallo es la raíz
+    for (int c = 0; c < 256; c++) {
+        unsigned short hijo = a->siguiente[0][c];
+        if (hijo) {
+            a->fallo[hijo] = 0;
+            cola[fin++] = hijo;
+        }
+    }
+
+    while (ini < fin) {
+        unsigned short u = cola[ini++];
+        for (int c = 0; c < 256; c++) {
+            unsigned short v = a->siguiente[u][c];
+            if (v) {
+                a->fallo[v] = a->siguiente[a->fallo[u]][c];
+                a->salida[v] |= a->salida[a->fallo[v]];
+                cola[fin++] = v;
+            } else {
+                a->siguiente[u][c] = a->siguiente[a->fallo[u]][c];
+            }
+        }
+    }
+    a->compilado = 1;
+}
+
+/**
+ * Evaluar el autómata sobre el texto de un mensaje
+ *
+ * Una sola pasada (con separadores virtuales al inicio y al final del
+ * texto). Termina antes si ya se encontraron todos los miembros de
+ * 'objetivo', ya que no hay nada más que decidir.
+ *
+ * @param a Autómata compilado
+ * @param texto Texto del mensaje terminado en '\0'
+ * @param objetivo Máscara de miembros cuyo resultado interesa
+ * @return Máscara de miembros con al menos un patrón presente en el texto
+ */
+mascara_t ac_evaluar(const struct automata *a, const char *texto, mascara_t objetivo) {
+    if (a->num_nodos <= 1 || !a->compilado) {
+        return 0;
+    }
+
+    mascara_t resultado = 0;
+    int estado = a->siguiente[0][' '];
+    for (const unsigned char *p = (const unsigned char *)texto; *p; p++) {
+        estado = a->siguiente[estado][normalizar(*p)];
+        resultado |= a->salida[estado];
+        if ((resultado & objetivo) == objetivo) {
+            return resultado;
+        }
+    }
+    estado = a->siguiente[estado][' '];
+    resultado |= a->salida[estado];
+    return resultado;
+}
@@ -0,0 +1,51 @@
+/*
+ * filtros.h - Autómata Aho-Corasick para entrega selectiva de mensajes
+ *
+ * Cada sala compila en un único autómata todas las palabras clave y
+ * menciones ("@usuario") de los miembros que tienen filtro activo. Cada
+ * patrón lleva asociada una máscara de bits con los miembros interesados,
+ * de modo que una sola pasada sobre el texto de un mensaje devuelve el
+ * conjunto de destinatarios filtrados que deben recibirlo.
+ *
+ * Las coincidencias son de palabra completa y sin distinguir mayúsculas
+ * (ASCII): el texto se normaliza y los patrones se buscan rodeados de
+ * separadores, así "gol" coincide en "GOL!!" pero no en "golpe". Los bytes
+ * UTF-8 cuentan como letras: tras "¡" (sin espacio) no hay límite de palabra.
+ */
+
+#ifndef FILTROS_H
+#define FILTROS_H
+
+#define AC_MAX_NODOS 2048    // Nodos máximos del trie por sala
+#define AC_MAX_PATRON 64     // Longitud máxima de un patrón (incluye separadores)
+
+typedef unsigned long long mascara_t;   // Un bit por posición de miembro en la sala
+
+/**
+ * Autómata determinista Aho-Corasick
+ *
+ * Tras ac_compilar(), siguiente[][] es la función de transición completa
+ * (ya incluye los enlaces de fallo) y salida[] acumula las máscaras de
+ * todos los patrones que terminan en cada estado.
+ */
+struct automata {
+    int num_nodos;                                  // Nodos usados (0 = sólo raíz vacía)
+    int compilado;                                  // 1 si siguiente[] ya es un DFA completo
+    unsigned short siguiente[AC_MAX_NODOS][256];   // Transiciones por byte normalizado
+    unsigned short fallo[AC_MAX_NODOS];            // Enlace de fallo de cada nodo
+    mascara_t salida[AC_MAX_NODOS];                // Máscara de miembros por estado
+};
+
+/* Vacía el autómata (sólo queda la raíz) */
+void ac_reiniciar(struct automata *a);
+
+/* Agrega un patrón (palabra o "@usuario") para los miembros de la máscara: 0 o -1 si no cabe */
+int ac_agregar(struct automata *a, const char *patron, mascara_t miembros);
+
+/* Calcula enlaces de fallo y transiciones completas; necesario antes de evaluar */
+void ac_compilar(struct automata *a);
+
+/* Máscara de miembros cuyos patrones aparecen en el texto (para al llegar a 'objetivo') */
+mascara_t ac_evaluar(const struct automata *a, const char *texto, mascara_t objetivo);
+
+#endif /* FILTROS_H */
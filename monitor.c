@@ -0,0 +1,366 @@
+/*
+ * monitor.c - Monitor en Vivo de un Nodo del Servidor de Chat (estilo top)
+ *
+ * Pide cada intervalo la orden "monitor" por la cola de administración
+ * del nodo y redibuja una tabla con:
+ * - Ocupación del bucle de despacho, mensajes en la cola global, salas
+ *   y sesiones
+ * - Salas ordenadas por mensajes por segundo, con miembros, observadores
+ *   y el coste de su difusión (copias por segundo y tiempo distribuyendo)
+ * - Los clientes más atrasados: los que más mensajes tienen sin leer en
+ *   su cola
+ *
+ * El servidor sólo entrega contadores acumulados; las tasas se calculan
+ * aquí entre dos muestras, así el servidor no gasta nada si nadie mira.
+ * Como toda orden de administración, la muestra no espera detrás del
+ * tráfico de chat: el monitor responde aunque la cola global esté llena.
+ *
+ * Uso: ./monitor [-n <nodo>] [-i <segundos>] [-c <clientes>] [-r <repeticiones>]
+ */
+
+#include <stdio.h>        // entrada/salida estándar
+#include <stdlib.h>       // funciones de utilidad general
+#include <string.h>       // manipulación de strings
+#include <sys/types.h>    // tipos de datos del sistema
+#include <sys/ipc.h>      // comunicación entre procesos
+#include <sys/msg.h>      // colas de mensajes System V
+#include <unistd.h>       // funciones estándar de Unix (getopt, sleep, isatty)
+#include <signal.h>       // manejo de señales del sistema
+#include <errno.h>        // códigos de error del sistema
+#include <time.h>         // hora de cada muestra
+
+#include "protocolo.h"    // estructura de mensaje y tipos compartidos
+#include "cluster.h"      // MAX_NODOS
+
+/* ==================== CONSTANTES Y CONFIGURACIÓN ==================== */
+#define MAX_FILAS_SALAS 64              // Salas mostradas de un nodo
+#define MAX_FILAS_CLIENTES 50           // Clientes atrasados mostrados (como MAX_MONITOR_CLIENTES)
+#define ESPERA_RESPUESTA 5              // Segundos de espera de una muestra
+
+/* ==================== ESTRUCTURAS ==================== */
+
+/**
+ * Contadores acumulados de una sala en una muestra
+ */
+struct fila_sala {
+    char nombre[MAX_NOMBRE];
+    unsigned int mensajes;              // Secuencia de la sala (mensajes distribuidos)
+    int miembros;
+    int observadores;
+    unsigned long copias;               // Copias entregadas a colas
+    long long ns_difusion;              // Tiempo acumulado distribuyendo
+    double por_seg;                     // Calculado: mensajes por segundo (-1 = sin muestra previa)
+};
+
+/**
+ * Un cliente con mensajes esperando en su cola
+ */
+struct fila_cliente {
+    char usuario[MAX_NOMBRE];
+    char sala[MAX_NOMBRE];
+    int qid;
+    unsigned long mensajes;
+    unsigned long bytes;
+};
+
+/**
+ * Una muestra completa del nodo
+ */
+struct muestra {
+    long long ahora_ns;                 // Reloj monótono del servidor
+    long long ocupado_ns;               // Tiempo acumulado en manejadores
+    int cola_global;                    // Mensajes esperando en la cola global
+    int salas;
+    int sesiones;
+    int num_salas;
+    struct fila_sala filas[MAX_FILAS_SALAS];
+    int num_clientes;
+    struct fila_cliente clientes[MAX_FILAS_CLIENTES];
+};
+
+/* ==================== VARIABLES GLOBALES ==================== */
+int cola_admin = -1;                    // Cola de administración del nodo
+int cola_respuestas = -1;               // Cola privada donde llegan las muestras
+
+/* ==================== FUNCIONES ==================== */
+
+/**
+ * Sin respuesta a tiempo: msgrcv vuelve con EINTR
+ *
+ * @param signo Número de la señal recibida
+ */
+void sin_respuesta(int signo) {
+    (void)signo;
+}
+
+/**
+ * Eliminar la cola de respuestas y terminar (Ctrl+C)
+ *
+ * @param signo Número de la señal recibida
+ */
+void terminar(int signo) {
+    (void)signo;
+    if (cola_respuestas != -1) {
+        msgctl(cola_respuestas, IPC_RMID, NULL);
+    }
+    if (isatty(STDOUT_FILENO)) {
+        write(STDOUT_FILENO, "\x1b[?25h\n", 7);  // Volver a mostrar el cursor
+    }
+    _exit(0);
+}
+
+/**
+ * Pedir una muestra al nodo y leer sus líneas
+ *
+ * @param clientes Clientes atrasados que se piden
+ * @param m Muestra a rellenar
+ * @return 0 si éxito, -1 si el nodo no respondió
+ */
+int pedir_muestra(int clientes, struct muestra *m) {
+    struct mensaje orden;
+    memset(&orden, 0, sizeof(orden));
+    orden.mtype = TIPO_ADMIN;
+    orden.reply_qid = cola_respuestas;
+    orden.corr = (unsigned int)getpid();
+    snprintf(orden.texto, MAX_TEXTO, "monitor %d", clientes);
+    if (msgsnd(cola_admin, &orden, sizeof(orden) - sizeof(long), 0) == -1) {
+        perror("Error: no se pudo pedir la muestra");
+        return -1;
+    }
+
+    memset(m, 0, sizeof(*m));
+    alarm(ESPERA_RESPUESTA);
+    struct mensaje resp;
+    while (1) {
+        if (msgrcv(cola_respuestas, &resp, sizeof(resp) - sizeof(long), TIPO_RESP, 0) == -1) {
+            alarm(0);
+            if (errno == EINTR) {
+                fprintf(stderr, "Error: el nodo no respondió en %d s\n", ESPERA_RESPUESTA);
+            } else {
+                perror("Error: no se pudo recibir la muestra");
+            }
+            return -1;
+        }
+        if (resp.corr != orden.corr) {
+            continue;  // Respuesta atrasada de una muestra anterior
+        }
+        resp.texto[MAX_TEXTO - 1] = '\0';
+
+        if (strncmp(resp.texto, "NODO\t", 5) == 0) {
+            sscanf(resp.texto + 5, "%lld\t%lld\t%d\t%d\t%d", &m->ahora_ns, &m->ocupado_ns,
+                   &m->cola_global, &m->salas, &m->sesiones);
+        } else if (strncmp(resp.texto, "SALA\t", 5) == 0 && m->num_salas < MAX_FILAS_SALAS) {
+            struct fila_sala *f = &m->filas[m->num_salas];
+            if (sscanf(resp.texto + 5, "%49[^\t]\t%u\t%d\t%d\t%lu\t%lld", f->nombre, &f->mensajes,
+                       &f->miembros, &f->observadores, &f->copias, &f->ns_difusion) == 6) {
+                m->num_salas++;
+            }
+        } else if (strncmp(resp.texto, "CLIENTE\t", 8) == 0 && m->num_clientes < MAX_FILAS_CLIENTES) {
+            struct fila_cliente *c = &m->clientes[m->num_clientes];
+            if (sscanf(resp.texto + 8, "%49[^\t]\t%49[^\t]\t%d\t%lu\t%lu", c->usuario, c->sala,
+                       &c->qid, &c->mensajes, &c->bytes) == 5) {
+                m->num_clientes++;
+            }
+        }
+
+        if (resp.seq == 0) {
+            alarm(0);
+            if (resp.estado != ESTADO_OK) {
+                fprintf(stderr, "Error: %s\n", resp.texto);
+                return -1;
+            }
+            return 0;
+        }
+    }
+}
+
+/**
+ * Buscar una sala en la muestra anterior
+ *
+ * @return Fila de la sala, o NULL si no estaba
+ */
+const struct fila_sala *fila_previa(const struct muestra *previa, const char *nombre) {
+    for (int i = 0; previa && i < previa->num_salas; i++) {
+        if (strcmp(previa->filas[i].nombre, nombre) == 0) {
+            return &previa->filas[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Orden de las salas: más mensajes por segundo, luego más miembros
+ */
+int comparar_salas(const void *a, const void *b) {
+    const struct fila_sala *x = a;
+    const struct fila_sala *y = b;
+    if (x->por_seg != y->por_seg) {
+        return x->por_seg < y->por_seg ? 1 : -1;
+    }
+    return y->miembros - x->miembros;
+}
+
+/**
+ * Dibujar una muestra con las tasas respecto a la anterior
+ *
+ * @param nodo Nodo observado
+ * @param actual Muestra recién pedida (se ordenan sus salas)
+ * @param previa Muestra anterior (NULL en la primera: sin tasas)
+ */
+void mostrar(int nodo, struct muestra *actual, const struct muestra *previa) {
+    double dt = previa ? (actual->ahora_ns - previa->ahora_ns) / 1e9 : 0;
+    if (dt <= 0) {
+        previa = NULL;
+    }
+
+    char hora[16];
+    time_t t = time(NULL);
+    strftime(hora, sizeof(hora), "%H:%M:%S", localtime(&t));
+    if (isatty(STDOUT_FILENO)) {
+        printf("\x1b[H\x1b[2J");  // Redibujar desde arriba
+    } else {
+        printf("\n");
+    }
+
+    printf("Nodo %d - %s - bucle ", nodo, hora);
+    if (previa) {
+        printf("%.1f%% ocupado", 100.0 * (actual->ocupado_ns - previa->ocupado_ns) / (dt * 1e9));
+    } else {
+        printf("-");
+    }
+    printf(", cola global %d, %d salas, %d sesiones\n\n", actual->cola_global, actual->salas,
+           actual->sesiones);
+
+    /* Salas: coste de difusión = copias por segundo y ms por segundo distribuyendo */
+    double por_seg_copias[MAX_FILAS_SALAS];
+    double ms_difusion[MAX_FILAS_SALAS];
+    for (int i = 0; i < actual->num_salas; i++) {
+        struct fila_sala *f = &actual->filas[i];
+        const struct fila_sala *p = previa ? fila_previa(previa, f->nombre) : NULL;
+        f->por_seg = p ? (f->mensajes - p->mensajes) / dt : -1;
+    }
+    qsort(actual->filas, actual->num_salas, sizeof(actual->filas[0]), comparar_salas);
+    for (int i = 0; i < actual->num_salas; i++) {
+        const struct fila_sala *f = &actual->filas[i];
+        const struct fila_sala *p = previa ? fila_previa(previa, f->nombre) : NULL;
+        por_seg_copias[i] = p ? (f->copias - p->copias) / dt : -1;
+        ms_difusion[i] = p ? (f->ns_difusion - p->ns_difusion) / 1e6 / dt : -1;
+    }
+
+    // "Ó" ocupa dos bytes: un ancho más para que la columna quede alineada
+    printf("%-20s %10s %9s %9s %10s %15s\n", "SALA", "MSG/S", "MIEMBROS", "OBSERV.", "COPIAS/S",
+           "DIFUSIÓN ms/s");
+    for (int i = 0; i < actual->num_salas; i++) {
+        const struct fila_sala *f = &actual->filas[i];
+        printf("%-20.20s ", f->nombre);
+        if (f->por_seg >= 0) {
+            printf("%10.1f ", f->por_seg);
+        } else {
+            printf("%10s ", "-");
+        }
+        printf("%9d %9d ", f->miembros, f->observadores);
+        if (por_seg_copias[i] >= 0) {
+            printf("%10.1f %13.2f\n", por_seg_copias[i], ms_difusion[i]);
+        } else {
+            printf("%10s %13s\n", "-", "-");
+        }
+    }
+    if (actual->num_salas == 0) {
+        printf("(sin salas)\n");
+    }
+
+    /* Clientes atrasados: ya vienen ordenados por mensajes en cola */
+    printf("\n%-20s %-20s %10s %10s %10s\n", "CLIENTE", "SALA", "COLA", "EN COLA", "KB");
+    for (int i = 0; i < actual->num_clientes; i++) {
+        const struct fila_cliente *c = &actual->clientes[i];
+        printf("%-20.20s %-20.20s %10d %10lu %10.1f\n", c->usuario, c->sala, c->qid, c->mensajes,
+               c->bytes / 1024.0);
+    }
+    if (actual->num_clientes == 0) {
+        printf("(ningún cliente con mensajes pendientes)\n");
+    }
+    fflush(stdout);
+}
+
+/**
+ * Mostrar el uso del programa y terminar
+ *
+ * @param programa Nombre del ejecutable
+ */
+void uso(const char *programa) {
+    fprintf(stderr, "Uso: %s [-n <nodo>] [-i <segundos>] [-c <clientes>] [-r <repeticiones>]\n",
+            programa);
+    exit(2);
+}
+
+/* ==================== FUNCIÓN PRINCIPAL ==================== */
+
+int main(int argc, char *argv[]) {
+    int nodo = 0;
+    int intervalo = 1;
+    int clientes = 10;
+    int repeticiones = 0;               // 0 = hasta Ctrl+C
+    int opcion;
+    while ((opcion = getopt(argc, argv, "n:i:c:r:")) != -1) {
+        switch (opcion) {
+            case 'n':
+                nodo = atoi(optarg);
+                break;
+            case 'i':
+                intervalo = atoi(optarg);
+                break;
+            case 'c':
+                clientes = atoi(optarg);
+                break;
+            case 'r':
+                repeticiones = atoi(optarg);
+                break;
+            default:
+                uso(argv[0]);
+        }
+    }
+    if (optind != argc || nodo < 0 || nodo >= MAX_NODOS || intervalo <= 0 || clientes < 0 ||
+        clientes > MAX_FILAS_CLIENTES || repeticiones < 0) {
+        uso(argv[0]);
+    }
+
+    key_t clave = ftok("/tmp", PROYECTO_ADMIN(nodo));
+    cola_admin = (clave == (key_t)-1) ? -1 : msgget(clave, 0);
+    if (cola_admin == -1) {
+        fprintf(stderr, "Error: el nodo %d no tiene cola de administración (¿servidor detenido "
+                "o de otro usuario?): %s\n", nodo, strerror(errno));
+        return 1;
+    }
+    cola_respuestas = msgget(IPC_PRIVATE, IPC_CREAT | 0600);
+    if (cola_respuestas == -1) {
+        perror("Error: no se pudo crear la cola de respuestas");
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sin_respuesta;
+    sigaction(SIGALRM, &sa, NULL);
+    sa.sa_handler = terminar;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // Dos muestras: la anterior da las tasas de la actual
+    static struct muestra muestras[2];
+    int actual = 0;
+    int estado = 0;
+    for (int n = 0; repeticiones == 0 || n < repeticiones; n++) {
+        if (n > 0) {
+            sleep(intervalo);
+        }
+        if (pedir_muestra(clientes, &muestras[actual]) == -1) {
+            estado = 1;
+            break;
+        }
+        mostrar(nodo, &muestras[actual], n > 0 ? &muestras[1 - actual] : NULL);
+        actual = 1 - actual;
+    }
+
+    msgctl(cola_respuestas, IPC_RMID, NULL);
+    return estado;
+}
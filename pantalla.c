@@ -0,0 +1,508 @@
+/*
+ * pantalla.c - Interfaz de terminal a pantalla completa (ver pantalla.h)
+ *
+ * Disposición (filas numeradas desde 1):
+ *   1 .. filas-2  historial de mensajes (las líneas largas ocupan varias filas)
+ *   filas-1       barra de estado (vídeo inverso)
+ *   filas         línea de entrada ("> " + lo que se está escribiendo)
+ *
+ * De cada fila se guarda una huella de lo último que se escribió en ella;
+ * un cuadro sólo envía las filas cuya huella cambió, todo en un único
+ * write(). El texto recibido se limpia de caracteres de control para que
+ * otro usuario no pueda mover el cursor ni cambiar colores en nuestra
+ * terminal.
+ */
+
+#include <stdio.h>        // snprintf, vsnprintf
+#include <stdarg.h>       // argumentos variables (emitirf)
+#include <string.h>       // manipulación de strings
+#include <signal.h>       // sigaction (SIGWINCH)
+#include <termios.h>      // modo sin eco ni edición de líneas
+#include <unistd.h>       // write, isatty
+#include <sys/ioctl.h>    // TIOCGWINSZ (tamaño de la terminal)
+#include <time.h>         // clock_gettime (límite de cuadros por segundo)
+
+#include "pantalla.h"
+
+/* ==================== CONSTANTES ==================== */
+#define TAM_HISTORIAL 2048              // Líneas del historial (potencia de 2)
+#define LARGO_LINEA 384                 // Bytes por línea (prefijo + remitente + texto)
+#define LARGO_ENTRADA 256               // Bytes de la línea de entrada (MAX_TEXTO)
+#define MAX_FILAS 256                   // Filas de terminal consideradas como máximo
+#define MAX_COLUMNAS 512                // Columnas consideradas como máximo
+#define TAM_SALIDA (1 << 16)            // Buffer de escritura de un cuadro
+
+/**
+ * Línea del historial
+ */
+struct linea {
+    char texto[LARGO_LINEA];            // Texto ya limpio de caracteres de control
+    int estilo;                         // PANTALLA_*
+};
+
+/* Atributos SGR de cada estilo */
+static const char *const atributos[] = {
+    [PANTALLA_NORMAL] = "\x1b[0m",
+    [PANTALLA_MENCION] = "\x1b[0;1;33m",
+    [PANTALLA_PRIVADO] = "\x1b[0;35m",
+    [PANTALLA_SERVIDOR] = "\x1b[0;36m",
+    [PANTALLA_AVISO] = "\x1b[0;31m",
+    [PANTALLA_PROPIO] = "\x1b[0;2m",
+    [PANTALLA_INFO] = "\x1b[0;32m",
+};
+
+/* ==================== ESTADO ==================== */
+static struct linea historial[TAM_HISTORIAL];   // Anillo de líneas
+static long total_lineas = 0;           // Líneas añadidas desde el inicio
+static int desplazamiento = 0;          // Líneas por debajo de la vista (0 = al final)
+static int filas_nuevas = 0;            // Filas añadidas al final desde el último cuadro
+static int filas = 24, columnas = 80;   // Tamaño de la terminal
+static unsigned long long mostrado[MAX_FILAS];  // Huella de cada fila escrita (0 = desconocida)
+static unsigned long long mostrado_estado, mostrado_entrada;
+static int completo = 1;                // 1 = borrar y redibujar todo en el próximo cuadro
+static int sucio = 1;                   // 1 = hay cambios sin dibujar
+static long long ultimo_cuadro = 0;     // Instante (ms) del último cuadro
+static char estado[LARGO_LINEA];        // Texto de la barra de estado
+static char entrada[LARGO_ENTRADA];     // Lo que el usuario está escribiendo
+static size_t largo_entrada = 0;
+static int escape = 0;                  // Secuencia de teclado: 0 = no, 1 = tras ESC, 2 = CSI
+static int parametro_escape = 0;        // Parámetro numérico de la secuencia CSI
+static struct termios original;         // Configuración de la terminal a restaurar
+static int activa = 0;
+static volatile sig_atomic_t redimensionada = 0;
+static char salida[TAM_SALIDA];         // Lo que se escribirá en este cuadro
+static size_t usada = 0;
+
+/* ==================== UTILIDADES ==================== */
+
+static long long ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+/**
+ * Escribir en la terminal todo lo acumulado
+ */
+static void volcar(void) {
+    size_t hecho = 0;
+    while (hecho < usada) {
+        ssize_t n = write(STDOUT_FILENO, salida + hecho, usada - hecho);
+        if (n <= 0) {
+            break;  // Terminal cerrada: no hay a quién mostrar nada
+        }
+        hecho += (size_t)n;
+    }
+    usada = 0;
+}
+
+static void emitir(const char *datos, size_t n) {
+    if (usada + n > sizeof(salida)) {
+        volcar();
+    }
+    memcpy(salida + usada, datos, n);
+    usada += n;
+}
+
+static void emitirf(const char *formato, ...) __attribute__((format(printf, 1, 2)));
+
+static void emitirf(const char *formato, ...) {
+    char buf[128];
+    va_list args;
+    va_start(args, formato);
+    int n = vsnprintf(buf, sizeof(buf), formato, args);
+    va_end(args);
+    if (n > 0) {
+        emitir(buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+    }
+}
+
+/**
+ * Bytes que ocupan los primeros 'cols' caracteres (UTF-8) de un texto
+ */
+static size_t bytes_de_columnas(const char *texto, size_t n, int cols) {
+    size_t i = 0;
+    while (i < n && cols > 0) {
+        i++;
+        while (i < n && ((unsigned char)texto[i] & 0xC0) == 0x80) {
+            i++;  // Bytes de continuación del mismo carácter
+        }
+        cols--;
+    }
+    return i;
+}
+
+/**
+ * Caracteres (no bytes) de un texto UTF-8
+ */
+static int columnas_de(const char *texto, size_t n) {
+    int cols = 0;
+    for (size_t i = 0; i < n; i++) {
+        cols += ((unsigned char)texto[i] & 0xC0) != 0x80;
+    }
+    return cols;
+}
+
+/**
+ * Filas que ocupa una línea del historial con el ancho actual
+ */
+static int filas_de(const struct linea *l) {
+    int cols = columnas_de(l->texto, strlen(l->texto));
+    return cols == 0 ? 1 : (cols + columnas - 1) / columnas;
+}
+
+/**
+ * Huella de una fila (FNV-1a sobre estilo y texto); nunca 0
+ */
+static unsigned long long huella(int estilo, const char *texto, size_t n) {
+    unsigned long long h = 1469598103934665603ULL ^ (unsigned long long)(estilo + 1);
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ (unsigned char)texto[i]) * 1099511628211ULL;
+    }
+    return h | 1;
+}
+
+static void leer_tamano(void) {
+    struct winsize w;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0 && w.ws_row > 0 && w.ws_col > 0) {
+        filas = w.ws_row < MAX_FILAS ? w.ws_row : MAX_FILAS;
+        columnas = w.ws_col < MAX_COLUMNAS ? w.ws_col : MAX_COLUMNAS;
+    }
+    if (filas < 3) {
+        filas = 3;
+    }
+    if (columnas < 8) {
+        columnas = 8;
+    }
+}
+
+static void al_redimensionar(int signo) {
+    (void)signo;
+    redimensionada = 1;
+}
+
+/**
+ * Líneas del historial que todavía se conservan
+ */
+static long lineas_disponibles(void) {
+    return total_lineas < TAM_HISTORIAL ? total_lineas : TAM_HISTORIAL;
+}
+
+/**
+ * Mover la vista (positivo = hacia atrás en el historial)
+ */
+static void mover_vista(int lineas) {
+    int anterior = desplazamiento;
+    long maximo = lineas_disponibles() - 1;
+    desplazamiento += lineas;
+    if (desplazamiento > maximo) {
+        desplazamiento = (int)maximo;
+    }
+    if (desplazamiento < 0) {
+        desplazamiento = 0;
+    }
+    if (desplazamiento != anterior) {
+        filas_nuevas = 0;  // La vista ya no es "lo de antes más lo nuevo": se compara fila a fila
+        sucio = 1;
+    }
+}
+
+/* ==================== INICIO Y FIN ==================== */
+
+int pantalla_iniciar(void) {
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) || tcgetattr(STDIN_FILENO, &original) == -1) {
+        return -1;
+    }
+
+    // Sin eco ni edición de líneas (la entrada la dibuja este módulo).
+    // ISIG se conserva: Ctrl+C sigue enviando SIGINT
+    struct termios t = original;
+    t.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+    t.c_iflag &= ~(IXON | ICRNL);
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &t) == -1) {
+        return -1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = al_redimensionar;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
+
+    leer_tamano();
+    activa = 1;
+    completo = 1;
+    sucio = 1;
+    emitirf("\x1b[?1049h");  // Pantalla alternativa: al salir vuelve lo que había
+    volcar();
+    return 0;
+}
+
+void pantalla_terminar(void) {
+    if (!activa) {
+        return;
+    }
+    emitirf("\x1b[0m\x1b[r\x1b[?25h\x1b[?1049l");
+    volcar();
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &original);
+    activa = 0;
+}
+
+/* ==================== CONTENIDO ==================== */
+
+/**
+ * Añadir una línea al historial
+ *
+ * Con la vista desplazada hacia atrás, ésta se queda fija en las mismas
+ * líneas: lo nuevo se acumula debajo hasta que el usuario vuelve al final.
+ */
+static void agregar_linea(int estilo, const char *texto, size_t n) {
+    struct linea *l = &historial[total_lineas & (TAM_HISTORIAL - 1)];
+    if (n >= LARGO_LINEA) {
+        n = LARGO_LINEA - 1;
+        while (n > 0 && ((unsigned char)texto[n] & 0xC0) == 0x80) {
+            n--;  // No partir un carácter UTF-8
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)texto[i];
+        l->texto[i] = (c < 0x20 || c == 0x7f) ? ' ' : (char)c;
+    }
+    l->texto[n] = '\0';
+    l->estilo = estilo;
+    total_lineas++;
+
+    if (desplazamiento > 0) {
+        mover_vista(1);
+    } else {
+        filas_nuevas += filas_de(l);
+    }
+    sucio = 1;
+}
+
+void pantalla_escribir(int estilo, const char *texto) {
+    while (*texto) {
+        size_t n = strcspn(texto, "\n");
+        agregar_linea(estilo, texto, n);
+        texto += n;
+        if (*texto == '\n') {
+            texto++;
+        }
+    }
+}
+
+void pantalla_estado(const char *texto) {
+    if (strcmp(estado, texto) != 0) {
+        strncpy(estado, texto, LARGO_LINEA - 1);
+        sucio = 1;
+    }
+}
+
+/* ==================== TECLADO ==================== */
+
+/**
+ * Tecla especial (secuencia CSI): desplazamiento del historial
+ */
+static void tecla_especial(unsigned char final, int parametro) {
+    int media_pagina = (filas - 2) / 2 > 0 ? (filas - 2) / 2 : 1;
+    if (final == 'A') {
+        mover_vista(1);                             // Flecha arriba
+    } else if (final == 'B') {
+        mover_vista(-1);                            // Flecha abajo
+    } else if (final == '~' && parametro == 5) {
+        mover_vista(media_pagina);                  // RePág
+    } else if (final == '~' && parametro == 6) {
+        mover_vista(-media_pagina);                 // AvPág
+    } else if (final == 'H' || (final == '~' && (parametro == 1 || parametro == 7))) {
+        mover_vista(TAM_HISTORIAL);                 // Inicio: lo más antiguo
+    } else if (final == 'F' || (final == '~' && (parametro == 4 || parametro == 8))) {
+        mover_vista(-desplazamiento);               // Fin: volver a lo último
+    }
+}
+
+int pantalla_entrada(const char *bytes, size_t n, void (*linea)(const char *)) {
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)bytes[i];
+
+        if (escape == 1) {
+            escape = (c == '[' || c == 'O') ? 2 : 0;
+            parametro_escape = 0;
+            continue;
+        }
+        if (escape == 2) {
+            if (c >= '0' && c <= '9') {
+                parametro_escape = parametro_escape * 10 + (c - '0');
+            } else if (c != ';') {
+                escape = 0;
+                tecla_especial(c, parametro_escape);
+            }
+            continue;
+        }
+
+        if (c == 0x1b) {
+            escape = 1;
+        } else if (c == '\r' || c == '\n') {
+            // Enter: la línea se procesa y la vista vuelve al final
+            char copia[LARGO_ENTRADA];
+            memcpy(copia, entrada, largo_entrada + 1);
+            largo_entrada = 0;
+            entrada[0] = '\0';
+            mover_vista(-desplazamiento);
+            sucio = 1;
+            linea(copia);
+        } else if (c == 0x7f || c == 0x08) {
+            // Retroceso: borrar un carácter completo (todos sus bytes UTF-8)
+            while (largo_entrada > 0 && ((unsigned char)entrada[--largo_entrada] & 0xC0) == 0x80) {
+            }
+            entrada[largo_entrada] = '\0';
+            sucio = 1;
+        } else if (c == 0x15) {
+            largo_entrada = 0;                      // Ctrl+U: borrar la línea
+            entrada[0] = '\0';
+            sucio = 1;
+        } else if (c == 0x0c) {
+            completo = 1;                           // Ctrl+L: redibujar todo
+            sucio = 1;
+        } else if (c == 0x04) {
+            if (largo_entrada == 0) {
+                return -1;                          // Ctrl+D con la entrada vacía: salir
+            }
+        } else if (c >= 0x20 && largo_entrada < LARGO_ENTRADA - 1) {
+            entrada[largo_entrada++] = (char)c;
+            entrada[largo_entrada] = '\0';
+            sucio = 1;
+        }
+    }
+    return 0;
+}
+
+/* ==================== DIBUJO ==================== */
+
+/**
+ * Escribir una fila si su contenido cambió
+ */
+static void escribir_fila(int fila, int estilo, const char *texto, size_t n) {
+    unsigned long long h = huella(estilo, texto, n);
+    if (mostrado[fila] == h) {
+        return;
+    }
+    mostrado[fila] = h;
+    emitirf("\x1b[%d;1H", fila + 1);
+    emitir(atributos[estilo], strlen(atributos[estilo]));
+    emitir(texto, n);
+    // Con la fila llena el cursor queda en la última columna: borrar la borraría
+    if (columnas_de(texto, n) < columnas) {
+        emitirf("\x1b[K");
+    }
+}
+
+/**
+ * Dibujar un cuadro: sólo las filas que cambiaron
+ */
+static void dibujar(void) {
+    int area = filas - 2;
+    emitirf("\x1b[?25l");  // Cursor oculto mientras se dibuja
+
+    if (completo) {
+        emitirf("\x1b[0m\x1b[2J");
+        memset(mostrado, 0, sizeof(mostrado));
+        mostrado_estado = 0;
+        mostrado_entrada = 0;
+        completo = 0;
+    } else if (filas_nuevas > 0 && filas_nuevas < area) {
+        // Vista al final con líneas nuevas: la terminal desplaza la zona
+        // de mensajes y sólo quedan por escribir las filas nuevas
+        emitirf("\x1b[0m\x1b[1;%dr\x1b[%dS\x1b[r", area, filas_nuevas);
+        memmove(mostrado, mostrado + filas_nuevas, (area - filas_nuevas) * sizeof(mostrado[0]));
+        memset(mostrado + area - filas_nuevas, 0, filas_nuevas * sizeof(mostrado[0]));
+    }
+    filas_nuevas = 0;
+
+    // Historial: de la línea visible más reciente hacia arriba, partida en filas
+    const char *inicio[MAX_FILAS];
+    size_t largo[MAX_FILAS];
+    int estilo[MAX_FILAS];
+    int libre = area;                               // Filas [0, libre) aún sin asignar
+    long indice = total_lineas - 1 - desplazamiento;
+    long primero = total_lineas - lineas_disponibles();
+    while (libre > 0 && indice >= primero) {
+        const struct linea *l = &historial[indice & (TAM_HISTORIAL - 1)];
+        size_t n = strlen(l->texto);
+        int trozos = filas_de(l);
+        for (int j = trozos - 1; j >= 0; j--) {
+            int fila = libre - (trozos - j);
+            if (fila < 0) {
+                continue;  // La parte de arriba de la línea no cabe
+            }
+            size_t desde = bytes_de_columnas(l->texto, n, j * columnas);
+            inicio[fila] = l->texto + desde;
+            largo[fila] = bytes_de_columnas(inicio[fila], n - desde, columnas);
+            estilo[fila] = l->estilo;
+        }
+        libre -= trozos;
+        indice--;
+    }
+    for (int fila = 0; fila < area; fila++) {
+        if (fila < libre) {
+            escribir_fila(fila, PANTALLA_NORMAL, "", 0);
+        } else {
+            escribir_fila(fila, estilo[fila], inicio[fila], largo[fila]);
+        }
+    }
+
+    // Barra de estado (ocupa todo el ancho, en vídeo inverso)
+    char barra[LARGO_LINEA + 64];
+    if (desplazamiento > 0) {
+        snprintf(barra, sizeof(barra), " %s | historial: %d líneas más abajo (Fin para volver)",
+                 estado, desplazamiento);
+    } else {
+        snprintf(barra, sizeof(barra), " %s", estado);
+    }
+    size_t n = bytes_de_columnas(barra, strlen(barra), columnas);
+    unsigned long long h = huella(0, barra, n);
+    if (h != mostrado_estado) {
+        mostrado_estado = h;
+        emitirf("\x1b[%d;1H\x1b[0;7m", filas - 1);
+        emitir(barra, n);
+        for (int c = columnas_de(barra, n); c < columnas; c++) {
+            emitir(" ", 1);
+        }
+    }
+
+    // Línea de entrada: se muestra el final si no cabe (la última columna queda libre)
+    int ancho = columnas - 3;
+    int cols = columnas_de(entrada, largo_entrada);
+    size_t desde = cols > ancho ? bytes_de_columnas(entrada, largo_entrada, cols - ancho) : 0;
+    h = huella(0, entrada + desde, largo_entrada - desde);
+    if (h != mostrado_entrada) {
+        mostrado_entrada = h;
+        emitirf("\x1b[%d;1H\x1b[0m> ", filas);
+        emitir(entrada + desde, largo_entrada - desde);
+        emitirf("\x1b[K");
+    }
+    emitirf("\x1b[0m\x1b[%d;%dH\x1b[?25h", filas, 3 + (cols > ancho ? ancho : cols));
+    volcar();
+}
+
+int pantalla_refrescar(void) {
+    if (redimensionada) {
+        redimensionada = 0;
+        leer_tamano();
+        completo = 1;
+        sucio = 1;
+    }
+    if (!sucio || !activa) {
+        return -1;
+    }
+    long long ahora = ahora_ms();
+    long long espera = ultimo_cuadro + 1000 / PANTALLA_FPS - ahora;
+    if (espera > 0) {
+        return (int)espera;
+    }
+    dibujar();
+    ultimo_cuadro = ahora;
+    sucio = 0;
+    return -1;
+}
@@ -0,0 +1,54 @@
+/*
+ * pantalla.h - Interfaz de terminal a pantalla completa (cliente -t)
+ *
+ * La pantalla se divide en tres zonas: el historial de mensajes (un
+ * anillo de líneas con desplazamiento hacia atrás), una barra de estado
+ * y la línea de entrada, que nunca se mezcla con lo que llega. Sólo se
+ * usan secuencias ANSI/VT100, sin bibliotecas externas.
+ *
+ * Los mensajes se acumulan sin escribir nada; pantalla_refrescar dibuja
+ * como mucho PANTALLA_FPS cuadros por segundo y en cada cuadro sólo
+ * escribe las filas que cambiaron. Si llegan líneas nuevas con la vista
+ * al final, la zona de mensajes se desplaza con la propia terminal y
+ * sólo se escriben las filas nuevas.
+ *
+ * Las funciones se llaman desde un único hilo (el bucle de eventos).
+ */
+
+#ifndef PANTALLA_H
+#define PANTALLA_H
+
+#include <stddef.h>       // size_t
+
+#define PANTALLA_FPS 30              // Cuadros por segundo como máximo
+
+/* ==================== ESTILOS DE LÍNEA ==================== */
+#define PANTALLA_NORMAL    0   // Mensaje de sala
+#define PANTALLA_MENCION   1   // Mensaje que menciona al usuario
+#define PANTALLA_PRIVADO   2   // Mensaje privado
+#define PANTALLA_SERVIDOR  3   // Respuesta del servidor
+#define PANTALLA_AVISO     4   // Aviso local, reconexión o error de un comando
+#define PANTALLA_PROPIO    5   // Mensaje enviado por el propio usuario
+#define PANTALLA_INFO      6   // Información local (bienvenida, solicitudes)
+
+/* Entra en pantalla completa (modo sin eco, pantalla alternativa). -1 si no hay terminal */
+int pantalla_iniciar(void);
+
+/* Restaura la terminal tal como estaba */
+void pantalla_terminar(void);
+
+/* Añade texto al historial (una línea por cada '\n'); no dibuja */
+void pantalla_escribir(int estilo, const char *texto);
+
+/* Texto de la barra de estado (sólo se redibuja si cambia) */
+void pantalla_estado(const char *texto);
+
+/* Procesa bytes leídos del teclado; linea() recibe cada línea terminada
+ * con Enter. -1 si el usuario pidió salir (Ctrl+D con la entrada vacía) */
+int pantalla_entrada(const char *bytes, size_t n, void (*linea)(const char *));
+
+/* Dibuja lo pendiente si ya toca otro cuadro. Devuelve los ms hasta el
+ * próximo cuadro necesario, o -1 si no hay nada pendiente */
+int pantalla_refrescar(void);
+
+#endif /* PANTALLA_H */
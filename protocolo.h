@@ -0,0 +1,119 @@
+/*
+ * protocolo.h - Definiciones compartidas del protocolo de chat
+ *
+ * Estructura de mensaje y tipos (mtype) comunes a servidor, cliente y
+ * relays. Todos los programas deben compilarse con la misma versión de
+ * este archivo para que los mensajes coincidan byte a byte en las colas.
+ */
+
+#ifndef PROTOCOLO_H
+#define PROTOCOLO_H
+
+/* ==================== LÍMITES DEL PROTOCOLO ==================== */
+#define MAX_TEXTO 256                   // Longitud máxima de un mensaje de texto
+#define MAX_NOMBRE 50                   // Longitud máxima para nombres de usuario y salas
+
+/* ==================== TIPOS DE MENSAJE (mtype) ==================== */
+#define TIPO_JOIN        1   // Cliente -> Servidor: unirse a una sala
+#define TIPO_RESP        2   // Servidor -> Cliente: respuestas y notificaciones
+#define TIPO_MSG         3   // Cliente -> Servidor: mensaje de chat a distribuir
+#define TIPO_CHAT        4   // Servidor -> Cliente: mensaje distribuido en una sala
+#define TIPO_LEAVE       5   // Cliente -> Servidor: abandonar sala
+#define TIPO_USERS       6   // Cliente -> Servidor: lista de usuarios de una sala
+#define TIPO_LIST        7   // Cliente -> Servidor: lista de salas disponibles
+#define TIPO_CONNECT     8   // Cliente -> Servidor: registrar sesión (nombre -> cola privada)
+#define TIPO_DISCONNECT  9   // Cliente -> Servidor: cerrar sesión
+#define TIPO_DM         10   // Cliente -> Servidor: mensaje privado (sala = destinatario)
+#define TIPO_PRIV       11   // Servidor -> Cliente: mensaje privado entregado
+#define TIPO_FILTER     12   // Cliente -> Servidor: filtro de suscripción en una sala
+#define TIPO_OBSERVE    13   // Cliente -> Servidor: observar sala (sólo lectura)
+#define TIPO_RELAY_REG  14   // Relay -> Servidor/Relay padre: registrar relay de una sala
+#define TIPO_RELAY_ADD  15   // Servidor/Relay -> Relay: atender a un observador (reply_qid)
+#define TIPO_RELAY_DEL  16   // Servidor/Relay -> Relay: dejar de atender a un observador
+#define TIPO_MIGRAR     17   // Nodo -> Nodo: estado de una sala que cambia de nodo (cluster)
+#define TIPO_BACKFILL   18   // Cliente -> Servidor: pedir mensajes perdidos (seq_prev < seq' <= seq)
+                             // Servidor -> Cliente: mensaje recuperado (remitente vacío = fin)
+#define TIPO_MIGRAR_REPLAY 19  // Nodo -> Nodo: entrada del anillo de reenvío de una sala migrada
+#define TIPO_DICCIONARIO 20  // Cliente -> Servidor: pedir el diccionario de compresión de una sala
+                             // Servidor -> Cliente: seq = su huella (0 = aún sin entrenar)
+#define TIPO_ADMIN      21   // Administrador -> Servidor: orden (texto), por la cola de administración
+                             // Servidor -> Administrador: RESP por línea (seq = 0 en la última)
+#define TIPO_PRESENCIA  22   // Servidor -> Cliente: altas y bajas de la sala agrupadas
+                             // (texto "+Ana +Bob -Carlos"; varias si no caben en uno)
+#define TIPO_MIEMBROS   23   // Cliente -> Servidor: miembros de una sala desde la versión seq
+                             // Servidor -> Cliente: cambios ("+Ana -Bob") o lista ("= +Ana +Bob")
+
+// Un nodo que entrega una sala reenvía los mensajes que ya tenía en cola
+// con mtype = TIPO_REENVIO_MIGRACION + tipo original: el nodo destino los
+// procesa antes que los que le llegan directamente de los clientes.
+#define TIPO_REENVIO_MIGRACION 1000
+
+// Varias sesiones de un mismo proceso pueden compartir una cola de
+// recepción (canal): cada una se presenta con su número de canal y el
+// servidor le envía con mtype = tipo + canal * CANAL_BASE, de modo que el
+// proceso sabe a qué sesión va cada mensaje. Canal 0 = cola propia.
+#define CANAL_BASE 64
+#define MTYPE_CANAL(tipo, canal) ((long)(tipo) + (long)(canal) * CANAL_BASE)
+
+/* ==================== VERSIÓN DE MIEMBROS ==================== */
+// Cada alta o baja de miembro incrementa la versión de su sala. PRESENCIA
+// y MIEMBROS llevan seq_prev = versión sobre la que se aplican y seq =
+// versión resultante; seq_prev = 0 indica una lista completa (el texto
+// empieza con "="). Un cliente aplica un mensaje sólo si seq_prev es 0 o
+// su propia versión; si no, le falta algo y pide MIEMBROS desde su
+// versión. En las respuestas a MIEMBROS, estado = partes que faltan.
+
+/* ==================== PLANO DE ADMINISTRACIÓN ==================== */
+// Cada nodo atiende además una cola de administración propia, con permisos
+// 0600 (sólo el usuario que ejecuta el servidor puede enviarle órdenes):
+// las órdenes no esperan detrás del tráfico de chat de la cola global.
+#define PROYECTO_ADMIN(k) (200 + (k))   // proj_id de ftok de la cola de administración del nodo k
+
+/* ==================== TEXTOS LARGOS EN EL CAMPO texto ==================== */
+// Los textos largos, comprimidos y adjuntos viajan como mensajes de sala
+// normales cuyo texto empieza con una cabecera entre '\x01' (ver chatlib.c):
+#define FORMATO_FRAGMENTO "\001F%x %d/%d\001"        // id, parte, partes + trozo de texto
+#define FORMATO_COMPRIMIDO "\001C%x %d/%d %x\001"    // id, parte, partes, diccionario + trozo escapado
+#define FORMATO_ADJUNTO "\001A%d %zu\001"            // segmento, bytes + nombre del archivo
+#define SALTO_FRAGMENTO '\x1f'    // Sustituye a '\n' en los fragmentos (el historial va por líneas)
+
+/* ==================== ESTADO DE UNA RESPUESTA (RESP) ==================== */
+#define ESTADO_OK        0   // La solicitud se aplicó
+#define ESTADO_ERROR     1   // La solicitud fue rechazada (texto = motivo)
+
+/**
+ * Estructura de mensaje para comunicación cliente-servidor
+ *
+ * Utilizada para todos los tipos de comunicación. En los mensajes de
+ * relay (14-16) reply_qid identifica la cola del relay que se registra o
+ * del observador que se delega; en el acuse de RELAY_DEL que un relay
+ * envía a su padre, reply_qid es la cola del relay y seq la del observador.
+ * 
+ * En CHAT, seq es el número de secuencia del mensaje en su sala y
+ * seq_prev el del mensaje anterior enviado a ese mismo destinatario (los
+ * filtros hacen que no todos reciban todos). Si seq_prev no coincide con
+ * el último recibido, hubo un hueco y el cliente pide BACKFILL.
+ * 
+ * corr es un identificador de correlación elegido por el cliente: el RESP
+ * que confirma o rechaza una solicitud lo repite junto con estado, así el
+ * cliente puede tener varias solicitudes en vuelo y sólo cambia su estado
+ * local (sala actual, filtro) cuando el servidor la confirma. 0 = sin
+ * correlación (notificaciones espontáneas).
+ * 
+ * canal identifica a la sesión dentro de una cola compartida por varias
+ * (ver MTYPE_CANAL); las respuestas a esa sesión lo llevan en su mtype.
+ */
+struct mensaje {
+    long mtype;                     // Tipo de mensaje (TIPO_*)
+    int reply_qid;                  // ID de cola privada del cliente (para respuestas)
+    char remitente[MAX_NOMBRE];     // Nombre del usuario que envía el mensaje
+    char texto[MAX_TEXTO];          // Contenido del mensaje o datos adicionales
+    char sala[MAX_NOMBRE];          // Nombre de la sala objetivo o actual (destinatario en DM)
+    unsigned int seq;               // Número de secuencia en la sala (CHAT, BACKFILL)
+    unsigned int seq_prev;          // Secuencia anterior para este destinatario (CHAT)
+    unsigned int corr;              // Correlación solicitud/respuesta (0 = ninguna)
+    int estado;                     // En RESP: ESTADO_OK o ESTADO_ERROR
+    int canal;                      // Sesión dentro de una cola compartida (0 = cola propia)
+};
+
+#endif /* PROTOCOLO_H */
@@ -0,0 +1,428 @@
+/*
+ * relay.c - Relay de Difusión para Salas con Muchos Observadores
+ *
+ * Proceso liviano que se suscribe a una sala (en el servidor o en otro
+ * relay) y reenvía cada mensaje a su propio subconjunto de observadores.
+ * Varios relays forman un árbol: el servidor envía una sola copia por
+ * relay y el costo de la difusión se reparte entre procesos y núcleos.
+ *
+ * Funcionamiento:
+ * - Al iniciar crea su cola privada y envía RELAY_REG al padre
+ *   (cola global del servidor, o la cola de otro relay con -p)
+ * - RELAY_ADD: el padre le delega un observador (reply_qid). Si el relay
+ *   ya atiende a 'capacidad' observadores y tiene hijos, lo delega a su
+ *   vez en el hijo menos cargado
+ * - RELAY_DEL: baja de un observador. Si es propio, le confirma y acusa
+ *   la baja al padre; si se delegó en un hijo, se la reenvía sólo a ese
+ *   hijo; si no lo tiene nadie, se la rechaza. Los acuses de los hijos
+ *   (y las bajas de observadores o hijos cuya cola desapareció) suben
+ *   hasta el servidor, que así lleva la carga exacta de cada relay
+ * - RELAY_REG: otro relay se registra como hijo de éste
+ * - CHAT: se reenvía a los hijos (bloqueante) y a los observadores propios
+ *   (sin bloqueo, como hace el servidor con sus observadores directos)
+ *
+ * Uso: ./relay [-p <qid_padre>] [-c <capacidad>] <sala>
+ */
+
+#include <stdio.h>        // entrada/salida estándar
+#include <stdlib.h>       // funciones de utilidad general
+#include <string.h>       // manipulación de strings
+#include <sys/types.h>    // tipos de datos del sistema
+#include <sys/ipc.h>      // comunicación entre procesos
+#include <sys/msg.h>      // colas de mensajes System V
+#include <unistd.h>       // funciones estándar de Unix (getopt)
+#include <signal.h>       // manejo de señales del sistema
+#include <errno.h>        // códigos de error del sistema
+
+#include "protocolo.h"    // estructura de mensaje y tipos compartidos
+
+/* ==================== CONSTANTES Y CONFIGURACIÓN ==================== */
+#define MAX_SUSCRIPTORES 16384          // Observadores atendidos por un relay
+#define MAX_HIJOS 16                    // Relays hijos registrados en este relay
+#define CAPACIDAD_POR_DEFECTO 1000      // Observadores propios antes de delegar en hijos
+#define MAX_DELEGADOS 16384             // Observadores delegados en hijos
+#define INDICE_DELEGADOS 32768          // Casillas del índice observador -> hijo (potencia de 2)
+
+/**
+ * Observador delegado en un hijo (para enviarle su baja sólo a ese hijo)
+ */
+struct delegado {
+    int qid;                            // Cola del observador
+    int hijo;                           // Cola del hijo que lo atiende
+    int estado;                         // 0 = libre, 1 = ocupada, 2 = borrada (lápida)
+};
+
+/* ==================== VARIABLES GLOBALES ==================== */
+int cola_padre = -1;                    // Cola del padre (servidor o relay)
+int cola_relay = -1;                    // Cola privada de este relay
+char sala[MAX_NOMBRE];                  // Sala que reparte este relay
+int capacidad = CAPACIDAD_POR_DEFECTO;  // Observadores propios antes de delegar
+
+int num_suscriptores = 0;               // Observadores atendidos directamente
+int suscriptores[MAX_SUSCRIPTORES];     // Colas de los observadores (array denso)
+int num_hijos = 0;                      // Relays hijos registrados
+int hijos_qid[MAX_HIJOS];               // Colas de los relays hijos
+int hijos_carga[MAX_HIJOS];             // Observadores delegados en cada hijo
+struct delegado delegados[INDICE_DELEGADOS];  // Observador -> hijo (sondeo lineal)
+int num_delegados = 0;                  // Entradas ocupadas de delegados
+
+/* ==================== FUNCIONES ==================== */
+
+/**
+ * Enviar una respuesta (RESP) a un observador
+ *
+ * @param qid Cola del observador
+ * @param texto Texto de la notificación
+ */
+void notificar(int qid, const char *texto) {
+    struct mensaje resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.mtype = TIPO_RESP;
+    snprintf(resp.texto, MAX_TEXTO, "%s", texto);
+    msgsnd(qid, &resp, sizeof(resp) - sizeof(long), IPC_NOWAIT);
+}
+
+/**
+ * Confirmar o rechazar la solicitud de un observador (repite su correlación)
+ *
+ * @param sol Solicitud delegada (reply_qid, corr y sala del observador)
+ * @param estado ESTADO_OK o ESTADO_ERROR
+ * @param texto Texto de la respuesta
+ */
+void confirmar(const struct mensaje *sol, int estado, const char *texto) {
+    struct mensaje resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.mtype = TIPO_RESP;
+    resp.corr = sol->corr;
+    resp.estado = estado;
+    snprintf(resp.sala, MAX_NOMBRE, "%s", sol->sala);
+    snprintf(resp.texto, MAX_TEXTO, "%s", texto);
+    msgsnd(sol->reply_qid, &resp, sizeof(resp) - sizeof(long), IPC_NOWAIT);
+}
+
+/**
+ * Quitar un observador propio por posición (intercambio con el último)
+ *
+ * @param pos Posición en el array de suscriptores
+ */
+void quitar_suscriptor(int pos) {
+    suscriptores[pos] = suscriptores[--num_suscriptores];
+}
+
+/**
+ * Acusar al padre la baja de un observador atendido por este relay o sus hijos
+ *
+ * Así el padre (y, subiendo, el servidor) descuenta la carga y olvida
+ * a qué relay lo delegó.
+ *
+ * @param qid Cola del observador dado de baja
+ */
+void acusar_baja(int qid) {
+    struct mensaje acuse;
+    memset(&acuse, 0, sizeof(acuse));
+    acuse.mtype = TIPO_RELAY_DEL;
+    acuse.reply_qid = cola_relay;
+    acuse.seq = (unsigned int)qid;
+    snprintf(acuse.sala, MAX_NOMBRE, "%s", sala);
+    msgsnd(cola_padre, &acuse, sizeof(acuse) - sizeof(long), 0);
+}
+
+/**
+ * Buscar la casilla de un observador delegado
+ *
+ * @param qid Cola del observador
+ * @param crear 1 para devolver una casilla libre si no está
+ * @return Casilla (ocupada con ese qid, o libre si crear), NULL si no hay
+ */
+struct delegado *casilla_delegado(int qid, int crear) {
+    unsigned int h = ((unsigned int)qid * 2654435761u) & (INDICE_DELEGADOS - 1);
+    struct delegado *libre = NULL;
+    for (int i = 0; i < INDICE_DELEGADOS; i++) {
+        struct delegado *d = &delegados[(h + i) & (INDICE_DELEGADOS - 1)];
+        if (d->estado == 1 && d->qid == qid) {
+            return d;
+        }
+        if (d->estado != 1 && !libre) {
+            libre = d;
+        }
+        if (d->estado == 0) {
+            break;  // Casilla nunca usada: el qid no está
+        }
+    }
+    return crear ? libre : NULL;
+}
+
+/**
+ * Olvidar un observador delegado
+ *
+ * @param qid Cola del observador
+ * @return Cola del hijo que lo atendía, o -1 si no estaba delegado
+ */
+int olvidar_delegado(int qid) {
+    struct delegado *d = casilla_delegado(qid, 0);
+    if (!d) {
+        return -1;
+    }
+    d->estado = 2;
+    num_delegados--;
+    return d->hijo;
+}
+
+/**
+ * Quitar un hijo cuya cola ya no existe
+ *
+ * Sus observadores quedan sin servicio: se acusan sus bajas al padre
+ * para que no se sigan contando.
+ *
+ * @param pos Posición del hijo
+ */
+void quitar_hijo(int pos) {
+    int qid = hijos_qid[pos];
+    printf("[RELAY] Hijo qid=%d dado de baja (%d observadores perdidos)\n", qid, hijos_carga[pos]);
+    for (int c = 0; c < INDICE_DELEGADOS && hijos_carga[pos] > 0; c++) {
+        struct delegado *d = &delegados[c];
+        if (d->estado == 1 && d->hijo == qid) {
+            d->estado = 2;
+            num_delegados--;
+            hijos_carga[pos]--;
+            acusar_baja(d->qid);
+        }
+    }
+    num_hijos--;
+    hijos_qid[pos] = hijos_qid[num_hijos];
+    hijos_carga[pos] = hijos_carga[num_hijos];
+}
+
+/**
+ * Atender una delegación de observador (RELAY_ADD)
+ *
+ * @param msg Mensaje RELAY_ADD (reply_qid = cola del observador)
+ */
+void agregar_observador(struct mensaje *msg) {
+    // Con cupo propio (o sin hijos donde delegar) lo atiende este relay
+    if ((num_suscriptores < capacidad || num_hijos == 0) && num_suscriptores < MAX_SUSCRIPTORES) {
+        suscriptores[num_suscriptores++] = msg->reply_qid;
+
+        char texto[MAX_TEXTO];
+        snprintf(texto, sizeof(texto), "Observando la sala: %s (sólo lectura, vía relay %d)",
+                 sala, cola_relay);
+        confirmar(msg, ESTADO_OK, texto);
+        printf("[RELAY] Observador '%s' agregado (%d propios)\n", msg->remitente, num_suscriptores);
+        return;
+    }
+
+    // Sin cupo: delegar en el hijo menos cargado (recordando en cuál)
+    struct delegado *d = (num_delegados < MAX_DELEGADOS) ? casilla_delegado(msg->reply_qid, 1) : NULL;
+    while (d && num_hijos > 0) {
+        int elegido = 0;
+        for (int i = 1; i < num_hijos; i++) {
+            if (hijos_carga[i] < hijos_carga[elegido]) {
+                elegido = i;
+            }
+        }
+        if (msgsnd(hijos_qid[elegido], msg, sizeof(*msg) - sizeof(long), 0) == 0) {
+            hijos_carga[elegido]++;
+            if (d->estado != 1) {
+                num_delegados++;
+            }
+            d->qid = msg->reply_qid;
+            d->hijo = hijos_qid[elegido];
+            d->estado = 1;
+            return;
+        }
+        // Hijo caído: quitarlo y probar con otro
+        quitar_hijo(elegido);
+        d = casilla_delegado(msg->reply_qid, 1);  // quitar_hijo pudo dejar lápidas
+    }
+
+    confirmar(msg, ESTADO_ERROR, "Error: el relay no tiene capacidad para más observadores");
+}
+
+/**
+ * Procesar una baja (RELAY_DEL): solicitud del padre o acuse de un hijo
+ *
+ * @param msg Mensaje RELAY_DEL
+ */
+void quitar_observador(struct mensaje *msg) {
+    // ¿Es el acuse de un hijo? (reply_qid = cola del hijo, seq = observador)
+    for (int i = 0; i < num_hijos; i++) {
+        if (hijos_qid[i] == msg->reply_qid) {
+            if (hijos_carga[i] > 0) {
+                hijos_carga[i]--;
+            }
+            olvidar_delegado((int)msg->seq);
+            acusar_baja((int)msg->seq);  // Sigue subiendo hasta el servidor
+            return;
+        }
+    }
+
+    // ¿Es un observador propio?
+    for (int i = 0; i < num_suscriptores; i++) {
+        if (suscriptores[i] == msg->reply_qid) {
+            quitar_suscriptor(i);
+
+            char texto[MAX_TEXTO];
+            snprintf(texto, sizeof(texto), "Has dejado de observar la sala: %s", sala);
+            confirmar(msg, ESTADO_OK, texto);
+            acusar_baja(msg->reply_qid);  // El padre descuenta nuestra carga
+            return;
+        }
+    }
+
+    // Delegado: sólo el hijo que lo atiende (él confirma y acusa la baja)
+    int hijo = olvidar_delegado(msg->reply_qid);
+    if (hijo != -1 && msgsnd(hijo, msg, sizeof(*msg) - sizeof(long), 0) == 0) {
+        return;
+    }
+
+    char texto[MAX_TEXTO];
+    snprintf(texto, sizeof(texto), "Error: no estás en la sala '%s'", sala);
+    confirmar(msg, ESTADO_ERROR, texto);
+}
+
+/**
+ * Reenviar un mensaje de la sala a hijos y observadores propios
+ *
+ * @param msg Mensaje CHAT recibido del padre
+ */
+void difundir(struct mensaje *msg) {
+    size_t tam = sizeof(*msg) - sizeof(long);
+
+    // Hijos primero: cada uno representa a muchos observadores
+    for (int i = 0; i < num_hijos; i++) {
+        if (msgsnd(hijos_qid[i], msg, tam, 0) == -1 && (errno == EINVAL || errno == EIDRM)) {
+            quitar_hijo(i);
+            i--;
+        }
+    }
+
+    // Observadores propios: sin bloqueo, los que ya no existen se quitan (y se acusan)
+    for (int i = 0; i < num_suscriptores; i++) {
+        if (msgsnd(suscriptores[i], msg, tam, IPC_NOWAIT) == -1 && (errno == EINVAL || errno == EIDRM)) {
+            acusar_baja(suscriptores[i]);
+            quitar_suscriptor(i);
+            i--;
+        }
+    }
+}
+
+/**
+ * Limpieza y terminación del relay
+ *
+ * Avisa a sus observadores de que deben volver a suscribirse y elimina
+ * la cola privada. El padre detecta la cola eliminada en su próximo envío.
+ *
+ * @param signo Número de la señal recibida
+ */
+void limpiar_y_salir(int signo) {
+    printf("\n[RELAY] Señal %d recibida, terminando...\n", signo);
+
+    char texto[MAX_TEXTO];
+    snprintf(texto, sizeof(texto), "El relay de la sala '%s' terminó. Usa /observar %s de nuevo.",
+             sala, sala);
+    for (int i = 0; i < num_suscriptores; i++) {
+        notificar(suscriptores[i], texto);
+    }
+
+    if (cola_relay != -1) {
+        msgctl(cola_relay, IPC_RMID, NULL);
+    }
+    exit(0);
+}
+
+/* ==================== FUNCIÓN PRINCIPAL ==================== */
+
+int main(int argc, char *argv[]) {
+    /* Procesar opciones de línea de comandos */
+    int opt;
+    while ((opt = getopt(argc, argv, "p:c:")) != -1) {
+        if (opt == 'p') {
+            cola_padre = atoi(optarg);
+        } else if (opt == 'c') {
+            capacidad = atoi(optarg);
+        } else {
+            optind = argc + 1;  // Forzar mensaje de uso
+            break;
+        }
+    }
+    if (optind != argc - 1 || capacidad <= 0) {
+        fprintf(stderr, "Uso: %s [-p <qid_padre>] [-c <capacidad>] <sala>\n", argv[0]);
+        exit(1);
+    }
+    snprintf(sala, MAX_NOMBRE, "%s", argv[optind]);
+
+    signal(SIGINT, limpiar_y_salir);
+    signal(SIGTERM, limpiar_y_salir);
+
+    /* Resolver el padre: por defecto, la cola global del servidor */
+    if (cola_padre == -1) {
+        key_t key_global = ftok("/tmp", 'A');
+        cola_padre = (key_global == (key_t)-1) ? -1 : msgget(key_global, 0666);
+        if (cola_padre == -1) {
+            fprintf(stderr, "Error: No se puede conectar al servidor.\n");
+            exit(1);
+        }
+    }
+
+    /* Crear cola privada y registrarse en el padre */
+    cola_relay = msgget(IPC_PRIVATE, IPC_CREAT | 0666);
+    if (cola_relay == -1) {
+        perror("Error creando cola del relay");
+        exit(1);
+    }
+
+    struct mensaje msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.mtype = TIPO_RELAY_REG;
+    msg.reply_qid = cola_relay;
+    snprintf(msg.remitente, MAX_NOMBRE, "relay-%d", cola_relay);
+    snprintf(msg.sala, MAX_NOMBRE, "%s", sala);
+    if (msgsnd(cola_padre, &msg, sizeof(msg) - sizeof(long), 0) == -1) {
+        perror("Error registrando relay en el padre");
+        limpiar_y_salir(0);
+    }
+
+    printf("=== RELAY DE DIFUSIÓN ===\n");
+    printf("Sala: %s | Cola del relay: %d | Padre: %d | Capacidad propia: %d\n",
+           sala, cola_relay, cola_padre, capacidad);
+    printf("Relays hijos: ./relay -p %d %s\n\n", cola_relay, sala);
+    fflush(stdout);  // El qid debe verse aunque la salida vaya a un archivo
+
+    /* Bucle principal de reenvío */
+    while (1) {
+        ssize_t r = msgrcv(cola_relay, &msg, sizeof(msg) - sizeof(long), 0, 0);
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("[ERROR] Error recibiendo en cola del relay");
+            if (errno == EINVAL || errno == EIDRM) {
+                exit(1);  // Nuestra cola fue eliminada
+            }
+            continue;
+        }
+
+        if (msg.mtype == TIPO_CHAT) {
+            difundir(&msg);
+        } else if (msg.mtype == TIPO_RELAY_ADD) {
+            agregar_observador(&msg);
+        } else if (msg.mtype == TIPO_RELAY_DEL) {
+            quitar_observador(&msg);
+        } else if (msg.mtype == TIPO_RELAY_REG) {
+            // Un relay hijo se cuelga de éste
+            if (num_hijos < MAX_HIJOS) {
+                hijos_qid[num_hijos] = msg.reply_qid;
+                hijos_carga[num_hijos] = 0;
+                num_hijos++;
+                notificar(msg.reply_qid, "Relay hijo registrado");
+                printf("[RELAY] Hijo qid=%d registrado (%d hijos)\n", msg.reply_qid, num_hijos);
+            } else {
+                notificar(msg.reply_qid, "Error: el relay padre no admite más hijos");
+            }
+        } else if (msg.mtype == TIPO_RESP) {
+            printf("[PADRE] %s\n", msg.texto);
+        }
+    }
+
+    return 0;
+}
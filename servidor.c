@@ -13,6 +13,17 @@
  * - Comandos administrativos (lista de salas y usuarios)
  * - Entrada y salida dinámica de usuarios de salas
  * - Distribución eficiente de mensajes
+ * - Entrega selectiva por filtros (menciones, palabras clave, remitentes)
+ * - Observadores de sólo lectura fuera del límite de usuarios por sala
+ * - Relays: procesos que reparten la difusión a observadores (árbol)
+ * - Modo cluster: varios procesos servidor se reparten las salas
+ * - Rebalanceo: migración en vivo de salas desde nodos sobrecargados
+ * - Números de secuencia por sala y anillo de reenvío para recuperar huecos
+ * - Diccionario de compresión entrenado por sala para los textos largos
+ * - Cola de administración: expulsar, localizar usuarios, cerrar salas, drenar, estado y nivel de log
+ * - Presencia: altas y bajas de cada sala agrupadas en una ventana corta
+ * - Versión de miembros por sala: listas sincronizadas con sólo los cambios
+ * - Registro de usuarios: nombres únicos y salas de cada usuario sin recorrerlas
  * - Limpieza automática de recursos al terminar
  * 
  * Protocolo de mensajes soportado:
@@ -23,9 +34,29 @@
  * - Tipo 5 (LEAVE): Cliente abandona sala actual
  * - Tipo 6 (USERS): Solicitud de lista de usuarios en sala
  * - Tipo 7 (LIST):  Solicitud de lista de salas disponibles
+ * - Tipo 8 (CONNECT):    Cliente registra su sesión (nombre -> cola privada)
+ * - Tipo 9 (DISCONNECT): Cliente cierra su sesión
+ * - Tipo 10 (DM):        Mensaje privado a otro usuario (sala = destinatario)
+ * - Tipo 11 (PRIV):      Mensaje privado entregado por el servidor
+ * - Tipo 12 (FILTER):    Configurar filtro de suscripción en una sala
+ * - Tipo 13 (OBSERVE):   Unirse a una sala como observador (sólo lectura)
+ * - Tipo 14 (RELAY_REG): Un proceso relay se registra para una sala
+ * - Tipo 15 (RELAY_ADD): Servidor delega un observador en un relay
+ * - Tipo 16 (RELAY_DEL): Baja de un observador delegado (y su confirmación)
+ * - Tipo 17 (MIGRAR):    Estado de una sala que se traslada a otro nodo
+ * - Tipo 18 (BACKFILL):  Cliente pide los mensajes que perdió (por secuencia)
+ * - Tipo 19 (MIGRAR_REPLAY): Entrada del anillo de reenvío de una sala migrada
+ * - Tipo 20 (DICCIONARIO):   Cliente pregunta por el diccionario de compresión de una sala
+ * - Tipo 21 (ADMIN):         Orden de administración (sólo por la cola de administración)
+ * - Tipo 22 (PRESENCIA):     Servidor avisa a los miembros de las altas y bajas de su sala
+ * - Tipo 23 (MIEMBROS):      Cliente pide los cambios de miembros desde su versión
  * 
  * Archivos generados:
  * - <nombre_sala>.txt: Historial de mensajes por sala
+ * - <nombre_sala>.dic: Diccionario de compresión entrenado de la sala
+ * - privados.log: Registro opcional de mensajes privados (opción -p)
+ * 
+ * Uso: ./servidor [-p] [-N <nodos> -n <nodo> [-u <profundidad>]]
  */
 
 #include <stdio.h>        // entrada/salida estándar
@@ -37,28 +68,120 @@
 #include <unistd.h>       // funciones estándar de Unix
 #include <signal.h>       // manejo de señales del sistema
 #include <errno.h>        // códigos de error del sistema
+#include <stdarg.h>       // argumentos variables (responder)
+#include <sys/time.h>     // setitimer (tick de métricas)
+#include <time.h>         // clock_gettime (coste de cada manejador)
+#include <sys/resource.h> // getrusage (uso de CPU)
+#include <sys/stat.h>     // stat (tamaño de los buzones)
+#include <sys/shm.h>      // segmentos de los diccionarios de compresión
+#include <pthread.h>      // hilo de la cola de administración
+
+#include "protocolo.h"    // estructura de mensaje y tipos compartidos
+#include "cadenas_simd.h" // comparación de nombres de ancho fijo con SIMD
+#include "filtros.h"      // autómata Aho-Corasick para filtros de suscripción
+#include "cluster.h"      // directorio de nodos y hashing consistente
+#include "compresion.h"   // entrenamiento de diccionarios de compresión
 
 /* ==================== CONSTANTES Y CONFIGURACIÓN ==================== */
 #define MAX_SALAS 4                    // Número máximo de salas de chat simultáneas
 #define MAX_USUARIOS_POR_SALA 20        // Límite de usuarios por sala individual
-#define MAX_TEXTO 256                   // Longitud máxima de un mensaje de texto
-#define MAX_NOMBRE 50                   // Longitud máxima para nombres de usuario y salas
+#define MAX_SESIONES 16384              // Capacidad del índice de sesiones (potencia de 2)
+#define ARCHIVO_PRIVADOS "privados.log" // Registro opcional de mensajes privados
+#define MAX_PALABRAS_FILTRO 8           // Palabras clave por filtro de miembro
+#define MAX_REMITENTES_FILTRO 8         // Remitentes permitidos por filtro de miembro
+#define MAX_OBSERVADORES_POR_SALA 4096  // Observadores (sólo lectura) por sala
+#define INDICE_OBSERVADORES 8192        // Casillas del índice qid -> posición (potencia de 2)
+#define MAX_RELAYS_POR_SALA 16          // Procesos relay registrados por sala
+#define MAX_DELEGADOS_POR_SALA 8192     // Observadores delegados en relays por sala
+#define INDICE_DELEGADOS 16384          // Casillas del índice observador -> relay (potencia de 2)
+#define RETENIDOS_INICIALES 1024        // Capacidad inicial de la retención de salas migradas (crece al doble)
+#define UMBRAL_PROFUNDIDAD 32           // Cola de entrada "sobrecargada" (mensajes pendientes)
+#define UMBRAL_CPU 80                   // Nodo "sobrecargado" (% de CPU)
+#define ESPERA_REBALANCEO 5             // Segundos mínimos entre dos migraciones de un nodo
+#define ESPERA_ACUSE_MS 2000            // Máximo que una migración espera que el destino acepte "ini"
+#define TAM_REPLAY 256                  // Últimos mensajes por sala disponibles para BACKFILL (potencia de 2)
+#define MAX_BUZON 1024                  // Mensajes guardados por miembro desconectado y sala
+#define MAX_MONITOR_CLIENTES 50         // Clientes más atrasados que informa la orden "monitor"
+#define VENTANA_PRESENCIA_MS 200        // Espera para agrupar las altas y bajas de una sala
+#define MAX_PRESENCIA (2 * MAX_USUARIOS_POR_SALA)  // Cambios pendientes por sala (más: se envían ya)
+#define TAM_CAMBIOS_MIEMBROS 64         // Últimas altas y bajas por sala para MIEMBROS (potencia de 2)
+#define MAX_PARTES (MAX_USUARIOS_POR_SALA + TAM_CAMBIOS_MIEMBROS)  // Mensajes de una lista de nombres
+
+/* ==================== NIVELES DE LOG ==================== */
+// Los errores se muestran siempre; el nivel se cambia en vivo con la orden "log"
+#define LOG_ERRORES 0                   // Sólo errores
+#define LOG_EVENTOS 1                   // Además salas, sesiones, buzones, migraciones
+#define LOG_TRAFICO 2                   // Además una línea por solicitud y mensaje (por defecto)
+#define LOG(nivel, ...) do { if (nivel_log >= (nivel)) printf(__VA_ARGS__); } while (0)
+
+// Cada miembro de una sala ocupa un bit de mascara_t en los filtros
+_Static_assert(MAX_USUARIOS_POR_SALA <= 64, "MAX_USUARIOS_POR_SALA no cabe en mascara_t");
+// Las colas de sala usan proj_id 100 + nodo * MAX_SALAS + sala (ftok sólo usa 8 bits)
+_Static_assert(100 + MAX_NODOS * MAX_SALAS <= 256, "proj_id de salas fuera de rango");
+_Static_assert(100 + MAX_NODOS * MAX_SALAS <= PROYECTO_ADMIN(0) && PROYECTO_ADMIN(MAX_NODOS) <= 256,
+               "proj_id de las colas de administración fuera de rango");
 
 /* ==================== ESTRUCTURAS DE DATOS ==================== */
 
 /**
- * Estructura de mensaje para comunicación cliente-servidor
+ * Filtro de suscripción de un miembro de sala
+ * 
+ * Un miembro sin filtro (activo = 0) recibe todo. Con filtro activo sólo
+ * recibe los mensajes que lo mencionan ("@nombre"), que contienen alguna
+ * de sus palabras clave o que envía alguno de sus remitentes permitidos.
+ */
+struct filtro {
+    int activo;                                             // 0 = recibe todo
+    int num_palabras;                                       // Palabras clave configuradas
+    char palabras[MAX_PALABRAS_FILTRO][AC_MAX_PATRON];     // Palabras clave
+    int num_remitentes;                                     // Remitentes permitidos configurados
+    char remitentes[MAX_REMITENTES_FILTRO][NOMBRE_SLOT];   // Remitentes permitidos (slots)
+};
+
+/**
+ * Entrada del anillo de reenvío de una sala (para BACKFILL)
+ */
+struct entrada_replay {
+    unsigned int seq;                   // Número de secuencia (0 = vacía)
+    char remitente[MAX_NOMBRE];         // Autor del mensaje
+    char texto[MAX_TEXTO];              // Contenido del mensaje
+};
+
+/**
+ * Registro del buzón de un miembro desconectado
  * 
- * Utilizada para todos los tipos de comunicación entre clientes y servidor.
- * Debe coincidir exactamente con la estructura del cliente para garantizar
- * compatibilidad en la transmisión de datos.
+ * El buzón no copia el mensaje: apunta a su línea en el historial de la
+ * sala (<sala>.txt), que ya lo guarda. Cada registro ocupa 16 bytes.
+ */
+struct registro_buzon {
+    unsigned int seq;                   // Secuencia del mensaje (para validar la línea)
+    long desplazamiento;                // Posición de su línea en el historial
+};
+
+/**
+ * Alta o baja de un miembro pendiente de avisar a su sala
+ */
+struct cambio_presencia {
+    char nombre[MAX_NOMBRE];
+    int alta;                           // 1 = se unió, 0 = se fue
+};
+
+/**
+ * Alta o baja de un miembro en el anillo de versiones de su sala
+ */
+struct cambio_miembro {
+    unsigned int version;               // Versión que produjo (0 = libre)
+    char nombre[MAX_NOMBRE];
+    int alta;                           // 1 = se unió, 0 = se fue
+};
+
+/**
+ * Observador delegado en un relay (para enviarle su baja sólo a ese relay)
  */
-struct mensaje {
-    long mtype;                     // Tipo de mensaje (1-7, ver protocolo arriba)
-    int reply_qid;                  // ID de cola privada del cliente (para respuestas)
-    char remitente[MAX_NOMBRE];     // Nombre del usuario que envía el mensaje
-    char texto[MAX_TEXTO];          // Contenido del mensaje o datos adicionales
-    char sala[MAX_NOMBRE];          // Nombre de la sala objetivo o actual
+struct delegado {
+    int qid;                            // Cola del observador
+    int relay;                          // Cola del relay que lo atiende
+    int estado;                         // 0 = libre, 1 = ocupada, 2 = borrada (lápida)
 };
 
 /**
@@ -66,26 +189,228 @@ struct mensaje {
  * 
  * Mantiene toda la información necesaria para gestionar una sala:
  * usuarios conectados, su información de contacto y recursos asociados.
+ * 
+ * Los nombres se guardan en slots de NOMBRE_SLOT bytes rellenados con
+ * ceros (ver cadenas_simd.h) para poder compararlos con SIMD.
+ * 
+ * Los filtros de todos los miembros se compilan en un único autómata por
+ * sala, que se reconstruye de forma perezosa cuando cambian los filtros
+ * o las posiciones de los miembros (filtros_sucios).
+ * 
+ * Los observadores no ocupan slots de usuarios: se guardan sólo como IDs
+ * de cola en un array denso (para difundir con un bucle mínimo) más un
+ * índice hash qid -> posición para altas y bajas en O(1).
+ * 
+ * Si la sala tiene relays registrados, los nuevos observadores se delegan
+ * en el relay menos cargado: el servidor sólo envía una copia por relay
+ * y cada relay reparte a sus propios observadores en otro proceso.
+ * Se recuerda en qué relay quedó cada uno (delegados) para enviarle
+ * su baja sólo a ese relay.
+ * 
+ * En modo cluster una sala puede migrar a otro nodo: mientras llega su
+ * estado (en_transito) los mensajes nuevos para ella quedan retenidos.
+ * 
+ * Cada mensaje distribuido recibe el siguiente número de secuencia de la
+ * sala y se guarda en un anillo de TAM_REPLAY entradas. Por cada miembro
+ * se recuerda la última secuencia que se le intentó enviar: así el
+ * cliente detecta huecos aunque su filtro descarte mensajes, y el envío
+ * puede ser sin bloqueo (lo que no cabe en su cola se recupera después).
+ * 
+ * Un miembro cuya cola desaparece (o que envía DISCONNECT) sigue en la
+ * sala como desconectado (qid -1): lo que le corresponde se anota en su
+ * buzón en disco y se le entrega de una vez cuando vuelve a unirse. Si
+ * la sala se llena, el desconectado más antiguo deja su puesto (y su
+ * buzón) al que llega.
+ * 
+ * Cada alta o baja incrementa la versión de miembros y se guarda en un
+ * anillo de TAM_CAMBIOS_MIEMBROS entradas: un cliente al día de una
+ * versión reciente recibe sólo lo que cambió desde entonces.
  */
 struct sala {
-    char nombre[MAX_NOMBRE];                            // Nombre identificador único de la sala
+    char nombre[NOMBRE_SLOT] __attribute__((aligned(64)));     // Nombre identificador único de la sala
+    char usuarios[MAX_USUARIOS_POR_SALA][NOMBRE_SLOT];         // Array de nombres de usuarios conectados
     int cola_id;                                        // ID de cola System V asociada a la sala
     int num_usuarios;                                   // Contador actual de usuarios en la sala
-    char usuarios[MAX_USUARIOS_POR_SALA][MAX_NOMBRE];  // Array de nombres de usuarios conectados
     int usuarios_qid[MAX_USUARIOS_POR_SALA];           // Array de IDs de colas privadas de usuarios
+    int usuarios_canal[MAX_USUARIOS_POR_SALA];         // Canal de cada usuario en su cola (0 = propia)
+    struct filtro usuarios_filtro[MAX_USUARIOS_POR_SALA];  // Filtro de suscripción de cada usuario
+    mascara_t mascara_filtrados;                        // Bits de usuarios con filtro activo
+    int filtros_sucios;                                 // 1 si hay que recompilar el autómata
+    struct automata automata;                           // Patrones de todos los filtros de la sala
+    int num_observadores;                               // Observadores de sólo lectura
+    int observadores_qid[MAX_OBSERVADORES_POR_SALA];   // Colas de observadores (array denso)
+    int indice_observadores[INDICE_OBSERVADORES];      // qid -> posición + 1 (0 = libre, -1 = lápida)
+    int num_relays;                                     // Relays registrados en la sala
+    int relays_qid[MAX_RELAYS_POR_SALA];               // Colas de los relays
+    int relays_carga[MAX_RELAYS_POR_SALA];             // Observadores delegados en cada relay
+    int num_delegados;                                  // Entradas ocupadas de delegados
+    struct delegado delegados[INDICE_DELEGADOS];        // Observador -> relay (sondeo lineal)
+    int ranura;                                         // Ranura de proj_id de su cola (0..MAX_SALAS-1)
+    int en_transito;                                    // 1 mientras se recibe la sala de otro nodo
+    int mensajes_tick;                                  // Mensajes distribuidos en el segundo actual
+    int actividad;                                      // Media móvil de mensajes por segundo
+    unsigned long copias;                               // Copias entregadas a colas (coste de difusión)
+    long long ns_difusion;                              // Tiempo acumulado distribuyendo (ns)
+    unsigned int seq;                                   // Último número de secuencia asignado
+    unsigned int seq_restaurada;                        // Secuencia con que se creó (del historial)
+    unsigned int usuarios_ultimo[MAX_USUARIOS_POR_SALA];  // Última secuencia enviada a cada miembro
+    int usuarios_buzon[MAX_USUARIOS_POR_SALA];         // Mensajes en el buzón de cada miembro
+    time_t usuarios_desconexion[MAX_USUARIOS_POR_SALA]; // Momento en que se desconectó (0 = conectado)
+    struct entrada_replay replay[TAM_REPLAY];           // Anillo de reenvío (seq & (TAM_REPLAY - 1))
+    unsigned int diccionario;                           // Huella del diccionario de compresión (0 = sin entrenar)
+    int diccionario_shm;                                // Segmento donde se publica (-1 = ninguno)
+    char *muestras;                                     // Texto reunido para entrenarlo (NULL = nada aún)
+    size_t largo_muestras;
+    struct cambio_presencia presencia[MAX_PRESENCIA];   // Altas y bajas aún sin avisar
+    int num_presencia;
+    unsigned int version_miembros;                      // Versión de la lista de miembros
+    unsigned int version_base;                          // Primera versión con cambios en el anillo
+    unsigned int version_avisada;                       // Versión tras la última PRESENCIA
+    struct cambio_miembro cambios_miembros[TAM_CAMBIOS_MIEMBROS];  // Anillo (version & (TAM - 1))
+};
+
+/**
+ * Entrada del registro de usuarios (usuario -> cola privada y salas)
+ * 
+ * El registro es una tabla hash con direccionamiento abierto (sondeo
+ * lineal) que permite entregar mensajes privados directamente a la cola
+ * del destinatario sin pasar por ninguna sala. Un nombre sólo puede tener
+ * una sesión: otra cola que lo reclame se rechaza mientras la primera
+ * siga viva.
+ * 
+ * Cada entrada guarda además la lista inversa de las salas de este nodo
+ * en las que el usuario es miembro, así "dónde está" o "expulsarlo de
+ * todas" no recorren las salas. En un cluster la sesión vive en el nodo
+ * dueño del nombre y las salas pueden estar en otros: una entrada sólo
+ * con salas (qid -1) no es una sesión.
+ */
+struct sesion {
+    char nombre[NOMBRE_SLOT];       // Nombre del usuario (slot rellenado con ceros)
+    int qid;                        // ID de la cola privada del cliente (-1 = sin sesión aquí)
+    int canal;                      // Sesión dentro de esa cola si es compartida (0 = propia)
+    int estado;                     // 0 = libre, 1 = ocupada, 2 = borrada (lápida)
+    int num_salas;                  // Salas de este nodo en las que es miembro
+    int salas[MAX_SALAS];           // Sus índices en salas[]
+};
+
+/**
+ * Manejador de un tipo de mensaje y su estadística
+ * 
+ * procesar_mensaje despacha con una tabla indexada por mtype; cada
+ * entrada acumula los mensajes atendidos y su coste.
+ */
+struct manejador {
+    const char *nombre;                 // Nombre del tipo en los logs
+    void (*funcion)(struct mensaje *msg);  // NULL = tipo sin manejador
+    unsigned long llamadas;             // Mensajes atendidos
+    long long ns_total;                 // Tiempo acumulado (ns)
+    long long ns_max;                   // Mensaje más lento (ns)
 };
 
 /* ==================== VARIABLES GLOBALES ==================== */
 struct sala salas[MAX_SALAS];       // Array de todas las salas de chat disponibles
 int num_salas = 0;                  // Contador actual de salas activas
 int cola_global = -1;               // ID de la cola global donde llegan todos los mensajes
+struct sesion sesiones[MAX_SESIONES];  // Índice de sesiones activas por nombre de usuario
+int num_sesiones = 0;               // Contador de sesiones registradas
+int num_entradas = 0;               // Entradas ocupadas del registro (sesiones o sólo salas)
+FILE *log_privados = NULL;          // Registro de mensajes privados (NULL = desactivado)
+struct directorio *directorio = NULL;  // Directorio del cluster (NULL = servidor único)
+int nodo_id = 0;                    // Índice de este nodo en el cluster
+int umbral_profundidad = UMBRAL_PROFUNDIDAD;  // 0 = rebalanceo desactivado
+struct mensaje *retenidos = NULL;   // Mensajes de salas en tránsito (en orden de llegada)
+int num_retenidos = 0;              // Mensajes retenidos actualmente
+int capacidad_retenidos = 0;        // Mensajes que caben en retenidos
+volatile sig_atomic_t tick_pendiente = 0;  // SIGALRM: toca actualizar métricas
+int mensajes_tick = 0;              // Mensajes recibidos en el segundo actual
+int ultima_migracion = 0;           // Ticks desde la última migración saliente
+unsigned long mensajes_desconocidos = 0;  // Mensajes sin manejador en la tabla
+long long ns_ocupado = 0;           // Tiempo acumulado en manejadores (ocupación del bucle)
+int nivel_log = LOG_TRAFICO;        // Detalle del log (orden "log" de administración)
+int cola_admin = -1;                // Cola de administración de este nodo (-1 = desactivada)
+int drenando = 0;                   // 1 tras "drenar": sin uniones nuevas, termina al vaciarse
+pthread_t hilo_admin;               // Recibe las órdenes de la cola de administración
+pthread_mutex_t mutex_admin = PTHREAD_MUTEX_INITIALIZER;  // Protege orden_admin
+pthread_cond_t orden_atendida = PTHREAD_COND_INITIALIZER; // El bucle principal terminó la orden
+struct mensaje orden_admin;         // Orden recibida, pendiente del bucle principal
+volatile sig_atomic_t admin_pendiente = 0;  // 1 mientras orden_admin espera al bucle principal
+pthread_t hilo_presencia;           // Vence la ventana de presencia
+pthread_mutex_t mutex_presencia = PTHREAD_MUTEX_INITIALIZER;  // Protege la ventana
+pthread_cond_t cambio_ventana;      // Ventana armada (reloj monótono)
+struct timespec vence_presencia;    // Fin de la ventana armada
+int presencia_armada = 0;           // 1 si hay una ventana en curso
+volatile sig_atomic_t presencia_vencida = 0;  // 1 cuando toca enviar la presencia pendiente
+int presencia_activa = 0;           // 0 si no hay hilo: la presencia se envía al momento
 
 /* ==================== PROTOTIPOS DE FUNCIONES ==================== */
 int crear_sala(const char *nombre);                                        // Crea nueva sala de chat
 int buscar_sala(const char *nombre);                                       // Busca sala por nombre
-int agregar_usuario_a_sala(int indice_sala, const char *nombre_usuario, int qid_usuario);  // Agrega usuario a sala
+int buscar_usuario_en_sala(int indice_sala, const char *nombre_usuario);   // Busca usuario dentro de sala
+int agregar_usuario_a_sala(int indice_sala, const char *nombre_usuario, int qid_usuario, int canal_usuario);  // Agrega usuario a sala
+void quitar_usuario_de_sala(int indice_sala, int pos);                    // Quita usuario de sala
+int desalojar_desconectado(int indice_sala);                               // Libera el puesto más antiguo
 void enviar_a_todos_en_sala(int indice_sala, struct mensaje *msg);        // Distribuye mensaje en sala
-void guardar_historial(int indice_sala, struct mensaje *msg);             // Guarda mensaje en archivo
+int configurar_filtro(int indice_sala, const char *nombre_usuario, const char *spec);  // Define filtro
+void recompilar_filtros(int indice_sala);                                  // Reconstruye autómata de sala
+mascara_t calcular_destinatarios(int indice_sala, struct mensaje *msg);   // Evalúa filtros del mensaje
+int agregar_observador(int indice_sala, int qid);                          // Agrega observador a sala
+int quitar_observador(int indice_sala, int qid);                           // Quita observador de sala
+int difundir_a_observadores(int indice_sala, struct mensaje *out);        // Envía a todos los observadores
+int registrar_relay(int indice_sala, int qid);                             // Registra relay de sala
+void quitar_relay(int indice_sala, int pos);                               // Da de baja un relay
+int delegar_observador(int indice_sala, struct mensaje *msg);              // Asigna observador a un relay
+int anotar_delegado(int indice_sala, int qid, int relay);                  // Recuerda el relay de un observador
+int buscar_delegado(int indice_sala, int qid);                             // Relay de un observador delegado
+int olvidar_delegado(int indice_sala, int qid);                            // Olvida un observador delegado
+void difundir_a_relays(int indice_sala, struct mensaje *out);             // Envía una copia por relay
+int observadores_totales(int indice_sala);                                 // Directos + delegados
+long guardar_historial(int indice_sala, struct mensaje *msg);             // Guarda mensaje en archivo
+int partir_linea_historial(char *linea, unsigned int seq_defecto, unsigned int *seq, 
+                           char *remitente, char *texto);                  // Separa una línea del historial
+void restaurar_historial(int indice_sala);                                 // Recupera secuencia y anillo del archivo
+void responder(const struct mensaje *sol, const char *formato, ...);      // Envía RESP a un cliente
+void responder_sin_bloqueo(const struct mensaje *sol, const char *formato, ...);  // RESP sin esperar cola
+void confirmar(const struct mensaje *sol, int estado, const char *formato, ...);  // RESP correlacionado
+struct sesion *buscar_entrada(const char *nombre);                         // Busca usuario en el registro
+struct sesion *buscar_sesion(const char *nombre);                          // Busca sesión por nombre
+int registrar_sesion(const char *nombre, int qid, int canal);              // Registra o actualiza sesión
+void eliminar_sesion(const char *nombre);                                  // Elimina sesión del índice
+void anotar_membresia(const char *nombre, int indice_sala);                // Añade sala a la lista inversa
+void olvidar_membresia(const char *nombre, int indice_sala);               // Quita sala de la lista inversa
+void enviar_privado(struct mensaje *msg);                                  // Entrega un mensaje privado
+int reenviar_a_dueno(struct mensaje *msg);                                 // Reenvía al nodo dueño
+int registrar_sesion_en_dueno(const struct mensaje *msg);                 // Registra sesión en su nodo
+void reenviar_list(struct mensaje *msg);                                   // Propaga LIST a los demás nodos
+void eliminar_sala(int indice_sala);                                       // Libera una sala de este nodo
+int migrar_sala(int indice_sala, int destino);                             // Traslada una sala a otro nodo
+void recibir_migracion(struct mensaje *msg);                               // Aplica un registro de migración
+int retener_si_en_transito(struct mensaje *msg);                          // Retiene mensajes de sala en tránsito
+void actualizar_metricas(void);                                            // Publica carga en el directorio
+void evaluar_rebalanceo(void);                                             // Decide si migrar una sala
+void atender_mensaje(struct mensaje *msg);                                 // Reenvío, retención o proceso
+void enviar_backfill(int indice_sala, struct mensaje *msg);               // Reenvía mensajes perdidos
+int contar_buzon(int indice_sala, const char *nombre);                     // Registros en el buzón de un miembro
+void guardar_en_buzon(int indice_sala, int pos, unsigned int seq, long desplazamiento);  // Anota un mensaje
+int vaciar_buzon(int indice_sala, int pos);                                // Entrega el buzón al miembro
+void reconectar_miembro(int indice_sala, int pos, struct mensaje *msg);    // Vuelve a unir a un desconectado
+void desconectar_miembro(const struct mensaje *msg);                       // Marca desconectado en sus salas
+int publicar_diccionario(int indice_sala, const char *dicc, size_t tam);   // Copia a memoria compartida
+void cargar_diccionario(int indice_sala);                                  // Recupera el diccionario del archivo
+void muestrear_texto(int indice_sala, const struct mensaje *msg);          // Reúne texto y entrena
+void procesar_mensaje(struct mensaje *msg);                               // Despacha un mensaje por tipo
+void informe_manejadores(const struct mensaje *orden);                    // Mensajes y coste por tipo
+void informar(const struct mensaje *orden, int ultima, int estado, const char *formato, ...);  // Línea de informe
+int iniciar_admin(void);                                                   // Crea la cola de administración
+void atender_admin(void);                                                  // Ejecuta la orden pendiente
+void comprobar_drenaje(void);                                              // Termina si ya no queda nadie
+int lanzar_hilo(pthread_t *hilo, void *(*funcion)(void *));                // Hilo sin señales
+int iniciar_presencia(void);                                               // Crea el hilo de la ventana
+void anotar_presencia(int indice_sala, const char *nombre, int alta);      // Alta o baja pendiente
+void enviar_presencia(int indice_sala);                                    // Avisa los cambios de una sala
+void enviar_presencias(void);                                              // Avisa los de todas las salas
+void registrar_cambio_miembro(int indice_sala, const char *nombre, int alta);  // Nueva versión de miembros
+int anadir_a_partes(struct mensaje partes[], int *num_partes, int max_partes, 
+                    char signo, const char *nombre);                        // Lista de nombres en mensajes
 void limpiar_colas_y_salir(int signo);                                    // Limpia recursos y termina servidor
 
 /* ==================== IMPLEMENTACIÓN DE FUNCIONES ==================== */
@@ -107,9 +432,18 @@ int crear_sala(const char *nombre) {
         return -1;
     }
     
+    // Buscar una ranura de proj_id libre (las salas migradas dejan huecos)
+    int ranura = 0;
+    for (int i = 0; i < num_salas; i++) {
+        if (salas[i].ranura == ranura) {
+            ranura++;
+            i = -1;  // Reiniciar la búsqueda con la siguiente ranura
+        }
+    }
+    
     // Generar clave única para la cola de mensajes de esta sala
-    // Usamos proj_id diferente por sala para evitar colisiones
-    key_t key = ftok("/tmp", 100 + num_salas);
+    // Usamos proj_id diferente por sala (y por nodo del cluster) para evitar colisiones
+    key_t key = ftok("/tmp", 100 + nodo_id * MAX_SALAS + ranura);
     if (key == (key_t)-1) { 
         perror("[ERROR] ftok para nueva sala"); 
         return -1; 
@@ -122,17 +456,48 @@ int crear_sala(const char *nombre) {
         return -1; 
     }
 
-    // Inicializar estructura de sala en memoria
-    strncpy(salas[num_salas].nombre, nombre, MAX_NOMBRE - 1);
-    salas[num_salas].nombre[MAX_NOMBRE - 1] = '\0';  // Asegurar terminación nula
+    // Inicializar estructura de sala en memoria (slot rellenado con ceros)
+    nombre_a_slot(salas[num_salas].nombre, nombre);
     salas[num_salas].cola_id = cola_id;
     salas[num_salas].num_usuarios = 0;
+    salas[num_salas].mascara_filtrados = 0;
+    salas[num_salas].filtros_sucios = 0;
+    ac_reiniciar(&salas[num_salas].automata);
+    salas[num_salas].num_observadores = 0;
+    memset(salas[num_salas].indice_observadores, 0, sizeof(salas[num_salas].indice_observadores));
+    salas[num_salas].num_relays = 0;
+    salas[num_salas].num_delegados = 0;
+    memset(salas[num_salas].delegados, 0, sizeof(salas[num_salas].delegados));
+    salas[num_salas].ranura = ranura;
+    salas[num_salas].en_transito = 0;
+    salas[num_salas].mensajes_tick = 0;
+    salas[num_salas].actividad = 0;
+    salas[num_salas].copias = 0;
+    salas[num_salas].ns_difusion = 0;
+    salas[num_salas].seq = 0;
+    memset(salas[num_salas].replay, 0, sizeof(salas[num_salas].replay));
+    salas[num_salas].diccionario = 0;
+    salas[num_salas].diccionario_shm = -1;
+    salas[num_salas].muestras = NULL;
+    salas[num_salas].largo_muestras = 0;
+    salas[num_salas].num_presencia = 0;
+    // La versión empieza en la hora: un cliente con la de una ejecución
+    // anterior queda por detrás de version_base y recibe la lista completa
+    salas[num_salas].version_miembros = (unsigned int)time(NULL);
+    salas[num_salas].version_base = salas[num_salas].version_miembros;
+    salas[num_salas].version_avisada = salas[num_salas].version_miembros;
+    memset(salas[num_salas].cambios_miembros, 0, sizeof(salas[num_salas].cambios_miembros));
     
     // Log de creación exitosa
-    printf("[SERVIDOR] Sala creada: '%s' (ID=%d, Índice=%d)\n", 
+    LOG(LOG_EVENTOS, "[SERVIDOR] Sala creada: '%s' (ID=%d, Índice=%d)\n", 
            nombre, cola_id, num_salas);
     
     num_salas++;
+    
+    // Tras un reinicio la numeración continúa donde la dejó el historial
+    restaurar_historial(num_salas - 1);
+    salas[num_salas - 1].seq_restaurada = salas[num_salas - 1].seq;
+    cargar_diccionario(num_salas - 1);
     return num_salas - 1;
 }
 
@@ -140,33 +505,57 @@ int crear_sala(const char *nombre) {
  * Buscar una sala por su nombre
  * 
  * Recorre el array de salas activas buscando una que coincida
- * exactamente con el nombre especificado.
+ * exactamente con el nombre especificado. El nombre se convierte una
+ * vez a slot de ancho fijo y cada comparación es de 64 bytes con SIMD.
  * 
  * @param nombre Nombre de la sala a buscar
  * @return Índice de la sala si existe, -1 si no se encuentra
  */
 int buscar_sala(const char *nombre) {
+    char clave[NOMBRE_SLOT];
+    nombre_a_slot(clave, nombre);
+    
     for (int i = 0; i < num_salas; i++) {
-        if (strcmp(salas[i].nombre, nombre) == 0) {
+        if (nombre_igual(salas[i].nombre, clave)) {
             return i;  // Sala encontrada, retornar índice
         }
     }
     return -1;  // Sala no encontrada
 }
 
+/**
+ * Buscar un usuario dentro de una sala
+ * 
+ * Recorre la tabla contigua de nombres de la sala con el kernel
+ * vectorial de cadenas_simd (una fila de 64 bytes por comparación).
+ * 
+ * @param indice_sala Índice de la sala en el array
+ * @param nombre_usuario Nombre del usuario a buscar
+ * @return Posición del usuario en la sala, -1 si no está
+ */
+int buscar_usuario_en_sala(int indice_sala, const char *nombre_usuario) {
+    char clave[NOMBRE_SLOT];
+    nombre_a_slot(clave, nombre_usuario);
+    
+    struct sala *s = &salas[indice_sala];
+    return buscar_nombre((const char (*)[NOMBRE_SLOT])s->usuarios, s->num_usuarios, clave);
+}
+
 /**
  * Agregar un usuario a una sala específica
  * 
  * Registra al usuario en la sala guardando su nombre y el ID de su cola
  * privada para poder enviarle mensajes posteriormente. Verifica duplicados,
- * límites de capacidad y validez de parámetros.
+ * límites de capacidad y validez de parámetros. Si la sala está llena
+ * pero tiene miembros desconectados, el más antiguo deja su puesto.
  * 
  * @param indice_sala Índice de la sala en el array de salas
  * @param nombre_usuario Nombre del usuario a agregar
- * @param qid_usuario ID de la cola privada del usuario
+ * @param qid_usuario ID de la cola privada del usuario (-1 = desconectado)
+ * @param canal_usuario Canal del usuario en esa cola (0 si es sólo suya)
  * @return 0 si éxito, -1 si error (sala inválida, llena, o usuario duplicado)
  */
-int agregar_usuario_a_sala(int indice_sala, const char *nombre_usuario, int qid_usuario) {
+int agregar_usuario_a_sala(int indice_sala, const char *nombre_usuario, int qid_usuario, int canal_usuario) {
     // Validar índice de sala
     if (indice_sala < 0 || indice_sala >= num_salas) {
         printf("[ERROR] Índice de sala inválido: %d\n", indice_sala);
@@ -175,386 +564,3668 @@ int agregar_usuario_a_sala(int indice_sala, const char *nombre_usuario, int qid_
     
     struct sala *s = &salas[indice_sala];
     
-    // Verificar capacidad de la sala
-    if (s->num_usuarios >= MAX_USUARIOS_POR_SALA) {
-        printf("[ERROR] Sala '%s' llena (%d/%d usuarios)\n", 
-               s->nombre, s->num_usuarios, MAX_USUARIOS_POR_SALA);
+    // Verificar que el usuario no esté ya en la sala (evitar duplicados)
+    if (buscar_usuario_en_sala(indice_sala, nombre_usuario) != -1) {
+        printf("[WARNING] Usuario '%s' ya está en sala '%s'\n", 
+               nombre_usuario, s->nombre);
         return -1;
     }
     
-    // Verificar que el usuario no esté ya en la sala (evitar duplicados)
-    for (int i = 0; i < s->num_usuarios; i++) {
-        if (strcmp(s->usuarios[i], nombre_usuario) == 0) {
-            printf("[WARNING] Usuario '%s' ya está en sala '%s'\n", 
-                   nombre_usuario, s->nombre);
-            return -1;
-        }
+    // Verificar capacidad de la sala (los desconectados ceden su puesto)
+    if (s->num_usuarios >= MAX_USUARIOS_POR_SALA && desalojar_desconectado(indice_sala) != 0) {
+        printf("[ERROR] Sala '%s' llena (%d/%d usuarios)\n", 
+               s->nombre, s->num_usuarios, MAX_USUARIOS_POR_SALA);
+        return -1;
     }
 
-    // Agregar usuario a la sala
-    strncpy(s->usuarios[s->num_usuarios], nombre_usuario, MAX_NOMBRE - 1);
-    s->usuarios[s->num_usuarios][MAX_NOMBRE - 1] = '\0';  // Terminación nula
+    // Agregar usuario a la sala (slot rellenado con ceros)
+    nombre_a_slot(s->usuarios[s->num_usuarios], nombre_usuario);
     s->usuarios_qid[s->num_usuarios] = qid_usuario;
+    s->usuarios_canal[s->num_usuarios] = canal_usuario;
+    memset(&s->usuarios_filtro[s->num_usuarios], 0, sizeof(struct filtro));  // Sin filtro: recibe todo
+    s->usuarios_ultimo[s->num_usuarios] = s->seq;  // Su secuencia empieza en el próximo mensaje
+    s->usuarios_buzon[s->num_usuarios] = 0;
+    s->usuarios_desconexion[s->num_usuarios] = (qid_usuario == -1) ? time(NULL) : 0;
     s->num_usuarios++;
+    registrar_cambio_miembro(indice_sala, nombre_usuario, 1);
+    anotar_membresia(nombre_usuario, indice_sala);
     
-    printf("[SERVIDOR] Usuario '%s' agregado a sala '%s' (%d/%d usuarios)\n", 
+    LOG(LOG_EVENTOS, "[SERVIDOR] Usuario '%s' agregado a sala '%s' (%d/%d usuarios)\n", 
            nombre_usuario, s->nombre, s->num_usuarios, MAX_USUARIOS_POR_SALA);
     return 0;
 }
 
 /**
- * Guardar mensaje en historial persistente de la sala
+ * Quitar un usuario de una sala por su posición
  * 
- * Crea o añade mensajes a un archivo de texto que actúa como historial
- * persistente de la sala. Cada sala tiene su propio archivo nombrado
- * según el nombre de la sala con extensión .txt.
+ * Desplaza todos los arrays paralelos de la sala para mantenerlos
+ * compactos. Como cambian las posiciones (y por tanto los bits de los
+ * filtros), el autómata de la sala se marca para recompilar.
  * 
  * @param indice_sala Índice de la sala en el array
- * @param msg Mensaje a guardar en el historial
+ * @param pos Posición del usuario dentro de la sala
  */
-void guardar_historial(int indice_sala, struct mensaje *msg) {
-    // Validar parámetros
-    if (indice_sala < 0 || indice_sala >= num_salas || !msg) {
-        printf("[ERROR] Parámetros inválidos para guardar historial\n");
-        return;
-    }
+void quitar_usuario_de_sala(int indice_sala, int pos) {
+    struct sala *s = &salas[indice_sala];
+    registrar_cambio_miembro(indice_sala, s->usuarios[pos], 0);
+    olvidar_membresia(s->usuarios[pos], indice_sala);
     
-    // Generar nombre de archivo basado en el nombre de la sala
-    char filename[150];
-    snprintf(filename, sizeof(filename), "%s.txt", salas[indice_sala].nombre);
+    // Lo que quedara en su buzón ya no se entregará
+    if (s->usuarios_buzon[pos] > 0) {
+        char ruta[2 * NOMBRE_SLOT + 8];
+        snprintf(ruta, sizeof(ruta), "%s.%s.buzon", s->nombre, s->usuarios[pos]);
+        unlink(ruta);
+    }
     
-    // Abrir archivo en modo append (crear si no existe)
-    FILE *f = fopen(filename, "a");
-    if (!f) { 
-        perror("[ERROR] No se pudo abrir archivo de historial"); 
-        return; 
+    for (int j = pos; j < s->num_usuarios - 1; j++) {
+        memcpy(s->usuarios[j], s->usuarios[j + 1], NOMBRE_SLOT);
+        s->usuarios_qid[j] = s->usuarios_qid[j + 1];
+        s->usuarios_canal[j] = s->usuarios_canal[j + 1];
+        s->usuarios_filtro[j] = s->usuarios_filtro[j + 1];
+        s->usuarios_ultimo[j] = s->usuarios_ultimo[j + 1];
+        s->usuarios_buzon[j] = s->usuarios_buzon[j + 1];
+        s->usuarios_desconexion[j] = s->usuarios_desconexion[j + 1];
     }
+    s->num_usuarios--;
+    s->filtros_sucios = 1;
+}
+
+/**
+ * Liberar el puesto del miembro desconectado hace más tiempo
+ * 
+ * Los desconectados conservan su puesto para recibir su buzón al volver,
+ * pero no pueden dejar la sala llena para siempre: cuando un JOIN no
+ * cabe, el más antiguo sale de la sala (como con /leave) y su buzón se
+ * borra.
+ * 
+ * @param indice_sala Índice de la sala
+ * @return 0 si se liberó un puesto, -1 si todos los miembros están conectados
+ */
+int desalojar_desconectado(int indice_sala) {
+    struct sala *s = &salas[indice_sala];
+    int elegido = -1;
     
-    // Escribir mensaje con formato: "Usuario: mensaje"
-    fprintf(f, "%s: %s\n", msg->remitente, msg->texto);
-    fclose(f);
+    for (int i = 0; i < s->num_usuarios; i++) {
+        if (s->usuarios_qid[i] == -1 && 
+            (elegido == -1 || s->usuarios_desconexion[i] < s->usuarios_desconexion[elegido])) {
+            elegido = i;
+        }
+    }
+    if (elegido == -1) {
+        return -1;
+    }
     
-    // Log opcional para debugging
-    // printf("[DEBUG] Historial guardado en %s\n", filename);
+    char nombre[NOMBRE_SLOT];
+    memcpy(nombre, s->usuarios[elegido], NOMBRE_SLOT);
+    LOG(LOG_EVENTOS, "[BUZÓN] Sala '%s' llena: '%s' (desconectado) deja su puesto y su buzón (%d mensajes)\n", 
+           s->nombre, nombre, s->usuarios_buzon[elegido]);
+    quitar_usuario_de_sala(indice_sala, elegido);
+    anotar_presencia(indice_sala, nombre, 0);
+    return 0;
 }
 
 /**
- * Distribuir mensaje a todos los usuarios de una sala
+ * Configurar el filtro de suscripción de un miembro
  * 
- * Toma un mensaje recibido de un usuario y lo distribuye a todos los demás
- * usuarios de la misma sala usando sus colas privadas. El remitente original
- * no recibe una copia de su propio mensaje. Además, guarda el mensaje en
- * el historial persistente de la sala.
+ * Especificaciones aceptadas (en msg.texto):
+ * - "todo":              quitar filtro, recibir todos los mensajes
+ * - "menciones":         recibir sólo mensajes que mencionen "@nombre"
+ * - "palabras a,b,c":    además, mensajes que contengan alguna palabra
+ * - "de ana,bob":        además, todos los mensajes de esos remitentes
  * 
- * @param indice_sala Índice de la sala donde distribuir el mensaje
- * @param msg Mensaje original recibido del cliente
+ * "palabras" y "de" reemplazan su lista anterior y se combinan entre sí;
+ * las menciones siempre se entregan a un miembro con filtro activo.
+ * 
+ * @param indice_sala Índice de la sala
+ * @param nombre_usuario Miembro que configura su filtro
+ * @param spec Especificación del filtro
+ * @return 0 si éxito, -1 si el usuario no está en la sala o spec inválida
  */
-void enviar_a_todos_en_sala(int indice_sala, struct mensaje *msg) {
-    // Validar parámetros
-    if (indice_sala < 0 || indice_sala >= num_salas || !msg) {
-        printf("[ERROR] Parámetros inválidos para distribución\n");
-        return;
+int configurar_filtro(int indice_sala, const char *nombre_usuario, const char *spec) {
+    int pos = buscar_usuario_en_sala(indice_sala, nombre_usuario);
+    if (pos == -1) {
+        return -1;
     }
     
     struct sala *s = &salas[indice_sala];
+    struct filtro *f = &s->usuarios_filtro[pos];
     
-    // Log de actividad de distribución
-    printf("[DISTRIBUCIÓN] Sala '%s': '%s' dice: %s (enviando a %d usuarios)\n", 
-           s->nombre, msg->remitente, msg->texto, s->num_usuarios - 1);
-
-    // Construir mensaje de salida tipo CHAT para distribución
-    struct mensaje out;
-    out.mtype = 4;  // Tipo CHAT para mensajes distribuidos
-    out.reply_qid = 0;  // No necesario para mensajes de difusión
+    if (strcmp(spec, "todo") == 0) {
+        memset(f, 0, sizeof(*f));
+    } else if (strcmp(spec, "menciones") == 0) {
+        f->activo = 1;
+    } else if (strncmp(spec, "palabras ", 9) == 0 || strncmp(spec, "de ", 3) == 0) {
+        int es_palabras = (spec[0] == 'p');
+        const char *lista = spec + (es_palabras ? 9 : 3);
+        
+        // Reemplazar la lista correspondiente con los elementos separados por comas
+        char copia[MAX_TEXTO];
+        strncpy(copia, lista, MAX_TEXTO - 1);
+        copia[MAX_TEXTO - 1] = '\0';
+        
+        int n = 0;
+        for (char *tok = strtok(copia, ","); tok; tok = strtok(NULL, ",")) {
+            while (*tok == ' ') tok++;                        // Recortar espacios iniciales
+            char *fin = tok + strlen(tok);
+            while (fin > tok && fin[-1] == ' ') *--fin = '\0';  // y finales
+            if (*tok == '\0') {
+                continue;
+            }
+            
+            if (es_palabras && n < MAX_PALABRAS_FILTRO && strlen(tok) + 2 <= AC_MAX_PATRON) {
+                strcpy(f->palabras[n++], tok);
+            } else if (!es_palabras && n < MAX_REMITENTES_FILTRO) {
+                nombre_a_slot(f->remitentes[n++], tok);
+            }
+        }
+        
+        if (es_palabras) {
+            f->num_palabras = n;
+        } else {
+            f->num_remitentes = n;
+        }
+        f->activo = 1;
+    } else {
+        return -1;
+    }
     
-    // Copiar datos del mensaje original con terminación nula segura
-    strncpy(out.remitente, msg->remitente, MAX_NOMBRE - 1);
-    out.remitente[MAX_NOMBRE - 1] = '\0';
-    strncpy(out.texto, msg->texto, MAX_TEXTO - 1);
-    out.texto[MAX_TEXTO - 1] = '\0';
-    strncpy(out.sala, msg->sala, MAX_NOMBRE - 1);
-    out.sala[MAX_NOMBRE - 1] = '\0';
+    s->filtros_sucios = 1;
+    return 0;
+}
 
-    // Distribuir mensaje a todos los usuarios de la sala (excepto remitente)
+/**
+ * Recompilar el autómata de filtros de una sala
+ * 
+ * Inserta, para cada miembro con filtro activo, su mención "@nombre" y
+ * sus palabras clave con el bit de su posición. Patrones repetidos entre
+ * miembros comparten nodo y acumulan bits.
+ * 
+ * @param indice_sala Índice de la sala
+ */
+void recompilar_filtros(int indice_sala) {
+    struct sala *s = &salas[indice_sala];
+    
+    ac_reiniciar(&s->automata);
+    s->mascara_filtrados = 0;
+    
     for (int i = 0; i < s->num_usuarios; i++) {
-        // Excluir al remitente (no enviarse el mensaje a sí mismo)
-        if (strcmp(s->usuarios[i], msg->remitente) == 0) {
+        struct filtro *f = &s->usuarios_filtro[i];
+        if (!f->activo) {
             continue;
         }
-
-        // Obtener ID de cola privada del usuario destinatario
-        int qid_dest = s->usuarios_qid[i];
         
-        // Intentar enviar mensaje a la cola del usuario
-        if (msgsnd(qid_dest, &out, sizeof(out) - sizeof(long), 0) == -1) {
-            // Registrar error pero continuar con otros usuarios
-            fprintf(stderr, "[ERROR] No se pudo enviar mensaje a '%s' (qid=%d): %s\n", 
-                    s->usuarios[i], qid_dest, strerror(errno));
+        mascara_t bit = 1ULL << i;
+        s->mascara_filtrados |= bit;
+        
+        char mencion[NOMBRE_SLOT + 1];
+        snprintf(mencion, sizeof(mencion), "@%s", s->usuarios[i]);
+        if (ac_agregar(&s->automata, mencion, bit) != 0) {
+            printf("[WARNING] Autómata de sala '%s' lleno, filtro de '%s' incompleto\n", 
+                   s->nombre, s->usuarios[i]);
+        }
+        for (int k = 0; k < f->num_palabras; k++) {
+            ac_agregar(&s->automata, f->palabras[k], bit);
         }
     }
     
-    // Guardar mensaje en historial persistente de la sala
-    guardar_historial(indice_sala, msg);
+    ac_compilar(&s->automata);
+    s->filtros_sucios = 0;
 }
 
 /**
- * Función de limpieza y terminación del servidor
+ * Calcular el conjunto de destinatarios de un mensaje
  * 
- * Esta función se ejecuta cuando el servidor recibe SIGINT (Ctrl+C) o SIGTERM.
- * Se encarga de eliminar todas las colas de mensajes System V creadas durante
- * la ejecución para evitar que queden recursos huérfanos en el sistema.
+ * Se evalúa una sola vez por mensaje (no por destinatario): los miembros
+ * sin filtro reciben siempre; de los filtrados, los que aparecen en la
+ * pasada del autómata sobre el texto o que permiten al remitente.
  * 
- * @param signo Número de la señal recibida
+ * @param indice_sala Índice de la sala
+ * @param msg Mensaje a distribuir
+ * @return Máscara de posiciones de miembros que deben recibir el mensaje
  */
-void limpiar_colas_y_salir(int signo) {
-    printf("\n[SERVIDOR] Señal de terminación recibida (%d), iniciando limpieza...\n", signo);
+mascara_t calcular_destinatarios(int indice_sala, struct mensaje *msg) {
+    struct sala *s = &salas[indice_sala];
     
-    // Eliminar cola global si existe
-    if (cola_global != -1) {
-        if (msgctl(cola_global, IPC_RMID, NULL) == 0) {
-            printf("[LIMPIEZA] Cola global eliminada correctamente\n");
-        } else {
-            perror("[ERROR] No se pudo eliminar cola global");
-        }
+    if (s->filtros_sucios) {
+        recompilar_filtros(indice_sala);
+    }
+    if (s->mascara_filtrados == 0) {
+        return ~0ULL;  // Caso común: nadie filtra, todos reciben
     }
     
-    // Eliminar todas las colas de salas creadas
-    for (int i = 0; i < num_salas; i++) {
-        if (salas[i].cola_id != -1) {
-            if (msgctl(salas[i].cola_id, IPC_RMID, NULL) == 0) {
-                printf("[LIMPIEZA] Cola de sala '%s' eliminada correctamente\n", salas[i].nombre);
-            } else {
-                fprintf(stderr, "[ERROR] No se pudo eliminar cola de sala '%s': %s\n", 
-                        salas[i].nombre, strerror(errno));
-            }
+    mascara_t interesados = ac_evaluar(&s->automata, msg->texto, s->mascara_filtrados);
+    
+    // Listas de remitentes permitidos: sólo para filtrados aún no decididos
+    char clave[NOMBRE_SLOT];
+    nombre_a_slot(clave, msg->remitente);
+    mascara_t pendientes = s->mascara_filtrados & ~interesados;
+    for (int i = 0; i < s->num_usuarios && pendientes; i++) {
+        struct filtro *f = &s->usuarios_filtro[i];
+        if ((pendientes & (1ULL << i)) && f->num_remitentes > 0 &&
+            buscar_nombre((const char (*)[NOMBRE_SLOT])f->remitentes, f->num_remitentes, clave) != -1) {
+            interesados |= 1ULL << i;
         }
     }
     
-    printf("[SERVIDOR] Terminado correctamente. Archivos de historial conservados.\n");
-    exit(0);
+    return ~s->mascara_filtrados | interesados;
 }
 
-/* ==================== FUNCIÓN PRINCIPAL ==================== */
-
 /**
- * Función principal del servidor de chat
+ * Localizar la casilla del índice de observadores para un qid
  * 
- * Inicializa el servidor, crea la cola global, instala manejadores de señales
- * y entra en el bucle principal de procesamiento de mensajes. Maneja todos
- * los tipos de mensajes del protocolo y coordina las operaciones del sistema.
+ * Sondeo lineal; devuelve la casilla que contiene el qid o, si no está,
+ * la primera casilla libre/borrada donde podría insertarse.
+ * 
+ * @param s Sala
+ * @param qid ID de la cola del observador
+ * @param encontrado Se pone a 1 si el qid está en el índice
+ * @return Número de casilla
  */
-int main() {
-    /* Configuración inicial del servidor */
+static int casilla_observador(struct sala *s, int qid, int *encontrado) {
+    unsigned int h = ((unsigned int)qid * 2654435761u) & (INDICE_OBSERVADORES - 1);
+    int primera_libre = -1;
     
-    // Instalar manejadores de señales para limpieza automática
-    signal(SIGINT, limpiar_colas_y_salir);   // Ctrl+C
-    signal(SIGTERM, limpiar_colas_y_salir);  // Terminación solicitada por el sistema
+    *encontrado = 0;
+    for (int i = 0; i < INDICE_OBSERVADORES; i++) {
+        int c = (h + i) & (INDICE_OBSERVADORES - 1);
+        int v = s->indice_observadores[c];
+        if (v == 0) {
+            return primera_libre != -1 ? primera_libre : c;
+        }
+        if (v == -1) {
+            if (primera_libre == -1) primera_libre = c;
+        } else if (s->observadores_qid[v - 1] == qid) {
+            *encontrado = 1;
+            return c;
+        }
+    }
+    return primera_libre;
+}
 
-    /* Crear cola global de comunicación */
+/**
+ * Agregar un observador (sólo lectura) a una sala
+ * 
+ * Los observadores no cuentan para MAX_USUARIOS_POR_SALA ni se identifican
+ * por nombre: basta su cola privada para entregarles la difusión.
+ * 
+ * @param indice_sala Índice de la sala
+ * @param qid ID de la cola privada del observador
+ * @return 0 si éxito, -1 si ya observa o la sala está llena de observadores
+ */
+int agregar_observador(int indice_sala, int qid) {
+    struct sala *s = &salas[indice_sala];
     
-    // Generar clave conocida para la cola global
-    key_t key_global = ftok("/tmp", 'A');
-    if (key_global == (key_t)-1) { 
-        perror("[ERROR] No se pudo generar clave para cola global"); 
-        exit(1);
+    if (s->num_observadores >= MAX_OBSERVADORES_POR_SALA) {
+        printf("[ERROR] Sala '%s' sin capacidad de observadores (%d)\n", 
+               s->nombre, MAX_OBSERVADORES_POR_SALA);
+        return -1;
     }
     
-    // Crear cola global donde llegarán todos los mensajes de clientes
-    cola_global = msgget(key_global, IPC_CREAT | 0666);
-    if (cola_global == -1) { 
-        perror("[ERROR] No se pudo crear cola global"); 
-        exit(1);
+    int encontrado;
+    int c = casilla_observador(s, qid, &encontrado);
+    if (encontrado || c == -1) {
+        return -1;
     }
     
-    /* Mostrar información de inicio */
-    printf("\n=== SERVIDOR DE CHAT MULTI-SALA ===\n");
-    printf("Servidor iniciado correctamente\n");
-    printf("Cola global ID: %d\n", cola_global);
-    printf("Capacidad: %d salas, %d usuarios por sala\n", MAX_SALAS, MAX_USUARIOS_POR_SALA);
-    printf("Esperando conexiones de clientes...\n");
-    printf("Presiona Ctrl+C para terminar el servidor\n");
-    printf("=====================================\n\n");
+    s->observadores_qid[s->num_observadores] = qid;
+    s->indice_observadores[c] = ++s->num_observadores;
+    return 0;
+}
 
-    /* Bucle principal de procesamiento de mensajes */
-    struct mensaje msg;
-    while (1) {
-        // Recibir cualquier tipo de mensaje de la cola global
-        ssize_t r = msgrcv(cola_global, &msg, sizeof(msg) - sizeof(long), 0, 0);
-        
-        // Manejar errores de recepción
-        if (r == -1) { 
-            if (errno == EINTR) {
-                // Interrupción por señal, continuar normalmente
-                continue;
+/**
+ * Quitar un observador de una sala
+ * 
+ * El último observador del array ocupa el hueco (intercambio con el
+ * último), así el array sigue denso y la baja es O(1).
+ * 
+ * @param indice_sala Índice de la sala
+ * @param qid ID de la cola privada del observador
+ * @return 0 si se quitó, -1 si no era observador de la sala
+ */
+int quitar_observador(int indice_sala, int qid) {
+    struct sala *s = &salas[indice_sala];
+    
+    int encontrado;
+    int c = casilla_observador(s, qid, &encontrado);
+    if (!encontrado) {
+        return -1;
+    }
+    
+    int pos = s->indice_observadores[c] - 1;
+    int ultimo = s->num_observadores - 1;
+    s->indice_observadores[c] = -1;  // Lápida
+    
+    if (pos != ultimo) {
+        // Mover el último observador al hueco y actualizar su casilla
+        int qid_ultimo = s->observadores_qid[ultimo];
+        int c_ultimo = casilla_observador(s, qid_ultimo, &encontrado);
+        s->observadores_qid[pos] = qid_ultimo;
+        s->indice_observadores[c_ultimo] = pos + 1;
+    }
+    s->num_observadores--;
+    return 0;
+}
+
+/**
+ * Difundir un mensaje ya construido a todos los observadores de una sala
+ * 
+ * Camino barato de uno-a-muchos: el mensaje se arma una sola vez y el
+ * bucle sólo hace msgsnd sin bloquear (IPC_NOWAIT), sin filtros ni
+ * comparaciones de nombres. Un observador lento pierde el mensaje en vez
+ * de frenar al servidor; uno cuya cola ya no existe se da de baja.
+ * 
+ * @param indice_sala Índice de la sala
+ * @param out Mensaje CHAT listo para enviar
+ * @return Número de observadores a los que no se pudo entregar
+ */
+int difundir_a_observadores(int indice_sala, struct mensaje *out) {
+    struct sala *s = &salas[indice_sala];
+    size_t tam = sizeof(*out) - sizeof(long);
+    int fallidos = 0;
+    
+    for (int i = 0; i < s->num_observadores; i++) {
+        if (msgsnd(s->observadores_qid[i], out, tam, IPC_NOWAIT) == -1) {
+            fallidos++;
+            if (errno == EINVAL || errno == EIDRM) {
+                // Cola eliminada: el observador se fue sin avisar
+                quitar_observador(indice_sala, s->observadores_qid[i]);
+                i--;  // El hueco lo ocupa ahora otro observador
             }
-            perror("[ERROR] Error recibiendo mensaje de cola global"); 
-            continue;
         }
-
-        /* ===== PROCESAMIENTO DE MENSAJE JOIN (Tipo 1) ===== */
-        if (msg.mtype == 1) {
-            printf("[JOIN] Usuario '%s' solicita unirse a sala '%s'\n", 
-                   msg.remitente, msg.sala);
+    }
+    return fallidos;
+}
+
+/**
+ * Registrar un proceso relay para una sala
+ * 
+ * @param indice_sala Índice de la sala
+ * @param qid Cola privada del relay
+ * @return 0 si éxito, -1 si ya estaba registrado o no hay espacio
+ */
+int registrar_relay(int indice_sala, int qid) {
+    struct sala *s = &salas[indice_sala];
+    
+    for (int i = 0; i < s->num_relays; i++) {
+        if (s->relays_qid[i] == qid) {
+            return -1;
+        }
+    }
+    if (s->num_relays >= MAX_RELAYS_POR_SALA) {
+        return -1;
+    }
+    
+    s->relays_qid[s->num_relays] = qid;
+    s->relays_carga[s->num_relays] = 0;
+    s->num_relays++;
+    return 0;
+}
+
+/**
+ * Localizar la casilla del índice de delegados para un observador
+ * 
+ * Sondeo lineal, igual que casilla_observador.
+ * 
+ * @param s Sala
+ * @param qid ID de la cola del observador
+ * @param encontrado Se pone a 1 si el qid está en el índice
+ * @return Número de casilla (o -1 si no está y no hay sitio)
+ */
+static int casilla_delegado(struct sala *s, int qid, int *encontrado) {
+    unsigned int h = ((unsigned int)qid * 2654435761u) & (INDICE_DELEGADOS - 1);
+    int primera_libre = -1;
+    
+    *encontrado = 0;
+    for (int i = 0; i < INDICE_DELEGADOS; i++) {
+        int c = (h + i) & (INDICE_DELEGADOS - 1);
+        struct delegado *d = &s->delegados[c];
+        if (d->estado == 0) {
+            return primera_libre != -1 ? primera_libre : c;
+        }
+        if (d->estado == 2) {
+            if (primera_libre == -1) primera_libre = c;
+        } else if (d->qid == qid) {
+            *encontrado = 1;
+            return c;
+        }
+    }
+    return primera_libre;
+}
+
+/**
+ * Recordar en qué relay quedó un observador delegado
+ * 
+ * @param indice_sala Índice de la sala
+ * @param qid ID de la cola del observador
+ * @param relay ID de la cola del relay
+ * @return 0 si éxito, -1 si no caben más delegados en la sala
+ */
+int anotar_delegado(int indice_sala, int qid, int relay) {
+    struct sala *s = &salas[indice_sala];
+    int encontrado;
+    int c = casilla_delegado(s, qid, &encontrado);
+    
+    if (!encontrado) {
+        if (c == -1 || s->num_delegados >= MAX_DELEGADOS_POR_SALA) {
+            return -1;
+        }
+        s->num_delegados++;
+    }
+    s->delegados[c].qid = qid;
+    s->delegados[c].relay = relay;
+    s->delegados[c].estado = 1;
+    return 0;
+}
+
+/**
+ * Buscar en qué relay quedó un observador delegado
+ * 
+ * @param indice_sala Índice de la sala
+ * @param qid ID de la cola del observador
+ * @return Cola del relay que lo atiende, o -1 si no está delegado
+ */
+int buscar_delegado(int indice_sala, int qid) {
+    struct sala *s = &salas[indice_sala];
+    int encontrado;
+    int c = casilla_delegado(s, qid, &encontrado);
+    return encontrado ? s->delegados[c].relay : -1;
+}
+
+/**
+ * Olvidar un observador delegado
+ * 
+ * @param indice_sala Índice de la sala
+ * @param qid ID de la cola del observador
+ * @return Cola del relay que lo atendía, o -1 si no estaba delegado
+ */
+int olvidar_delegado(int indice_sala, int qid) {
+    struct sala *s = &salas[indice_sala];
+    int encontrado;
+    int c = casilla_delegado(s, qid, &encontrado);
+    
+    if (!encontrado) {
+        return -1;
+    }
+    s->delegados[c].estado = 2;
+    s->num_delegados--;
+    return s->delegados[c].relay;
+}
+
+/**
+ * Dar de baja un relay (su cola ya no existe)
+ * 
+ * Sus observadores quedan sin servicio; el relay les avisa al terminar
+ * para que vuelvan a usar /observar.
+ * 
+ * @param indice_sala Índice de la sala
+ * @param pos Posición del relay en la sala
+ */
+void quitar_relay(int indice_sala, int pos) {
+    struct sala *s = &salas[indice_sala];
+    
+    LOG(LOG_EVENTOS, "[RELAY] Relay qid=%d de sala '%s' dado de baja (%d observadores perdidos)\n", 
+           s->relays_qid[pos], s->nombre, s->relays_carga[pos]);
+    
+    // Olvidar a sus delegados: ya no hay a quién enviarles la baja
+    for (int c = 0; c < INDICE_DELEGADOS && s->num_delegados > 0; c++) {
+        struct delegado *d = &s->delegados[c];
+        if (d->estado == 1 && d->relay == s->relays_qid[pos]) {
+            d->estado = 2;
+            s->num_delegados--;
+        }
+    }
+    
+    s->num_relays--;
+    s->relays_qid[pos] = s->relays_qid[s->num_relays];
+    s->relays_carga[pos] = s->relays_carga[s->num_relays];
+}
+
+/**
+ * Delegar un nuevo observador en el relay menos cargado de la sala
+ * 
+ * El relay recibe RELAY_ADD con la cola del observador y es él quien le
+ * confirma la suscripción. El servidor lleva la cuenta por relay y
+ * recuerda en cuál quedó cada observador.
+ * 
+ * @param indice_sala Índice de la sala
+ * @param msg Solicitud OBSERVE original (reply_qid = cola del observador)
+ * @return 0 si se delegó, -1 si no hay relays disponibles o no caben más delegados
+ */
+int delegar_observador(int indice_sala, struct mensaje *msg) {
+    struct sala *s = &salas[indice_sala];
+    int encontrado;
+    
+    if (s->num_delegados >= MAX_DELEGADOS_POR_SALA || 
+        casilla_delegado(s, msg->reply_qid, &encontrado) == -1) {
+        return -1;  // Se atenderá como observador directo
+    }
+    
+    while (s->num_relays > 0) {
+        int elegido = 0;
+        for (int i = 1; i < s->num_relays; i++) {
+            if (s->relays_carga[i] < s->relays_carga[elegido]) {
+                elegido = i;
+            }
+        }
+        
+        struct mensaje add = *msg;
+        add.mtype = TIPO_RELAY_ADD;
+        if (msgsnd(s->relays_qid[elegido], &add, sizeof(add) - sizeof(long), 0) == 0) {
+            s->relays_carga[elegido]++;
+            anotar_delegado(indice_sala, msg->reply_qid, s->relays_qid[elegido]);
+            return 0;
+        }
+        
+        // Relay caído: darlo de baja y probar con el siguiente
+        quitar_relay(indice_sala, elegido);
+    }
+    return -1;
+}
+
+/**
+ * Enviar un mensaje a todos los relays de una sala
+ * 
+ * Es el único costo por mensaje de los observadores delegados: O(relays).
+ * El envío es bloqueante porque cada relay representa a muchos
+ * observadores y perder su copia sería perderla para todos ellos.
+ * 
+ * @param indice_sala Índice de la sala
+ * @param out Mensaje listo para reenviar
+ */
+void difundir_a_relays(int indice_sala, struct mensaje *out) {
+    struct sala *s = &salas[indice_sala];
+    
+    for (int i = 0; i < s->num_relays; i++) {
+        if (msgsnd(s->relays_qid[i], out, sizeof(*out) - sizeof(long), 0) == -1) {
+            fprintf(stderr, "[ERROR] No se pudo enviar a relay qid=%d: %s\n", 
+                    s->relays_qid[i], strerror(errno));
+            if (errno == EINVAL || errno == EIDRM) {
+                quitar_relay(indice_sala, i);
+                i--;
+            }
+        }
+    }
+}
+
+/**
+ * Contar todos los observadores de una sala (directos + delegados)
+ * 
+ * @param indice_sala Índice de la sala
+ * @return Número total de observadores
+ */
+int observadores_totales(int indice_sala) {
+    struct sala *s = &salas[indice_sala];
+    int total = s->num_observadores;
+    for (int i = 0; i < s->num_relays; i++) {
+        total += s->relays_carga[i];
+    }
+    return total;
+}
+
+/**
+ * Guardar mensaje en historial persistente de la sala
+ * 
+ * Crea o añade mensajes a un archivo de texto que actúa como historial
+ * persistente de la sala. Cada sala tiene su propio archivo nombrado
+ * según el nombre de la sala con extensión .txt. Cada línea empieza con
+ * el número de secuencia del mensaje, para poder retomarlo al reiniciar.
+ * 
+ * @param indice_sala Índice de la sala en el array
+ * @param msg Mensaje a guardar en el historial (ya numerado)
+ * @return Posición de la línea en el archivo (para los buzones), o -1 si error
+ */
+long guardar_historial(int indice_sala, struct mensaje *msg) {
+    // Validar parámetros
+    if (indice_sala < 0 || indice_sala >= num_salas || !msg) {
+        printf("[ERROR] Parámetros inválidos para guardar historial\n");
+        return -1;
+    }
+    
+    // Generar nombre de archivo basado en el nombre de la sala
+    char filename[150];
+    snprintf(filename, sizeof(filename), "%s.txt", salas[indice_sala].nombre);
+    
+    // Abrir archivo en modo append (crear si no existe)
+    FILE *f = fopen(filename, "a");
+    if (!f) { 
+        perror("[ERROR] No se pudo abrir archivo de historial"); 
+        return -1; 
+    }
+    
+    // Escribir mensaje con formato: "[secuencia] Usuario: mensaje"
+    fseek(f, 0, SEEK_END);
+    long desplazamiento = ftell(f);
+    fprintf(f, "[%u] %s: %s\n", msg->seq, msg->remitente, msg->texto);
+    fclose(f);
+    
+    // Log opcional para debugging
+    // printf("[DEBUG] Historial guardado en %s\n", filename);
+    return desplazamiento;
+}
+
+/**
+ * Separar una línea del historial en secuencia, remitente y texto
+ * 
+ * Las líneas antiguas sin "[secuencia]" toman seq_defecto.
+ * 
+ * @param linea Línea leída (se le quita el salto de línea)
+ * @param seq_defecto Secuencia para las líneas sin numerar
+ * @param seq Secuencia de la línea
+ * @param remitente Buffer de MAX_NOMBRE bytes para el autor
+ * @param texto Buffer de MAX_TEXTO bytes para el contenido
+ * @return 0 si la línea es válida, -1 si no
+ */
+int partir_linea_historial(char *linea, unsigned int seq_defecto, unsigned int *seq, 
+                           char *remitente, char *texto) {
+    linea[strcspn(linea, "\n")] = '\0';
+    
+    int n = 0;
+    const char *resto = linea;
+    if (sscanf(linea, "[%u] %n", seq, &n) == 1 && n > 0) {
+        resto = linea + n;
+    } else {
+        *seq = seq_defecto;
+    }
+    const char *sep = strstr(resto, ": ");
+    if (!sep || *seq == 0) {
+        return -1;
+    }
+    
+    size_t largo = (size_t)(sep - resto) < MAX_NOMBRE - 1 ? (size_t)(sep - resto) : MAX_NOMBRE - 1;
+    memset(remitente, 0, MAX_NOMBRE);
+    memcpy(remitente, resto, largo);
+    memset(texto, 0, MAX_TEXTO);
+    strncpy(texto, sep + 2, MAX_TEXTO - 1);
+    return 0;
+}
+
+/**
+ * Recuperar la secuencia y el anillo de reenvío desde el historial
+ * 
+ * Se llama al crear una sala: si el servidor se reinició, los clientes
+ * que se reconectan piden BACKFILL desde su última secuencia, así que la
+ * numeración debe continuar y los últimos TAM_REPLAY mensajes deben
+ * estar disponibles. Las líneas antiguas sin "[secuencia]" cuentan como
+ * la siguiente de la anterior.
+ * 
+ * @param indice_sala Índice de la sala en el array
+ */
+void restaurar_historial(int indice_sala) {
+    struct sala *s = &salas[indice_sala];
+    
+    char filename[150];
+    snprintf(filename, sizeof(filename), "%s.txt", s->nombre);
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        return;  // Sala nueva: sin historial
+    }
+    
+    char linea[MAX_NOMBRE + MAX_TEXTO + 16];
+    while (fgets(linea, sizeof(linea), f)) {
+        unsigned int seq;
+        char remitente[MAX_NOMBRE];
+        char texto[MAX_TEXTO];
+        if (partir_linea_historial(linea, s->seq + 1, &seq, remitente, texto) != 0) {
+            continue;
+        }
+        
+        struct entrada_replay *e = &s->replay[seq & (TAM_REPLAY - 1)];
+        e->seq = seq;
+        memcpy(e->remitente, remitente, MAX_NOMBRE);
+        memcpy(e->texto, texto, MAX_TEXTO);
+        if (seq > s->seq) {
+            s->seq = seq;
+        }
+    }
+    fclose(f);
+    
+    if (s->seq > 0) {
+        LOG(LOG_EVENTOS, "[SERVIDOR] Sala '%s': historial restaurado hasta la secuencia %u\n", 
+               s->nombre, s->seq);
+    }
+}
+
+/**
+ * Distribuir mensaje a todos los usuarios de una sala
+ * 
+ * Toma un mensaje recibido de un usuario y lo distribuye a todos los demás
+ * usuarios de la misma sala usando sus colas privadas. El remitente original
+ * no recibe una copia de su propio mensaje. Además, guarda el mensaje en
+ * el historial persistente de la sala; a los miembros desconectados sólo
+ * se les anota en el buzón la posición de su línea.
+ * 
+ * @param indice_sala Índice de la sala donde distribuir el mensaje
+ * @param msg Mensaje original recibido del cliente
+ */
+void enviar_a_todos_en_sala(int indice_sala, struct mensaje *msg) {
+    // Validar parámetros
+    if (indice_sala < 0 || indice_sala >= num_salas || !msg) {
+        printf("[ERROR] Parámetros inválidos para distribución\n");
+        return;
+    }
+    
+    struct sala *s = &salas[indice_sala];
+    s->mensajes_tick++;  // Actividad de la sala (para elegir qué sala migrar)
+    struct timespec inicio, fin;
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+    
+    // Conjunto de destinatarios según los filtros de los miembros (una evaluación)
+    mascara_t destinatarios = calcular_destinatarios(indice_sala, msg);
+    
+    // Posición del remitente en la sala (se busca una sola vez, no por destinatario)
+    int pos_remitente = buscar_usuario_en_sala(indice_sala, msg->remitente);
+    if (pos_remitente != -1) {
+        destinatarios &= ~(1ULL << pos_remitente);
+    }
+    
+    int total = 0;
+    for (int i = 0; i < s->num_usuarios; i++) {
+        total += (destinatarios >> i) & 1;
+    }
+    
+    // Log de actividad de distribución
+    LOG(LOG_TRAFICO, "[DISTRIBUCIÓN] Sala '%s': '%s' dice: %s (enviando a %d usuarios, %d filtrados, %d observadores, %d relays)\n", 
+           s->nombre, msg->remitente, msg->texto, total, 
+           s->num_usuarios - (pos_remitente != -1) - total, s->num_observadores, s->num_relays);
+
+    // Construir mensaje de salida tipo CHAT para distribución
+    struct mensaje out;
+    out.mtype = TIPO_CHAT;  // Mensaje distribuido a la sala
+    out.reply_qid = 0;  // No necesario para mensajes de difusión
+    
+    // Copiar datos del mensaje original con terminación nula segura
+    strncpy(out.remitente, msg->remitente, MAX_NOMBRE - 1);
+    out.remitente[MAX_NOMBRE - 1] = '\0';
+    strncpy(out.texto, msg->texto, MAX_TEXTO - 1);
+    out.texto[MAX_TEXTO - 1] = '\0';
+    strncpy(out.sala, msg->sala, MAX_NOMBRE - 1);
+    out.sala[MAX_NOMBRE - 1] = '\0';
+    
+    // Asignar secuencia y guardar en el anillo de reenvío
+    out.seq = ++s->seq;
+    struct entrada_replay *e = &s->replay[out.seq & (TAM_REPLAY - 1)];
+    e->seq = out.seq;
+    memcpy(e->remitente, out.remitente, MAX_NOMBRE);
+    memcpy(e->texto, out.texto, MAX_TEXTO);
+    
+    // Guardar mensaje (con su secuencia) en historial persistente de la sala
+    long desplazamiento = guardar_historial(indice_sala, &out);
+
+    // Distribuir mensaje a los destinatarios (el remitente ya está excluido)
+    for (int i = 0; i < s->num_usuarios; i++) {
+        // Saltar remitente y miembros cuyo filtro descarta el mensaje
+        if (!(destinatarios & (1ULL << i))) {
+            continue;
+        }
+
+        // Obtener ID de cola privada del usuario destinatario
+        int qid_dest = s->usuarios_qid[i];
+        out.mtype = MTYPE_CANAL(TIPO_CHAT, s->usuarios_canal[i]);
+        out.seq_prev = s->usuarios_ultimo[i];
+        s->usuarios_ultimo[i] = out.seq;  // Intentado: si falla, el cliente verá el hueco
+        
+        // Miembro desconectado: al buzón, se le entrega cuando vuelva
+        if (qid_dest == -1) {
+            guardar_en_buzon(indice_sala, i, out.seq, desplazamiento);
+            continue;
+        }
+        
+        // Enviar sin bloqueo: un cliente lento no frena la sala
+        if (msgsnd(qid_dest, &out, sizeof(out) - sizeof(long), IPC_NOWAIT) == -1) {
+            if (errno == EINVAL || errno == EIDRM) {
+                // Su cola ya no existe: se fue sin avisar, queda desconectado
+                LOG(LOG_EVENTOS, "[BUZÓN] '%s' desconectado de sala '%s': sus mensajes van a su buzón\n", 
+                       s->usuarios[i], s->nombre);
+                s->usuarios_qid[i] = -1;
+                s->usuarios_desconexion[i] = time(NULL);
+                guardar_en_buzon(indice_sala, i, out.seq, desplazamiento);
+                continue;
+            }
+            // Registrar error pero continuar con otros usuarios
+            fprintf(stderr, "[ERROR] No se pudo enviar mensaje %u a '%s' (qid=%d): %s (recuperable con BACKFILL)\n", 
+                    out.seq, s->usuarios[i], qid_dest, strerror(errno));
+        } else {
+            s->copias++;
+        }
+    }
+    
+    // Observadores y relays reciben todos los mensajes: su anterior es seq - 1
+    out.mtype = TIPO_CHAT;
+    out.seq_prev = out.seq - 1;
+    
+    // Relays: una copia por relay, ellos reparten a sus observadores
+    if (s->num_relays > 0) {
+        s->copias += s->num_relays;
+        difundir_a_relays(indice_sala, &out);
+    }
+    
+    // Observadores: difusión sin filtros ni bloqueo
+    if (s->num_observadores > 0) {
+        int intentados = s->num_observadores;
+        int fallidos = difundir_a_observadores(indice_sala, &out);
+        s->copias += intentados - fallidos;
+        if (fallidos > 0) {
+            fprintf(stderr, "[ERROR] Sala '%s': %d observadores no recibieron el mensaje\n", 
+                    s->nombre, fallidos);
+        }
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &fin);
+    s->ns_difusion += (fin.tv_sec - inicio.tv_sec) * 1000000000LL + (fin.tv_nsec - inicio.tv_nsec);
+}
+
+/**
+ * Enviar una respuesta (RESP, tipo 2) a la cola privada de un cliente
+ * 
+ * Construye el texto con formato estilo printf y lo envía en un solo paso.
+ * 
+ * @param sol Solicitud recibida (reply_qid y canal del cliente)
+ * @param formato Formato del texto (como printf)
+ */
+void responder(const struct mensaje *sol, const char *formato, ...) {
+    struct mensaje resp = {.mtype = MTYPE_CANAL(TIPO_RESP, sol->canal)};
+    
+    va_list args;
+    va_start(args, formato);
+    vsnprintf(resp.texto, MAX_TEXTO, formato, args);
+    va_end(args);
+    
+    msgsnd(sol->reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
+}
+
+/**
+ * Enviar una respuesta (RESP) sin bloquear si la cola del cliente está llena
+ * 
+ * Para avisos a clientes que pueden no estar leyendo su cola (p. ej. los
+ * que piden BACKFILL porque se les llenó): si no cabe, se pierde.
+ * 
+ * @param sol Solicitud recibida (reply_qid y canal del cliente)
+ * @param formato Formato del texto (como printf)
+ */
+void responder_sin_bloqueo(const struct mensaje *sol, const char *formato, ...) {
+    struct mensaje resp = {.mtype = MTYPE_CANAL(TIPO_RESP, sol->canal)};
+    
+    va_list args;
+    va_start(args, formato);
+    vsnprintf(resp.texto, MAX_TEXTO, formato, args);
+    va_end(args);
+    
+    msgsnd(sol->reply_qid, &resp, sizeof(resp) - sizeof(long), IPC_NOWAIT);
+}
+
+/**
+ * Responder a una solicitud repitiendo su correlación
+ * 
+ * Para las solicitudes que cambian el estado del cliente (JOIN, OBSERVE,
+ * LEAVE, FILTER): el cliente sólo aplica el cambio si estado es ESTADO_OK.
+ * 
+ * @param sol Solicitud recibida (reply_qid y corr)
+ * @param estado ESTADO_OK o ESTADO_ERROR
+ * @param formato Formato del texto (como printf)
+ */
+void confirmar(const struct mensaje *sol, int estado, const char *formato, ...) {
+    struct mensaje resp = {.mtype = MTYPE_CANAL(TIPO_RESP, sol->canal)};
+    resp.corr = sol->corr;
+    resp.estado = estado;
+    snprintf(resp.sala, sizeof(resp.sala), "%s", sol->sala);
+    
+    va_list args;
+    va_start(args, formato);
+    vsnprintf(resp.texto, MAX_TEXTO, formato, args);
+    va_end(args);
+    
+    msgsnd(sol->reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
+}
+
+/**
+ * Buscar a un usuario en el registro
+ * 
+ * Sondeo lineal desde la posición del hash; las lápidas (estado 2) no
+ * cortan la búsqueda, sólo una casilla libre (estado 0) lo hace.
+ * 
+ * @param nombre Nombre del usuario
+ * @return Puntero a su entrada (con o sin sesión), o NULL si no está
+ */
+struct sesion *buscar_entrada(const char *nombre) {
+    char clave[NOMBRE_SLOT];
+    nombre_a_slot(clave, nombre);
+    
+    unsigned int h = hash_nombre(clave) & (MAX_SESIONES - 1);
+    for (int i = 0; i < MAX_SESIONES; i++) {
+        struct sesion *e = &sesiones[(h + i) & (MAX_SESIONES - 1)];
+        if (e->estado == 0) {
+            return NULL;  // Casilla nunca usada: el nombre no está
+        }
+        if (e->estado == 1 && nombre_igual(e->nombre, clave)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Buscar la sesión de un usuario en el registro
+ * 
+ * @param nombre Nombre del usuario
+ * @return Puntero a la sesión, o NULL si el usuario no tiene sesión en este nodo
+ */
+struct sesion *buscar_sesion(const char *nombre) {
+    struct sesion *e = buscar_entrada(nombre);
+    return (e && e->qid != -1) ? e : NULL;
+}
+
+/**
+ * Crear la entrada de un usuario que no está en el registro
+ * 
+ * Se inserta en la primera casilla libre o borrada desde la posición del
+ * hash, sin sesión ni salas.
+ * 
+ * @param nombre Nombre del usuario
+ * @return Puntero a la entrada, o NULL si el registro está lleno
+ */
+static struct sesion *crear_entrada(const char *nombre) {
+    if (num_entradas >= MAX_SESIONES - 1) {
+        printf("[ERROR] Registro de usuarios lleno (%d), '%s' no registrado\n", 
+               MAX_SESIONES, nombre);
+        return NULL;
+    }
+    
+    char clave[NOMBRE_SLOT];
+    nombre_a_slot(clave, nombre);
+    unsigned int h = hash_nombre(clave) & (MAX_SESIONES - 1);
+    for (int i = 0; i < MAX_SESIONES; i++) {
+        struct sesion *e = &sesiones[(h + i) & (MAX_SESIONES - 1)];
+        if (e->estado != 1) {
+            memcpy(e->nombre, clave, NOMBRE_SLOT);
+            e->qid = -1;
+            e->canal = 0;
+            e->num_salas = 0;
+            e->estado = 1;
+            num_entradas++;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Borrar una entrada que ya no tiene sesión ni salas
+ * 
+ * La casilla queda marcada como lápida para no romper las cadenas de
+ * sondeo de otros nombres que colisionaron con éste.
+ * 
+ * @param e Entrada del registro
+ */
+static void liberar_entrada_vacia(struct sesion *e) {
+    if (e->qid == -1 && e->num_salas == 0) {
+        e->estado = 2;
+        num_entradas--;
+    }
+}
+
+/**
+ * Comprobar si la cola privada de una sesión sigue en uso
+ * 
+ * La cola de un cliente que terminó de golpe (sin DISCONNECT) puede
+ * seguir existiendo: si el último proceso que leyó de ella ya no existe,
+ * la sesión se da por abandonada.
+ * 
+ * @param qid Cola privada de la sesión
+ * @return 1 si la cola existe y su lector sigue vivo (o no se sabe), 0 si no
+ */
+static int cola_en_uso(int qid) {
+    struct msqid_ds info;
+    if (msgctl(qid, IPC_STAT, &info) == -1) {
+        return !(errno == EINVAL || errno == EIDRM);
+    }
+    return info.msg_lrpid == 0 || kill(info.msg_lrpid, 0) == 0 || errno != ESRCH;
+}
+
+/**
+ * Registrar (o actualizar) la sesión de un usuario
+ * 
+ * La misma cola (y canal) puede registrarse de nuevo, por ejemplo al
+ * reconectar. Otra cola que reclame un nombre con sesión se rechaza,
+ * salvo que la sesión anterior esté abandonada (ver cola_en_uso). Si el
+ * registro está lleno se registra el error y el usuario simplemente no
+ * podrá recibir mensajes privados.
+ * 
+ * @param nombre Nombre del usuario
+ * @param qid ID de la cola privada del cliente
+ * @param canal Canal de la sesión en esa cola (0 si es sólo suya)
+ * @return 0 si éxito, -1 si el nombre ya está en uso por otra sesión
+ */
+int registrar_sesion(const char *nombre, int qid, int canal) {
+    if (nombre[0] == '\0') {
+        return 0;
+    }
+    
+    struct sesion *e = buscar_entrada(nombre);
+    if (e && e->qid != -1 && (e->qid != qid || e->canal != canal)) {
+        if (cola_en_uso(e->qid)) {
+            LOG(LOG_EVENTOS, "[SESIÓN] Nombre '%s' rechazado para qid=%d: ya lo usa qid=%d\n", 
+                nombre, qid, e->qid);
+            return -1;
+        }
+        LOG(LOG_EVENTOS, "[SESIÓN] Sesión abandonada de '%s' (qid=%d) reemplazada\n", nombre, e->qid);
+    }
+    if (!e && !(e = crear_entrada(nombre))) {
+        return 0;
+    }
+    
+    if (e->qid == -1) {
+        num_sesiones++;
+        LOG(LOG_EVENTOS, "[SESIÓN] Usuario '%s' registrado (qid=%d, %d sesiones)\n", 
+               nombre, qid, num_sesiones);
+    }
+    e->qid = qid;
+    e->canal = canal;
+    return 0;
+}
+
+/**
+ * Eliminar la sesión de un usuario del registro
+ * 
+ * Si sigue siendo miembro de salas de este nodo la entrada se conserva
+ * (sin sesión) para su lista inversa.
+ * 
+ * @param nombre Nombre del usuario
+ */
+void eliminar_sesion(const char *nombre) {
+    struct sesion *e = buscar_sesion(nombre);
+    if (e) {
+        e->qid = -1;
+        num_sesiones--;
+        liberar_entrada_vacia(e);
+        LOG(LOG_EVENTOS, "[SESIÓN] Usuario '%s' desconectado (%d sesiones)\n", nombre, num_sesiones);
+    }
+}
+
+/**
+ * Anotar que un usuario es miembro de una sala de este nodo
+ * 
+ * @param nombre Nombre del usuario
+ * @param indice_sala Índice de la sala
+ */
+void anotar_membresia(const char *nombre, int indice_sala) {
+    struct sesion *e = buscar_entrada(nombre);
+    if (!e && !(e = crear_entrada(nombre))) {
+        return;
+    }
+    if (e->num_salas < MAX_SALAS) {
+        e->salas[e->num_salas++] = indice_sala;
+    }
+}
+
+/**
+ * Quitar una sala de la lista inversa de un usuario
+ * 
+ * @param nombre Nombre del usuario
+ * @param indice_sala Índice de la sala
+ */
+void olvidar_membresia(const char *nombre, int indice_sala) {
+    struct sesion *e = buscar_entrada(nombre);
+    if (!e) {
+        return;
+    }
+    for (int k = 0; k < e->num_salas; k++) {
+        if (e->salas[k] == indice_sala) {
+            e->salas[k] = e->salas[--e->num_salas];
+            break;
+        }
+    }
+    liberar_entrada_vacia(e);
+}
+
+/**
+ * Entregar un mensaje privado (DM) directamente al destinatario
+ * 
+ * Resuelve el destinatario con el índice de sesiones y envía el mensaje
+ * a su cola privada como tipo PRIV. No se crea ni se consulta ninguna
+ * sala: no se consume un slot de sala, una cola de sala ni un archivo de
+ * historial. Si el registro de privados está activo, se añade una línea.
+ * 
+ * El envío es sin bloqueo (como la difusión en salas): si la cola del
+ * destinatario está llena, el DM no se entrega y se avisa al remitente.
+ * Un usuario que no lee su cola no puede detener al servidor.
+ * 
+ * @param msg Mensaje DM recibido (msg->sala contiene el destinatario)
+ */
+void enviar_privado(struct mensaje *msg) {
+    struct sesion *dest = buscar_sesion(msg->sala);
+    if (!dest) {
+        responder(msg, "Error: el usuario '%s' no está conectado", msg->sala);
+        return;
+    }
+    
+    // Construir mensaje PRIV conservando remitente, texto y destinatario
+    struct mensaje out;
+    memset(&out, 0, sizeof(out));
+    out.mtype = MTYPE_CANAL(TIPO_PRIV, dest->canal);
+    memcpy(out.remitente, msg->remitente, MAX_NOMBRE - 1);
+    memcpy(out.texto, msg->texto, MAX_TEXTO - 1);
+    memcpy(out.sala, msg->sala, MAX_NOMBRE - 1);
+    
+    if (msgsnd(dest->qid, &out, sizeof(out) - sizeof(long), IPC_NOWAIT) == -1) {
+        if (errno == EAGAIN) {
+            LOG(LOG_TRAFICO, "[DM] Cola de '%s' llena: privado de '%s' no entregado\n", 
+                   msg->sala, msg->remitente);
+            responder_sin_bloqueo(msg, "Error: '%s' no está leyendo sus mensajes; el privado no se entregó", 
+                                  msg->sala);
+            return;
+        }
+        fprintf(stderr, "[ERROR] No se pudo entregar privado a '%s' (qid=%d): %s\n", 
+                msg->sala, dest->qid, strerror(errno));
+        
+        // La cola del destinatario ya no existe: su sesión es obsoleta
+        if (errno == EINVAL || errno == EIDRM) {
+            eliminar_sesion(msg->sala);
+        }
+        responder_sin_bloqueo(msg, "Error: no se pudo entregar el mensaje a '%s'", msg->sala);
+        return;
+    }
+    
+    // Registro ligero opcional (una línea por mensaje, archivo siempre abierto)
+    if (log_privados) {
+        fprintf(log_privados, "%s -> %s: %s\n", out.remitente, out.sala, out.texto);
+        fflush(log_privados);
+    }
+}
+
+/* ==================== RECUPERACIÓN DE HUECOS (BACKFILL) ==================== */
+
+/**
+ * Reenviar a un cliente los mensajes de una sala que no recibió
+ * 
+ * Recorre el anillo de reenvío en el rango (seq_prev, seq] pedido. A un
+ * miembro sólo se le envían los mensajes que pasan su filtro actual; a
+ * un observador, todos. Los envíos son sin bloqueo: si su cola se llena
+ * se corta, y el mensaje final (remitente vacío) indica hasta dónde se
+ * llegó para que el cliente pida el resto. Lo que ya salió del anillo se
+ * avisa con un RESP (también sin bloqueo) y se da por perdido.
+ * 
+ * Un miembro que se reconecta puede pedir desde una secuencia mayor que
+ * la de la sala (servidor reiniciado sin historial): la secuencia nunca
+ * retrocede, así que la sala la adopta y sus mensajes siguen siendo nuevos.
+ * Sólo mientras la sala no haya numerado nada desde que se creó y con un
+ * salto de hasta TAM_REPLAY; cualquier otra secuencia adelantada se
+ * rechaza (un salto arbitrario acercaría el contador a su desbordamiento).
+ * 
+ * @param indice_sala Índice de la sala
+ * @param msg Solicitud BACKFILL (seq_prev = último recibido, seq = hasta)
+ */
+void enviar_backfill(int indice_sala, struct mensaje *msg) {
+    struct sala *s = &salas[indice_sala];
+    int pos = buscar_usuario_en_sala(indice_sala, msg->remitente);
+    
+    // Lo más antiguo que le falta está en su buzón (no cupo al volver)
+    if (pos != -1 && s->usuarios_buzon[pos] > 0 && s->usuarios_qid[pos] != -1) {
+        vaciar_buzon(indice_sala, pos);
+        return;
+    }
+    
+    if (msg->seq_prev > s->seq) {
+        if (pos == -1 || s->seq != s->seq_restaurada || msg->seq_prev - s->seq > TAM_REPLAY) {
+            responder_sin_bloqueo(msg, "Error: la secuencia %u de '%s' no es válida (la sala va por la %u)", 
+                                  msg->seq_prev, msg->sala, s->seq);
+            return;
+        }
+        LOG(LOG_EVENTOS, "[BACKFILL] Sala '%s': secuencia adelantada de %u a %u\n", 
+               s->nombre, s->seq, msg->seq_prev);
+        s->seq = msg->seq_prev;
+        if (pos != -1) {
+            s->usuarios_ultimo[pos] = s->seq;
+        }
+    }
+    
+    unsigned int desde = msg->seq_prev;
+    unsigned int hasta = (msg->seq == 0 || msg->seq > s->seq) ? s->seq : msg->seq;
+    unsigned int primero = (s->seq > TAM_REPLAY) ? s->seq - TAM_REPLAY + 1 : 1;
+    
+    if (desde + 1 < primero) {
+        responder_sin_bloqueo(msg, "Aviso: %u mensajes de '%s' ya no se pueden recuperar", 
+                              primero - desde - 1, msg->sala);
+        desde = primero - 1;
+    }
+    if (hasta < desde) {
+        hasta = desde;  // Nada que reenviar
+    }
+    
+    mascara_t bit = (pos != -1) ? (1ULL << pos) : 0;
+    
+    struct mensaje out;
+    memset(&out, 0, sizeof(out));
+    out.mtype = MTYPE_CANAL(TIPO_BACKFILL, msg->canal);
+    memcpy(out.sala, msg->sala, MAX_NOMBRE - 1);
+    
+    unsigned int alcanzado = desde;
+    int enviados = 0;
+    for (unsigned int seq = desde; seq != hasta; ) {
+        seq++;  // Sin desbordar aunque hasta sea UINT_MAX
+        struct entrada_replay *e = &s->replay[seq & (TAM_REPLAY - 1)];
+        
+        // A un miembro con filtro sólo lo que su filtro deja pasar (ni lo suyo propio)
+        memcpy(out.remitente, e->remitente, MAX_NOMBRE);
+        memcpy(out.texto, e->texto, MAX_TEXTO);
+        int omitir = (e->seq != seq) || 
+                     (pos != -1 && (strcmp(s->usuarios[pos], e->remitente) == 0 || 
+                                    !(calcular_destinatarios(indice_sala, &out) & bit)));
+        if (!omitir) {
+            out.seq = seq;
+            if (msgsnd(msg->reply_qid, &out, sizeof(out) - sizeof(long), IPC_NOWAIT) == -1) {
+                break;  // Cola llena: el cliente pedirá desde 'alcanzado'
+            }
+            enviados++;
+        }
+        alcanzado = seq;
+    }
+    
+    // Marca de fin: remitente vacío y seq = hasta dónde se llegó
+    memset(out.remitente, 0, sizeof(out.remitente));
+    memset(out.texto, 0, sizeof(out.texto));
+    out.seq = alcanzado;
+    msgsnd(msg->reply_qid, &out, sizeof(out) - sizeof(long), IPC_NOWAIT);
+    
+    LOG(LOG_TRAFICO, "[BACKFILL] '%s' en sala '%s': (%u, %u] -> %d mensajes reenviados\n", 
+           msg->remitente, msg->sala, desde, alcanzado, enviados);
+}
+
+/* ==================== BUZONES DE MIEMBROS DESCONECTADOS ==================== */
+
+/**
+ * Contar los registros del buzón de un miembro (tamaño del archivo)
+ * 
+ * @param indice_sala Índice de la sala
+ * @param nombre Nombre del miembro
+ * @return Registros pendientes (0 si no tiene buzón)
+ */
+int contar_buzon(int indice_sala, const char *nombre) {
+    char ruta[2 * NOMBRE_SLOT + 8];
+    snprintf(ruta, sizeof(ruta), "%s.%s.buzon", salas[indice_sala].nombre, nombre);
+    
+    struct stat st;
+    if (stat(ruta, &st) == -1) {
+        return 0;
+    }
+    return (int)(st.st_size / (off_t)sizeof(struct registro_buzon));
+}
+
+/**
+ * Anotar un mensaje en el buzón de un miembro desconectado
+ * 
+ * Un buzón lleno (MAX_BUZON) no crece más: lo que no cabe se pierde para
+ * ese miembro y su cliente lo verá como un hueco al volver.
+ * 
+ * @param indice_sala Índice de la sala
+ * @param pos Posición del miembro
+ * @param seq Secuencia del mensaje
+ * @param desplazamiento Posición de su línea en el historial (-1 = no se guardó)
+ */
+void guardar_en_buzon(int indice_sala, int pos, unsigned int seq, long desplazamiento) {
+    struct sala *s = &salas[indice_sala];
+    if (desplazamiento < 0 || s->usuarios_buzon[pos] >= MAX_BUZON) {
+        return;
+    }
+    
+    char ruta[2 * NOMBRE_SLOT + 8];
+    snprintf(ruta, sizeof(ruta), "%s.%s.buzon", s->nombre, s->usuarios[pos]);
+    FILE *f = fopen(ruta, "ab");
+    if (!f) {
+        perror("[ERROR] No se pudo abrir el buzón");
+        return;
+    }
+    
+    struct registro_buzon r = {.seq = seq, .desplazamiento = desplazamiento};
+    if (fwrite(&r, sizeof(r), 1, f) == 1) {
+        s->usuarios_buzon[pos]++;
+    }
+    fclose(f);
+}
+
+/**
+ * Entregar el buzón de un miembro que volvió, de una vez
+ * 
+ * Cada registro se resuelve leyendo su línea del historial y se envía
+ * como BACKFILL (en orden de secuencia), sin bloqueo. Se envía sólo lo
+ * que cabe en la cola del cliente dejando sitio para la marca de fin;
+ * el resto queda en el buzón y el cliente lo pide con BACKFILL, que se
+ * atiende desde aquí mientras queden registros.
+ * 
+ * @param indice_sala Índice de la sala
+ * @param pos Posición del miembro (ya reconectado)
+ * @return Mensajes entregados
+ */
+int vaciar_buzon(int indice_sala, int pos) {
+    struct sala *s = &salas[indice_sala];
+    
+    char ruta[2 * NOMBRE_SLOT + 8];
+    snprintf(ruta, sizeof(ruta), "%s.%s.buzon", s->nombre, s->usuarios[pos]);
+    FILE *b = fopen(ruta, "r+b");
+    if (!b) {
+        s->usuarios_buzon[pos] = 0;
+        return 0;
+    }
+    
+    static struct registro_buzon registros[MAX_BUZON];
+    int n = (int)fread(registros, sizeof(registros[0]), MAX_BUZON, b);
+    
+    char filename[150];
+    snprintf(filename, sizeof(filename), "%s.txt", s->nombre);
+    FILE *h = fopen(filename, "r");
+    
+    struct mensaje out;
+    memset(&out, 0, sizeof(out));
+    out.mtype = MTYPE_CANAL(TIPO_BACKFILL, s->usuarios_canal[pos]);
+    memcpy(out.sala, s->nombre, MAX_NOMBRE - 1);
+    
+    // Hueco libre en la cola del cliente, menos la marca de fin
+    struct msqid_ds info;
+    int cabe = n;
+    if (msgctl(s->usuarios_qid[pos], IPC_STAT, &info) == 0) {
+        cabe = (int)((info.msg_qbytes - info.msg_cbytes) / sizeof(out)) - 1;
+    }
+    
+    unsigned int alcanzado = 0;
+    int enviados = 0;
+    int k;
+    for (k = 0; k < n && enviados < cabe; k++) {
+        char linea[MAX_NOMBRE + MAX_TEXTO + 16];
+        unsigned int seq;
+        if (!h || fseek(h, registros[k].desplazamiento, SEEK_SET) != 0 || 
+            !fgets(linea, sizeof(linea), h) ||
+            partir_linea_historial(linea, 0, &seq, out.remitente, out.texto) != 0 || 
+            seq != registros[k].seq) {
+            continue;  // Línea ilegible: se da por perdida
+        }
+        out.seq = seq;
+        if (msgsnd(s->usuarios_qid[pos], &out, sizeof(out) - sizeof(long), IPC_NOWAIT) == -1) {
+            break;  // Cola llena: el resto queda en el buzón
+        }
+        enviados++;
+        alcanzado = seq;
+    }
+    if (h) {
+        fclose(h);
+    }
+    
+    // Reescribir el buzón sólo con lo que no se entregó
+    if (k == n) {
+        fclose(b);
+        unlink(ruta);
+    } else {
+        rewind(b);
+        fwrite(registros + k, sizeof(registros[0]), n - k, b);
+        fflush(b);
+        if (ftruncate(fileno(b), (off_t)((n - k) * sizeof(registros[0]))) == -1) {
+            perror("[ERROR] No se pudo recortar el buzón");
+        }
+        fclose(b);
+    }
+    s->usuarios_buzon[pos] = n - k;
+    
+    // Marca de fin: remitente vacío y seq = hasta dónde se llegó
+    memset(out.remitente, 0, sizeof(out.remitente));
+    memset(out.texto, 0, sizeof(out.texto));
+    out.seq = alcanzado;
+    msgsnd(s->usuarios_qid[pos], &out, sizeof(out) - sizeof(long), IPC_NOWAIT);
+    
+    LOG(LOG_EVENTOS, "[BUZÓN] '%s' en sala '%s': %d mensajes entregados, %d pendientes\n", 
+           s->usuarios[pos], s->nombre, enviados, n - k);
+    return enviados;
+}
+
+/**
+ * Volver a unir a un miembro desconectado y entregarle su buzón
+ * 
+ * La confirmación lleva en seq la secuencia anterior al primer mensaje
+ * del buzón y en seq_prev la del último: el cliente parte de la primera
+ * y pide con BACKFILL lo que no quepa ahora en su cola hasta la última.
+ * 
+ * @param indice_sala Índice de la sala
+ * @param pos Posición del miembro
+ * @param msg Solicitud JOIN (cola, canal y correlación del cliente)
+ */
+void reconectar_miembro(int indice_sala, int pos, struct mensaje *msg) {
+    struct sala *s = &salas[indice_sala];
+    s->usuarios_qid[pos] = msg->reply_qid;
+    s->usuarios_canal[pos] = msg->canal;
+    s->usuarios_ultimo[pos] = s->seq;
+    s->usuarios_desconexion[pos] = 0;
+    
+    // Secuencias base (anterior al primer registro) y final (último registro)
+    unsigned int base = 0, hasta = 0;
+    if (s->usuarios_buzon[pos] > 0) {
+        char ruta[2 * NOMBRE_SLOT + 8];
+        snprintf(ruta, sizeof(ruta), "%s.%s.buzon", s->nombre, s->usuarios[pos]);
+        FILE *b = fopen(ruta, "rb");
+        struct registro_buzon r;
+        if (b && fread(&r, sizeof(r), 1, b) == 1 && r.seq > 0) {
+            base = r.seq - 1;
+            hasta = r.seq;
+            if (fseek(b, -(long)sizeof(r), SEEK_END) == 0 && fread(&r, sizeof(r), 1, b) == 1) {
+                hasta = r.seq;
+            }
+        }
+        if (b) {
+            fclose(b);
+        }
+    }
+    
+    struct mensaje resp = {.mtype = MTYPE_CANAL(TIPO_RESP, msg->canal)};
+    resp.corr = msg->corr;
+    resp.estado = ESTADO_OK;
+    resp.seq = base;
+    resp.seq_prev = hasta;
+    snprintf(resp.sala, sizeof(resp.sala), "%s", msg->sala);
+    snprintf(resp.texto, MAX_TEXTO, "Te has unido exitosamente a la sala: %s (%d mensajes en tu buzón)", 
+             msg->sala, s->usuarios_buzon[pos]);
+    msgsnd(msg->reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
+    
+    LOG(LOG_EVENTOS, "[BUZÓN] '%s' vuelve a sala '%s' (%d mensajes pendientes)\n", 
+           msg->remitente, s->nombre, s->usuarios_buzon[pos]);
+    if (s->usuarios_buzon[pos] > 0) {
+        vaciar_buzon(indice_sala, pos);
+    }
+}
+
+/**
+ * Marcar a un usuario como desconectado en las salas de este nodo
+ * 
+ * Sólo si sigue ahí con la misma cola (y canal): un segundo cliente con
+ * el mismo nombre al que se le rechazó el JOIN no desconecta al primero.
+ * 
+ * @param msg Mensaje DISCONNECT recibido
+ */
+void desconectar_miembro(const struct mensaje *msg) {
+    struct sesion *e = buscar_entrada(msg->remitente);
+    for (int k = 0; e && k < e->num_salas; k++) {
+        int i = e->salas[k];  // Sólo sus salas (lista inversa del registro)
+        struct sala *s = &salas[i];
+        int pos = buscar_usuario_en_sala(i, msg->remitente);
+        if (pos != -1 && s->usuarios_qid[pos] == msg->reply_qid && 
+            s->usuarios_canal[pos] == msg->canal) {
+            s->usuarios_qid[pos] = -1;
+            s->usuarios_desconexion[pos] = time(NULL);
+            LOG(LOG_EVENTOS, "[BUZÓN] '%s' desconectado de sala '%s': sus mensajes van a su buzón\n", 
+                   msg->remitente, s->nombre);
+        }
+    }
+}
+
+/* ==================== DICCIONARIOS DE COMPRESIÓN ==================== */
+
+/**
+ * Publicar el diccionario de una sala en memoria compartida
+ * 
+ * La clave sale del nombre de la sala y de la huella, así que los
+ * clientes lo encuentran sin pedirlo y un diccionario distinto nunca
+ * se confunde con éste. Si quedó un segmento de otro tamaño con la misma
+ * clave (de una ejecución anterior) se reemplaza.
+ * 
+ * @param indice_sala Índice de la sala
+ * @param dicc Contenido del diccionario
+ * @param tam Bytes del diccionario
+ * @return 0 si éxito, -1 si error
+ */
+int publicar_diccionario(int indice_sala, const char *dicc, size_t tam) {
+    struct sala *s = &salas[indice_sala];
+    unsigned int huella = huella_diccionario(dicc, tam);
+    key_t clave = clave_diccionario(s->nombre, huella);
+    
+    int shmid = shmget(clave, tam, IPC_CREAT | 0644);
+    if (shmid == -1 && errno == EINVAL) {
+        int viejo = shmget(clave, 0, 0);
+        if (viejo != -1) {
+            shmctl(viejo, IPC_RMID, NULL);
+        }
+        shmid = shmget(clave, tam, IPC_CREAT | 0644);
+    }
+    if (shmid == -1) {
+        perror("[ERROR] shmget del diccionario");
+        return -1;
+    }
+    char *p = shmat(shmid, NULL, 0);
+    if (p == (void *)-1) {
+        perror("[ERROR] shmat del diccionario");
+        return -1;
+    }
+    memcpy(p, dicc, tam);
+    shmdt(p);
+    
+    s->diccionario = huella;
+    s->diccionario_shm = shmid;
+    return 0;
+}
+
+/**
+ * Recuperar el diccionario de una sala guardado en "<sala>.dic"
+ * 
+ * Se llama al crear la sala (tras un reinicio o al recibirla migrada): la
+ * huella no cambia, así que los textos ya comprimidos del historial
+ * siguen siendo legibles.
+ * 
+ * @param indice_sala Índice de la sala
+ */
+void cargar_diccionario(int indice_sala) {
+    struct sala *s = &salas[indice_sala];
+    
+    char filename[150];
+    snprintf(filename, sizeof(filename), "%s.dic", s->nombre);
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        return;  // Aún sin entrenar
+    }
+    char dicc[DICC_TAM];
+    size_t tam = fread(dicc, 1, sizeof(dicc), f);
+    fclose(f);
+    
+    if (tam > 0 && publicar_diccionario(indice_sala, dicc, tam) == 0) {
+        LOG(LOG_EVENTOS, "[DICCIONARIO] Sala '%s': diccionario %08x restaurado (%zu bytes)\n", 
+               s->nombre, s->diccionario, tam);
+    }
+}
+
+/**
+ * Reunir el texto de un mensaje para entrenar el diccionario de la sala
+ * 
+ * Cuentan los mensajes normales y los fragmentos sin comprimir (los
+ * comprimidos y los adjuntos no son texto). Con DICC_MUESTRAS bytes se
+ * entrena una sola vez, se guarda en "<sala>.dic" y se publica; a partir
+ * de ahí los clientes que comprimen lo usan.
+ * 
+ * @param indice_sala Índice de la sala
+ * @param msg Mensaje MSG recibido
+ */
+void muestrear_texto(int indice_sala, const struct mensaje *msg) {
+    struct sala *s = &salas[indice_sala];
+    if (s->diccionario != 0) {
+        return;
+    }
+    
+    const char *texto = msg->texto;
+    int es_fragmento = 0;
+    if (texto[0] == '\001') {
+        unsigned int id;
+        int parte, partes, usados = 0;
+        if (sscanf(texto, FORMATO_FRAGMENTO "%n", &id, &parte, &partes, &usados) != 3 || usados == 0) {
+            return;
+        }
+        texto += usados;
+        es_fragmento = 1;
+    }
+    
+    if (!s->muestras) {
+        s->muestras = malloc(DICC_MUESTRAS);
+        if (!s->muestras) {
+            return;
+        }
+        s->largo_muestras = 0;
+    }
+    for (const char *c = texto; *c && s->largo_muestras < DICC_MUESTRAS; c++) {
+        s->muestras[s->largo_muestras++] = (*c == SALTO_FRAGMENTO) ? '\n' : *c;
+    }
+    if (!es_fragmento && s->largo_muestras < DICC_MUESTRAS) {
+        s->muestras[s->largo_muestras++] = '\n';
+    }
+    if (s->largo_muestras < DICC_MUESTRAS) {
+        return;
+    }
+    
+    char dicc[DICC_TAM];
+    size_t tam = entrenar_diccionario(s->muestras, s->largo_muestras, dicc, sizeof(dicc));
+    free(s->muestras);
+    s->muestras = NULL;
+    s->largo_muestras = 0;
+    if (tam == 0) {
+        return;
+    }
+    
+    char filename[150];
+    snprintf(filename, sizeof(filename), "%s.dic", s->nombre);
+    FILE *f = fopen(filename, "wb");
+    if (!f || fwrite(dicc, 1, tam, f) != tam) {
+        perror("[ERROR] No se pudo guardar el diccionario");
+    }
+    if (f) {
+        fclose(f);
+    }
+    if (publicar_diccionario(indice_sala, dicc, tam) == 0) {
+        LOG(LOG_EVENTOS, "[DICCIONARIO] Sala '%s': diccionario %08x entrenado (%zu bytes)\n", 
+               s->nombre, s->diccionario, tam);
+    }
+}
+
+/* ==================== MODO CLUSTER ==================== */
+
+/**
+ * Reenviar un mensaje al nodo dueño si no es este nodo (función "shim")
+ * 
+ * El reenvío conserva reply_qid, así que el dueño responde directamente
+ * al cliente. Se envía sin bloqueo: si la cola del dueño está llena (sala
+ * muy activa) se avisa al cliente en lugar de frenar a este nodo y a las
+ * salas que atiende. Si el dueño ya no existe se marca inactivo en el
+ * directorio y la clave pasa al siguiente nodo del anillo. El dueño de
+ * una sala migrada por el rebalanceo lo indica el directorio.
+ * 
+ * @param msg Mensaje recibido
+ * @return 1 si el mensaje fue reenviado (o rechazado), 0 si debe procesarse aquí
+ */
+int reenviar_a_dueno(struct mensaje *msg) {
+    const char *clave = clave_de_reparto(msg);
+    if (!directorio || !clave) {
+        return 0;
+    }
+    
+    while (1) {
+        int nodo = nodo_de_mensaje(directorio, msg);
+        if (nodo == -1 || nodo == nodo_id) {
+            return 0;
+        }
+        
+        if (msgsnd(directorio->colas[nodo], msg, sizeof(*msg) - sizeof(long), IPC_NOWAIT) == 0) {
+            LOG(LOG_TRAFICO, "[CLUSTER] Tipo %ld de '%s' reenviado al nodo %d (clave '%s')\n", 
+                   msg->mtype, msg->remitente, nodo, clave);
+            return 1;
+        }
+        
+        if (errno == EAGAIN) {
+            confirmar(msg, ESTADO_ERROR, "Error: el nodo %d está saturado, reintenta en unos segundos", nodo);
+            return 1;
+        }
+        
+        // Cola del dueño eliminada (nodo caído sin limpiar): sacarlo del anillo
+        fprintf(stderr, "[CLUSTER] Nodo %d no responde (%s), se marca inactivo\n", 
+                nodo, strerror(errno));
+        directorio->colas[nodo] = -1;
+        directorio->version++;
+    }
+}
+
+/**
+ * Registrar una sesión en el nodo dueño del nombre de usuario
+ * 
+ * Un JOIN llega al dueño de la sala, que puede no ser el dueño del
+ * usuario: en ese caso se le reenvía un CONNECT equivalente (si el
+ * nombre está en uso, el dueño avisa directamente al cliente).
+ * 
+ * @param msg Solicitud del usuario (remitente, reply_qid y canal)
+ * @return 0 si se registró o se reenvió, -1 si el nombre ya está en uso aquí
+ */
+int registrar_sesion_en_dueno(const struct mensaje *msg) {
+    struct mensaje con;
+    memset(&con, 0, sizeof(con));
+    con.mtype = TIPO_CONNECT;
+    con.reply_qid = msg->reply_qid;
+    con.canal = msg->canal;
+    snprintf(con.remitente, sizeof(con.remitente), "%s", msg->remitente);
+    
+    if (reenviar_a_dueno(&con)) {
+        return 0;
+    }
+    return registrar_sesion(msg->remitente, msg->reply_qid, msg->canal);
+}
+
+/**
+ * Propagar una solicitud LIST a los demás nodos activos
+ * 
+ * Cada nodo responde con sus propias salas. La copia reenviada lleva
+ * texto "cluster" para que los demás nodos no la vuelvan a propagar.
+ * 
+ * @param msg Mensaje LIST recibido del cliente
+ */
+void reenviar_list(struct mensaje *msg) {
+    if (!directorio || strcmp(msg->texto, "cluster") == 0) {
+        return;
+    }
+    
+    struct mensaje copia = *msg;
+    strcpy(copia.texto, "cluster");
+    for (int k = 0; k < directorio->num_nodos; k++) {
+        if (k != nodo_id && directorio->colas[k] != -1) {
+            msgsnd(directorio->colas[k], &copia, sizeof(copia) - sizeof(long), IPC_NOWAIT);
+        }
+    }
+}
+
+/* ==================== MIGRACIÓN Y REBALANCEO ==================== */
+
+/**
+ * Liberar una sala de este nodo (tras migrarla)
+ * 
+ * Elimina su cola y mueve la última sala a su posición. Las salas se
+ * identifican por nombre; sólo las listas inversas del registro de
+ * usuarios guardan índices, y se corrigen aquí (los miembros que queden
+ * la pierden, los de la sala movida cambian su índice).
+ * 
+ * @param indice_sala Índice de la sala a liberar
+ */
+void eliminar_sala(int indice_sala) {
+    if (salas[indice_sala].cola_id != -1) {
+        msgctl(salas[indice_sala].cola_id, IPC_RMID, NULL);
+    }
+    // El segmento del diccionario se queda: el nodo destino lo vuelve a publicar
+    free(salas[indice_sala].muestras);
+    for (int j = 0; j < salas[indice_sala].num_usuarios; j++) {
+        olvidar_membresia(salas[indice_sala].usuarios[j], indice_sala);
+    }
+    
+    num_salas--;
+    if (indice_sala != num_salas) {
+        salas[indice_sala] = salas[num_salas];
+        for (int j = 0; j < salas[indice_sala].num_usuarios; j++) {
+            struct sesion *e = buscar_entrada(salas[indice_sala].usuarios[j]);
+            for (int k = 0; e && k < e->num_salas; k++) {
+                if (e->salas[k] == num_salas) {
+                    e->salas[k] = indice_sala;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Enviar un mensaje a la cola de otro nodo (bloqueante: no se pierde)
+ * 
+ * Si el tick de SIGALRM interrumpe la espera, se reintenta: sólo falla
+ * si la cola no existe o no se puede usar.
+ * 
+ * @param cola Cola de entrada del nodo destino
+ * @param msg Mensaje a enviar
+ * @return 0 si éxito, -1 si msgsnd falla
+ */
+static int enviar_a_nodo(int cola, struct mensaje *msg) {
+    int r;
+    while ((r = msgsnd(cola, msg, sizeof(*msg) - sizeof(long), 0)) == -1 && errno == EINTR) {
+    }
+    return r;
+}
+
+/**
+ * Enviar un registro de migración al nodo destino (bloqueante: no se pierde)
+ * 
+ * @param cola Cola de entrada del nodo destino
+ * @param sala Nombre de la sala migrada
+ * @param nombre Usuario al que se refiere el registro ("" si ninguno)
+ * @param qid Cola asociada (miembro, observador o relay)
+ * @param seq Secuencia asociada (última del miembro, contador de la sala)
+ * @param formato Texto del registro ("ini", "miembro", "palabra x", ...)
+ * @return 0 si éxito, -1 si msgsnd falla
+ */
+static int enviar_registro(int cola, const char *sala, const char *nombre, int qid, 
+                           unsigned int seq, const char *formato, ...) {
+    struct mensaje reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.mtype = TIPO_MIGRAR;
+    reg.reply_qid = qid;
+    reg.seq = seq;
+    strncpy(reg.remitente, nombre, MAX_NOMBRE - 1);
+    strncpy(reg.sala, sala, MAX_NOMBRE - 1);
+    
+    va_list args;
+    va_start(args, formato);
+    vsnprintf(reg.texto, MAX_TEXTO, formato, args);
+    va_end(args);
+    
+    return enviar_a_nodo(cola, &reg);
+}
+
+/**
+ * Esperar a que el nodo destino acepte (o rechace) una migración
+ * 
+ * El destino responde a "ini" con un RESP en la cola privada indicada en
+ * el registro, una vez creada la sala en tránsito.
+ * 
+ * @param cola_acuse Cola privada de la migración
+ * @return 0 si el destino aceptó, -1 si la rechazó o no respondió a tiempo
+ */
+static int esperar_acuse_migracion(int cola_acuse) {
+    struct mensaje resp;
+    for (int ms = 0; ms < ESPERA_ACUSE_MS; ms++) {
+        if (msgrcv(cola_acuse, &resp, sizeof(resp) - sizeof(long), 0, IPC_NOWAIT) != -1) {
+            if (resp.estado != ESTADO_OK) {
+                fprintf(stderr, "[ERROR] El destino rechazó la migración: %s\n", resp.texto);
+                return -1;
+            }
+            return 0;
+        }
+        usleep(1000);
+    }
+    fprintf(stderr, "[ERROR] El destino no aceptó la migración en %d ms\n", ESPERA_ACUSE_MS);
+    return -1;
+}
+
+/**
+ * Migrar una sala en vivo a otro nodo del cluster
+ * 
+ * Secuencia (sin pérdidas ni reordenamientos):
+ * 1. Se envía "ini" y se espera a que el destino acepte: ya creó la sala
+ *    "en tránsito". Luego el estado: miembros con sus filtros y su última
+ *    secuencia, observadores, relays, el contador de secuencia y el
+ *    anillo de reenvío. Si algún envío falla (o no se puede publicar la
+ *    reubicación) se envía "cancelar" y la sala se queda en este nodo.
+ * 2. Se publica la reubicación en el directorio y se libera la sala: los
+ *    clientes empiezan a enviar al destino, que retiene esos mensajes.
+ * 3. Se vacían los mensajes que ya estaban en la cola de este nodo: los de
+ *    la sala se reenvían como TIPO_REENVIO_MIGRACION + tipo, que el
+ *    destino procesa de inmediato (son anteriores a los retenidos).
+ * 4. Se envía "fin": el destino procesa los retenidos en orden.
+ * 
+ * El historial no se copia: es el archivo <sala>.txt, en el que escribe
+ * el nodo que atiende la sala en cada momento. Tampoco los buzones de
+ * los miembros desconectados: el destino los encuentra en el disco.
+ * 
+ * @param indice_sala Índice de la sala a migrar
+ * @param destino Nodo destino
+ * @return 0 si éxito, -1 si error (la sala sigue en este nodo)
+ */
+int migrar_sala(int indice_sala, int destino) {
+    struct sala *s = &salas[indice_sala];
+    int cola = directorio->colas[destino];
+    char nombre[MAX_NOMBRE];
+    strncpy(nombre, s->nombre, MAX_NOMBRE - 1);
+    nombre[MAX_NOMBRE - 1] = '\0';
+    
+    enviar_presencia(indice_sala);  // Los cambios pendientes no viajan con la sala
+    
+    LOG(LOG_EVENTOS, "[MIGRACIÓN] Sala '%s' -> nodo %d (%d usuarios, %d observadores, %d relays)\n", 
+           nombre, destino, s->num_usuarios, s->num_observadores, s->num_relays);
+    
+    /* 1. Estado de la sala (el destino acepta "ini" antes de recibir el resto) */
+    int cola_acuse = msgget(IPC_PRIVATE, IPC_CREAT | 0600);
+    if (cola_acuse == -1) {
+        perror("[ERROR] No se pudo crear la cola de acuse de la migración");
+        return -1;
+    }
+    if (enviar_registro(cola, nombre, "", cola_acuse, 0, "ini") == -1) {
+        perror("[ERROR] No se pudo iniciar la migración");
+        msgctl(cola_acuse, IPC_RMID, NULL);
+        return -1;
+    }
+    int aceptada = esperar_acuse_migracion(cola_acuse);
+    msgctl(cola_acuse, IPC_RMID, NULL);
+    if (aceptada != 0) {
+        enviar_registro(cola, nombre, "", -1, 0, "cancelar");  // Por si aceptó tarde
+        return -1;
+    }
+    
+    int fallos = 0;
+    for (int i = 0; i < s->num_usuarios; i++) {
+        struct filtro *f = &s->usuarios_filtro[i];
+        fallos |= enviar_registro(cola, nombre, s->usuarios[i], s->usuarios_qid[i], 
+                                  s->usuarios_ultimo[i], "miembro %d", s->usuarios_canal[i]);
+        if (f->activo) {
+            fallos |= enviar_registro(cola, nombre, s->usuarios[i], -1, 0, "menciones");
+        }
+        for (int j = 0; j < f->num_palabras; j++) {
+            fallos |= enviar_registro(cola, nombre, s->usuarios[i], -1, 0, "palabra %s", f->palabras[j]);
+        }
+        for (int j = 0; j < f->num_remitentes; j++) {
+            fallos |= enviar_registro(cola, nombre, s->usuarios[i], -1, 0, "remitente %s", f->remitentes[j]);
+        }
+    }
+    for (int i = 0; i < s->num_observadores; i++) {
+        fallos |= enviar_registro(cola, nombre, "", s->observadores_qid[i], 0, "observador");
+    }
+    for (int i = 0; i < s->num_relays; i++) {
+        fallos |= enviar_registro(cola, nombre, "", s->relays_qid[i], 0, "relay %d", s->relays_carga[i]);
+    }
+    for (int c = 0; c < INDICE_DELEGADOS; c++) {
+        if (s->delegados[c].estado == 1) {
+            fallos |= enviar_registro(cola, nombre, "", s->delegados[c].qid, 
+                                      (unsigned int)s->delegados[c].relay, "delegado");
+        }
+    }
+    
+    // Contador de secuencia y anillo de reenvío (del más antiguo al más nuevo)
+    fallos |= enviar_registro(cola, nombre, "", -1, s->seq, "contador");
+    fallos |= enviar_registro(cola, nombre, "", -1, s->version_miembros, "version");
+    for (unsigned int k = 0; k < TAM_REPLAY; k++) {
+        struct entrada_replay *e = &s->replay[(s->seq + 1 + k) & (TAM_REPLAY - 1)];
+        if (e->seq == 0) {
+            continue;
+        }
+        struct mensaje reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.mtype = TIPO_MIGRAR_REPLAY;
+        reg.seq = e->seq;
+        memcpy(reg.remitente, e->remitente, MAX_NOMBRE);
+        memcpy(reg.texto, e->texto, MAX_TEXTO);
+        memcpy(reg.sala, nombre, MAX_NOMBRE);
+        fallos |= enviar_a_nodo(cola, &reg);
+    }
+    if (fallos) {
+        perror("[ERROR] Migración incompleta, se cancela");
+        enviar_registro(cola, nombre, "", -1, 0, "cancelar");
+        return -1;
+    }
+    
+    /* 2. Cambio de dueño */
+    if (fijar_reubicacion(directorio, nombre, destino) != 0) {
+        fprintf(stderr, "[ERROR] Tabla de reubicaciones llena, la sala '%s' se queda en este nodo\n", nombre);
+        enviar_registro(cola, nombre, "", -1, 0, "cancelar");
+        return -1;
+    }
+    eliminar_sala(indice_sala);
+    
+    /* 3. Mensajes que ya estaban en cola (los que llegaron antes del cambio) */
+    // (el destino ya es el dueño: un envío fallido aquí sólo puede registrarse)
+    struct msqid_ds info;
+    int pendientes = (msgctl(cola_global, IPC_STAT, &info) == 0) ? (int)info.msg_qnum : 0;
+    struct mensaje msg;
+    for (int i = 0; i < pendientes; i++) {
+        if (msgrcv(cola_global, &msg, sizeof(msg) - sizeof(long), 0, IPC_NOWAIT) == -1) {
+            break;
+        }
+        const char *clave = clave_de_reparto(&msg);
+        if (clave && strcmp(clave, nombre) == 0 && nodo_de_mensaje(directorio, &msg) == destino) {
+            msg.mtype += TIPO_REENVIO_MIGRACION;
+            if (enviar_a_nodo(cola, &msg) == -1) {
+                fprintf(stderr, "[ERROR] Mensaje de '%s' para la sala migrada '%s' perdido: %s\n", 
+                        msg.remitente, nombre, strerror(errno));
+            }
+        } else {
+            atender_mensaje(&msg);
+        }
+    }
+    
+    /* 4. Fin: el destino libera los mensajes retenidos */
+    if (enviar_registro(cola, nombre, "", -1, 0, "fin") == -1) {
+        fprintf(stderr, "[ERROR] No se pudo enviar el fin de la migración de '%s': %s\n", 
+                nombre, strerror(errno));
+    }
+    LOG(LOG_EVENTOS, "[MIGRACIÓN] Sala '%s' entregada al nodo %d (%d mensajes en cola revisados)\n", 
+           nombre, destino, pendientes);
+    return 0;
+}
+
+/**
+ * Aplicar un registro de migración recibido de otro nodo
+ * 
+ * @param msg Registro TIPO_MIGRAR o TIPO_MIGRAR_REPLAY (ver migrar_sala)
+ */
+void recibir_migracion(struct mensaje *msg) {
+    int idx = buscar_sala(msg->sala);
+    
+    if (strcmp(msg->texto, "ini") == 0) {
+        // El origen no cede la sala hasta recibir esta confirmación
+        if (idx != -1) {
+            confirmar(msg, ESTADO_ERROR, "Error: la sala '%s' ya está en este nodo", msg->sala);
+            return;
+        }
+        idx = crear_sala(msg->sala);
+        if (idx == -1) {
+            fprintf(stderr, "[ERROR] Sin espacio para recibir la sala '%s'\n", msg->sala);
+            confirmar(msg, ESTADO_ERROR, "Error: sin espacio para recibir la sala '%s'", msg->sala);
+            return;
+        }
+        salas[idx].en_transito = 1;
+        confirmar(msg, ESTADO_OK, "Recibiendo la sala '%s'", msg->sala);
+        LOG(LOG_EVENTOS, "[MIGRACIÓN] Recibiendo sala '%s'\n", msg->sala);
+        return;
+    }
+    if (idx == -1) {
+        return;
+    }
+    if (strcmp(msg->texto, "cancelar") == 0) {
+        // El origen conserva la sala: se descarta lo recibido
+        if (salas[idx].en_transito) {
+            eliminar_sala(idx);
+            LOG(LOG_EVENTOS, "[MIGRACIÓN] Recepción de la sala '%s' cancelada\n", msg->sala);
+        }
+        return;
+    }
+    
+    struct sala *s = &salas[idx];
+    if (msg->mtype == TIPO_MIGRAR_REPLAY) {
+        struct entrada_replay *e = &s->replay[msg->seq & (TAM_REPLAY - 1)];
+        e->seq = msg->seq;
+        memcpy(e->remitente, msg->remitente, MAX_NOMBRE);
+        memcpy(e->texto, msg->texto, MAX_TEXTO);
+        return;
+    }
+    
+    int pos = buscar_usuario_en_sala(idx, msg->remitente);
+    char arg[MAX_TEXTO] = "";
+    sscanf(msg->texto, "%*s %255[^\n]", arg);
+    
+    if (strncmp(msg->texto, "miembro ", 8) == 0) {
+        if (agregar_usuario_a_sala(idx, msg->remitente, msg->reply_qid, atoi(arg)) == 0) {
+            s->usuarios_ultimo[s->num_usuarios - 1] = msg->seq;
+            s->usuarios_buzon[s->num_usuarios - 1] = contar_buzon(idx, msg->remitente);
+        }
+    } else if (strcmp(msg->texto, "contador") == 0) {
+        s->seq = msg->seq;
+    } else if (strcmp(msg->texto, "version") == 0) {
+        // Las altas de los registros "miembro" no son cambios reales: el
+        // anillo empieza vacío en la versión que traía la sala
+        s->version_miembros = msg->seq;
+        s->version_base = msg->seq;
+        s->version_avisada = msg->seq;
+        memset(s->cambios_miembros, 0, sizeof(s->cambios_miembros));
+    } else if (strcmp(msg->texto, "menciones") == 0 && pos != -1) {
+        s->usuarios_filtro[pos].activo = 1;
+        s->filtros_sucios = 1;
+    } else if (strncmp(msg->texto, "palabra ", 8) == 0 && pos != -1) {
+        struct filtro *f = &s->usuarios_filtro[pos];
+        if (f->num_palabras < MAX_PALABRAS_FILTRO && strlen(arg) + 2 <= AC_MAX_PATRON) {
+            strcpy(f->palabras[f->num_palabras++], arg);
+            s->filtros_sucios = 1;
+        }
+    } else if (strncmp(msg->texto, "remitente ", 10) == 0 && pos != -1) {
+        struct filtro *f = &s->usuarios_filtro[pos];
+        if (f->num_remitentes < MAX_REMITENTES_FILTRO) {
+            nombre_a_slot(f->remitentes[f->num_remitentes++], arg);
+            s->filtros_sucios = 1;
+        }
+    } else if (strcmp(msg->texto, "observador") == 0) {
+        agregar_observador(idx, msg->reply_qid);
+    } else if (strncmp(msg->texto, "relay ", 6) == 0) {
+        if (registrar_relay(idx, msg->reply_qid) == 0) {
+            s->relays_carga[s->num_relays - 1] = atoi(arg);
+        }
+    } else if (strcmp(msg->texto, "delegado") == 0) {
+        anotar_delegado(idx, msg->reply_qid, (int)msg->seq);
+    } else if (strcmp(msg->texto, "fin") == 0) {
+        // Procesar en orden los mensajes retenidos de esta sala
+        s->en_transito = 0;
+        int quedan = 0, liberados = 0;
+        for (int i = 0; i < num_retenidos; i++) {
+            if (strcmp(retenidos[i].sala, msg->sala) == 0) {
+                procesar_mensaje(&retenidos[i]);
+                liberados++;
+            } else {
+                retenidos[quedan++] = retenidos[i];
+            }
+        }
+        num_retenidos = quedan;
+        LOG(LOG_EVENTOS, "[MIGRACIÓN] Sala '%s' recibida (%d usuarios, %d observadores, %d mensajes retenidos)\n", 
+               msg->sala, s->num_usuarios, s->num_observadores, liberados);
+    }
+}
+
+/**
+ * Retener un mensaje dirigido a una sala que todavía está llegando
+ * 
+ * Un mensaje de una sala en tránsito nunca se procesa antes de "fin": iría
+ * por delante de los que el nodo origen aún no reenvió. Si la retención
+ * se llena, crece; sólo si no hay memoria se rechaza (el cliente puede
+ * reintentar), nunca se adelanta.
+ * 
+ * @param msg Mensaje recibido directamente de un cliente
+ * @return 1 si se retuvo (o rechazó), 0 si debe procesarse ya
+ */
+int retener_si_en_transito(struct mensaje *msg) {
+    const char *clave = clave_de_reparto(msg);
+    if (!directorio || !clave || msg->mtype == TIPO_DM || 
+        msg->mtype == TIPO_CONNECT || msg->mtype == TIPO_DISCONNECT) {
+        return 0;
+    }
+    
+    int idx = buscar_sala(clave);
+    if (idx == -1 || !salas[idx].en_transito) {
+        return 0;
+    }
+    if (num_retenidos >= capacidad_retenidos) {
+        int nueva = capacidad_retenidos ? 2 * capacidad_retenidos : RETENIDOS_INICIALES;
+        struct mensaje *mayor = realloc(retenidos, nueva * sizeof(struct mensaje));
+        if (!mayor) {
+            perror("[ERROR] No se pudo ampliar la retención");
+            confirmar(msg, ESTADO_ERROR, "Error: la sala '%s' está cambiando de nodo, inténtalo de nuevo", 
+                      clave);
+            return 1;
+        }
+        retenidos = mayor;
+        capacidad_retenidos = nueva;
+        LOG(LOG_EVENTOS, "[MIGRACIÓN] Retención ampliada a %d mensajes\n", capacidad_retenidos);
+    }
+    
+    retenidos[num_retenidos++] = *msg;
+    return 1;
+}
+
+/**
+ * Manejador de SIGALRM: sólo marca que toca la tarea periódica
+ */
+void marcar_tick(int signo) {
+    (void)signo;
+    tick_pendiente = 1;
+}
+
+/**
+ * Publicar las métricas de carga de este nodo en el directorio
+ * 
+ * Profundidad de la cola de entrada (IPC_STAT), mensajes recibidos y uso
+ * de CPU del proceso (getrusage) en el último segundo. La actividad de
+ * cada sala es una media móvil, para que una pausa breve no la borre.
+ */
+void actualizar_metricas(void) {
+    static struct timeval cpu_previa;
+    static struct timeval reloj_previo;
+    
+    struct rusage uso;
+    struct timeval ahora;
+    getrusage(RUSAGE_SELF, &uso);
+    gettimeofday(&ahora, NULL);
+    
+    struct timeval cpu;
+    timeradd(&uso.ru_utime, &uso.ru_stime, &cpu);
+    long cpu_us = (cpu.tv_sec - cpu_previa.tv_sec) * 1000000L + (cpu.tv_usec - cpu_previa.tv_usec);
+    long reloj_us = (ahora.tv_sec - reloj_previo.tv_sec) * 1000000L + (ahora.tv_usec - reloj_previo.tv_usec);
+    cpu_previa = cpu;
+    reloj_previo = ahora;
+    
+    struct msqid_ds info;
+    struct metricas_nodo *m = &directorio->metricas[nodo_id];
+    m->profundidad = (msgctl(cola_global, IPC_STAT, &info) == 0) ? (int)info.msg_qnum : 0;
+    m->mensajes_por_seg = mensajes_tick;
+    m->cpu_pct = (reloj_us > 0) ? (int)(cpu_us * 100 / reloj_us) : 0;
+    m->num_salas = num_salas;
+    mensajes_tick = 0;
+    
+    for (int i = 0; i < num_salas; i++) {
+        salas[i].actividad = salas[i].actividad / 2 + salas[i].mensajes_tick;
+        salas[i].mensajes_tick = 0;
+    }
+}
+
+/**
+ * Decidir si este nodo debe ceder una sala
+ * 
+ * Si la cola de entrada o la CPU superan su umbral, se cede la sala más
+ * activa salvo la más activa de todas: la sala "viral" se queda y son
+ * las demás las que se van, así no se traslada el problema de nodo en
+ * nodo. El destino es el nodo activo menos cargado, y sólo si está por
+ * debajo de la mitad de ambos umbrales y tiene sitio para otra sala.
+ */
+void evaluar_rebalanceo(void) {
+    ultima_migracion++;
+    if (umbral_profundidad <= 0 || num_salas < 2 || ultima_migracion < ESPERA_REBALANCEO) {
+        return;
+    }
+    
+    struct metricas_nodo *propia = &directorio->metricas[nodo_id];
+    if (propia->profundidad < umbral_profundidad && propia->cpu_pct < UMBRAL_CPU) {
+        return;
+    }
+    
+    // Nodo destino: el menos cargado con capacidad
+    int destino = -1;
+    for (int k = 0; k < directorio->num_nodos; k++) {
+        struct metricas_nodo *m = &directorio->metricas[k];
+        if (k == nodo_id || directorio->colas[k] == -1 || m->num_salas >= MAX_SALAS ||
+            m->profundidad * 2 >= umbral_profundidad || m->cpu_pct * 2 >= UMBRAL_CPU) {
+            continue;
+        }
+        if (destino == -1 || m->profundidad + m->cpu_pct < 
+            directorio->metricas[destino].profundidad + directorio->metricas[destino].cpu_pct) {
+            destino = k;
+        }
+    }
+    if (destino == -1) {
+        return;
+    }
+    
+    // Sala a ceder: la más activa después de la más activa
+    int mayor = -1, elegida = -1;
+    for (int i = 0; i < num_salas; i++) {
+        if (salas[i].en_transito) {
+            continue;
+        }
+        if (mayor == -1 || salas[i].actividad > salas[mayor].actividad) {
+            elegida = mayor;
+            mayor = i;
+        } else if (elegida == -1 || salas[i].actividad > salas[elegida].actividad) {
+            elegida = i;
+        }
+    }
+    if (elegida == -1) {
+        return;
+    }
+    
+    LOG(LOG_EVENTOS, "[REBALANCEO] Nodo %d sobrecargado (cola=%d, cpu=%d%%): cede '%s' al nodo %d\n", 
+           nodo_id, propia->profundidad, propia->cpu_pct, salas[elegida].nombre, destino);
+    if (migrar_sala(elegida, destino) == 0) {
+        ultima_migracion = 0;
+    }
+}
+
+/**
+ * Atender un mensaje recibido en la cola de entrada
+ * 
+ * Avisos para despertar al bucle (se ignoran), registros de migración, reenvíos de una migración (se procesan ya),
+ * reenvío al nodo dueño, retención si la sala está llegando, o proceso.
+ * 
+ * @param msg Mensaje recibido
+ */
+void atender_mensaje(struct mensaje *msg) {
+    if (msg->mtype == TIPO_ADMIN) {
+        return;  // Sólo despierta al bucle (orden de administración o ventana de presencia)
+    }
+    mensajes_tick++;
+    
+    if (msg->mtype == TIPO_MIGRAR || msg->mtype == TIPO_MIGRAR_REPLAY) {
+        recibir_migracion(msg);
+        return;
+    }
+    if (msg->mtype > TIPO_REENVIO_MIGRACION) {
+        msg->mtype -= TIPO_REENVIO_MIGRACION;
+        procesar_mensaje(msg);
+        return;
+    }
+    
+    // En modo cluster, lo que pertenece a otro nodo se le reenvía
+    if (reenviar_a_dueno(msg) || retener_si_en_transito(msg)) {
+        return;
+    }
+    procesar_mensaje(msg);
+}
+
+/**
+ * Función de limpieza y terminación del servidor
+ * 
+ * Esta función se ejecuta cuando el servidor recibe SIGINT (Ctrl+C) o SIGTERM.
+ * Se encarga de eliminar todas las colas de mensajes System V creadas durante
+ * la ejecución para evitar que queden recursos huérfanos en el sistema.
+ * 
+ * @param signo Número de la señal recibida
+ */
+void limpiar_colas_y_salir(int signo) {
+    printf("\n[SERVIDOR] Señal de terminación recibida (%d), iniciando limpieza...\n", signo);
+    
+    // Eliminar cola global si existe
+    if (cola_global != -1) {
+        if (msgctl(cola_global, IPC_RMID, NULL) == 0) {
+            printf("[LIMPIEZA] Cola global eliminada correctamente\n");
+        } else {
+            perror("[ERROR] No se pudo eliminar cola global");
+        }
+    }
+    
+    // Eliminar todas las colas de salas creadas
+    for (int i = 0; i < num_salas; i++) {
+        if (salas[i].cola_id != -1) {
+            if (msgctl(salas[i].cola_id, IPC_RMID, NULL) == 0) {
+                printf("[LIMPIEZA] Cola de sala '%s' eliminada correctamente\n", salas[i].nombre);
+            } else {
+                fprintf(stderr, "[ERROR] No se pudo eliminar cola de sala '%s': %s\n", 
+                        salas[i].nombre, strerror(errno));
+            }
+        }
+        // El archivo .dic se conserva: al reiniciar se publica con la misma clave
+        if (salas[i].diccionario_shm != -1) {
+            shmctl(salas[i].diccionario_shm, IPC_RMID, NULL);
+        }
+    }
+    
+    // Eliminar la cola de administración (su hilo termina con EIDRM)
+    if (cola_admin != -1) {
+        msgctl(cola_admin, IPC_RMID, NULL);
+    }
+    
+    if (log_privados) {
+        fclose(log_privados);
+    }
+    
+    informe_manejadores(NULL);
+    
+    // Salir del directorio: las salas de este nodo pasan al siguiente del anillo
+    if (directorio) {
+        directorio->colas[nodo_id] = -1;
+        directorio->pids[nodo_id] = 0;
+        directorio->version++;
+        directorio_liberar(directorio);
+        printf("[LIMPIEZA] Nodo %d retirado del directorio del cluster\n", nodo_id);
+    }
+    
+    printf("[SERVIDOR] Terminado correctamente. Archivos de historial conservados.\n");
+    exit(0);
+}
+
+/* ==================== MANEJADORES POR TIPO DE MENSAJE ==================== */
+
+/**
+ * JOIN (tipo 1): unir a un usuario a una sala (la crea si no existe)
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_join(struct mensaje *msg) {
+    LOG(LOG_TRAFICO, "[JOIN] Usuario '%s' solicita unirse a sala '%s'\n", 
+           msg->remitente, msg->sala);
+    
+    if (drenando) {
+        confirmar(msg, ESTADO_ERROR, "Error: el servidor se está drenando y no admite uniones");
+        return;
+    }
+    
+    // Un JOIN también registra la sesión (clientes que no enviaron CONNECT)
+    if (registrar_sesion_en_dueno(msg) != 0) {
+        confirmar(msg, ESTADO_ERROR, "Error: el nombre '%s' ya está en uso por otro cliente", 
+                  msg->remitente);
+        return;
+    }
+    
+    // Buscar si la sala ya existe
+    int idx = buscar_sala(msg->sala);
+    
+    // Si no existe, intentar crearla
+    if (idx == -1) {
+        idx = crear_sala(msg->sala);
+    }
+    
+    if (idx == -1) {
+        // Error al crear sala (límite alcanzado)
+        confirmar(msg, ESTADO_ERROR, 
+                  "Error: no se pudo crear la sala '%s' (límite de %d salas alcanzado)", 
+                  msg->sala, MAX_SALAS);
+        return;
+    }
+    
+    // Un miembro desconectado vuelve a su puesto y recibe su buzón
+    int pos = buscar_usuario_en_sala(idx, msg->remitente);
+    if (pos != -1 && salas[idx].usuarios_qid[pos] == -1) {
+        reconectar_miembro(idx, pos, msg);
+        return;
+    }
+    
+    // Intentar agregar usuario a la sala
+    if (agregar_usuario_a_sala(idx, msg->remitente, msg->reply_qid, msg->canal) != 0) {
+        // Error al agregar (duplicado o sala llena)
+        confirmar(msg, ESTADO_ERROR, 
+                  "Error: no se pudo agregar a '%s' (usuario duplicado o sala llena)", 
+                  msg->remitente);
+    } else {
+        // Éxito al agregar usuario (un buzón de una ejecución anterior ya no vale)
+        char ruta[2 * NOMBRE_SLOT + 8];
+        snprintf(ruta, sizeof(ruta), "%s.%s.buzon", salas[idx].nombre, 
+                 salas[idx].usuarios[salas[idx].num_usuarios - 1]);
+        unlink(ruta);
+        confirmar(msg, ESTADO_OK, "Te has unido exitosamente a la sala: %s", msg->sala);
+        anotar_presencia(idx, msg->remitente, 1);
+    }
+}
+
+/**
+ * MSG (tipo 3): distribuir un mensaje de chat en su sala
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_msg(struct mensaje *msg) {
+    if (strncmp(msg->texto, "\001C", 2) == 0) {
+        // Fragmento comprimido: binario escapado, no se muestra
+        LOG(LOG_TRAFICO, "[MSG] Usuario '%s' en sala '%s': (fragmento comprimido, %zu bytes)\n", 
+               msg->remitente, msg->sala, strlen(msg->texto));
+    } else {
+        LOG(LOG_TRAFICO, "[MSG] Usuario '%s' en sala '%s': %s\n", 
+               msg->remitente, msg->sala, msg->texto);
+    }
+    
+    // Buscar la sala de destino
+    int idx = buscar_sala(msg->sala);
+    if (idx != -1 && buscar_usuario_en_sala(idx, msg->remitente) == -1) {
+        // Sólo los miembros pueden hablar (los observadores son de sólo lectura)
+        responder(msg, 
+                  "Error: no eres miembro de la sala '%s' (los observadores no pueden enviar)", 
+                  msg->sala);
+    } else if (idx != -1) {
+        // Sala encontrada, distribuir mensaje a todos los usuarios (tal cual,
+        // también los comprimidos: no se recomprime por destinatario)
+        muestrear_texto(idx, msg);
+        enviar_a_todos_en_sala(idx, msg);
+    } else {
+        // Sala no existe, notificar error al remitente
+        struct mensaje resp = {.mtype = MTYPE_CANAL(TIPO_RESP, msg->canal)};
+        snprintf(resp.texto, MAX_TEXTO, 
+                "Error: la sala '%s' no existe o fue eliminada", msg->sala);
+        msgsnd(msg->reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
+        printf("[ERROR] Usuario '%s' intentó enviar mensaje a sala inexistente '%s'\n", 
+               msg->remitente, msg->sala);
+    }
+}
+
+/**
+ * LEAVE (tipo 5): sacar a un miembro u observador de una sala
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_leave(struct mensaje *msg) {
+    LOG(LOG_TRAFICO, "[LEAVE] Usuario '%s' abandona sala '%s'\n", 
+           msg->remitente, msg->sala);
+    
+    // Buscar la sala
+    int idx = buscar_sala(msg->sala);
+    if (idx != -1) {
+        struct sala *s = &salas[idx];
+        
+        // Buscar el usuario en la lista de la sala
+        int found = buscar_usuario_en_sala(idx, msg->remitente);
+        
+        if (found != -1) {
+            // Remover usuario desplazando los arrays de la sala
+            quitar_usuario_de_sala(idx, found);
+            anotar_presencia(idx, msg->remitente, 0);
+            
+            // Confirmar salida al usuario
+            confirmar(msg, ESTADO_OK, "Has abandonado la sala: %s", msg->sala);
+            
+            LOG(LOG_EVENTOS, "[SERVIDOR] Usuario '%s' removído de sala '%s' (%d usuarios restantes)\n", 
+                   msg->remitente, msg->sala, s->num_usuarios);
+        } else if (quitar_observador(idx, msg->reply_qid) == 0) {
+            // No era miembro: era observador (se identifica por su cola)
+            confirmar(msg, ESTADO_OK, "Has dejado de observar la sala: %s", msg->sala);
+            LOG(LOG_EVENTOS, "[SERVIDOR] Observador '%s' removído de sala '%s' (%d observadores restantes)\n", 
+                   msg->remitente, msg->sala, s->num_observadores);
+        } else {
+            // Observador delegado: sólo el relay que lo atiende le confirma
+            // la baja (o el error) y nos devuelve RELAY_DEL como acuse
+            int relay = olvidar_delegado(idx, msg->reply_qid);
+            struct mensaje del = *msg;
+            del.mtype = TIPO_RELAY_DEL;
+            if (relay == -1 || msgsnd(relay, &del, sizeof(del) - sizeof(long), 0) == -1) {
+                confirmar(msg, ESTADO_ERROR, "Error: no estás en la sala '%s'", msg->sala);
+            }
+        }
+    } else {
+        confirmar(msg, ESTADO_ERROR, "Error: la sala '%s' no existe", msg->sala);
+    }
+}
+
+/**
+ * USERS (tipo 6): responder con la lista de usuarios de una sala
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_users(struct mensaje *msg) {
+    LOG(LOG_TRAFICO, "[USERS] Solicitud de lista de usuarios en sala '%s'\n", msg->sala);
+    
+    int idx = buscar_sala(msg->sala);
+    if (idx != -1) {
+        struct sala *s = &salas[idx];
+        struct mensaje resp = {.mtype = MTYPE_CANAL(TIPO_RESP, msg->canal)};
+        resp.corr = msg->corr;  // La respuesta se asocia a su solicitud
+        snprintf(resp.sala, sizeof(resp.sala), "%s", msg->sala);
+        
+        // Construir lista de usuarios
+        char buf[512] = "Usuarios en sala: ";
+        for (int i = 0; i < s->num_usuarios; i++) {
+            strcat(buf, s->usuarios[i]);
+            if (i < s->num_usuarios - 1) {
+                strcat(buf, ", ");
+            }
+        }
+        
+        // Añadir información adicional
+        char info[100];
+        snprintf(info, sizeof(info), " (%d/%d usuarios, %d observadores)", 
+                s->num_usuarios, MAX_USUARIOS_POR_SALA, observadores_totales(idx));
+        strcat(buf, info);
+        
+        strncpy(resp.texto, buf, MAX_TEXTO - 1);
+        resp.texto[MAX_TEXTO - 1] = '\0';
+        msgsnd(msg->reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
+    } else {
+        // Sala no existe
+        confirmar(msg, ESTADO_ERROR, "Error: la sala '%s' no existe", msg->sala);
+    }
+}
+
+/**
+ * LIST (tipo 7): responder con la lista de salas de este nodo
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_list(struct mensaje *msg) {
+    LOG(LOG_TRAFICO, "[LIST] Solicitud de lista de salas disponibles\n");
+    
+    // En cluster cada nodo responde con sus salas
+    reenviar_list(msg);
+    
+    struct mensaje resp = {.mtype = MTYPE_CANAL(TIPO_RESP, msg->canal)};
+    resp.corr = msg->corr;
+    
+    if (num_salas == 0 && directorio) {
+        snprintf(resp.texto, MAX_TEXTO, "[nodo %d] Sin salas", nodo_id);
+    } else if (num_salas == 0) {
+        strcpy(resp.texto, "No hay salas disponibles. ¡Crea la primera con 'join <nombre>!");
+    } else {
+        char buf[512] = "Salas disponibles: ";
+        if (directorio) {
+            snprintf(buf, sizeof(buf), "[nodo %d] Salas: ", nodo_id);
+        }
+        for (int i = 0; i < num_salas; i++) {
+            strcat(buf, salas[i].nombre);
             
-            // Buscar si la sala ya existe
-            int idx = buscar_sala(msg.sala);
+            // Añadir contador de usuarios
+            char count[32];
+            int obs = observadores_totales(i);
+            if (obs > 0) {
+                snprintf(count, sizeof(count), "(%d+%d)", salas[i].num_usuarios, obs);
+            } else {
+                snprintf(count, sizeof(count), "(%d)", salas[i].num_usuarios);
+            }
+            strcat(buf, count);
             
-            // Si no existe, intentar crearla
-            if (idx == -1) {
-                idx = crear_sala(msg.sala);
+            if (i < num_salas - 1) {
+                strcat(buf, ", ");
+            }
+        }
+        
+        strncpy(resp.texto, buf, MAX_TEXTO - 1);
+        resp.texto[MAX_TEXTO - 1] = '\0';
+    }
+    
+    msgsnd(msg->reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
+}
+
+/**
+ * CONNECT (tipo 8): registrar la sesión de un cliente (nombre -> cola privada)
+ * 
+ * Sólo se responde si el nombre ya está en uso: el cliente no debe seguir.
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_connect(struct mensaje *msg) {
+    if (registrar_sesion(msg->remitente, msg->reply_qid, msg->canal) != 0) {
+        confirmar(msg, ESTADO_ERROR, "Error: el nombre '%s' ya está en uso por otro cliente", 
+                  msg->remitente);
+    }
+}
+
+/**
+ * DISCONNECT (tipo 9): cerrar la sesión de un cliente (sus salas le guardan buzón)
+ * 
+ * Un cliente rechazado por nombre en uso no cierra la sesión del que lo tiene.
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_disconnect(struct mensaje *msg) {
+    struct sesion *e = buscar_sesion(msg->remitente);
+    if (e && (e->qid != msg->reply_qid || e->canal != msg->canal)) {
+        return;
+    }
+    eliminar_sesion(msg->remitente);
+    desconectar_miembro(msg);
+}
+
+/**
+ * DM (tipo 10): entregar un mensaje privado
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_dm(struct mensaje *msg) {
+    LOG(LOG_TRAFICO, "[DM] '%s' -> '%s'\n", msg->remitente, msg->sala);
+    enviar_privado(msg);
+}
+
+/**
+ * FILTER (tipo 12): configurar el filtro de suscripción de un miembro
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_filter(struct mensaje *msg) {
+    LOG(LOG_TRAFICO, "[FILTER] Usuario '%s' en sala '%s': %s\n", 
+           msg->remitente, msg->sala, msg->texto);
+    
+    int idx = buscar_sala(msg->sala);
+    if (idx == -1 || configurar_filtro(idx, msg->remitente, msg->texto) != 0) {
+        confirmar(msg, ESTADO_ERROR, 
+                  "Error: filtro inválido o no estás en la sala '%s' "
+                  "(usa: todo | menciones | palabras a,b | de ana,bob)", msg->sala);
+    } else {
+        confirmar(msg, ESTADO_OK, "Filtro de la sala '%s' actualizado: %s", 
+                  msg->sala, msg->texto);
+    }
+}
+
+/**
+ * OBSERVE (tipo 13): agregar un observador de sólo lectura (o delegarlo en un relay)
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_observe(struct mensaje *msg) {
+    LOG(LOG_TRAFICO, "[OBSERVE] Usuario '%s' observa sala '%s'\n", msg->remitente, msg->sala);
+
+    if (drenando) {
+        confirmar(msg, ESTADO_ERROR, "Error: el servidor se está drenando y no admite observadores");
+        return;
+    }
+
+    // Observadores y relays se identifican sólo por su cola: no admiten canal
+    if (msg->canal != 0) {
+        confirmar(msg, ESTADO_ERROR,
+                  "Error: para observar '%s' se necesita una cola propia (sin canal)", msg->sala);
+        return;
+    }
+
+    // Observar también crea la sala si no existe (igual que JOIN)
+    int idx = buscar_sala(msg->sala);
+    if (idx == -1) {
+        idx = crear_sala(msg->sala);
+    }
+    
+    if (idx == -1) {
+        confirmar(msg, ESTADO_ERROR, 
+                  "Error: no se pudo crear la sala '%s' (límite de %d salas alcanzado)", 
+                  msg->sala, MAX_SALAS);
+    } else if (buscar_delegado(idx, msg->reply_qid) != -1) {
+        confirmar(msg, ESTADO_ERROR, "Error: ya observas la sala '%s'", msg->sala);
+    } else if (salas[idx].num_relays > 0 && delegar_observador(idx, msg) == 0) {
+        // Delegado: el relay confirma directamente al observador
+        LOG(LOG_EVENTOS, "[SERVIDOR] Observador '%s' delegado a relay en sala '%s'\n", 
+               msg->remitente, msg->sala);
+    } else if (agregar_observador(idx, msg->reply_qid) != 0) {
+        confirmar(msg, ESTADO_ERROR, 
+                  "Error: no se pudo observar '%s' (ya observas o no hay capacidad)", msg->sala);
+    } else {
+        confirmar(msg, ESTADO_OK, "Observando la sala: %s (sólo lectura)", msg->sala);
+        LOG(LOG_EVENTOS, "[SERVIDOR] Observador '%s' agregado a sala '%s' (%d observadores)\n", 
+               msg->remitente, msg->sala, salas[idx].num_observadores);
+    }
+}
+
+/**
+ * RELAY_REG (tipo 14): registrar un relay de difusión en una sala
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_relay_reg(struct mensaje *msg) {
+    LOG(LOG_EVENTOS, "[RELAY] Relay qid=%d se registra para sala '%s'\n", msg->reply_qid, msg->sala);
+    
+    int idx = buscar_sala(msg->sala);
+    if (idx == -1) {
+        idx = crear_sala(msg->sala);
+    }
+    
+    if (idx == -1 || registrar_relay(idx, msg->reply_qid) != 0) {
+        responder(msg, "Error: no se pudo registrar el relay en '%s'", msg->sala);
+    } else {
+        responder(msg, "Relay registrado en la sala: %s (%d relays)", 
+                  msg->sala, salas[idx].num_relays);
+    }
+}
+
+/**
+ * RELAY_DEL (tipo 16): acuse de baja de un observador delegado: se descuenta de su relay
+ * 
+ * El acuse trae la cola del relay en reply_qid y la del observador en seq.
+ * Puede llegar sin LEAVE previo (el observador o un relay hijo desapareció).
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_relay_del(struct mensaje *msg) {
+    int idx = buscar_sala(msg->sala);
+    if (idx != -1) {
+        struct sala *s = &salas[idx];
+        for (int i = 0; i < s->num_relays; i++) {
+            if (s->relays_qid[i] == msg->reply_qid && s->relays_carga[i] > 0) {
+                s->relays_carga[i]--;
+                if (buscar_delegado(idx, (int)msg->seq) == msg->reply_qid) {
+                    olvidar_delegado(idx, (int)msg->seq);
+                }
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * BACKFILL (tipo 18): reenviar los mensajes de un hueco de secuencia
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_backfill(struct mensaje *msg) {
+    int idx = buscar_sala(msg->sala);
+    if (idx != -1) {
+        enviar_backfill(idx, msg);
+    }
+}
+
+/**
+ * DICCIONARIO (tipo 20): responder con la huella del diccionario de compresión de una sala
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_diccionario(struct mensaje *msg) {
+    // La respuesta es sólo la huella: el cliente proyecta el segmento por su clave
+    int idx = buscar_sala(msg->sala);
+    struct mensaje resp = {.mtype = MTYPE_CANAL(TIPO_DICCIONARIO, msg->canal)};
+    snprintf(resp.sala, sizeof(resp.sala), "%s", msg->sala);
+    resp.seq = (idx != -1) ? salas[idx].diccionario : 0;
+    msgsnd(msg->reply_qid, &resp, sizeof(resp) - sizeof(long), IPC_NOWAIT);
+}
+
+/**
+ * MIEMBROS (tipo 23): cambios de miembros desde la versión del cliente
+ * 
+ * Si el anillo conserva todos los cambios desde su versión (msg->seq) se
+ * envían sólo ésos, en orden; si está demasiado atrasado (o pide 0) se
+ * envía la lista completa. Varias partes si no caben en un texto.
+ * 
+ * @param msg Mensaje recibido
+ */
+static void manejar_miembros(struct mensaje *msg) {
+    LOG(LOG_TRAFICO, "[MIEMBROS] '%s' pide los miembros de '%s' desde la versión %u\n", 
+        msg->remitente, msg->sala, msg->seq);
+    
+    int idx = buscar_sala(msg->sala);
+    if (idx == -1) {
+        confirmar(msg, ESTADO_ERROR, "Error: la sala '%s' no existe", msg->sala);
+        return;
+    }
+    struct sala *s = &salas[idx];
+    unsigned int desde = msg->seq;
+    
+    int completa = (desde == 0 || desde < s->version_base || desde > s->version_miembros || 
+                    s->version_miembros - desde > TAM_CAMBIOS_MIEMBROS);
+    for (unsigned int v = desde + 1; !completa && v <= s->version_miembros; v++) {
+        completa = (s->cambios_miembros[v & (TAM_CAMBIOS_MIEMBROS - 1)].version != v);
+    }
+    
+    struct mensaje partes[MAX_PARTES];
+    int num_partes = 0;
+    if (completa) {
+        anadir_a_partes(partes, &num_partes, MAX_PARTES, '=', "");
+        for (int i = 0; i < s->num_usuarios; i++) {
+            anadir_a_partes(partes, &num_partes, MAX_PARTES, '+', s->usuarios[i]);
+        }
+    } else if (desde == s->version_miembros) {
+        anadir_a_partes(partes, &num_partes, MAX_PARTES, '\0', "");  // Al día: sin cambios
+    } else {
+        for (unsigned int v = desde + 1; v <= s->version_miembros; v++) {
+            const struct cambio_miembro *c = &s->cambios_miembros[v & (TAM_CAMBIOS_MIEMBROS - 1)];
+            anadir_a_partes(partes, &num_partes, MAX_PARTES, c->alta ? '+' : '-', c->nombre);
+        }
+    }
+    
+    for (int k = 0; k < num_partes; k++) {
+        struct mensaje *p = &partes[k];
+        p->mtype = MTYPE_CANAL(TIPO_MIEMBROS, msg->canal);
+        p->corr = msg->corr;
+        strncpy(p->sala, s->nombre, MAX_NOMBRE - 1);
+        p->seq_prev = (k > 0) ? s->version_miembros : (completa ? 0 : desde);
+        p->seq = s->version_miembros;
+        p->estado = num_partes - 1 - k;  // Partes que faltan
+        msgsnd(msg->reply_qid, p, sizeof(*p) - sizeof(long), 0);
+    }
+    
+    LOG(LOG_TRAFICO, "[MIEMBROS] Sala '%s' versión %u: %s a '%s' (%d mensajes)\n", s->nombre, 
+        s->version_miembros, completa ? "lista completa" : "sólo cambios", msg->remitente, num_partes);
+}
+
+/**
+ * Tabla de manejadores indexada por tipo de mensaje
+ * 
+ * Un tipo nuevo del protocolo sólo necesita su función y su entrada aquí:
+ * el bucle principal no cambia. Los tipos sin entrada se tratan como
+ * desconocidos.
+ */
+static struct manejador manejadores[CANAL_BASE] = {
+    [TIPO_JOIN]         = {"JOIN", manejar_join},
+    [TIPO_MSG]          = {"MSG", manejar_msg},
+    [TIPO_LEAVE]        = {"LEAVE", manejar_leave},
+    [TIPO_USERS]        = {"USERS", manejar_users},
+    [TIPO_LIST]         = {"LIST", manejar_list},
+    [TIPO_CONNECT]      = {"CONNECT", manejar_connect},
+    [TIPO_DISCONNECT]   = {"DISCONNECT", manejar_disconnect},
+    [TIPO_DM]           = {"DM", manejar_dm},
+    [TIPO_FILTER]       = {"FILTER", manejar_filter},
+    [TIPO_OBSERVE]      = {"OBSERVE", manejar_observe},
+    [TIPO_RELAY_REG]    = {"RELAY_REG", manejar_relay_reg},
+    [TIPO_RELAY_DEL]    = {"RELAY_DEL", manejar_relay_del},
+    [TIPO_BACKFILL]     = {"BACKFILL", manejar_backfill},
+    [TIPO_DICCIONARIO]  = {"DICCIONARIO", manejar_diccionario},
+    [TIPO_MIEMBROS]     = {"MIEMBROS", manejar_miembros},
+};
+
+/**
+ * Procesar un mensaje del protocolo ya asignado a este nodo
+ * 
+ * Despacho del bucle principal: una llamada indexada por tipo a la tabla
+ * de manejadores, midiendo cuántos mensajes atiende cada uno y cuánto
+ * tardan. Está separado del bucle para poder procesar también los
+ * mensajes retenidos durante la migración de una sala, en el mismo orden
+ * en que llegaron.
+ * 
+ * @param msg Mensaje a procesar
+ */
+void procesar_mensaje(struct mensaje *msg) {
+    struct manejador *m = (msg->mtype > 0 && msg->mtype < CANAL_BASE) ? &manejadores[msg->mtype] : NULL;
+    if (!m || !m->funcion) {
+        /* ===== MENSAJE DE TIPO DESCONOCIDO ===== */
+        mensajes_desconocidos++;
+        printf("[WARNING] Mensaje de tipo desconocido recibido: %ld\n", msg->mtype);
+        printf("          Remitente: '%s', Sala: '%s', Texto: '%s'\n", 
+               msg->remitente, msg->sala, msg->texto);
+        return;
+    }
+    
+    struct timespec inicio, fin;
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+    m->funcion(msg);
+    clock_gettime(CLOCK_MONOTONIC, &fin);
+    
+    long long ns = (fin.tv_sec - inicio.tv_sec) * 1000000000LL + (fin.tv_nsec - inicio.tv_nsec);
+    m->llamadas++;
+    m->ns_total += ns;
+    ns_ocupado += ns;
+    if (ns > m->ns_max) {
+        m->ns_max = ns;
+    }
+}
+
+/**
+ * Informar cuántos mensajes atendió cada manejador y su coste
+ * 
+ * Tiempo medio y del mensaje más lento, en microsegundos. Se muestra al
+ * terminar el servidor y con la orden "estado" de administración.
+ * 
+ * @param orden Orden de administración que lo pide (NULL = al log)
+ */
+void informe_manejadores(const struct mensaje *orden) {
+    informar(orden, 0, ESTADO_OK, "[ESTADÍSTICAS] %-12s %10s %12s %12s", 
+             "Tipo", "Mensajes", "Medio (us)", "Peor (us)");
+    for (int t = 0; t < CANAL_BASE; t++) {
+        const struct manejador *m = &manejadores[t];
+        if (!m->funcion || m->llamadas == 0) {
+            continue;
+        }
+        informar(orden, 0, ESTADO_OK, "[ESTADÍSTICAS] %-12s %10lu %12.1f %12.1f", m->nombre, m->llamadas, 
+                 m->ns_total / 1000.0 / m->llamadas, m->ns_max / 1000.0);
+    }
+    if (mensajes_desconocidos > 0) {
+        informar(orden, 0, ESTADO_OK, "[ESTADÍSTICAS] %-12s %10lu", "desconocido", mensajes_desconocidos);
+    }
+}
+
+/* ==================== PRESENCIA ==================== */
+
+/**
+ * Añadir "<signo><nombre>" a una lista de nombres repartida en mensajes
+ * 
+ * Se abre una parte nueva (a ceros) cuando la palabra no cabe en el texto
+ * de la actual. El llamador completa después los campos de cada parte.
+ * 
+ * @param partes Mensajes de la lista
+ * @param num_partes Partes usadas (se actualiza)
+ * @param max_partes Capacidad de partes
+ * @param signo '+', '-' o '\0' (sin signo)
+ * @param nombre Nombre a añadir ("" sólo para el signo)
+ * @return 0 si éxito, -1 si no quedan partes
+ */
+int anadir_a_partes(struct mensaje partes[], int *num_partes, int max_partes, 
+                    char signo, const char *nombre) {
+    size_t largo = strlen(nombre) + (signo != '\0');
+    size_t usado = *num_partes ? strlen(partes[*num_partes - 1].texto) : 0;
+    if (*num_partes == 0 || usado + largo + 1 >= MAX_TEXTO) {
+        if (*num_partes == max_partes) {
+            return -1;
+        }
+        memset(&partes[*num_partes], 0, sizeof(partes[0]));
+        (*num_partes)++;
+        usado = 0;
+    }
+    char *texto = partes[*num_partes - 1].texto;
+    snprintf(texto + usado, MAX_TEXTO - usado, "%s%.*s%s", usado ? " " : "", 
+             signo != '\0', &signo, nombre);
+    return 0;
+}
+
+/**
+ * Vencer la ventana de presencia (hilo propio)
+ * 
+ * Como el hilo de administración, no toca las salas: marca la ventana
+ * como vencida y despierta al bucle principal con un TIPO_ADMIN vacío,
+ * que es quien envía los cambios.
+ */
+static void *vigilar_presencia(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&mutex_presencia);
+    while (1) {
+        while (!presencia_armada) {
+            pthread_cond_wait(&cambio_ventana, &mutex_presencia);
+        }
+        if (pthread_cond_timedwait(&cambio_ventana, &mutex_presencia, &vence_presencia) != ETIMEDOUT) {
+            continue;  // Despertado antes de tiempo: se vuelve a comprobar
+        }
+        presencia_armada = 0;
+        presencia_vencida = 1;
+        struct mensaje despertar = {.mtype = TIPO_ADMIN};
+        msgsnd(cola_global, &despertar, sizeof(despertar) - sizeof(long), IPC_NOWAIT);
+    }
+    return NULL;
+}
+
+/**
+ * Crear el hilo que vence la ventana de presencia
+ * 
+ * Sin él (no se pudo crear) cada alta o baja se avisa al momento.
+ * 
+ * @return 0 si éxito, -1 si error
+ */
+int iniciar_presencia(void) {
+    pthread_condattr_t atributos;
+    pthread_condattr_init(&atributos);
+    pthread_condattr_setclock(&atributos, CLOCK_MONOTONIC);
+    pthread_cond_init(&cambio_ventana, &atributos);
+    pthread_condattr_destroy(&atributos);
+    
+    int r = lanzar_hilo(&hilo_presencia, vigilar_presencia);
+    if (r != 0) {
+        fprintf(stderr, "[ERROR] No se pudo crear el hilo de presencia: %s (avisos sin agrupar)\n", 
+                strerror(r));
+        return -1;
+    }
+    presencia_activa = 1;
+    return 0;
+}
+
+/**
+ * Anotar el alta o la baja de un miembro para avisar a su sala
+ * 
+ * Los cambios se acumulan durante VENTANA_PRESENCIA_MS desde el primero:
+ * una avalancha de uniones llega a cada miembro como unos pocos mensajes
+ * en lugar de uno por unión. Un alta y una baja del mismo usuario dentro
+ * de la ventana se anulan.
+ * 
+ * @param indice_sala Índice de la sala
+ * @param nombre Usuario que se unió o se fue
+ * @param alta 1 si se unió, 0 si se fue
+ */
+void anotar_presencia(int indice_sala, const char *nombre, int alta) {
+    struct sala *s = &salas[indice_sala];
+    
+    for (int i = 0; i < s->num_presencia; i++) {
+        if (strcmp(s->presencia[i].nombre, nombre) == 0 && s->presencia[i].alta != alta) {
+            s->presencia[i] = s->presencia[--s->num_presencia];  // Se anulan
+            return;
+        }
+    }
+    if (s->num_presencia == MAX_PRESENCIA) {
+        enviar_presencia(indice_sala);
+    }
+    struct cambio_presencia *c = &s->presencia[s->num_presencia++];
+    strncpy(c->nombre, nombre, MAX_NOMBRE - 1);
+    c->nombre[MAX_NOMBRE - 1] = '\0';
+    c->alta = alta;
+    
+    if (!presencia_activa) {
+        enviar_presencia(indice_sala);
+        return;
+    }
+    pthread_mutex_lock(&mutex_presencia);
+    if (!presencia_armada) {
+        clock_gettime(CLOCK_MONOTONIC, &vence_presencia);
+        vence_presencia.tv_nsec += VENTANA_PRESENCIA_MS * 1000000L;
+        if (vence_presencia.tv_nsec >= 1000000000L) {
+            vence_presencia.tv_sec += vence_presencia.tv_nsec / 1000000000L;
+            vence_presencia.tv_nsec %= 1000000000L;
+        }
+        presencia_armada = 1;
+        pthread_cond_signal(&cambio_ventana);
+    }
+    pthread_mutex_unlock(&mutex_presencia);
+}
+
+/**
+ * Avisar a los miembros conectados de los cambios pendientes de una sala
+ * 
+ * Cada aviso es un TIPO_PRESENCIA con "+nombre" por alta y "-nombre" por
+ * baja separados por espacios; si no caben en un texto se envían varios.
+ * Lleva las versiones de miembros (de la del aviso anterior a la actual):
+ * el cliente que sigue la lista la mantiene al día sin pedir nada.
+ * Sin bloqueo, como la difusión: un cliente lento no frena al servidor
+ * y puede recuperar la lista con /users.
+ * 
+ * @param indice_sala Índice de la sala
+ */
+void enviar_presencia(int indice_sala) {
+    struct sala *s = &salas[indice_sala];
+    if (s->num_presencia == 0) {
+        return;
+    }
+    
+    // La primera parte lleva el cambio de versión; las demás la continúan
+    struct mensaje avisos[MAX_PRESENCIA];
+    int num_avisos = 0;
+    int altas = 0;
+    for (int i = 0; i < s->num_presencia; i++) {
+        const struct cambio_presencia *c = &s->presencia[i];
+        anadir_a_partes(avisos, &num_avisos, MAX_PRESENCIA, c->alta ? '+' : '-', c->nombre);
+        altas += c->alta;
+    }
+    for (int k = 0; k < num_avisos; k++) {
+        strncpy(avisos[k].sala, s->nombre, MAX_NOMBRE - 1);
+        avisos[k].seq_prev = (k == 0) ? s->version_avisada : s->version_miembros;
+        avisos[k].seq = s->version_miembros;
+    }
+    s->version_avisada = s->version_miembros;
+    
+    int avisados = 0;
+    for (int j = 0; j < s->num_usuarios; j++) {
+        if (s->usuarios_qid[j] == -1) {
+            continue;  // Desconectado: al volver pide la lista
+        }
+        for (int k = 0; k < num_avisos; k++) {
+            avisos[k].mtype = MTYPE_CANAL(TIPO_PRESENCIA, s->usuarios_canal[j]);
+            msgsnd(s->usuarios_qid[j], &avisos[k], sizeof(avisos[k]) - sizeof(long), IPC_NOWAIT);
+        }
+        avisados++;
+    }
+    
+    LOG(LOG_EVENTOS, "[PRESENCIA] Sala '%s': %d altas y %d bajas avisadas a %d miembros (%d mensajes)\n", 
+        s->nombre, altas, s->num_presencia - altas, avisados, num_avisos);
+    s->num_presencia = 0;
+}
+
+/**
+ * Registrar un alta o baja de miembro: nueva versión de la lista
+ * 
+ * @param indice_sala Índice de la sala
+ * @param nombre Usuario que se unió o se fue
+ * @param alta 1 si se unió, 0 si se fue
+ */
+void registrar_cambio_miembro(int indice_sala, const char *nombre, int alta) {
+    struct sala *s = &salas[indice_sala];
+    unsigned int version = ++s->version_miembros;
+    struct cambio_miembro *c = &s->cambios_miembros[version & (TAM_CAMBIOS_MIEMBROS - 1)];
+    c->version = version;
+    strncpy(c->nombre, nombre, MAX_NOMBRE - 1);
+    c->nombre[MAX_NOMBRE - 1] = '\0';
+    c->alta = alta;
+}
+
+/**
+ * Avisar los cambios pendientes de todas las salas (ventana vencida)
+ */
+void enviar_presencias(void) {
+    for (int i = 0; i < num_salas; i++) {
+        enviar_presencia(i);
+    }
+}
+
+/* ==================== PLANO DE ADMINISTRACIÓN ==================== */
+
+/**
+ * Escribir una línea de informe: al administrador que la pidió o al log
+ * 
+ * Al administrador cada línea le llega como un RESP; la última lleva
+ * seq = 0 y el estado de la orden.
+ * 
+ * @param orden Orden de administración (NULL = al log del servidor)
+ * @param ultima 1 si es la última línea de la respuesta
+ * @param estado ESTADO_OK o ESTADO_ERROR (sólo cuenta en la última)
+ * @param formato Formato printf del texto
+ */
+void informar(const struct mensaje *orden, int ultima, int estado, const char *formato, ...) {
+    struct mensaje resp = {.mtype = TIPO_RESP};
+    va_list args;
+    va_start(args, formato);
+    vsnprintf(resp.texto, MAX_TEXTO, formato, args);
+    va_end(args);
+    
+    if (!orden) {
+        printf("%s\n", resp.texto);
+        return;
+    }
+    resp.corr = orden->corr;
+    resp.seq = ultima ? 0 : 1;
+    resp.estado = estado;
+    // Sin bloqueo: un administrador que ya no espera no frena al servidor
+    msgsnd(orden->reply_qid, &resp, sizeof(resp) - sizeof(long), IPC_NOWAIT);
+}
+
+/**
+ * Recibir las órdenes de la cola de administración (hilo propio)
+ * 
+ * El estado del servidor sólo lo toca el bucle principal: este hilo deja
+ * la orden en orden_admin y despierta al bucle con un TIPO_ADMIN vacío en
+ * la cola global (si el bucle está ocupado, ve la orden pendiente antes
+ * del siguiente mensaje de chat, sin esperar a los que estén en cola).
+ * Espera a que la orden se atienda antes de recibir la siguiente.
+ */
+static void *recibir_admin(void *arg) {
+    (void)arg;
+    struct mensaje orden;
+    while (1) {
+        if (msgrcv(cola_admin, &orden, sizeof(orden) - sizeof(long), TIPO_ADMIN, 0) == -1) {
+            if (errno == EINTR) {
+                continue;
             }
-            
-            if (idx == -1) {
-                // Error al crear sala (límite alcanzado)
-                struct mensaje resp = {.mtype = 2};
-                snprintf(resp.texto, MAX_TEXTO, 
-                        "Error: no se pudo crear la sala '%s' (límite de %d salas alcanzado)", 
-                        msg.sala, MAX_SALAS);
-                msgsnd(msg.reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
+            return NULL;  // Cola eliminada: el servidor termina
+        }
+        orden.texto[MAX_TEXTO - 1] = '\0';
+        
+        pthread_mutex_lock(&mutex_admin);
+        orden_admin = orden;
+        admin_pendiente = 1;
+        struct mensaje despertar = {.mtype = TIPO_ADMIN};
+        msgsnd(cola_global, &despertar, sizeof(despertar) - sizeof(long), IPC_NOWAIT);
+        while (admin_pendiente) {
+            pthread_cond_wait(&orden_atendida, &mutex_admin);
+        }
+        pthread_mutex_unlock(&mutex_admin);
+    }
+}
+
+/**
+ * Crear un hilo auxiliar con todas las señales bloqueadas
+ * 
+ * Las señales (SIGINT, SIGALRM) deben llegar al hilo principal, que es
+ * el único que toca el estado del servidor.
+ * 
+ * @param hilo Identificador del hilo creado
+ * @param funcion Cuerpo del hilo
+ * @return 0 si éxito, código de error de pthread_create si no
+ */
+int lanzar_hilo(pthread_t *hilo, void *(*funcion)(void *)) {
+    sigset_t todas, previa;
+    sigfillset(&todas);
+    pthread_sigmask(SIG_BLOCK, &todas, &previa);
+    int r = pthread_create(hilo, NULL, funcion, NULL);
+    pthread_sigmask(SIG_SETMASK, &previa, NULL);
+    return r;
+}
+
+/**
+ * Crear la cola de administración de este nodo y su hilo receptor
+ * 
+ * La cola es 0600: sólo el usuario del servidor puede dar órdenes. Una
+ * cola que ya existe y pertenece a otro usuario no se usa.
+ * 
+ * @return 0 si éxito, -1 si la administración queda desactivada
+ */
+int iniciar_admin(void) {
+    key_t clave = ftok("/tmp", PROYECTO_ADMIN(nodo_id));
+    int cola = (clave == (key_t)-1) ? -1 : msgget(clave, IPC_CREAT | 0600);
+    if (cola == -1) {
+        perror("[ERROR] No se pudo crear la cola de administración");
+        return -1;
+    }
+    
+    struct msqid_ds info;
+    if (msgctl(cola, IPC_STAT, &info) == -1 || info.msg_perm.uid != geteuid()) {
+        fprintf(stderr, "[ERROR] La cola de administración pertenece a otro usuario: "
+                "administración desactivada\n");
+        return -1;
+    }
+    info.msg_perm.mode = 0600;  // Por si quedó de una ejecución con otros permisos
+    msgctl(cola, IPC_SET, &info);
+    cola_admin = cola;
+    
+    int r = lanzar_hilo(&hilo_admin, recibir_admin);
+    if (r != 0) {
+        fprintf(stderr, "[ERROR] No se pudo crear el hilo de administración: %s\n", strerror(r));
+        msgctl(cola_admin, IPC_RMID, NULL);
+        cola_admin = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Avisar a un usuario con un RESP espontáneo (sin bloqueo)
+ */
+static void avisar_usuario(int qid, int canal, const char *sala, const char *texto) {
+    if (qid == -1) {
+        return;  // Desconectado
+    }
+    struct mensaje aviso = {.mtype = MTYPE_CANAL(TIPO_RESP, canal)};
+    snprintf(aviso.sala, sizeof(aviso.sala), "%s", sala);
+    snprintf(aviso.texto, sizeof(aviso.texto), "%s", texto);
+    msgsnd(qid, &aviso, sizeof(aviso) - sizeof(long), IPC_NOWAIT);
+}
+
+/**
+ * Orden "expulsar <usuario> [sala]": sacar a un miembro de una sala o,
+ * sin sala, de todas las de este nodo y del registro de usuarios
+ * 
+ * Sólo recorre las salas del usuario (lista inversa del registro).
+ */
+static void admin_expulsar(const struct mensaje *orden, const char *usuario, const char *sala) {
+    int indices[MAX_SALAS];
+    int num = 0;
+    struct sesion *e = buscar_entrada(usuario);
+    if (e) {
+        num = e->num_salas;
+        memcpy(indices, e->salas, num * sizeof(int));  // quitar_usuario_de_sala la modifica
+    }
+    
+    int expulsado = 0;
+    for (int k = 0; k < num; k++) {
+        int i = indices[k];
+        struct sala *s = &salas[i];
+        int pos = buscar_usuario_en_sala(i, usuario);
+        if (pos == -1 || (sala[0] != '\0' && strcmp(s->nombre, sala) != 0)) {
+            continue;
+        }
+        char texto[MAX_TEXTO];
+        snprintf(texto, sizeof(texto), "Un administrador te ha expulsado de la sala '%.*s'", 
+                 MAX_NOMBRE, s->nombre);
+        avisar_usuario(s->usuarios_qid[pos], s->usuarios_canal[pos], s->nombre, texto);
+        quitar_usuario_de_sala(i, pos);
+        anotar_presencia(i, usuario, 0);
+        expulsado++;
+        LOG(LOG_EVENTOS, "[ADMIN] '%s' expulsado de la sala '%s'\n", usuario, s->nombre);
+    }
+    if (sala[0] == '\0' && buscar_sesion(usuario)) {
+        eliminar_sesion(usuario);  // Sin sesión tampoco recibe privados
+        expulsado++;
+    }
+    
+    if (expulsado == 0) {
+        informar(orden, 1, ESTADO_ERROR, "'%s' no está en %s de este nodo", usuario, 
+                 sala[0] ? "esa sala" : "ninguna sala ni sesión");
+    } else {
+        informar(orden, 1, ESTADO_OK, "'%s' expulsado%s%s", usuario, sala[0] ? " de " : "", sala);
+    }
+}
+
+/**
+ * Orden "donde <usuario>": su sesión y las salas de este nodo en que es miembro
+ * 
+ * Una búsqueda en el registro y un recorrido de su lista inversa.
+ */
+static void admin_donde(const struct mensaje *orden, const char *usuario) {
+    struct sesion *e = buscar_entrada(usuario);
+    if (!e) {
+        informar(orden, 1, ESTADO_ERROR, "'%s' no tiene sesión ni salas en el nodo %d", usuario, nodo_id);
+        return;
+    }
+    if (e->qid != -1) {
+        informar(orden, 0, ESTADO_OK, "'%s' conectado en el nodo %d (qid=%d, canal %d)", usuario, 
+                 nodo_id, e->qid, e->canal);
+    } else {
+        informar(orden, 0, ESTADO_OK, "'%s' sin sesión en el nodo %d", usuario, nodo_id);
+    }
+    for (int k = 0; k < e->num_salas; k++) {
+        const struct sala *s = &salas[e->salas[k]];
+        int pos = buscar_usuario_en_sala(e->salas[k], usuario);
+        informar(orden, 0, ESTADO_OK, "Sala '%s'%s", s->nombre, 
+                 (pos != -1 && s->usuarios_qid[pos] == -1) ? " (desconectado, con buzón)" : "");
+    }
+    informar(orden, 1, ESTADO_OK, "%d sala%s en el nodo %d", e->num_salas, e->num_salas == 1 ? "" : "s", 
+             nodo_id);
+}
+
+/**
+ * Orden "cerrar <sala>": avisar a miembros y observadores y eliminar la sala
+ * 
+ * El historial se conserva; los buzones de sus miembros y el segmento de
+ * su diccionario se eliminan.
+ */
+static void admin_cerrar(const struct mensaje *orden, const char *sala) {
+    int idx = buscar_sala(sala);
+    if (idx == -1) {
+        informar(orden, 1, ESTADO_ERROR, "La sala '%s' no está en este nodo", sala);
+        return;
+    }
+    struct sala *s = &salas[idx];
+    int miembros = s->num_usuarios;
+    int observadores = s->num_observadores;
+    
+    char texto[MAX_TEXTO];
+    snprintf(texto, sizeof(texto), "Un administrador ha cerrado la sala '%s'", sala);
+    for (int i = 0; i < s->num_observadores; i++) {
+        avisar_usuario(s->observadores_qid[i], 0, sala, texto);
+    }
+    while (s->num_usuarios > 0) {
+        int pos = s->num_usuarios - 1;
+        avisar_usuario(s->usuarios_qid[pos], s->usuarios_canal[pos], sala, texto);
+        quitar_usuario_de_sala(idx, pos);
+    }
+    if (s->diccionario_shm != -1) {
+        shmctl(s->diccionario_shm, IPC_RMID, NULL);
+    }
+    eliminar_sala(idx);
+    
+    LOG(LOG_EVENTOS, "[ADMIN] Sala '%s' cerrada (%d miembros, %d observadores)\n", 
+        sala, miembros, observadores);
+    informar(orden, 1, ESTADO_OK, "Sala '%s' cerrada (%d miembros, %d observadores avisados)", 
+             sala, miembros, observadores);
+}
+
+/**
+ * Contar los miembros conectados en las salas de este nodo
+ */
+static int miembros_conectados(void) {
+    int total = 0;
+    for (int i = 0; i < num_salas; i++) {
+        for (int j = 0; j < salas[i].num_usuarios; j++) {
+            if (salas[i].usuarios_qid[j] != -1) {
+                total++;
+            }
+        }
+    }
+    return total;
+}
+
+/**
+ * Orden "estado": resumen del nodo, de cada sala y de los manejadores
+ */
+static void admin_estado(const struct mensaje *orden) {
+    struct msqid_ds info;
+    int pendientes = (msgctl(cola_global, IPC_STAT, &info) == 0) ? (int)info.msg_qnum : -1;
+    informar(orden, 0, ESTADO_OK, "Nodo %d: %d salas, %d sesiones, %d mensajes en la cola global, "
+             "log %d%s", nodo_id, num_salas, num_sesiones, pendientes, nivel_log, 
+             drenando ? ", drenando" : "");
+    for (int i = 0; i < num_salas; i++) {
+        struct sala *s = &salas[i];
+        int desconectados = 0;
+        for (int j = 0; j < s->num_usuarios; j++) {
+            desconectados += (s->usuarios_qid[j] == -1);
+        }
+        informar(orden, 0, ESTADO_OK, "Sala '%s': %d miembros (%d desconectados), %d observadores, "
+                 "secuencia %u, %d msg/s, diccionario %08x", s->nombre, s->num_usuarios, desconectados, 
+                 observadores_totales(i), s->seq, s->actividad, s->diccionario);
+    }
+    informe_manejadores(orden);
+    informar(orden, 1, ESTADO_OK, "Fin del estado del nodo %d", nodo_id);
+}
+
+/**
+ * Orden "monitor [n]": contadores acumulados para el monitor (monitor.c)
+ * 
+ * Líneas separadas por tabuladores que el monitor convierte en tasas
+ * comparando dos muestras:
+ *   NODO    ahora_ns ocupado_ns cola_global salas sesiones
+ *   SALA    nombre mensajes miembros observadores copias difusion_ns
+ *   CLIENTE usuario sala qid mensajes_en_cola bytes_en_cola
+ * Los clientes son los n con más mensajes esperando en su cola
+ * (miembros conectados y observadores directos).
+ */
+static void admin_monitor(const struct mensaje *orden, const char *arg) {
+    int n = arg[0] ? atoi(arg) : 10;
+    if (n < 0 || n > MAX_MONITOR_CLIENTES) {
+        n = MAX_MONITOR_CLIENTES;
+    }
+    
+    struct timespec ahora;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    struct msqid_ds info;
+    int pendientes = (msgctl(cola_global, IPC_STAT, &info) == 0) ? (int)info.msg_qnum : -1;
+    informar(orden, 0, ESTADO_OK, "NODO\t%lld\t%lld\t%d\t%d\t%d", 
+             ahora.tv_sec * 1000000000LL + ahora.tv_nsec, ns_ocupado, pendientes, num_salas, num_sesiones);
+    
+    // Los n clientes más atrasados, ordenados por mensajes en cola (inserción)
+    struct {
+        int sala, pos, qid;             // pos = -1 para un observador
+        unsigned long mensajes, bytes;
+    } lentos[MAX_MONITOR_CLIENTES];
+    int num_lentos = 0;
+    
+    for (int i = 0; i < num_salas; i++) {
+        struct sala *s = &salas[i];
+        informar(orden, 0, ESTADO_OK, "SALA\t%s\t%u\t%d\t%d\t%lu\t%lld", s->nombre, s->seq, 
+                 s->num_usuarios, observadores_totales(i), s->copias, s->ns_difusion);
+        
+        for (int j = -s->num_observadores; j < s->num_usuarios; j++) {
+            int qid = (j < 0) ? s->observadores_qid[-j - 1] : s->usuarios_qid[j];
+            if (qid == -1 || msgctl(qid, IPC_STAT, &info) == -1 || info.msg_qnum == 0) {
                 continue;
             }
-            
-            // Intentar agregar usuario a la sala
-            if (agregar_usuario_a_sala(idx, msg.remitente, msg.reply_qid) != 0) {
-                // Error al agregar (duplicado o sala llena)
-                struct mensaje resp = {.mtype = 2};
-                snprintf(resp.texto, MAX_TEXTO, 
-                        "Error: no se pudo agregar a '%s' (usuario duplicado o sala llena)", 
-                        msg.remitente);
-                msgsnd(msg.reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
+            int k;
+            if (num_lentos < n) {
+                k = num_lentos++;
+            } else if (n > 0 && lentos[n - 1].mensajes < info.msg_qnum) {
+                k = n - 1;  // Desplaza al menos atrasado
             } else {
-                // Éxito al agregar usuario
-                struct mensaje resp = {.mtype = 2};
-                snprintf(resp.texto, MAX_TEXTO, 
-                        "Te has unido exitosamente a la sala: %s", msg.sala);
-                msgsnd(msg.reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
+                continue;
             }
-        } else if (msg.mtype == 3) {
-            /* ===== PROCESAMIENTO DE MENSAJE MSG (Tipo 3) ===== */
-            printf("[MSG] Usuario '%s' en sala '%s': %s\n", 
-                   msg.remitente, msg.sala, msg.texto);
-            
-            // Buscar la sala de destino
-            int idx = buscar_sala(msg.sala);
-            if (idx != -1) {
-                // Sala encontrada, distribuir mensaje a todos los usuarios
-                enviar_a_todos_en_sala(idx, &msg);
-            } else {
-                // Sala no existe, notificar error al remitente
-                struct mensaje resp = {.mtype = 2};
-                snprintf(resp.texto, MAX_TEXTO, 
-                        "Error: la sala '%s' no existe o fue eliminada", msg.sala);
-                msgsnd(msg.reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
-                printf("[ERROR] Usuario '%s' intentó enviar mensaje a sala inexistente '%s'\n", 
-                       msg.remitente, msg.sala);
+            while (k > 0 && lentos[k - 1].mensajes < info.msg_qnum) {
+                lentos[k] = lentos[k - 1];
+                k--;
             }
-            
-        } else if (msg.mtype == 5) {
-            /* ===== PROCESAMIENTO DE MENSAJE LEAVE (Tipo 5) ===== */
-            printf("[LEAVE] Usuario '%s' abandona sala '%s'\n", 
-                   msg.remitente, msg.sala);
-            
-            // Buscar la sala
-            int idx = buscar_sala(msg.sala);
-            if (idx != -1) {
-                struct sala *s = &salas[idx];
-                int found = -1;
-                
-                // Buscar el usuario en la lista de la sala
-                for (int i = 0; i < s->num_usuarios; i++) {
-                    if (strcmp(s->usuarios[i], msg.remitente) == 0) { 
-                        found = i; 
-                        break;
-                    }
-                }
-                
-                if (found != -1) {
-                    // Remover usuario desplazando el array
-                    for (int j = found; j < s->num_usuarios - 1; j++) {
-                        strncpy(s->usuarios[j], s->usuarios[j + 1], MAX_NOMBRE);
-                        s->usuarios_qid[j] = s->usuarios_qid[j + 1];
-                    }
-                    s->num_usuarios--;
-                    
-                    // Confirmar salida al usuario
-                    struct mensaje resp = {.mtype = 2};
-                    snprintf(resp.texto, MAX_TEXTO, 
-                            "Has abandonado la sala: %s", msg.sala);
-                    msgsnd(msg.reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
-                    
-                    printf("[SERVIDOR] Usuario '%s' removído de sala '%s' (%d usuarios restantes)\n", 
-                           msg.remitente, msg.sala, s->num_usuarios);
-                }
+            lentos[k].sala = i;
+            lentos[k].pos = (j < 0) ? -1 : j;
+            lentos[k].qid = qid;
+            lentos[k].mensajes = info.msg_qnum;
+            lentos[k].bytes = info.msg_cbytes;
+        }
+    }
+    
+    for (int k = 0; k < num_lentos; k++) {
+        struct sala *s = &salas[lentos[k].sala];
+        informar(orden, 0, ESTADO_OK, "CLIENTE\t%s\t%s\t%d\t%lu\t%lu", 
+                 lentos[k].pos == -1 ? "(observador)" : s->usuarios[lentos[k].pos], s->nombre, 
+                 lentos[k].qid, lentos[k].mensajes, lentos[k].bytes);
+    }
+    informar(orden, 1, ESTADO_OK, "FIN");
+}
+
+/**
+ * Ejecutar la orden de administración pendiente (bucle principal)
+ * 
+ * Órdenes: expulsar <usuario> [sala] | cerrar <sala> | drenar | apagar |
+ * estado | log <0-2> | monitor [n] (para el monitor)
+ */
+void atender_admin(void) {
+    pthread_mutex_lock(&mutex_admin);
+    struct mensaje orden = orden_admin;
+    pthread_mutex_unlock(&mutex_admin);
+    
+    char palabra[32] = "";
+    char arg1[MAX_NOMBRE] = "";
+    char arg2[MAX_NOMBRE] = "";
+    sscanf(orden.texto, "%31s %49s %49s", palabra, arg1, arg2);
+    LOG(LOG_EVENTOS, "[ADMIN] Orden recibida: %s\n", orden.texto);
+    
+    if (strcmp(palabra, "expulsar") == 0 && arg1[0] != '\0') {
+        admin_expulsar(&orden, arg1, arg2);
+    } else if (strcmp(palabra, "donde") == 0 && arg1[0] != '\0') {
+        admin_donde(&orden, arg1);
+    } else if (strcmp(palabra, "cerrar") == 0 && arg1[0] != '\0') {
+        admin_cerrar(&orden, arg1);
+    } else if (strcmp(palabra, "drenar") == 0) {
+        drenando = 1;
+        informar(&orden, 1, ESTADO_OK, "Nodo %d drenando: sin uniones nuevas, termina cuando se "
+                 "vayan los %d miembros conectados", nodo_id, miembros_conectados());
+    } else if (strcmp(palabra, "apagar") == 0) {
+        informar(&orden, 1, ESTADO_OK, "Nodo %d terminando", nodo_id);
+        limpiar_colas_y_salir(0);
+    } else if (strcmp(palabra, "estado") == 0) {
+        admin_estado(&orden);
+    } else if (strcmp(palabra, "monitor") == 0) {
+        admin_monitor(&orden, arg1);
+    } else if (strcmp(palabra, "log") == 0 && arg1[0] >= '0' && arg1[0] <= '2' && arg1[1] == '\0') {
+        nivel_log = arg1[0] - '0';
+        informar(&orden, 1, ESTADO_OK, "Nivel de log: %d", nivel_log);
+    } else {
+        informar(&orden, 1, ESTADO_ERROR, "Orden inválida: '%s' (expulsar <usuario> [sala] | "
+                 "donde <usuario> | cerrar <sala> | drenar | apagar | estado | monitor [n] | "
+                 "log <0-2>)", orden.texto);
+    }
+    
+    pthread_mutex_lock(&mutex_admin);
+    admin_pendiente = 0;
+    pthread_cond_signal(&orden_atendida);
+    pthread_mutex_unlock(&mutex_admin);
+}
+
+/**
+ * Terminar el nodo en drenaje cuando ya no quedan miembros conectados
+ * 
+ * Los desconectados (con buzón) y los observadores no lo retienen.
+ */
+void comprobar_drenaje(void) {
+    if (drenando && miembros_conectados() == 0) {
+        LOG(LOG_EVENTOS, "[ADMIN] Drenaje completo: no quedan miembros conectados\n");
+        limpiar_colas_y_salir(0);
+    }
+}
+
+/* ==================== FUNCIÓN PRINCIPAL ==================== */
+
+/**
+ * Función principal del servidor de chat
+ * 
+ * Inicializa el servidor, crea la cola global, instala manejadores de señales
+ * y entra en el bucle principal de procesamiento de mensajes. Maneja todos
+ * los tipos de mensajes del protocolo y coordina las operaciones del sistema.
+ * 
+ * Opciones:
+ *   -p          Registrar los mensajes privados en privados.log
+ *   -N <nodos>  Tamaño del cluster (varios procesos servidor en el mismo host)
+ *   -n <nodo>   Índice de este nodo dentro del cluster (0 .. nodos-1)
+ *   -u <n>      Cola con n mensajes pendientes = nodo sobrecargado (0 = sin rebalanceo)
+ */
+int main(int argc, char *argv[]) {
+    /* Configuración inicial del servidor */
+    
+    // Procesar opciones de línea de comandos
+    int opt;
+    int num_nodos = 1;
+    while ((opt = getopt(argc, argv, "pN:n:u:")) != -1) {
+        if (opt == 'p') {
+            log_privados = fopen(ARCHIVO_PRIVADOS, "a");
+            if (!log_privados) {
+                perror("[ERROR] No se pudo abrir registro de privados");
             }
-        } else if (msg.mtype == 6) {
-            /* ===== PROCESAMIENTO DE MENSAJE USERS (Tipo 6) ===== */
-            printf("[USERS] Solicitud de lista de usuarios en sala '%s'\n", msg.sala);
-            
-            int idx = buscar_sala(msg.sala);
-            if (idx != -1) {
-                struct sala *s = &salas[idx];
-                struct mensaje resp = {.mtype = 2};
-                
-                // Construir lista de usuarios
-                char buf[512] = "Usuarios en sala: ";
-                for (int i = 0; i < s->num_usuarios; i++) {
-                    strcat(buf, s->usuarios[i]);
-                    if (i < s->num_usuarios - 1) {
-                        strcat(buf, ", ");
-                    }
+        } else if (opt == 'N') {
+            num_nodos = atoi(optarg);
+        } else if (opt == 'n') {
+            nodo_id = atoi(optarg);
+        } else if (opt == 'u') {
+            umbral_profundidad = atoi(optarg);
+        } else {
+            fprintf(stderr, "Uso: %s [-p] [-N <nodos> -n <nodo> [-u <profundidad>]]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (num_nodos < 1 || num_nodos > MAX_NODOS || nodo_id < 0 || nodo_id >= num_nodos) {
+        fprintf(stderr, "Error: se requiere 1 <= nodos <= %d y 0 <= nodo < nodos\n", MAX_NODOS);
+        exit(1);
+    }
+    
+    // Elegir kernels de comparación de cadenas según la CPU (AVX2/SSE2/escalar)
+    simd_inicializar();
+    
+    // Instalar manejadores de señales para limpieza automática
+    signal(SIGINT, limpiar_colas_y_salir);   // Ctrl+C
+    signal(SIGTERM, limpiar_colas_y_salir);  // Terminación solicitada por el sistema
+
+    /* Crear cola global de comunicación (cola de entrada de este nodo) */
+    
+    // Generar clave conocida para la cola global ('A' para el nodo 0)
+    key_t key_global = ftok("/tmp", PROYECTO_NODO(nodo_id));
+    if (key_global == (key_t)-1) { 
+        perror("[ERROR] No se pudo generar clave para cola global"); 
+        exit(1);
+    }
+    
+    // Crear cola global donde llegarán todos los mensajes de clientes
+    cola_global = msgget(key_global, IPC_CREAT | 0666);
+    if (cola_global == -1) { 
+        perror("[ERROR] No se pudo crear cola global"); 
+        exit(1);
+    }
+    
+    /* Registrarse en el directorio del cluster */
+    if (num_nodos > 1) {
+        directorio = directorio_adjuntar(1);
+        if (!directorio) {
+            limpiar_colas_y_salir(0);
+        }
+        
+        // Un directorio de otro tamaño sólo se reutiliza si no queda ningún nodo vivo
+        if (directorio->num_nodos != num_nodos) {
+            for (int k = 0; k < MAX_NODOS; k++) {
+                if (directorio->colas[k] != -1 && directorio->pids[k] > 0 && 
+                    kill(directorio->pids[k], 0) == 0) {
+                    fprintf(stderr, "Error: el cluster activo tiene %d nodos, no %d\n", 
+                            directorio->num_nodos, num_nodos);
+                    exit(1);  // Sin limpieza: la cola podría ser la de un nodo vivo
                 }
-                
-                // Añadir información adicional
-                char info[100];
-                snprintf(info, sizeof(info), " (%d/%d usuarios)", 
-                        s->num_usuarios, MAX_USUARIOS_POR_SALA);
-                strcat(buf, info);
-                
-                strncpy(resp.texto, buf, MAX_TEXTO - 1);
-                resp.texto[MAX_TEXTO - 1] = '\0';
-                msgsnd(msg.reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
-            } else {
-                // Sala no existe
-                struct mensaje resp = {.mtype = 2};
-                snprintf(resp.texto, MAX_TEXTO, "Error: la sala '%s' no existe", msg.sala);
-                msgsnd(msg.reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
             }
-            
-        } else if (msg.mtype == 7) {
-            /* ===== PROCESAMIENTO DE MENSAJE LIST (Tipo 7) ===== */
-            printf("[LIST] Solicitud de lista de salas disponibles\n");
-            
-            struct mensaje resp = {.mtype = 2};
-            
-            if (num_salas == 0) {
-                strcpy(resp.texto, "No hay salas disponibles. ¡Crea la primera con 'join <nombre>!");
-            } else {
-                char buf[512] = "Salas disponibles: ";
-                for (int i = 0; i < num_salas; i++) {
-                    strcat(buf, salas[i].nombre);
-                    
-                    // Añadir contador de usuarios
-                    char count[20];
-                    snprintf(count, sizeof(count), "(%d)", salas[i].num_usuarios);
-                    strcat(buf, count);
-                    
-                    if (i < num_salas - 1) {
-                        strcat(buf, ", ");
-                    }
-                }
-                
-                strncpy(resp.texto, buf, MAX_TEXTO - 1);
-                resp.texto[MAX_TEXTO - 1] = '\0';
+            for (int k = 0; k < MAX_NODOS; k++) {
+                directorio->colas[k] = -1;
             }
-            
-            msgsnd(msg.reply_qid, &resp, sizeof(resp) - sizeof(long), 0);
-            
+            directorio->num_nodos = num_nodos;
+        }
+        
+        // Dos procesos no pueden ser el mismo nodo
+        pid_t previo = directorio->pids[nodo_id];
+        if (directorio->colas[nodo_id] != -1 && previo > 0 && kill(previo, 0) == 0) {
+            fprintf(stderr, "Error: el nodo %d ya está activo (pid %d)\n", nodo_id, (int)previo);
+            exit(1);  // Sin limpieza: la cola es la del nodo que ya está activo
+        }
+        
+        directorio->colas[nodo_id] = cola_global;
+        directorio->pids[nodo_id] = getpid();
+        memset(&directorio->metricas[nodo_id], 0, sizeof(directorio->metricas[nodo_id]));
+        directorio->version++;
+        
+        // Tick de un segundo para métricas y rebalanceo. Sin SA_RESTART:
+        // msgrcv vuelve con EINTR y el bucle atiende la tarea periódica
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = marcar_tick;
+        sigaction(SIGALRM, &sa, NULL);
+        struct itimerval intervalo = {{1, 0}, {1, 0}};
+        setitimer(ITIMER_REAL, &intervalo, NULL);
+    }
+    
+    /* Cola de administración (fuera del tráfico de chat) y ventana de presencia */
+    iniciar_admin();
+    iniciar_presencia();
+    
+    /* Mostrar información de inicio */
+    printf("\n=== SERVIDOR DE CHAT MULTI-SALA ===\n");
+    printf("Servidor iniciado correctamente\n");
+    printf("Cola global ID: %d\n", cola_global);
+    if (directorio) {
+        printf("Cluster: nodo %d de %d (salas y sesiones por hashing consistente)\n", 
+               nodo_id, num_nodos);
+        if (umbral_profundidad > 0) {
+            printf("Rebalanceo: cola >= %d mensajes o CPU >= %d%%\n", umbral_profundidad, UMBRAL_CPU);
         } else {
-            /* ===== MENSAJE DE TIPO DESCONOCIDO ===== */
-            printf("[WARNING] Mensaje de tipo desconocido recibido: %ld\n", msg.mtype);
-            printf("          Remitente: '%s', Sala: '%s', Texto: '%s'\n", 
-                   msg.remitente, msg.sala, msg.texto);
+            printf("Rebalanceo: desactivado\n");
+        }
+    }
+    printf("Capacidad: %d salas, %d usuarios por sala\n", MAX_SALAS, MAX_USUARIOS_POR_SALA);
+    printf("Comparación de nombres: %s\n", simd_implementacion());
+    printf("Registro de privados: %s\n", log_privados ? ARCHIVO_PRIVADOS : "desactivado");
+    if (cola_admin != -1) {
+        printf("Cola de administración ID: %d (./admin -n %d <orden>)\n", cola_admin, nodo_id);
+    }
+    printf("Esperando conexiones de clientes...\n");
+    printf("Presiona Ctrl+C para terminar el servidor\n");
+    printf("=====================================\n\n");
+
+    /* Bucle principal de procesamiento de mensajes */
+    struct mensaje msg;
+    while (1) {
+        // Tarea periódica del cluster (marcada por SIGALRM)
+        if (tick_pendiente) {
+            tick_pendiente = 0;
+            actualizar_metricas();
+            evaluar_rebalanceo();
+        }
+        
+        // Una orden de administración pasa delante de lo que haya en la cola
+        if (admin_pendiente) {
+            atender_admin();
         }
+        if (presencia_vencida) {
+            presencia_vencida = 0;
+            enviar_presencias();
+        }
+        if (drenando) {
+            comprobar_drenaje();
+        }
+        
+        // Recibir cualquier tipo de mensaje de la cola global
+        ssize_t r = msgrcv(cola_global, &msg, sizeof(msg) - sizeof(long), 0, 0);
+        
+        // Manejar errores de recepción
+        if (r == -1) { 
+            if (errno == EINTR) {
+                // Interrupción por señal, continuar normalmente
+                continue;
+            }
+            perror("[ERROR] Error recibiendo mensaje de cola global"); 
+            continue;
+        }
+        
+        atender_mensaje(&msg);
     }
     
     // Aca nunca llega...